@@ -256,6 +256,33 @@ public:
             throw error;
     }
 
+    /**
+     * Reserve room in the message pools for messages up to the given size.
+     *
+     * @param payload_size payload size of the messages (up to 4 KiB)
+     * @param count number of messages to keep preallocated, 0 drops the reservation
+     */
+    void reserveMessagePool(size_t payload_size, unsigned int count)
+    {
+        Error error;
+
+        if (!LSReserveMessagePool(_handle, payload_size, count, error.get()))
+            throw error;
+    }
+
+    /**
+     * Connect to the peers the service is going to call, ahead of the first call.
+     *
+     * @param peers NULL-terminated list of service names
+     */
+    void prewarmPeers(const char * const *peers)
+    {
+        Error error;
+
+        if (!LSPrewarmPeers(_handle, peers, error.get()))
+            throw error;
+    }
+
     /**
      * @brief Set the userdata that is delivered to each callback registered
      *        to the category.
@@ -312,6 +339,38 @@ public:
             throw error;
     }
 
+    /**
+     * @brief Set where the callbacks registered to the category run.
+     *
+     * @param category category name
+     * @param executor where to run the callbacks, see LSExecutorType
+     *
+     * @note Callbacks run away from the main loop must be thread-safe
+     */
+    void setCategoryExecutor(const char *category, LSExecutorType executor)
+    {
+        Error error;
+
+        if (!LSCategorySetExecutor(_handle, category, executor, error.get()))
+            throw error;
+    }
+
+    /**
+     * @brief Set where the callback registered to the method runs.
+     *        Overrides the category executor.
+     *
+     * @param category category name
+     * @param method method name
+     * @param executor where to run the callback, see LSExecutorType
+     */
+    void setMethodExecutor(const char *category, const char *method, LSExecutorType executor)
+    {
+        Error error;
+
+        if (!LSMethodSetExecutor(_handle, category, method, executor, error.get()))
+            throw error;
+    }
+
     /**
      * @brief Push a role file for this process. Once the role file has been
      * pushed with this function, the process will be restricted to the
@@ -388,6 +447,21 @@ public:
             throw error;
     }
 
+    /**
+     * @brief Runs the socket I/O of the service connection on an internal
+     *        thread, so slow callbacks don't hold up the connection.
+     *
+     *        This should be called before @ref attachToLoop()
+     * @param enable true to use the I/O thread
+     */
+    void setIoThread(bool enable = true) const
+    {
+        Error error;
+
+        if (!LSGmainSetIoThread(_handle, enable, error.get()))
+            throw error;
+    }
+
     /**
      * Sends a signal specified by URI with given payload to subscribed services.
      * Services register signals with the method registerCategory(). The signal can be fired with sendSignal().
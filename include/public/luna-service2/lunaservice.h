@@ -257,6 +257,12 @@ typedef enum {
 typedef enum {
 	LUNA_SIGNAL_FLAG_DEPRECATED = (1 << 0),
 
+	/**
+	 * The signal carries the latest value of a state: while an instance is
+	 * still queued for a subscriber, a newer one replaces it
+	 */
+	LUNA_SIGNAL_FLAG_COALESCE = (1 << 1),
+
 	/**
 	 * Constant to reprsent method with no flags turned on
 	 */
@@ -275,6 +281,37 @@ typedef enum {
 	LUNA_PROPERTY_FLAGS_NONE = 0,
 } LSPropertyFlags;
 
+/**
+* @brief Where the handlers of a category or a method run
+*
+* @note Handlers run away from the main loop must be thread-safe. Replies
+*       (LSMessageRespond and friends) can be sent from any thread.
+* @note The order of the calls from one sender is only kept among the methods
+*       run by the same executor: the main loop, the pool, or one serial
+*       executor. Calls from a sender to methods with different executors may
+*       run at the same time and finish in any order.
+* @note LSUnregister fails when called from a handler run by an executor, and
+*       so does changing the executor of a method from a handler it runs.
+*/
+typedef enum {
+	/**
+	 * In the main loop the service handle is attached to (default)
+	 */
+	LUNA_EXECUTOR_MAINLOOP = 0,
+
+	/**
+	 * In a thread pool shared by the process. Calls from the same sender to any
+	 * of the methods run by the pool run one at a time, in the order they were
+	 * sent
+	 */
+	LUNA_EXECUTOR_POOL,
+
+	/**
+	 * In a thread of their own, one at a time, in the order they were received
+	 */
+	LUNA_EXECUTOR_SERIAL,
+} LSExecutorType;
+
 typedef struct {
     const char *name;		      /**< Method name */
 	LSMethodFunction function;  /**< Method function */
@@ -358,6 +395,10 @@ typedef void (*LSDisconnectHandler)(LSHandle *sh, void *user_data);
 bool LSSetDisconnectHandler(LSHandle *sh, LSDisconnectHandler disconnect_handler,
                     void *user_data, LSError *lserror);
 
+bool LSReserveMessagePool(LSHandle *sh, size_t payload_size, unsigned int count, LSError *lserror);
+
+bool LSPrewarmPeers(LSHandle *sh, const char * const *peers, LSError *lserror);
+
 bool LSRegisterCategory(LSHandle *sh, const char *category,
                    LSMethod      *methods,
                    LSSignal      *langis,
@@ -374,6 +415,12 @@ bool LSCategorySetData(LSHandle *sh, const char *category,
 bool LSMethodSetData(LSHandle *sh, const char *category, const char *method,
                      void *user_data, LSError *lserror);
 
+bool LSCategorySetExecutor(LSHandle *sh, const char *category,
+                           LSExecutorType executor, LSError *lserror);
+
+bool LSMethodSetExecutor(LSHandle *sh, const char *category, const char *method,
+                         LSExecutorType executor, LSError *lserror);
+
 bool LSUnregister(LSHandle *service, LSError *lserror);
 
 const char * LSHandleGetName(LSHandle *sh);
@@ -443,6 +490,8 @@ bool LSGmainDetach(LSHandle *sh, LSError *lserror);
 
 bool LSGmainSetPriority(LSHandle *sh, int priority, LSError *lserror);
 
+bool LSGmainSetIoThread(LSHandle *sh, bool enable, LSError *lserror);
+
 /** @} END OF LunaServiceMainloop */
 
 /**
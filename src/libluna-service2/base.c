@@ -47,7 +47,6 @@
 #include <pmtrace_ls2.h>
 
 #define ENHANCED_ACG
-#define DEFAULT_TRUST_LEVEL "dev"
 
 /** @cond INTERNAL */
 
@@ -249,6 +248,46 @@ _LSGlobalUnlock()
     pthread_mutex_unlock(&state.lock);
 }
 
+/**
+ *******************************************************************************
+ * @brief Read the high-water marks of the per-client message queues from the
+ * environment.
+ *
+ * LS_OUTGOING_HWM_BYTES, LS_OUTGOING_HWM_MESSAGES, LS_INCOMING_HWM_BYTES and
+ * LS_INCOMING_HWM_MESSAGES set the marks, 0 or unset means unlimited.
+ * LS_OUTGOING_HWM_POLICY is one of "drop-signals" (default), "disconnect" or
+ * "push-back".
+ *******************************************************************************
+ */
+static void
+_LSInitQueueLimits(void)
+{
+    const char *value;
+
+    if ((value = getenv("LS_OUTGOING_HWM_BYTES")))
+        _ls_outgoing_hwm_bytes = strtoul(value, NULL, 10);
+
+    if ((value = getenv("LS_OUTGOING_HWM_MESSAGES")))
+        _ls_outgoing_hwm_messages = strtoul(value, NULL, 10);
+
+    if ((value = getenv("LS_INCOMING_HWM_BYTES")))
+        _ls_incoming_hwm_bytes = strtoul(value, NULL, 10);
+
+    if ((value = getenv("LS_INCOMING_HWM_MESSAGES")))
+        _ls_incoming_hwm_messages = strtoul(value, NULL, 10);
+
+    if ((value = getenv("LS_OUTGOING_HWM_POLICY")) &&
+        !_LSTransportQueuePolicyFromString(value, &_ls_outgoing_hwm_policy))
+    {
+        LOG_LS_WARNING(MSGID_LS_QUEUE_ERROR, 0, "Unknown outgoing queue policy \"%s\"", value);
+    }
+
+    LOG_LS_DEBUG("Outgoing queue high-water mark: %lu bytes, %lu messages, %s; incoming: %lu bytes, %lu messages",
+                 _ls_outgoing_hwm_bytes, _ls_outgoing_hwm_messages,
+                 _LSTransportQueuePolicyToString(_ls_outgoing_hwm_policy),
+                 _ls_incoming_hwm_bytes, _ls_incoming_hwm_messages);
+}
+
 /**
  *******************************************************************************
  * @brief Called once to initialize the Luna Service world.
@@ -274,6 +313,15 @@ _LSInit(void)
         LOG_LS_DEBUG("Enable UTF8 validation on payloads");
     }
 
+    char *memfd_threshold = getenv("LS_MEMFD_THRESHOLD");
+    if (memfd_threshold)
+    {
+        _ls_memfd_threshold = strtoul(memfd_threshold, NULL, 10);
+        LOG_LS_DEBUG("Pass message bodies of %lu bytes and larger in memfd", _ls_memfd_threshold);
+    }
+
+    _LSInitQueueLimits();
+
     transport_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 }
 
@@ -386,107 +434,139 @@ _LSSecurityCheckGroup(const LSTransportBitmaskWord *provides,
     return false;
 }
 
-/** @brief Check if required ACG (of caller) intersect with provided ACG (of the service).
+#ifdef ENHANCED_ACG
+/** @brief Rank of a trust level
  *
- * Every call is tested against ACG by the receiving part. Bitmasks for ACG seem to be
- * a good choice for good performance.
+ * Trust levels are compared by rank. Trust levels unknown to the library share
+ * the same rank, but they don't outrank each other -- a caller passes with such
+ * trust level only if it is provided as is.
+ */
+typedef enum {
+    LSTrustLevelRankDefault = 0,    /**< DEFAULT_TRUST_LEVEL, an unsigned app/service */
+    LSTrustLevelRankOther,          /**< signed, trust level unknown to the library */
+    LSTrustLevelRankPart,
+    LSTrustLevelRankOem,
+    LSTrustLevelRankCount,
+} LSTrustLevelRank;
+
+static LSTrustLevelRank
+_LSSecurityGetTrustLevelRank(const char *trust_level_string)
+{
+    if (!trust_level_string || !strcmp(trust_level_string, DEFAULT_TRUST_LEVEL))
+        return LSTrustLevelRankDefault;
+    if (!strcmp(trust_level_string, "oem"))
+        return LSTrustLevelRankOem;
+    if (!strcmp(trust_level_string, "part"))
+        return LSTrustLevelRankPart;
+    return LSTrustLevelRankOther;
+}
+
+/** @brief Compile trust level table of a method from its provided ACG.
  *
- * @param[in] provides  Bit set of provided ACG
- * @param[in] requires  Bit set of required ACG
- * @param[in] size      Size of bit set in bitmask words
+ * Signed and Unsigned app/service criteria to check for trust level
+ *      ----------------------------------------------
+ *      <app/service    |   signed   |  unsigned     |
+ *      ----------------------------------------------
+ *      signed          |     o      |     o         |
+ *      ----------------------------------------------
+ *      unsigned        |     X      |     o         |
+ *      ----------------------------------------------
  *
- * @retval true If bit sets @p provides and @p requires have common bits
- * @retval false If there's no common bit in @p provides and @p requires
+ * Trust level hierarchy (caller in rows, provided trust level in columns)
+ *
+ *                    | oem | part | dev |
+ *              --------------------------
+ *              oem   |  o  |  o   |  o  |
+ *              --------------------------
+ *              part  |  x  |  o   |  o  |
+ *              --------------------------
+ *              dev   |  x  |  x   |  o  |
+ *              --------------------------
+ *
+ * A caller passes if it passes for any of the trust levels provided with
+ * the method groups, that is, if it outranks the lowest of them or has one
+ * of them exactly. Thus a method in an "oem" group and a "dev" group passes
+ * "dev" callers, as the per-group check did, which moved on to the next group
+ * on denial. The method passes every caller if its groups don't provide any
+ * trust level.
+ *
+ * @param[in] transport
+ * @param[in,out] method
  */
-static inline bool
-_LSSecurityCheckTrustLevel(const char* provided_trust_level_string,
-                           const char* required_trust_level_string)
+static void
+_LSSecurityCompileTrustLevels(_LSTransport *transport, LSMethodEntry *method)
 {
-    /* Signed and Unsigned app/service criteria to check for trust level
-        ----------------------------------------------
-        <app/service    |   signed   |  unsigned     |
-        ----------------------------------------------
-        signed          |     o      |     o         |
-        ----------------------------------------------
-        unsigned        |     X      |     o         |
-        ----------------------------------------------
-    */
-
-    bool isProvidedTrusted = false;
-    bool isRequiredTrusted = false;
-
-    if(strcmp(provided_trust_level_string, DEFAULT_TRUST_LEVEL))
-        isProvidedTrusted = true;
-    if(strcmp(required_trust_level_string, DEFAULT_TRUST_LEVEL))
-        isRequiredTrusted = true;
-
-    /* Usigned caller and unsigned callee */
-    if (!isProvidedTrusted && !isRequiredTrusted)
-    {
-        /* Since both are unsigned no trustLevel is specified */
-        return true;
-    }
+    g_free(method->trust_provided_levels);
+    method->trust_provided_levels = LSTransportGetTrustFromGroupMask(transport, method->security_provided_groups);
 
-    if (!isProvidedTrusted || !isRequiredTrusted)
+    int lowest_rank = LSTrustLevelRankCount;
+    if (method->trust_provided_levels)
     {
-        /* Unsigned caller and signed callee */
-        if(isProvidedTrusted)
-            return false;
-        /* Signed caller and unsigned callee */
-        if(isRequiredTrusted)
-            return true;
-    }
+        GHashTableIter iter_trust;
+        gpointer trust;
+        gpointer bit;
 
-    /* Trust level hierarchy
-
-                      | oem | part | dev |
-                --------------------------
-                oem   |  o  |  o   |  o  |
-                --------------------------
-                part  |  x  |  o   |  o  |
-                --------------------------
-                dev   |  x  |  x   |  o  |
-                --------------------------
-    */
-    if (!strcmp(provided_trust_level_string, required_trust_level_string)) {
-        LOG_LS_DEBUG("[%s] Trust Level Matched \
-                     provided_trust_level_string : %s \
-                     required_trust_level_string : %s \n",
-                     __func__, provided_trust_level_string, required_trust_level_string);
-        return true;
-    }
-    else if(!strcmp("oem", required_trust_level_string))
-    {
-        LOG_LS_DEBUG("[%s]Required trust level [%s] superseeds every other trust level \n",
-                     __func__, required_trust_level_string);
-        return true;
+        g_hash_table_iter_init(&iter_trust, transport->provided_trust_level_map);
+        while (g_hash_table_iter_next(&iter_trust, &trust, &bit))
+        {
+            if (BitMaskTestBit(method->trust_provided_levels, GPOINTER_TO_INT(bit)))
+            {
+                int rank = _LSSecurityGetTrustLevelRank(trust);
+                if (rank < lowest_rank)
+                    lowest_rank = rank;
+            }
+        }
     }
-    else if(!strcmp("oem", provided_trust_level_string))
+
+    if (lowest_rank == LSTrustLevelRankCount)
     {
-        LOG_LS_DEBUG("[%s]Required trust level [%s] superseeds every other trust level \n",
-                     __func__, provided_trust_level_string);
-        return false;
+        /* No trust level is provided, anybody passes */
+        method->trust_allowed_ranks = (1u << LSTrustLevelRankCount) - 1;
     }
-    else if(!strcmp("part", required_trust_level_string))
+    else
     {
-        LOG_LS_DEBUG("[%s]Required trust level [%s] can access other than OEM \n",
-        __func__, required_trust_level_string);
-        return true;
+        /* Ranks above the lowest one */
+        method->trust_allowed_ranks = ((1u << LSTrustLevelRankCount) - 1) & ~((2u << lowest_rank) - 1);
     }
-    else if(!strcmp("part", provided_trust_level_string))
+
+    method->trust_level_generation = LSTransportGetTrustLevelGeneration(transport);
+}
+
+/** @brief Check trust level of the caller against trust levels provided with method ACG.
+ *
+ * Trust tables of the method and the caller are computed once per change of the
+ * security maps, thus the check itself is a couple of bit tests.
+ *
+ * @param[in] transport
+ * @param[in] method  method entry, its trust table is compiled on demand
+ * @param[in] client  caller, its trust level code and rank are cached on demand
+ *
+ * @retval true If the caller's trust level is sufficient for the method
+ */
+static inline bool
+_LSSecurityCheckTrustLevel(_LSTransport *transport, LSMethodEntry *method, _LSTransportClient *client)
+{
+    unsigned generation = LSTransportGetTrustLevelGeneration(transport);
+
+    if (unlikely(method->trust_level_generation != generation))
     {
-        LOG_LS_DEBUG("[%s]Required trust level [%s] can access other than OEM \n",
-        __func__, provided_trust_level_string);
-        return false;
+        _LSSecurityCompileTrustLevels(transport, method);
     }
-    else
+
+    if (unlikely(client->trust_level_generation != generation))
     {
-        return false;
+        client->trust_level_code = LSTransportGetTrustLevelCode(transport, client->trust_level_string);
+        client->trust_level_rank = _LSSecurityGetTrustLevelRank(client->trust_level_string);
+        client->trust_level_generation = generation;
     }
 
-    // TESTING: just to avoid unstable luna service, till feature, otherwise returns false on mismatch
-    return false;
+    if (method->trust_allowed_ranks & (1u << client->trust_level_rank))
+        return true;
+
+    return client->trust_level_code >= 0 && method->trust_provided_levels &&
+           BitMaskTestBit(method->trust_provided_levels, client->trust_level_code);
 }
+#endif
 
 static inline gchar *
 _LSSecurityGetGroupsStringFromMask(_LSTransport *transport, LSTransportBitmaskWord *mask)
@@ -506,6 +586,122 @@ _LSSecurityGetGroupsStringFromMask(_LSTransport *transport, LSTransportBitmaskWo
     return g_string_free(groups, FALSE);
 }
 
+/* Run the method handler, traced */
+static bool
+LSMethodEntryInvoke(LSHandle *sh, LSCategoryTable *category, LSMethodEntry *method,
+                    const char *sender, const char *receiver, LSMessage *message)
+{
+    const char *method_name = LSMessageGetMethod(message);
+
+    // pmtrace point before call a handler
+    PMTRACE_SERVER_RECEIVE(sender, receiver, (char*)method_name, LSMessageGetToken(message));
+
+    // TODO prevent DEBUG mode from using CPU and memory
+    struct timespec start_time, end_time, gap_time;
+    if (DEBUG_TRACING)
+    {
+        ClockGetTime(&start_time);
+    }
+    bool handled;
+
+    if (method->method_user_data != NULL) /* method context is set. use it instead of category */
+    { handled = method->function(sh, message, method->method_user_data); }
+    else
+    { handled = method->function(sh, message, category->category_user_data); }
+
+    if (DEBUG_TRACING)
+    {
+        ClockGetTime(&end_time);
+        ClockDiff(&gap_time, &end_time, &start_time);
+        LOG_LS_DEBUG("TYPE=service handler execution time | TIME=%ld | SERVICE=%s | CATEGORY=%s | METHOD=%s",
+                ClockGetMs(&gap_time), receiver, LSMessageGetCategory(message), method_name);
+    }
+
+    // pmtrace point after handler
+    PMTRACE_SERVER_REPLY(sender, receiver, (char*)method_name, LSMessageGetToken(message));
+
+    return handled;
+}
+
+/* Method calls handed to executors and not done yet, see _LSExecutorCallsWait() */
+static GMutex executor_calls_lock;
+static GCond executor_calls_done;
+
+typedef struct LSExecutorCall {
+    LSHandle *sh;
+    LSCategoryTable *category;
+    LSMethodEntry *method;
+    LSMessage *message;         /**< ref'd */
+} _LSExecutorCall;
+
+static void
+_LSExecutorCallRun(gpointer data)
+{
+    _LSExecutorCall *call = data;
+    LSHandle *sh = call->sh;
+    LSMessage *message = call->message;
+
+    const char *sender = _LSTransportClientGetServiceName(_LSTransportMessageGetClient(message->transport_msg));
+    const char *receiver = sh->name ? sh->name : "(null)";
+
+    if (!LSMethodEntryInvoke(sh, call->category, call->method, sender, receiver, message))
+    {
+        LOG_LS_WARNING(MSGID_LS_MSG_NOT_HANDLED, 1,
+                       PMLOGKS("METHOD", LSMessageGetMethod(message)),
+                       "Method wasn't handled!");
+
+        /* what the transport does for the handlers run from the main loop */
+        char *error_msg = g_strdup_printf("Method \"%s\" for category \"%s\" was not handled",
+                                          LSMessageGetMethod(message), LSMessageGetCategory(message));
+        LSError lserror;
+        LSErrorInit(&lserror);
+        if (!_LSTransportSendReplyString(message->transport_msg, _LSTransportMessageTypeError,
+                                         error_msg, &lserror))
+        {
+            LOG_LSERROR(MSGID_LS_TRANSPORT_NETWORK_ERR, &lserror);
+            LSErrorFree(&lserror);
+        }
+        g_free(error_msg);
+    }
+
+    LSMessageUnref(message);
+    g_slice_free(_LSExecutorCall, call);
+
+    g_mutex_lock(&executor_calls_lock);
+    if (--sh->executor_calls == 0)
+        g_cond_broadcast(&executor_calls_done);
+    g_mutex_unlock(&executor_calls_lock);
+}
+
+/* Calls from the same client keep their order */
+static void
+_LSExecutorCallSubmit(_LSExecutor *executor, LSHandle *sh, LSCategoryTable *category,
+                      LSMethodEntry *method, _LSTransportClient *client, LSMessage *message)
+{
+    _LSExecutorCall *call = g_slice_new(_LSExecutorCall);
+    call->sh = sh;
+    call->category = category;
+    call->method = method;
+    call->message = message;
+    LSMessageRef(message);
+
+    g_mutex_lock(&executor_calls_lock);
+    sh->executor_calls++;
+    g_mutex_unlock(&executor_calls_lock);
+
+    _LSExecutorSubmit(executor, client, _LSExecutorCallRun, call);
+}
+
+/* Wait for the method calls of the handle still in executors to be done */
+static void
+_LSExecutorCallsWait(LSHandle *sh)
+{
+    g_mutex_lock(&executor_calls_lock);
+    while (sh->executor_calls > 0)
+        g_cond_wait(&executor_calls_done, &executor_calls_lock);
+    g_mutex_unlock(&executor_calls_lock);
+}
+
 static inline LSMessageHandlerResult
 LSCategoryMethodCall(LSHandle *sh, LSCategoryTable *category,
                      _LSTransportClient *client, LSMessage *message)
@@ -601,36 +797,25 @@ LSCategoryMethodCall(LSHandle *sh, LSCategoryTable *category,
                        "Deprecated method call");
     }
 
-    // pmtrace point before call a handler
-    PMTRACE_SERVER_RECEIVE(sender, receiver, (char*)method_name, LSMessageGetToken(message));
-
-    // TODO prevent DEBUG mode from using CPU and memory
-    struct timespec start_time, end_time, gap_time;
-    if (DEBUG_TRACING)
+    if (validCall && method->function != NULL)
     {
-        ClockGetTime(&start_time);
+        _LSExecutor *executor = method->executor ? method->executor : category->executor;
+        if (executor)
+        {
+            g_free(receiver);
+            _LSExecutorCallSubmit(executor, sh, category, method, client, message);
+            return LSMessageHandlerResultHandled;
+        }
     }
+
     bool handled;
 
     if (!validCall) /* validation error were sent */
     { handled = true; }
     else if (method->function == NULL) /* no callback were set? */
     { handled = false; }
-    else if (method->method_user_data != NULL) /* method context is set. use it instead of category */
-    { handled = method->function(sh, message, method->method_user_data); }
     else
-    { handled = method->function(sh, message, category->category_user_data); }
-
-    if (DEBUG_TRACING)
-    {
-        ClockGetTime(&end_time);
-        ClockDiff(&gap_time, &end_time, &start_time);
-        LOG_LS_DEBUG("TYPE=service handler execution time | TIME=%ld | SERVICE=%s | CATEGORY=%s | METHOD=%s",
-                ClockGetMs(&gap_time), receiver, LSMessageGetCategory(message), method_name);
-    }
-
-    // pmtrace point after handler
-    PMTRACE_SERVER_REPLY(sender, receiver, (char*)method_name, LSMessageGetToken(message));
+    { handled = LSMethodEntryInvoke(sh, category, method, sender, receiver, message); }
 
     g_free(receiver);
 
@@ -649,99 +834,14 @@ LSCategoryMethodCall(LSHandle *sh, LSCategoryTable *category,
 LSMessageHandlerResult _LSCheckProvidedTrustedGroups(LSHandle *sh,
     _LSTransportClient *client, LSMethodEntry *method)
 {
-    LSMessageHandlerResult eResult = LSMessageHandlerResultHandled;
-
-    /* Compare the trust level */
-    GSList *list = LSTransportGetTrustLevelToGroups(sh->transport);
-    if (list)
+    if (!_LSSecurityCheckTrustLevel(sh->transport, method, client))
     {
-        bool trustLevelFound = false;
-        jvalue_ref providedGroupTrustLevel = NULL;
-        jvalue_ref providedGroupsRef = NULL;
-
-        LOG_LS_INFO(MSGID_LS_NOT_AN_ERROR, 0,"Enhanced ACG \n");
-        // prepare full methods name for pattern matching
-        //char *full_name = g_build_path("/", category_path, m->name, NULL);
-        const LSTransportTrustLevelGroupBitmask *TrustLevel_bitmask = NULL;
-
-        /* Get the provided groups and get the mask */
-        providedGroupsRef = LSTransportGetGroupsFromMask(sh->transport, method->security_provided_groups);
-        if (providedGroupsRef)
-        {
-            char* providedGroup = NULL;
-            for (ssize_t i = 0; i != jarray_size(providedGroupsRef); ++i)
-            {
-                jvalue_ref jgroup = jarray_get(providedGroupsRef, i);
-                raw_buffer provided_raw = jstring_get_fast(jgroup);
-                providedGroup = g_strndup(provided_raw.m_str, provided_raw.m_len);
-                list = LSTransportGetTrustLevelToGroups(sh->transport);
-
-                for (; list; list = g_slist_next(list))
-                {
-                    TrustLevel_bitmask = (const LSTransportTrustLevelGroupBitmask *) list->data;
-
-                    /* Default groups like all are added by default which do not have trust level */
-                    /* Ignore such groups while checking for trust level */
-                    LOG_LS_DEBUG("[%s] providedGroup: %s \n", __func__, providedGroup);
-
-                    if (g_pattern_match_string(TrustLevel_bitmask->group_pattern, providedGroup))
-                    {
-                        if(TrustLevel_bitmask->trustLevel_group_bitmask)
-                        {
-                            LOG_LS_INFO(MSGID_LS_NOT_AN_ERROR, 0, "[%s] found group bit mask : %d \n", __func__,
-                                               *TrustLevel_bitmask->trustLevel_group_bitmask);
-                            providedGroupTrustLevel = LSTransportGetTrustFromMask(sh->transport,
-                                                          TrustLevel_bitmask->trustLevel_group_bitmask);
-														  													  
-							/* Get required group's trust level */
-							if(providedGroupTrustLevel)
-							{
-								char* providedTrustLevel = NULL;
-								for (ssize_t i = 0; i != jarray_size(providedGroupTrustLevel); ++i)
-								{
-									jvalue_ref jgroup = jarray_get(providedGroupTrustLevel, i);
-									raw_buffer provided_raw = jstring_get_fast(jgroup);
-									providedTrustLevel = g_strndup(provided_raw.m_str, provided_raw.m_len);
-
-									if (!_LSSecurityCheckTrustLevel(providedTrustLevel,
-																	client->trust_level_string))
-									{
-										eResult = LSMessageHandlerResultPermissionDenied;
-										LOG_LS_DEBUG("[%s] Tust Not matched [Provided : %s] [required : %s] \n",
-													 __func__, providedTrustLevel,
-													 client->trust_level_string);
-									}
-									else
-									{
-										eResult = LSMessageHandlerResultHandled;
-										trustLevelFound = true;
-									}
-									LOG_LS_DEBUG("LSCategoryMethodCall [ %s]", providedTrustLevel);
-
-									g_free(providedTrustLevel);
-									providedTrustLevel = NULL;
-
-									if (LSMessageHandlerResultHandled == eResult)
-										break;
-								}
-								j_release(&providedGroupTrustLevel);
-							}                            
-                            break;
-                        }
-                    }
-                }
-                g_free(providedGroup);
-                providedGroup = NULL;
-
-                /* Assumption is that only the group bit of the method is set */
-                if(trustLevelFound)
-                    break;
-            }
-            j_release(&providedGroupsRef);
-        }
+        LOG_LS_DEBUG("[%s] Trust Not matched [required : %s] \n", __func__,
+                     client->trust_level_string ? client->trust_level_string : "(null)");
+        return LSMessageHandlerResultPermissionDenied;
     }
 
-    return eResult;
+    return LSMessageHandlerResultHandled;
 }
 #endif
 
@@ -1125,6 +1225,9 @@ static LSMethod _privateMethods[] = {
 #endif
 #ifdef INTROSPECTION_DEBUG
     { "introspection", _LSPrivateInrospection},
+#endif
+#ifdef QUEUE_DEBUG
+    { "queues", _LSPrivateGetQueues},
 #endif
     { },
 };
@@ -1154,6 +1257,71 @@ LSSetDisconnectHandler(LSHandle *sh, LSDisconnectHandler disconnect_handler,
     return true;
 }
 
+/**
+ *******************************************************************************
+ * @brief Reserve room in the message pools for messages up to the given size.
+ *
+ * Messages are allocated from pools shared by the whole process. Reserving
+ * lets a service with bursts of traffic keep enough of them preallocated to
+ * not go to the heap for every small message. The reservations of a handle are
+ * released when it's unregistered.
+ *
+ * @param sh           IN  handle to service
+ * @param payload_size IN  payload size of the messages (up to 4 KiB)
+ * @param count        IN  number of messages to keep, replaces the count reserved
+ *                         before by the handle for this size, 0 drops it
+ * @param lserror      OUT set on error
+ *
+ * @return true on success, otherwise false
+ *******************************************************************************
+ */
+bool
+LSReserveMessagePool(LSHandle *sh, size_t payload_size, unsigned int count, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror, MSGID_LS_INVALID_HANDLE);
+    LSHANDLE_VALIDATE(sh);
+
+    unsigned long klass = _LSTransportMessagePoolClass(payload_size);
+    if (klass == LS_TRANSPORT_MESSAGE_POOL_CLASSES)
+    {
+        _LSErrorSet(lserror, MSGID_LS_INVALID_PAYLOAD, -EINVAL,
+                    "%s: payload size %zu is too big to be pooled", __FUNCTION__, payload_size);
+        return false;
+    }
+
+    _LSTransportMessagePoolReserve(klass, (int) count - (int) sh->message_pool[klass]);
+    sh->message_pool[klass] = count;
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Connect to the peers a service is going to call, ahead of the first
+ * call.
+ *
+ * Normally the first call to a service waits for the hub to resolve its name
+ * before the connection is made. Declaring peers right after registration lets
+ * these lookups go out at once, in a single batch when the hub supports it,
+ * instead of one by one on the first calls. A peer that comes up again is
+ * reconnected without waiting for a call.
+ *
+ * @param sh      IN  handle to service
+ * @param peers   IN  NULL-terminated list of service names
+ * @param lserror OUT set on error
+ *
+ * @return true on success, otherwise false
+ *******************************************************************************
+ */
+bool
+LSPrewarmPeers(LSHandle *sh, const char * const *peers, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror, MSGID_LS_INVALID_HANDLE);
+    _LSErrorIfFail(peers != NULL, lserror, MSGID_LS_PARAMETER_IS_NULL);
+    LSHANDLE_VALIDATE(sh);
+
+    return _LSTransportPrewarmPeers(sh->transport, peers, sh->is_public_bus, lserror);
+}
+
 /** @cond INTERNAL */
 
 /*
@@ -1394,6 +1562,17 @@ _LSUnregisterCommon(LSHandle *sh, bool flush_and_send_shutdown, void *call_ret_a
     _LSErrorIfFail(sh != NULL, lserror, MSGID_LS_INVALID_HANDLE);
     LSHANDLE_VALIDATE(sh);
 
+    /* a handler run by an executor would wait for itself */
+    if (_LSExecutorGetCurrent())
+    {
+        _LSErrorSet(lserror, MSGID_LS_EXECUTOR_ERR, -EDEADLK,
+                    "%s: can't unregister from a callback run by an executor", __func__);
+        return false;
+    }
+
+    /* the handlers run away from the main loop may still use the handle */
+    _LSExecutorCallsWait(sh);
+
     _LSGlobalLock();
 
     _LSTransport *transport = sh->transport;
@@ -1431,6 +1610,12 @@ _LSUnregisterCommon(LSHandle *sh, bool flush_and_send_shutdown, void *call_ret_a
         sh->context = NULL;
     }
 
+    for (unsigned long klass = 0; klass < LS_TRANSPORT_MESSAGE_POOL_CLASSES; ++klass)
+    {
+        if (sh->message_pool[klass])
+            _LSTransportMessagePoolReserve(klass, -(int) sh->message_pool[klass]);
+    }
+
     g_free(sh->name);
 
     LSHANDLE_SET_DESTROYED(sh, call_ret_addr);
@@ -1452,6 +1637,11 @@ _LSUnregisterCommon(LSHandle *sh, bool flush_and_send_shutdown, void *call_ret_a
  *******************************************************************************
  * @brief Unregister a service.
  *
+ * Waits for the callbacks still running in executors (see
+ * @ref LSCategorySetExecutor), so it fails when called from one of them.
+ * Such a callback can have the handle unregistered from the main loop
+ * instead, e.g. with an idle source.
+ *
  * @param sh      IN  handle to service
  * @param lserror OUT set on error
  *
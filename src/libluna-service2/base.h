@@ -124,6 +124,11 @@ struct LSHandle {
     LSDisconnectHandler disconnect_handler;
     void           *disconnect_handler_data;
 
+    unsigned int    message_pool[LS_TRANSPORT_MESSAGE_POOL_CLASSES];  /**< message pool reservations,
+                                                                          see LSReserveMessagePool() */
+
+    unsigned int    executor_calls;  /**< method calls handed to executors and not done yet */
+
 #ifdef SECURITY_COMPATIBILITY
     bool is_public_bus;            /**< for compatibility with old public/private connections */
 #endif //SECURITY_COMPATIBILITY
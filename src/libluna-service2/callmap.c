@@ -20,6 +20,7 @@
 #include <pthread.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <regex.h>
 
 #include <pbnjson.h>
@@ -36,6 +37,7 @@
 #include "category.h"
 #include "transport_utils.h"
 #include "clock.h"
+#include "timersource.h"
 #include "pmtrace_ls2.h"
 #include "uri.h"
 
@@ -120,9 +122,42 @@ typedef struct _ServerInfo
     bool connected;
 } _ServerInfo;
 
+typedef struct _Call _Call;
+
+/**
+ * Array of slots of _CallTable
+ */
+typedef struct _CallSlots
+{
+    struct _CallSlots *retired; //< previous array, still may be read by lock-free lookups
+    guint         bits;         //< log2 of number of slots
+    gsize         mask;         //< number of slots - 1
+    _Call        *calls[];      //< NULL marks an empty slot
+} _CallSlots;
+
+/**
+ * Open-addressing table from LSMessageToken to _Call
+ *
+ * Linear probing, removal shifts following entries of the cluster back, so
+ * there are no tombstones. The table is at most half full.
+ *
+ * Only modified under the callmap lock, but may be looked up without it:
+ * slots are accessed atomically and slot arrays replaced while growing are
+ * kept until the table is destroyed. There's no telling when a lookup is done
+ * with an array, and keeping them costs little: the table only grows, by
+ * doubling, so the retired arrays together are smaller than the live one. Such a lookup racing with modification
+ * may miss a call (and has to be repeated under the lock), but any call
+ * found is a valid _Call (see _CallPoolAlloc) which token is to be checked.
+ */
+typedef struct _CallTable
+{
+    _CallSlots   *slots;
+    gsize         count;
+} _CallTable;
+
 struct _CallMap {
 
-    GHashTable *tokenMap;      //< Map from token to _Call
+    _CallTable  tokenMap;      //< Map from token to _Call
     GHashTable *signalMap;     //< Map from signal key to list of tokens
     GHashTable *serviceMap;    //< Map from serviceName to list of tokens
 
@@ -154,9 +189,8 @@ enum {
     CALL_TYPE_SIGNAL_SERVER_STATUS,
 };
 
-typedef struct _Call {
+struct _Call {
 
-    int           ref;
     char         *serviceName;
 #ifdef HAS_LTTNG
     char         *methodName;
@@ -166,8 +200,6 @@ typedef struct _Call {
 
     void         *ctx;         //< user context
 
-    LSMessageToken token;      //< key used in callmap->tokenMap
-
     int            type;
 
     bool           single;
@@ -177,16 +209,229 @@ typedef struct _Call {
     //char          *rule;
     char          *signal_method;   //< registered signal method (could be NULL)
     char          *signal_category; //< registered signal category (required)
+    bool           signal_coalesce; //< only the latest undelivered signal is queued
     char          *match_key;  //<key used in callmap->signalMap
     struct        timespec time;  //< time value for performance measurement
-    GSource       *timer_source; //< source for timer expiration (non-NULL if set)
+    guint          timeout_id;   //< timer wheel id for timer expiration (0 if not set)
 
     int           timeout_ms;  //< milliseconds to timeout before next message reply.
 
     bool          is_connected;  //< Connection status of the service. Is valid only for server status signals
 
+    _Call         *pool_next;  //< next free call in the pool
+
+    /* Fields below live as long as the pool, keep them last */
     pthread_mutex_t lock;
-} _Call;
+
+    /* Read by lock-free lookups even after the call is freed, thus they are
+     * written only atomically */
+    int           ref;
+    LSMessageToken token;      //< key used in callmap->tokenMap
+    _CallMap     *map;         //< callmap the call is inserted to
+};
+
+/* The token is accessed with g_atomic_pointer_*() */
+G_STATIC_ASSERT(sizeof(LSMessageToken) == sizeof(gpointer));
+
+static inline LSMessageToken
+_CallGetTokenAtomic(_Call *call)
+{
+    return (LSMessageToken) g_atomic_pointer_get(&call->token);
+}
+
+static inline _CallMap *
+_CallGetMapAtomic(_Call *call)
+{
+    return g_atomic_pointer_get(&call->map);
+}
+
+/**
+ * Pool of _Call objects
+ *
+ * Calls are allocated in chunks and never given back to the system, a freed
+ * call is reused for another one. Thus a call pointer read from the token
+ * table without the callmap lock can always be dereferenced, the lock-free
+ * lookup takes a reference only if the call is alive and checks that it's
+ * still the one looked for. The reference count, the token and the map,
+ * which the lookup reads before it holds a reference, survive reuse and are
+ * accessed atomically. As a bonus, the recursive mutex of a call is initialized only
+ * once.
+ */
+#define CALL_POOL_CHUNK_SIZE 64
+
+static pthread_mutex_t call_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Call *call_pool_free = NULL;
+
+static _Call *
+_CallPoolAlloc(void)
+{
+    LS_ASSERT(pthread_mutex_lock(&call_pool_lock) == 0);
+
+    if (!call_pool_free)
+    {
+        _Call *chunk = g_new0(_Call, CALL_POOL_CHUNK_SIZE);
+
+        pthread_mutexattr_t ma;
+        pthread_mutexattr_init(&ma);
+        int res = pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_RECURSIVE);
+        LS_ASSERT(res == 0);
+
+        for (int i = 0; i < CALL_POOL_CHUNK_SIZE; ++i)
+        {
+            res = pthread_mutex_init(&chunk[i].lock, &ma);
+            LS_ASSERT(res == 0);
+            chunk[i].pool_next = i + 1 < CALL_POOL_CHUNK_SIZE ? &chunk[i + 1] : NULL;
+        }
+        pthread_mutexattr_destroy(&ma);
+
+        call_pool_free = chunk;
+    }
+
+    _Call *call = call_pool_free;
+    call_pool_free = call->pool_next;
+
+    LS_ASSERT(pthread_mutex_unlock(&call_pool_lock) == 0);
+
+    // Stale lookups may read the call concurrently, but they won't take it
+    // while the reference count is zero. Neither the count, the token nor the
+    // map is cleared here.
+    LS_ASSERT(g_atomic_int_get(&call->ref) == 0);
+    memset(call, 0, offsetof(_Call, lock));
+
+    return call;
+}
+
+static void
+_CallPoolFree(_Call *call)
+{
+#ifdef MEMCHECK
+    memset(call, 0xFF, offsetof(_Call, lock));
+    g_atomic_int_set(&call->ref, 0);
+#endif
+
+    LS_ASSERT(pthread_mutex_lock(&call_pool_lock) == 0);
+    call->pool_next = call_pool_free;
+    call_pool_free = call;
+    LS_ASSERT(pthread_mutex_unlock(&call_pool_lock) == 0);
+}
+
+static _CallSlots *
+_CallSlotsNew(guint bits)
+{
+    _CallSlots *slots = g_malloc0(sizeof(_CallSlots) + (sizeof(_Call *) << bits));
+    slots->bits = bits;
+    slots->mask = ((gsize) 1 << bits) - 1;
+    return slots;
+}
+
+static inline gsize
+_CallSlotsHome(const _CallSlots *slots, LSMessageToken token)
+{
+    // Fibonacci hashing spreads sequential tokens of different handles
+    return (gsize) (((guint64) token * 0x9E3779B97F4A7C15ull) >> (64 - slots->bits));
+}
+
+static void
+_CallTableInit(_CallTable *table)
+{
+    table->slots = _CallSlotsNew(4);
+    table->count = 0;
+}
+
+static _Call *
+_CallTableLookup(const _CallTable *table, LSMessageToken token)
+{
+    const _CallSlots *slots = g_atomic_pointer_get(&table->slots);
+
+    for (gsize i = _CallSlotsHome(slots, token); ; i = (i + 1) & slots->mask)
+    {
+        _Call *call = g_atomic_pointer_get(&slots->calls[i]);
+        if (!call || _CallGetTokenAtomic(call) == token)
+            return call;
+    }
+}
+
+static void
+_CallSlotsPut(_CallSlots *slots, _Call *call)
+{
+    gsize i = _CallSlotsHome(slots, call->token);
+    while (slots->calls[i])
+        i = (i + 1) & slots->mask;
+
+    g_atomic_pointer_set(&slots->calls[i], call);
+}
+
+static void
+_CallTableInsert(_CallTable *table, _Call *call)
+{
+    _CallSlots *slots = table->slots;
+
+    if ((table->count + 1) * 2 > slots->mask + 1)
+    {
+        _CallSlots *grown = _CallSlotsNew(slots->bits + 1);
+        for (gsize i = 0; i <= slots->mask; ++i)
+        {
+            if (slots->calls[i])
+                _CallSlotsPut(grown, slots->calls[i]);
+        }
+
+        grown->retired = slots;
+        g_atomic_pointer_set(&table->slots, grown);
+        slots = grown;
+    }
+
+    _CallSlotsPut(slots, call);
+    ++table->count;
+}
+
+static void
+_CallTableRemove(_CallTable *table, _Call *call)
+{
+    _CallSlots *slots = table->slots;
+
+    gsize hole = _CallSlotsHome(slots, call->token);
+    while (slots->calls[hole] != call)
+    {
+        LS_ASSERT(slots->calls[hole] != NULL);
+        hole = (hole + 1) & slots->mask;
+    }
+
+    // Move back entries of the cluster, which can't be reached past the hole
+    for (gsize i = (hole + 1) & slots->mask; slots->calls[i]; i = (i + 1) & slots->mask)
+    {
+        gsize home = _CallSlotsHome(slots, slots->calls[i]->token);
+        if (((i - home) & slots->mask) >= ((i - hole) & slots->mask))
+        {
+            g_atomic_pointer_set(&slots->calls[hole], slots->calls[i]);
+            hole = i;
+        }
+    }
+
+    g_atomic_pointer_set(&slots->calls[hole], NULL);
+    --table->count;
+}
+
+static void
+_CallTableDestroy(_CallTable *table, void (*destroy)(_Call *))
+{
+    _CallSlots *slots = table->slots;
+
+    for (gsize i = 0; i <= slots->mask; ++i)
+    {
+        if (slots->calls[i])
+            destroy(slots->calls[i]);
+    }
+
+    while (slots)
+    {
+        _CallSlots *retired = slots->retired;
+        g_free(slots);
+        slots = retired;
+    }
+
+    table->slots = NULL;
+    table->count = 0;
+}
 
 
 _Call *
@@ -194,27 +439,18 @@ _CallNew(LSHandle *sh, int type, const char *serviceName,
          LSFilterFunc callback, void *ctx,
          LSMessageToken token, const char *methodName)
 {
-    _Call *call = g_new0(_Call, 1);
+    _Call *call = _CallPoolAlloc();
 
     call->sh = sh;
     call->serviceName = g_strdup(serviceName);
     call->callback = callback;
     call->ctx = ctx;
-    call->token = token;
+    g_atomic_pointer_set(&call->token, token);
     call->type = type;
 #ifdef HAS_LTTNG
     call->methodName = g_strdup(methodName);
 #endif
 
-    int res;
-    pthread_mutexattr_t ma;
-    pthread_mutexattr_init(&ma);
-    res = pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_RECURSIVE);
-    LS_ASSERT(res == 0);
-    res = pthread_mutex_init(&call->lock, &ma);
-    LS_ASSERT(res == 0);
-    pthread_mutexattr_destroy(&ma);
-
     return call;
 }
 
@@ -223,10 +459,9 @@ _CallFree(_Call *call)
 {
     if (!call) return;
 
-    if (call->timer_source != NULL)
+    if (call->timeout_id != 0)
     {
-        g_source_destroy(call->timer_source);
-        g_source_unref(call->timer_source);
+        _LSTimerWheelRemove(call->timeout_id);
     }
     g_free(call->serviceName);
     //g_free(call->rule);
@@ -238,13 +473,7 @@ _CallFree(_Call *call)
     g_free(call->methodName);
 #endif
 
-    pthread_mutex_destroy(&call->lock);
-
-#ifdef MEMCHECK
-    memset(call, 0xFF, sizeof(_Call));
-#endif
-
-    g_free(call);
+    _CallPoolFree(call);
 }
 
 void _CallDebug(_Call* call, const char* uri, const char* payload)
@@ -278,6 +507,7 @@ _service_watch_disable(LSHandle *sh, _Call *call)
 }
 
 static void ResetCallTimeout(_Call *call);
+static void _CallReleaseUnsafe(_Call *call);
 
 /**
  *******************************************************************************
@@ -319,7 +549,8 @@ _CallInsert(_CallMap *map, _Call *call, bool single,
     call->single = single;
 
     // TODO: LS_ASSERT(call->ref == 0);
-    call->ref = 1;
+    g_atomic_pointer_set(&call->map, map);
+    g_atomic_int_set(&call->ref, 1);
 
     _TokenList *token_list = g_hash_table_lookup(table, key);
     if (_TokenListLen(token_list) == 0)
@@ -335,9 +566,9 @@ _CallInsert(_CallMap *map, _Call *call, bool single,
     _TokenListAdd(token_list, call->token);
 
     /* It's an error if the key is already in the map */
-    LS_ASSERT(g_hash_table_lookup(map->tokenMap, (gpointer)call->token) == NULL);
+    LS_ASSERT(_CallTableLookup(&map->tokenMap, call->token) == NULL);
 
-    g_hash_table_replace(map->tokenMap, (gpointer)call->token, call);
+    _CallTableInsert(&map->tokenMap, call);
 
     return true;
 }
@@ -347,13 +578,13 @@ _CallRemove(_CallMap *map, _Call *call)
 {
     _CallMapLock(map);
 
-    _Call *orig_call = g_hash_table_lookup(map->tokenMap, (gpointer)call->token);
+    _Call *orig_call = _CallTableLookup(&map->tokenMap, call->token);
     if (orig_call == call)
     {
         GHashTable *table = NULL;
         gpointer    key = NULL;
 
-        if (call->timer_source != NULL)
+        if (call->timeout_id != 0)
         {
             call->timeout_ms = 0;
             ResetCallTimeout(call);
@@ -384,7 +615,8 @@ _CallRemove(_CallMap *map, _Call *call)
                 g_hash_table_remove(table, key);
             }
         }
-        g_hash_table_remove(map->tokenMap, (gpointer)call->token);
+        _CallTableRemove(&map->tokenMap, call);
+        _CallReleaseUnsafe(call);
     }
 
     /* <eeh> TODO: what does the else case mean (i.e., orig_call != call) */
@@ -411,6 +643,44 @@ _CallUnlock(_Call *call)
     pthread_mutex_unlock(&call->lock);
 }
 
+/**
+ *******************************************************************************
+ * @brief Look up and reference a call without taking the callmap lock.
+ *
+ * @param map
+ * @param token
+ *
+ * @return referenced call, NULL if it wasn't found (maybe because of a
+ * concurrent modification of the map)
+ *******************************************************************************
+ */
+static _Call*
+_CallAcquireFast(_CallMap *map, LSMessageToken token)
+{
+    _Call *call = _CallTableLookup(&map->tokenMap, token);
+    if (!call)
+        return NULL;
+
+    // The call may be released and even reused meanwhile, take it only alive
+    int ref;
+    do
+    {
+        ref = g_atomic_int_get(&call->ref);
+        if (ref <= 0)
+            return NULL;
+    }
+    while (!g_atomic_int_compare_and_exchange(&call->ref, ref, ref + 1));
+
+    // Holding the reference, the call can't be reused any more
+    if (_CallGetTokenAtomic(call) != token || _CallGetMapAtomic(call) != map)
+    {
+        _CallReleaseUnsafe(call);
+        return NULL;
+    }
+
+    return call;
+}
+
 static _Call*
 _CallAcquireEx(_CallMap *map, LSMessageToken token, bool lock)
 {
@@ -419,9 +689,17 @@ _CallAcquireEx(_CallMap *map, LSMessageToken token, bool lock)
     if(!map)
         return NULL;
 
+    call = _CallAcquireFast(map, token);
+    if (call)
+    {
+        if (lock)
+            _CallLock(call);
+        return call;
+    }
+
     _CallMapLock(map);
 
-    call = g_hash_table_lookup(map->tokenMap, (gpointer)token);
+    call = _CallTableLookup(&map->tokenMap, token);
     if (call)
     {
         _CallAddReference(call);
@@ -458,6 +736,17 @@ _CallRelease(_Call *call)
     _CallReleaseUnsafe(call);
 }
 
+static void
+_CallDestroy(_Call *call)
+{
+    if (call->timeout_id != 0)
+    {
+        call->timeout_ms = 0;
+        ResetCallTimeout(call);
+    }
+    _CallReleaseUnsafe(call);
+}
+
 /**
  *******************************************************************************
  * @brief Initialize callmap.
@@ -474,8 +763,7 @@ _CallMapInit(LSHandle *sh, _CallMap **ret_map, LSError *lserror)
 {
     _CallMap *map = g_new0(_CallMap, 1);
 
-    map->tokenMap = g_hash_table_new_full(g_direct_hash, g_direct_equal,
-                    NULL, (GDestroyNotify)_CallReleaseUnsafe);
+    _CallTableInit(&map->tokenMap);
     map->signalMap = g_hash_table_new_full(g_str_hash, g_str_equal,
                     (GDestroyNotify)g_free, (GDestroyNotify)_TokenListFree);
     map->serviceMap = g_hash_table_new_full(g_str_hash, g_str_equal,
@@ -512,19 +800,7 @@ _CallMapDeinit(LSHandle *sh, _CallMap *map)
         g_hash_table_destroy(map->serviceMap);
 
         //Destroy set timers for all remaining calls if any
-        GHashTableIter iter;
-        gpointer key, value;
-        g_hash_table_iter_init(&iter, map->tokenMap);
-        while (g_hash_table_iter_next(&iter, &key, &value))
-        {
-            _Call * call = (_Call *)value;
-            if (call->timer_source != NULL)
-            {
-                call->timeout_ms = 0;
-                ResetCallTimeout(call);
-            }
-        }
-        g_hash_table_destroy(map->tokenMap);
+        _CallTableDestroy(&map->tokenMap, _CallDestroy);
 
         if (pthread_mutex_destroy(&map->lock))
         {
@@ -1279,6 +1555,17 @@ _json_get_string(jvalue_ref object, const char *label)
     return NULL;
 }
 
+static bool
+_json_get_bool(jvalue_ref object, const char *label)
+{
+    bool value = false;
+    jvalue_ref m = jobject_get(object, j_cstr_to_buffer(label));
+    if (jis_valid(m) && jis_boolean(m)) {
+        (void) jboolean_get(m, &value);
+    }
+    return value;
+}
+
 static inline void
 _SendFakeReply(LSHandle *sh, LSFilterFunc callback, void *ctx,
                     const char *method, const char *errorText)
@@ -1316,6 +1603,7 @@ _send_match(LSHandle        *sh,
     char *category = NULL;
     char *method = NULL;
     char *key = NULL;
+    bool coalesce = false;
     _Call *call = NULL;
     LSMessageToken token = LSMESSAGE_TOKEN_INVALID;
 
@@ -1334,9 +1622,10 @@ _send_match(LSHandle        *sh,
     }
 
     method = _json_get_string(object, "method");
+    coalesce = _json_get_bool(object, "coalesce");
 
     if (category) {
-        retVal = LSTransportRegisterSignal(sh->transport, category, method, sh->is_public_bus, &token, lserror);
+        retVal = LSTransportRegisterSignal(sh->transport, category, method, coalesce, sh->is_public_bus, &token, lserror);
         if (!retVal) goto done;
     }
 
@@ -1353,6 +1642,7 @@ _send_match(LSHandle        *sh,
 
     call->signal_category = category;
     call->signal_method = method;
+    call->signal_coalesce = coalesce;
     call->match_key = key;
 
     /* release ownership over method and category (moved to call structure) */
@@ -1583,7 +1873,7 @@ _cancel_signal(LSHandle *sh, _Call *call, LSError *lserror)
     if ((call->signal_category != NULL) || (call->signal_method != NULL))
     {
         if (!LSTransportUnregisterSignal(sh->transport, call->signal_category, call->signal_method,
-                                         sh->is_public_bus, NULL, lserror))
+                                         call->signal_coalesce, sh->is_public_bus, NULL, lserror))
         {
             return false;
         }
@@ -1620,15 +1910,20 @@ _LSSignalSendCommon(LSHandle *sh, const char *uri, const char *payload,
         return false;
     }
 
+    /* the declaration tells whether the signal is latest-value */
+    LSCategoryTable *table = sh->tableHandlers
+        ? (LSCategoryTable*) g_hash_table_lookup(sh->tableHandlers, luri->objectPath)
+        : NULL;
+    const LSSignal *signal = table
+        ? (const LSSignal*) g_hash_table_lookup(table->signals, luri->methodName)
+        : NULL;
+
     if (typecheck)
     {
         /* typecheck the signal, warn if we haven't done a
          * LSRegisterCategory() with the the same signal name.
          */
-        LSCategoryTable *table;
-        table = (LSCategoryTable*)
-            g_hash_table_lookup(sh->tableHandlers, luri->objectPath);
-        if (!table || !g_hash_table_lookup(table->signals, luri->methodName))
+        if (!signal)
         {
             LOG_LS_WARNING(MSGID_LS_SIGNAL_NOT_REGISTERED, 1,
                            PMLOGKS("URI", uri),
@@ -1642,6 +1937,7 @@ _LSSignalSendCommon(LSHandle *sh, const char *uri, const char *payload,
                                    luri->methodName,
                                    payload,
                                    sh->is_public_bus,
+                                   signal && (signal->flags & LUNA_SIGNAL_FLAG_COALESCE),
                                    lserror);
 
     LSUriFree(luri);
@@ -1690,6 +1986,10 @@ _LSSignalSendCommon(LSHandle *sh, const char *uri, const char *payload,
  *            "{"category": "/com/palm/bluetooth/gap"}",
  *            callback, ctx, lserror);
  *
+ * Add "coalesce": true to the addmatch payload if only the latest value
+ * matters: while a signal is still queued for the subscriber, a newer one
+ * with the same category and method replaces it instead of being appended.
+ *
  * @return true on success, otherwise false
  *******************************************************************************
  */
@@ -2057,7 +2357,7 @@ OnCallTimedOut(_Call *call)
     {
         LSErrorFree(&lserror);
     }
-    call->timer_source = NULL;
+    call->timeout_id = 0;
 
     // Send fake message to sender if call timed out
     _send_timeout_msg(call);
@@ -2068,22 +2368,22 @@ OnCallTimedOut(_Call *call)
 static void
 ResetCallTimeout(_Call *call)
 {
-    if (call->timer_source != NULL)
+    if (call->timeout_id != 0)
     {
-        g_source_destroy(call->timer_source);
-        g_source_unref(call->timer_source);
+        _LSTimerWheelRemove(call->timeout_id);
     }
 
+    /* all timeouts of a context share one source, see _LSTimerWheelAdd */
     if (call->timeout_ms > 0)
     {
         _CallAddReference(call);
-        call->timer_source = g_timeout_source_new(call->timeout_ms);
-        g_source_set_callback(call->timer_source, (GSourceFunc) OnCallTimedOut, call, (GDestroyNotify) _CallRelease);
-        (void)g_source_attach(call->timer_source, call->sh->context);
+        call->timeout_id = _LSTimerWheelAdd(call->sh->context, call->timeout_ms,
+                                            (GSourceFunc) OnCallTimedOut, call,
+                                            (GDestroyNotify) _CallRelease);
     }
     else
     {
-        call->timer_source = NULL;
+        call->timeout_id = 0;
     }
 }
 
@@ -25,6 +25,7 @@
 #include "luna-service2/lunaservice-meta.h"
 #include "log.h"
 
+#include <errno.h>
 #include <pthread.h>
 
 /**
@@ -45,6 +46,9 @@ _LSCategoryTableFree(LSCategoryTable *table)
 
     j_release(&table->description);
 
+    if (table->executor)
+        _LSExecutorUnref(table->executor);
+
 #ifdef MEMCHECK
     memset(table, 0xFF, sizeof(LSCategoryTable));
 #endif
@@ -109,6 +113,44 @@ fail:
     return NULL;
 }
 
+/* Replace *executor with one of the given type (NULL for the main loop) */
+static bool
+_LSExecutorSet(_LSExecutor **executor, LSExecutorType type, LSError *lserror)
+{
+    _LSExecutor *new_executor = NULL;
+
+    /* the executor's thread can't wait for the executor to be done */
+    if (*executor && *executor == _LSExecutorGetCurrent())
+    {
+        _LSErrorSet(lserror, MSGID_LS_EXECUTOR_ERR, -EDEADLK,
+                    "Can't replace the executor from a callback it runs");
+        return false;
+    }
+
+    switch (type)
+    {
+    case LUNA_EXECUTOR_MAINLOOP:
+        break;
+    case LUNA_EXECUTOR_POOL:
+        new_executor = _LSExecutorGetPool(lserror);
+        if (!new_executor) return false;
+        break;
+    case LUNA_EXECUTOR_SERIAL:
+        new_executor = _LSExecutorNewSerial(lserror);
+        if (!new_executor) return false;
+        break;
+    default:
+        _LSErrorSet(lserror, MSGID_LS_EXECUTOR_ERR, -1, "Unknown executor type: %d", type);
+        return false;
+    }
+
+    if (*executor)
+        _LSExecutorUnref(*executor);
+    *executor = new_executor;
+
+    return true;
+}
+
 static LSMethodEntry *LSMethodEntryCreate()
 {
     LSMethodEntry *entry = g_slice_new0(LSMethodEntry);
@@ -143,6 +185,11 @@ static void LSMethodEntryFree(void *methodEntry)
     jschema_release(&entry->schema_firstReply);
 
     g_free(entry->security_provided_groups);
+    g_free(entry->trust_provided_levels);
+
+    if (entry->executor)
+        _LSExecutorUnref(entry->executor);
+
     g_slice_free(LSMethodEntry, entry);
 }
 
@@ -481,6 +528,9 @@ LSRegisterCategoryAppend(LSHandle *sh, const char *category,
                                   : SECURITY_PRIVATE_GROUP_BIT);
             }
 #endif
+
+            // trust table follows the provided groups, recompute it with the first call
+            entry->trust_level_generation = 0;
         }
     }
 
@@ -670,6 +720,79 @@ LSMethodSetData(LSHandle *sh, const char *category, const char *method,
     return true;
 }
 
+/**
+ *******************************************************************************
+ * @brief Set where the callbacks registered to the category run.
+ *
+ * By default they run in the main loop the handle is attached to. With
+ * @ref LUNA_EXECUTOR_POOL they run in a thread pool shared by the process,
+ * calls from the same sender one at a time, in the order they were sent. With
+ * @ref LUNA_EXECUTOR_SERIAL they run in a thread of the category, one at a
+ * time, in the order they were received. The calls of a sender to methods run
+ * in different places aren't ordered with each other.
+ *
+ * @param  sh         IN  handle to service
+ * @param  category   IN  category name
+ * @param  executor   IN  where to run the callbacks
+ * @param  lserror    OUT set on error
+ *
+ * @return true on success, otherwise false
+ *
+ * @note Callbacks run away from the main loop must be thread-safe; replies
+ *       can be sent from them as usual.
+ * @note If a method executor is set using @ref LSMethodSetExecutor, it
+ *       overrides the category one
+ *******************************************************************************
+ */
+bool
+LSCategorySetExecutor(LSHandle *sh, const char *category, LSExecutorType executor, LSError *lserror)
+{
+    LSHANDLE_VALIDATE(sh);
+
+    LSCategoryTable *table = LSHandleGetCategory(sh, category, lserror);
+    if (table == NULL) return false;
+
+    return _LSExecutorSet(&table->executor, executor, lserror);
+}
+
+/**
+ *******************************************************************************
+ * @brief Set where the callback registered to the method runs. Overrides
+ *        the category executor, see @ref LSCategorySetExecutor.
+ *
+ * @param  sh         IN  handle to service
+ * @param  category   IN  category name
+ * @param  method     IN  method name
+ * @param  executor   IN  where to run the callback
+ * @param  lserror    OUT set on error
+ *
+ * @return true on success, otherwise false
+ *
+ * @note It's recommended to set the executor before the handle is attached
+ *       to a mainloop, so that all calls of the method run in the same place.
+ *******************************************************************************
+ */
+bool
+LSMethodSetExecutor(LSHandle *sh, const char *category, const char *method,
+                    LSExecutorType executor, LSError *lserror)
+{
+    LSHANDLE_VALIDATE(sh);
+
+    LSCategoryTable *table = LSHandleGetCategory(sh, category, lserror);
+    if (table == NULL) return false;
+
+    LSMethodEntry *entry = g_hash_table_lookup(table->methods, method);
+    if (entry == NULL)
+    {
+        /* create a stub entry for further filling with appropriate callback */
+        entry = LSMethodEntryCreate();
+
+        g_hash_table_insert(table->methods, strdup(method), entry);
+    }
+
+    return _LSExecutorSet(&entry->executor, executor, lserror);
+}
+
 /**
  *******************************************************************************
  * @brief Register tables of callbacks associated with the message category.
@@ -26,6 +26,7 @@
 #include "base.h"
 #include "error.h"
 #include "clock.h"
+#include "executor.h"
 
 #include <pmtrace_ls2.h>
 
@@ -50,6 +51,7 @@ struct LSCategoryTable {
 
     void           *category_user_data;
     jvalue_ref     description;
+    _LSExecutor    *executor;       /**< runs the method handlers, NULL for the main loop */
 };
 
 typedef struct LSCategoryTable LSCategoryTable;
@@ -61,7 +63,13 @@ typedef struct {
     jschema_ref schema_firstReply;
     jschema_ref schema_reply;
     LSTransportBitmaskWord *security_provided_groups; /**< bitmask, see security_mask_size in the struct LSTransport */
+    unsigned trust_level_generation; /**< trust level maps generation the trust table is computed for (0 - not yet) */
+    unsigned trust_allowed_ranks;    /**< bit set of caller trust ranks that pass the trust level check */
+    LSTransportBitmaskWord *trust_provided_levels; /**< bitmask of provided trust levels, callers with one of them
+                                                        pass the check too, see trust_security_mask_size in the
+                                                        struct LSTransport */
     void *method_user_data; /**< Method context. If set, overwrites category context */
+    _LSExecutor *executor;  /**< Runs the handler. If set, overrides the category one */
 } LSMethodEntry;
 
 bool LSCategoryValidateCall(LSMethodEntry *entry, LSMessage *message);
@@ -259,6 +259,33 @@ error:
 }
 #endif  /* MALLOC_DEBUG */
 
+#ifdef QUEUE_DEBUG
+bool
+_LSPrivateGetQueues(LSHandle* sh, LSMessage *message, void *ctx)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    /* returnValue: true,
+     * limits: {outgoing: {...}, incoming: {...}},
+     * clients: [{unique_name: string, outgoing: {...}, incoming: {...}},...]
+     */
+    jvalue_ref ret_obj = LSTransportGetQueues(sh->transport);
+    jobject_put(ret_obj, J_CSTR_TO_JVAL("returnValue"), jboolean_create(true));
+
+    bool reply_ret = LSMessageReply(sh, message, jvalue_tostring_simple(ret_obj), &lserror);
+    if (!reply_ret)
+    {
+        LOG_LSERROR(MSGID_LS_SEND_ERROR, &lserror);
+        LSErrorFree(&lserror);
+    }
+
+    j_release(&ret_obj);
+
+    return true;
+}
+#endif  /* QUEUE_DEBUG */
+
 #ifdef INTROSPECTION_DEBUG
 static void
 build_categories_flat(LSHandle *sh, jvalue_ref ret_obj)
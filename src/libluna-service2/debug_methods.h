@@ -24,6 +24,7 @@
 #define SUBSCRIPTION_DEBUG
 #define MALLOC_DEBUG
 #define INTROSPECTION_DEBUG
+#define QUEUE_DEBUG
 
 #ifdef SUBSCRIPTION_DEBUG
 bool _LSPrivateGetSubscriptions(LSHandle* sh, LSMessage *message, void *ctx);
@@ -35,5 +36,8 @@ bool _LSPrivateDoMallocTrim(LSHandle* sh, LSMessage *message, void *ctx);
 #ifdef INTROSPECTION_DEBUG
 bool _LSPrivateInrospection(LSHandle* sh, LSMessage *message, void *ctx);
 #endif
+#ifdef QUEUE_DEBUG
+bool _LSPrivateGetQueues(LSHandle* sh, LSMessage *message, void *ctx);
+#endif
 
 #endif // _DEBUG_METHODS_H_
@@ -0,0 +1,291 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#include "error.h"
+#include "log.h"
+#include "executor.h"
+
+/**
+ * @cond INTERNAL
+ * @defgroup LunaServiceExecutor Method call executors
+ * @ingroup LunaServiceInternals
+ *
+ * Executors run method handlers away from the main loop.
+ *
+ * The pool executor is shared by the whole process. Its work is split into
+ * strands (one per sender): a strand runs on one pool thread at a time, in
+ * the order the work was submitted, while different strands run in
+ * parallel. A strand goes back to the end of the pool queue after every
+ * item, so a busy sender can't starve the others.
+ *
+ * A serial executor has a thread of its own and runs everything submitted to
+ * it in order, one at a time.
+ *
+ * Work run by an executor mustn't wait for the executor to be done, e.g. by
+ * releasing the last reference to it; see @ref _LSExecutorGetCurrent().
+ *
+ * @{
+ */
+
+typedef struct LSExecutorTask {
+    LSExecutorFunc func;
+    gpointer data;
+} _LSExecutorTask;
+
+typedef struct LSExecutorStrand {
+    gconstpointer key;
+    GQueue tasks;           /**< the first one is the one running (if any) */
+} _LSExecutorStrand;
+
+struct LSExecutor {
+    gint ref;
+    GThreadPool *threads;   /**< runs strands (pool) or tasks (serial) */
+    GMutex lock;            /**< protects strands */
+    GHashTable *strands;    /**< strand key -> _LSExecutorStrand, for as long as it has
+                                 work; NULL for a serial executor */
+};
+
+static _LSExecutor *shared_pool = NULL;
+static GMutex shared_pool_lock;
+
+/* executor whose work the thread is running, NULL out of it */
+static GPrivate current_executor;
+
+static _LSExecutorTask*
+_LSExecutorTaskNew(LSExecutorFunc func, gpointer data)
+{
+    _LSExecutorTask *task = g_slice_new(_LSExecutorTask);
+    task->func = func;
+    task->data = data;
+    return task;
+}
+
+static void
+_LSExecutorTaskRun(_LSExecutor *executor, _LSExecutorTask *task)
+{
+    g_private_set(&current_executor, executor);
+    task->func(task->data);
+    g_private_set(&current_executor, NULL);
+
+    g_slice_free(_LSExecutorTask, task);
+}
+
+/* Serial executor: the thread pool of one thread runs the tasks as they come */
+static void
+_LSExecutorRunTask(gpointer data, gpointer user_data)
+{
+    _LSExecutorTaskRun((_LSExecutor*) user_data, (_LSExecutorTask*) data);
+}
+
+/* Pool executor: run the next item of a strand and put it back in line */
+static void
+_LSExecutorRunStrand(gpointer data, gpointer user_data)
+{
+    _LSExecutorStrand *strand = (_LSExecutorStrand*) data;
+    _LSExecutor *executor = (_LSExecutor*) user_data;
+
+    g_mutex_lock(&executor->lock);
+    _LSExecutorTask *task = g_queue_peek_head(&strand->tasks);
+    g_mutex_unlock(&executor->lock);
+
+    _LSExecutorTaskRun(executor, task);
+
+    g_mutex_lock(&executor->lock);
+    g_queue_pop_head(&strand->tasks);
+    if (g_queue_is_empty(&strand->tasks))
+    {
+        g_hash_table_remove(executor->strands, strand->key);
+        g_slice_free(_LSExecutorStrand, strand);
+    }
+    else
+    {
+        g_thread_pool_push(executor->threads, strand, NULL);
+    }
+    g_mutex_unlock(&executor->lock);
+}
+
+static _LSExecutor*
+_LSExecutorNew(GFunc func, gint max_threads, gboolean exclusive, LSError *lserror)
+{
+    _LSExecutor *executor = g_slice_new0(_LSExecutor);
+    GError *error = NULL;
+
+    executor->ref = 1;
+    executor->threads = g_thread_pool_new(func, executor, max_threads, exclusive, &error);
+    if (!executor->threads)
+    {
+        _LSErrorSetFromGError(lserror, MSGID_LS_EXECUTOR_ERR, error);
+        g_slice_free(_LSExecutor, executor);
+        return NULL;
+    }
+    g_mutex_init(&executor->lock);
+
+    return executor;
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the pool executor shared by the process.
+ *
+ * It has a thread for every processor and lives as long as the process. Work
+ * submitted with the same strand runs one at a time, in order.
+ *
+ * @param  lserror  OUT set on error
+ *
+ * @retval  ref'd executor on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSExecutor*
+_LSExecutorGetPool(LSError *lserror)
+{
+    g_mutex_lock(&shared_pool_lock);
+    if (!shared_pool)
+    {
+        shared_pool = _LSExecutorNew(_LSExecutorRunStrand, MAX(g_get_num_processors(), 2), FALSE, lserror);
+        if (shared_pool)
+        {
+            shared_pool->strands = g_hash_table_new(g_direct_hash, g_direct_equal);
+        }
+    }
+    _LSExecutor *executor = shared_pool ? _LSExecutorRef(shared_pool) : NULL;
+    g_mutex_unlock(&shared_pool_lock);
+
+    return executor;
+}
+
+/**
+ *******************************************************************************
+ * @brief Allocate an executor with a dedicated thread, running everything
+ * submitted to it in order, one at a time.
+ *
+ * @param  lserror  OUT set on error
+ *
+ * @retval  executor on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSExecutor*
+_LSExecutorNewSerial(LSError *lserror)
+{
+    return _LSExecutorNew(_LSExecutorRunTask, 1, TRUE, lserror);
+}
+
+_LSExecutor*
+_LSExecutorRef(_LSExecutor *executor)
+{
+    LS_ASSERT(executor != NULL);
+    LS_ASSERT(g_atomic_int_get(&executor->ref) > 0);
+
+    g_atomic_int_inc(&executor->ref);
+    return executor;
+}
+
+/**
+ *******************************************************************************
+ * @brief Release an executor. The last reference waits for the submitted work
+ * to finish.
+ *
+ * @attention mustn't be called from the executor's own threads
+ *
+ * @param  executor     IN  executor
+ *******************************************************************************
+ */
+void
+_LSExecutorUnref(_LSExecutor *executor)
+{
+    LS_ASSERT(executor != NULL);
+    LS_ASSERT(g_atomic_int_get(&executor->ref) > 0);
+
+    if (!g_atomic_int_dec_and_test(&executor->ref))
+        return;
+
+    /* the thread would wait for itself */
+    LS_ASSERT(_LSExecutorGetCurrent() != executor);
+
+    g_thread_pool_free(executor->threads, FALSE, TRUE);
+
+    if (executor->strands)
+    {
+        LS_ASSERT(g_hash_table_size(executor->strands) == 0);
+        g_hash_table_unref(executor->strands);
+    }
+    g_mutex_clear(&executor->lock);
+
+    g_slice_free(_LSExecutor, executor);
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the executor running the calling thread.
+ *
+ * @retval  executor whose work the calling thread is running
+ * @retval  NULL if the thread isn't running work of an executor
+ *******************************************************************************
+ */
+_LSExecutor*
+_LSExecutorGetCurrent(void)
+{
+    return g_private_get(&current_executor);
+}
+
+/**
+ *******************************************************************************
+ * @brief Have the executor run @p func.
+ *
+ * @param  executor     IN  executor
+ * @param  strand       IN  work with the same strand runs in the order it's
+ *                          submitted, one at a time (e.g., the sender); the
+ *                          key has to stay valid until the work has run
+ * @param  func         IN  work to run
+ * @param  data         IN  passed to @p func
+ *******************************************************************************
+ */
+void
+_LSExecutorSubmit(_LSExecutor *executor, gconstpointer strand, LSExecutorFunc func, gpointer data)
+{
+    LS_ASSERT(executor != NULL);
+    LS_ASSERT(func != NULL);
+
+    _LSExecutorTask *task = _LSExecutorTaskNew(func, data);
+
+    if (!executor->strands)
+    {
+        g_thread_pool_push(executor->threads, task, NULL);
+        return;
+    }
+
+    g_mutex_lock(&executor->lock);
+    _LSExecutorStrand *line = g_hash_table_lookup(executor->strands, strand);
+    if (line)
+    {
+        /* in line already, it picks the task up when its turn comes */
+        g_queue_push_tail(&line->tasks, task);
+    }
+    else
+    {
+        line = g_slice_new0(_LSExecutorStrand);
+        line->key = strand;
+        g_queue_push_tail(&line->tasks, task);
+        g_hash_table_insert(executor->strands, (gpointer) strand, line);
+        g_thread_pool_push(executor->threads, line, NULL);
+    }
+    g_mutex_unlock(&executor->lock);
+}
+
+/** @} END OF LunaServiceExecutor */
+/** @endcond */
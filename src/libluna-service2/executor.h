@@ -0,0 +1,42 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef _EXECUTOR_H_
+#define _EXECUTOR_H_
+
+#include <glib.h>
+
+#include "error.h"
+
+/** @cond INTERNAL */
+
+typedef struct LSExecutor _LSExecutor;
+
+/** Work run by an executor */
+typedef void (*LSExecutorFunc)(gpointer data);
+
+_LSExecutor* _LSExecutorGetPool(LSError *lserror);
+_LSExecutor* _LSExecutorNewSerial(LSError *lserror);
+_LSExecutor* _LSExecutorRef(_LSExecutor *executor);
+void _LSExecutorUnref(_LSExecutor *executor);
+_LSExecutor* _LSExecutorGetCurrent(void);
+
+void _LSExecutorSubmit(_LSExecutor *executor, gconstpointer strand, LSExecutorFunc func, gpointer data);
+
+/** @endcond */
+
+#endif // _EXECUTOR_H_
@@ -63,6 +63,7 @@
 #define MSGID_LSHUB_ROLE_EXISTS                 "LSHUB_ROLE_EXISTS"     /** Role already exists for exe_path */
 #define MSGID_LSHUB_ROLE_DEPRECATED             "LSHUB_ROLE_DEPRECATED" /** Deprecated ls2 permission model is used */
 #define MSGID_LSHUB_ROLE_FILE_ERR               "LSHUB_ROLE_FILE"       /** Error in role file */
+#define MSGID_LSHUB_SECURITY_CACHE_ERR          "LSHUB_SEC_CACHE"       /** Security cache file can not be written */
 #define MSGID_LSHUB_SENDMSG_ERROR               "LSHUB_SENDMSG"         /** Message sending error */
 #define MSGID_LSHUB_SERVICE_ADD_ERR             "LSHUB_SRV_ADD_ERROR"   /** Error adding service */
 #define MSGID_LSHUB_SERVICE_CONNECT_ERROR       "LSHUB_SRV_CONN"        /** Could not connect to service */
@@ -116,12 +117,16 @@
 #define MSGID_LS_INVALID_URI_METHOD             "LS_INV_URI_METH"       /** Invalid method in URI */
 #define MSGID_LS_INVALID_URI_PATH               "LS_INV_URI_PATH"       /** Invalid path in URI */
 #define MSGID_LS_INVALID_URI_SERVICE_NAME       "LS_INV_URI_SNAME"      /** Invalid service name in URI */
+#define MSGID_LS_IO_THREAD_ERR                  "LS_IO_THREAD"          /** I/O thread error */
+#define MSGID_LS_EXECUTOR_ERR                   "LS_EXECUTOR"           /** Method call executor error */
 #define MSGID_LS_LOCK_FILE_ERR                  "LS_LCK_FILE"           /** Lock file error */
 #define MSGID_LS_MAGIC_ASSERT                   "LS_MAGIC_ASSERT"       /** No LS_MAGIC field */
 #define MSGID_LS_MAINCONTEXT_ERROR              "LS_MCTXT"              /** Maincontext error */
 #define MSGID_LS_MAINLOOP_ERROR                 "LS_MLOOP"              /** Mainloop error */
+#define MSGID_LS_MEMFD_ERR                      "LS_MEMFD"              /** Body passed in memfd failed */
 #define MSGID_LS_MALLOC_SEND_FAILED             "LS_MALL_SEND_FAIL"     /** Sending malloc info failed */
 #define MSGID_LS_MALLOC_TRIM_SEND_FAILED        "LS_MALLTRIM_SEND_FAIL" /** Sending malloc trim result failed */
+#define MSGID_LS_MONITOR_FILTER_ERR             "LS_MON_FILTER"         /** Invalid monitor filter expression */
 #define MSGID_LS_MSG_ERR                        "LS_MSG"                /** Messages errors */
 #define MSGID_LS_MSG_NOT_HANDLED                "LS_MSG_NOT_HNDLD"      /** Messages not handled */
 #define MSGID_LS_MUTEX_ERR                      "LS_MUTEX"              /** Mutex error */
@@ -142,6 +147,7 @@
 #define MSGID_LS_PRIVILEGES_ERROR               "LS_PRIV"               /** Not enaugh privileges */
 #define MSGID_LS_QNAME_ERR                      "LS_QNAME"              /** Query name error */
 #define MSGID_LS_QUEUE_ERROR                    "LS_QUEUE"              /** Message queue error */
+#define MSGID_LS_QUEUE_FULL                     "LS_QUEUE_FULL"         /** Queue over its high-water mark */
 #define MSGID_LS_REPLY_TOK                      "LS_REPLY_TOK"          /** Getting reply token for message type */
 #define MSGID_LS_REQUEST_NAME                   "LS_REQ_NAME"           /** Error during name request */
 #define MSGID_LS_SEND_ERROR                     "LS_SEND"               /** Sending error */
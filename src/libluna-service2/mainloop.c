@@ -71,13 +71,14 @@ bool LSGmainContextAttach(LSHandle *sh, GMainContext *mainContext, LSError *lser
     _LSErrorIfFailMsg(mainContext != NULL, lserror, MSGID_LS_MAINCONTEXT_ERROR, -1,
                    "%s: %s", __FUNCTION__, ": No maincontext.");
 
+    GMainContext *attached = _LSTransportGetUserContext(sh->transport);
     _LSErrorGotoIfFail(error,
-            !sh->transport->mainloop_context || mainContext == sh->transport->mainloop_context,
+            !attached || mainContext == attached,
             lserror,
             MSGID_LS_PALM_SERVICE_WITH_TWO_CONTEXTS,
             -1);
 
-    if(!sh->transport->mainloop_context)
+    if(!attached)
         _LSTransportGmainAttach(sh->transport, mainContext);
     sh->context = g_main_context_ref(mainContext);
 
@@ -159,4 +160,35 @@ LSGmainSetPriority(LSHandle *sh, int priority, LSError *lserror)
     return _LSTransportGmainSetPriority(sh->transport, priority, lserror);
 }
 
+/**
+ *******************************************************************************
+ * @brief Run the socket I/O of the service connection on an internal thread.
+ *
+ *        Reading, writing, message framing and the hub protocol are then
+ *        handled on a thread of their own, so a callback doing slow work
+ *        doesn't hold up the connection. Callbacks still run from the
+ *        attached main loop, in the order the messages arrived.
+ *
+ *        This has to be called before @ref LSGmainAttach() or
+ *        @ref LSGmainContextAttach(). Don't combine it with
+ *        @ref LSGmainDetach() in a fork()'ed child, which doesn't have the
+ *        thread.
+ *
+ * @param sh       IN  handle to service
+ * @param enable   IN  true to use the I/O thread
+ * @param lserror  OUT set on error
+ *
+ * @return true on success, otherwise false
+ *******************************************************************************
+ */
+bool
+LSGmainSetIoThread(LSHandle *sh, bool enable, LSError *lserror)
+{
+    _LSErrorIfFail(sh != NULL, lserror, MSGID_LS_INVALID_HANDLE);
+
+    LSHANDLE_VALIDATE(sh);
+
+    return _LSTransportSetIoThread(sh->transport, enable, lserror);
+}
+
 /** @} END OF LunaServiceMainloop */
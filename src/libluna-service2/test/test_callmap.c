@@ -704,6 +704,128 @@ test_LSCallSetTimeoutExpiration(TestData *fixture, gconstpointer user_data)
     g_assert(fixture->timeout_expiration_msg_processed);
 }
 
+static bool
+test_countingcall_callback(LSHandle *sh, LSMessage *reply, void *ctx)
+{
+    g_atomic_int_inc((int *) ctx);
+    return true;
+}
+
+static void
+test_LSCallManyReplies(TestData *fixture, gconstpointer user_data)
+{
+    // Enough calls for the token table to grow and wrap around several times
+    enum { CALLS = 5000 };
+
+    LSError error;
+    LSErrorInit(&error);
+
+    int *replies = g_new0(int, CALLS + 1);
+    for (LSMessageToken i = 1; i <= CALLS; ++i)
+    {
+        LSMessageToken token = LSMESSAGE_TOKEN_INVALID;
+        if (i % 2)
+            g_assert(LSCall(&fixture->sh, "luna://com.name.service/method", "{}",
+                            test_countingcall_callback, &replies[i], &token, &error));
+        else
+            g_assert(LSCallOneReply(&fixture->sh, "luna://com.name.service/method", "{}",
+                                    test_countingcall_callback, &replies[i], &token, &error));
+        g_assert_cmpint(token, ==, i);
+    }
+
+    // Every third call gets cancelled before any reply
+    for (LSMessageToken i = 3; i <= CALLS; i += 3)
+    {
+        g_assert(LSCallCancel(&fixture->sh, i, &error));
+    }
+
+    fixture->transport_message_type = _LSTransportMessageTypeReply;
+    fixture->transport_message_payload = "{}";
+    _LSTransportMessage *msg = GINT_TO_POINTER(2);
+
+    for (int round = 0; round < 2; ++round)
+    {
+        for (LSMessageToken i = CALLS; i > 0; --i)
+        {
+            fixture->transport_message_reply_token = i;
+            g_assert(_LSHandleReply(&fixture->sh, msg));
+        }
+    }
+
+    for (LSMessageToken i = 1; i <= CALLS; ++i)
+    {
+        int expected = (i % 3 == 0) ? 0 : (i % 2) ? 2 : 1;
+        g_assert_cmpint(replies[i], ==, expected);
+
+        // Only subscriptions are left
+        g_assert(LSCallCancel(&fixture->sh, i, &error) == (expected == 2));
+    }
+
+    g_free(replies);
+    LSErrorFree(&error);
+}
+
+typedef struct
+{
+    TestData *fixture;
+    int replies;
+    volatile bool done;
+} ConcurrentCallsData;
+
+static gpointer
+test_concurrent_calls_thread(gpointer data)
+{
+    ConcurrentCallsData *d = data;
+    LSError error;
+    LSErrorInit(&error);
+
+    // Churn the map: new calls grow it, cancels shift entries back
+    for (int i = 0; i < 20000; ++i)
+    {
+        LSMessageToken token = LSMESSAGE_TOKEN_INVALID;
+        g_assert(LSCall(&d->fixture->sh, "luna://com.name.service/method", "{}",
+                        test_countingcall_callback, &d->replies, &token, &error));
+        if (i % 4)
+            g_assert(LSCallCancel(&d->fixture->sh, token, &error));
+    }
+
+    d->done = true;
+    return NULL;
+}
+
+static void
+test_LSCallConcurrentReplies(TestData *fixture, gconstpointer user_data)
+{
+    LSError error;
+    LSErrorInit(&error);
+
+    // A long-living subscription, which replies should never get lost
+    int replies = 0;
+    LSMessageToken token = LSMESSAGE_TOKEN_INVALID;
+    g_assert(LSCall(&fixture->sh, "luna://com.name.service/method", "{}",
+                    test_countingcall_callback, &replies, &token, &error));
+
+    ConcurrentCallsData data = { fixture, 0, false };
+    GThread *thread = g_thread_new("calls", test_concurrent_calls_thread, &data);
+
+    fixture->transport_message_type = _LSTransportMessageTypeReply;
+    fixture->transport_message_payload = "{}";
+    fixture->transport_message_reply_token = token;
+    _LSTransportMessage *msg = GINT_TO_POINTER(2);
+
+    int sent = 0;
+    while (!data.done)
+    {
+        g_assert(_LSHandleReply(&fixture->sh, msg));
+        ++sent;
+    }
+    g_thread_join(thread);
+
+    g_assert_cmpint(replies, ==, sent);
+    g_assert(LSCallCancel(&fixture->sh, token, &error));
+    LSErrorFree(&error);
+}
+
 /* Mocks **********************************************************************/
 
 // base.c
@@ -860,7 +982,7 @@ _LSTransportMessageGetError(const _LSTransportMessage *message)
 
 bool
 LSTransportRegisterSignal(_LSTransport *transport, const char *category, const char *method,
-                          bool is_public_bus,
+                          bool coalesce, bool is_public_bus,
                            LSMessageToken *token, LSError *lserror)
 {
     *token = ++test_data->transport_next_serial;
@@ -870,7 +992,7 @@ LSTransportRegisterSignal(_LSTransport *transport, const char *category, const c
 
 bool
 LSTransportUnregisterSignal(_LSTransport *transport, const char *category, const char *method,
-                            bool is_public_bus,
+                            bool coalesce, bool is_public_bus,
                            LSMessageToken *token, LSError *lserror)
 {
     g_assert(NULL == token);
@@ -879,7 +1001,7 @@ LSTransportUnregisterSignal(_LSTransport *transport, const char *category, const
 }
 
 bool
-LSTransportSendSignal(_LSTransport *transport, const char *category, const char *method, const char *payload, bool is_public_bus, LSError *lserror)
+LSTransportSendSignal(_LSTransport *transport, const char *category, const char *method, const char *payload, bool is_public_bus, bool coalesce, LSError *lserror)
 {
     ++test_data->transport_send_signal_called;
     return true;
@@ -996,6 +1118,8 @@ main(int argc, char *argv[])
     LSTEST_ADD("/luna-service2/LSHandleReply", test_LSHandleReply);
     LSTEST_ADD("/luna-service2/LSCallAndCallCancel", test_LSCallAndCancel);
     LSTEST_ADD("/luna-service2/LSCallOneReply", test_LSCallOneReply);
+    LSTEST_ADD("/luna-service2/LSCallManyReplies", test_LSCallManyReplies);
+    LSTEST_ADD("/luna-service2/LSCallConcurrentReplies", test_LSCallConcurrentReplies);
     LSTEST_ADD("/luna-service2/LSCallFromApplication", test_LSCallFromApplication);
     LSTEST_ADD("/luna-service2/LSCallFromApplicationOneReply", test_LSCallFromApplicationOneReply);
     LSTEST_ADD("/luna-service2/LSRegisterServerStatusAndCancel", test_LSRegisterServerStatusAndCancel);
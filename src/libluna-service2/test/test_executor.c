@@ -0,0 +1,308 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <string.h>
+#include <glib.h>
+#include "executor.h"
+
+/* Test data ******************************************************************/
+
+#define STRANDS     8
+#define PER_STRAND  500
+
+typedef struct {
+    GMutex lock;
+    GCond cond;
+    int done;
+    int next[STRANDS];      /* next expected item of each strand */
+    int running[STRANDS];   /* items of each strand running right now */
+    bool in_order;
+    bool overlapped;        /* items of a strand ran at the same time */
+    GThread *thread;        /* thread the last item ran in */
+} Progress;
+
+typedef struct {
+    Progress *progress;
+    int strand;
+    int i;
+} Item;
+
+static void
+progress_init(Progress *progress)
+{
+    memset(progress, 0, sizeof(*progress));
+    g_mutex_init(&progress->lock);
+    g_cond_init(&progress->cond);
+    progress->in_order = true;
+}
+
+static void
+progress_clear(Progress *progress)
+{
+    g_mutex_clear(&progress->lock);
+    g_cond_clear(&progress->cond);
+}
+
+static void
+progress_wait(Progress *progress, int done)
+{
+    gint64 deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+
+    g_mutex_lock(&progress->lock);
+    while (progress->done < done)
+    {
+        g_assert(g_cond_wait_until(&progress->cond, &progress->lock, deadline));
+    }
+    g_mutex_unlock(&progress->lock);
+}
+
+static void
+run_item(gpointer data)
+{
+    Item *item = data;
+    Progress *progress = item->progress;
+
+    g_mutex_lock(&progress->lock);
+    if (progress->running[item->strand]++ > 0)
+        progress->overlapped = true;
+    if (progress->next[item->strand] != item->i)
+        progress->in_order = false;
+    progress->next[item->strand] = item->i + 1;
+    g_mutex_unlock(&progress->lock);
+
+    /* give the other threads a chance to step in */
+    if (item->i % 16 == 0)
+        g_thread_yield();
+
+    g_mutex_lock(&progress->lock);
+    progress->running[item->strand]--;
+    progress->thread = g_thread_self();
+    progress->done++;
+    g_cond_broadcast(&progress->cond);
+    g_mutex_unlock(&progress->lock);
+}
+
+static void
+submit_items(_LSExecutor *executor, Progress *progress, Item items[STRANDS][PER_STRAND])
+{
+    int i, strand;
+
+    /* interleave the strands */
+    for (i = 0; i < PER_STRAND; i++)
+    {
+        for (strand = 0; strand < STRANDS; strand++)
+        {
+            Item *item = &items[strand][i];
+            item->progress = progress;
+            item->strand = strand;
+            item->i = i;
+            _LSExecutorSubmit(executor, &items[strand], run_item, item);
+        }
+    }
+}
+
+static Item items[STRANDS][PER_STRAND];
+
+/* Test cases *****************************************************************/
+
+static void
+test_LSExecutorSerial(void)
+{
+    Progress progress;
+    progress_init(&progress);
+
+    _LSExecutor *executor = _LSExecutorNewSerial(NULL);
+    g_assert(executor != NULL);
+
+    /* case: everything runs in order, one at a time, away from the caller */
+    submit_items(executor, &progress, items);
+    progress_wait(&progress, STRANDS * PER_STRAND);
+
+    g_assert(progress.in_order);
+    g_assert(!progress.overlapped);
+    g_assert(progress.thread != g_thread_self());
+
+    _LSExecutorUnref(executor);
+    progress_clear(&progress);
+}
+
+static void
+test_LSExecutorPoolStrands(void)
+{
+    Progress progress;
+    progress_init(&progress);
+
+    _LSExecutor *executor = _LSExecutorGetPool(NULL);
+    g_assert(executor != NULL);
+
+    /* case: the process shares the pool */
+    _LSExecutor *other = _LSExecutorGetPool(NULL);
+    g_assert(other == executor);
+    _LSExecutorUnref(other);
+
+    /* case: the items of every strand run in order, one at a time */
+    submit_items(executor, &progress, items);
+    progress_wait(&progress, STRANDS * PER_STRAND);
+
+    g_assert(progress.in_order);
+    g_assert(!progress.overlapped);
+    g_assert(progress.thread != g_thread_self());
+
+    _LSExecutorUnref(executor);
+    progress_clear(&progress);
+}
+
+typedef struct {
+    GMutex lock;
+    GCond cond;
+    bool first;
+    bool second;
+} Rendezvous;
+
+static void
+meet_first(gpointer data)
+{
+    Rendezvous *rendezvous = data;
+    gint64 deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+
+    g_mutex_lock(&rendezvous->lock);
+    rendezvous->first = true;
+    g_cond_broadcast(&rendezvous->cond);
+    while (!rendezvous->second)
+    {
+        if (!g_cond_wait_until(&rendezvous->cond, &rendezvous->lock, deadline))
+            break;
+    }
+    g_mutex_unlock(&rendezvous->lock);
+}
+
+static void
+meet_second(gpointer data)
+{
+    Rendezvous *rendezvous = data;
+
+    g_mutex_lock(&rendezvous->lock);
+    rendezvous->second = true;
+    g_cond_broadcast(&rendezvous->cond);
+    g_mutex_unlock(&rendezvous->lock);
+}
+
+static void
+test_LSExecutorPoolParallel(void)
+{
+    Rendezvous rendezvous = { .first = false, .second = false };
+    g_mutex_init(&rendezvous.lock);
+    g_cond_init(&rendezvous.cond);
+
+    _LSExecutor *executor = _LSExecutorGetPool(NULL);
+
+    /* case: a strand blocked doesn't hold the others back */
+    _LSExecutorSubmit(executor, &rendezvous.first, meet_first, &rendezvous);
+    _LSExecutorSubmit(executor, &rendezvous.second, meet_second, &rendezvous);
+
+    gint64 deadline = g_get_monotonic_time() + 10 * G_USEC_PER_SEC;
+    g_mutex_lock(&rendezvous.lock);
+    while (!(rendezvous.first && rendezvous.second))
+    {
+        g_assert(g_cond_wait_until(&rendezvous.cond, &rendezvous.lock, deadline));
+    }
+    g_mutex_unlock(&rendezvous.lock);
+
+    _LSExecutorUnref(executor);
+
+    /* let meet_first() return before the rendezvous goes away */
+    g_usleep(10000);
+    g_mutex_clear(&rendezvous.lock);
+    g_cond_clear(&rendezvous.cond);
+}
+
+static void
+sleep_item(gpointer data)
+{
+    g_usleep(1000);
+    g_atomic_int_inc((gint *) data);
+}
+
+static void
+test_LSExecutorUnrefWaits(void)
+{
+    gint ran = 0;
+    int i;
+
+    _LSExecutor *executor = _LSExecutorNewSerial(NULL);
+
+    for (i = 0; i < 20; i++)
+    {
+        _LSExecutorSubmit(executor, NULL, sleep_item, &ran);
+    }
+
+    /* case: the last reference waits for the work submitted */
+    _LSExecutorRef(executor);
+    _LSExecutorUnref(executor);
+    _LSExecutorUnref(executor);
+    g_assert_cmpint(g_atomic_int_get(&ran), ==, 20);
+}
+
+static void
+check_current(gpointer data)
+{
+    _LSExecutor **current = data;
+    *current = _LSExecutorGetCurrent();
+}
+
+static void
+test_LSExecutorGetCurrent(void)
+{
+    _LSExecutor *current = NULL;
+
+    /* case: the caller isn't run by an executor */
+    g_assert(_LSExecutorGetCurrent() == NULL);
+
+    /* case: the work knows the executor running it */
+    _LSExecutor *executor = _LSExecutorNewSerial(NULL);
+    _LSExecutorSubmit(executor, NULL, check_current, &current);
+    _LSExecutorUnref(executor);
+    g_assert(current == executor);
+
+    executor = _LSExecutorGetPool(NULL);
+    current = NULL;
+    _LSExecutorSubmit(executor, &current, check_current, &current);
+    while (g_atomic_pointer_get(&current) == NULL)
+        g_usleep(1000);
+    g_assert(current == executor);
+    _LSExecutorUnref(executor);
+}
+
+/* Test suite *****************************************************************/
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/luna-service2/LSExecutorSerial",
+                    test_LSExecutorSerial);
+    g_test_add_func("/luna-service2/LSExecutorPoolStrands",
+                    test_LSExecutorPoolStrands);
+    g_test_add_func("/luna-service2/LSExecutorPoolParallel",
+                    test_LSExecutorPoolParallel);
+    g_test_add_func("/luna-service2/LSExecutorUnrefWaits",
+                    test_LSExecutorUnrefWaits);
+    g_test_add_func("/luna-service2/LSExecutorGetCurrent",
+                    test_LSExecutorGetCurrent);
+
+    return g_test_run();
+}
@@ -98,6 +98,8 @@ test_timer_source_new()
     test_iterate_main_loop(100);
     g_assert(fired);
 
+    // the source points at this frame, don't let it fire into the next tests
+    g_source_destroy((GSource*)source);
     g_source_unref((GSource*)source);
     g_main_loop_unref(main_loop);
 }
@@ -116,6 +118,139 @@ test_timer_source_set_interval()
     g_source_unref((GSource*)source);
 }
 
+typedef struct
+{
+    gint64 added;
+    guint interval_ms;
+    gint64 fired;
+    int fire_count;
+    int repeat;
+    guint id;
+    bool remove_self;
+    int notified;
+} WheelTimer;
+
+static gboolean
+test_on_wheel_timeout(gpointer user_data)
+{
+    WheelTimer *timer = user_data;
+
+    timer->fired = g_get_monotonic_time();
+    timer->fire_count++;
+
+    if (timer->remove_self)
+    {
+        g_assert(_LSTimerWheelRemove(timer->id));
+        return TRUE;
+    }
+    return timer->fire_count < timer->repeat;
+}
+
+static void
+test_on_wheel_notify(gpointer user_data)
+{
+    ((WheelTimer *) user_data)->notified++;
+}
+
+static void
+wheel_timer_add(WheelTimer *timer, GMainContext *context, guint interval_ms)
+{
+    timer->added = g_get_monotonic_time();
+    timer->interval_ms = interval_ms;
+    timer->repeat = timer->repeat ? timer->repeat : 1;
+    timer->id = _LSTimerWheelAdd(context, interval_ms, test_on_wheel_timeout, timer,
+                                 test_on_wheel_notify);
+    g_assert_cmpuint(timer->id, !=, 0);
+}
+
+static void
+test_timer_wheel_fire()
+{
+    /* spread over the first two levels of the wheel */
+    static const guint intervals[] = { 1, 5, 63, 64, 65, 100, 127, 128, 200, 333 };
+    WheelTimer timers[G_N_ELEMENTS(intervals)] = { { 0 } };
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(intervals); i++)
+    {
+        wheel_timer_add(&timers[i], NULL, intervals[i]);
+    }
+
+    test_iterate_main_loop(450);
+
+    for (i = 0; i < G_N_ELEMENTS(intervals); i++)
+    {
+        /* never early, and once */
+        g_assert_cmpint(timers[i].fire_count, ==, 1);
+        g_assert_cmpint(timers[i].fired - timers[i].added, >=, intervals[i] * 1000);
+        g_assert_cmpint(timers[i].notified, ==, 1);
+        g_assert(!_LSTimerWheelRemove(timers[i].id));
+    }
+}
+
+static void
+test_timer_wheel_repeat()
+{
+    WheelTimer timer = { .repeat = 3 };
+
+    wheel_timer_add(&timer, NULL, 100);
+
+    test_iterate_main_loop(150);
+    g_assert_cmpint(timer.fire_count, >=, 1);
+    g_assert_cmpint(timer.notified, ==, 0);
+
+    test_iterate_main_loop(250);
+    g_assert_cmpint(timer.fire_count, ==, 3);
+    g_assert_cmpint(timer.notified, ==, 1);
+}
+
+static void
+test_timer_wheel_remove()
+{
+    WheelTimer removed = { 0 };
+    WheelTimer kept = { 0 };
+    WheelTimer self = { .remove_self = true };
+
+    wheel_timer_add(&removed, NULL, 20);
+    wheel_timer_add(&kept, NULL, 20);
+    wheel_timer_add(&self, NULL, 20);
+
+    /* case: removed before it's due, notified right away */
+    g_assert(_LSTimerWheelRemove(removed.id));
+    g_assert_cmpint(removed.notified, ==, 1);
+    g_assert(!_LSTimerWheelRemove(removed.id));
+
+    test_iterate_main_loop(100);
+
+    g_assert_cmpint(removed.fire_count, ==, 0);
+    g_assert_cmpint(kept.fire_count, ==, 1);
+
+    /* case: removed from its own callback, no second round */
+    g_assert_cmpint(self.fire_count, ==, 1);
+    g_assert_cmpint(self.notified, ==, 1);
+}
+
+static void
+test_timer_wheel_context()
+{
+    GMainContext *context = g_main_context_new();
+    WheelTimer fired = { 0 };
+    WheelTimer pending = { 0 };
+
+    wheel_timer_add(&fired, context, 10);
+    wheel_timer_add(&pending, context, 60000);
+
+    g_usleep(20000);
+    while (g_main_context_iteration(context, FALSE));
+    g_assert_cmpint(fired.fire_count, ==, 1);
+
+    /* case: timeouts pending on a context that goes away are dropped */
+    g_main_context_unref(context);
+    g_assert_cmpint(pending.fire_count, ==, 0);
+    g_assert_cmpint(pending.notified, ==, 1);
+    g_assert(!_LSTimerWheelRemove(pending.id));
+}
+
 /* Test suite *****************************************************************/
 
 int
@@ -128,6 +263,10 @@ main(int argc, char *argv[])
 
     g_test_add_func("/luna-service2/g_timer_source_new", test_timer_source_new);
     g_test_add_func("/luna-service2/g_timer_source_set_interval", test_timer_source_set_interval);
+    g_test_add_func("/luna-service2/LSTimerWheelFire", test_timer_wheel_fire);
+    g_test_add_func("/luna-service2/LSTimerWheelRepeat", test_timer_wheel_repeat);
+    g_test_add_func("/luna-service2/LSTimerWheelRemove", test_timer_wheel_remove);
+    g_test_add_func("/luna-service2/LSTimerWheelContext", test_timer_wheel_context);
 
     return g_test_run();
 }
@@ -15,6 +15,7 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include <stdlib.h>
+#include <sys/uio.h>
 #include <glib.h>
 #include "transport.h"
 #include "transport_priv.h" /* LSTransport */
@@ -24,6 +25,7 @@
 
 /* Not in transport.h */
 gboolean _LSTransportSendClient(GIOChannel *source, GIOCondition condition, gpointer data);
+void _LSTransportHandleQueryNameFailure(_LSTransportMessage *message, long err_code, const char *service_name, bool is_dynamic);
 
 int calls_to_disconnect;
 int calls_to_shmdeinit;
@@ -48,6 +50,8 @@ gboolean has_send_watch = false;
 gboolean has_recv_watch = false;
 gboolean sendfd_success = true;
 gboolean sendfd_need_retry = false;
+int calls_to_writev;
+ssize_t writev_limit = G_MAXSSIZE;
 _LSTransportChannel *listen_channel;
 _LSTransportShm *my_shm;
 struct LSTransport *this_transport;
@@ -68,6 +72,8 @@ clear_counters()
     calls_to_messageref = 0;
     calls_to_messagesettype = 0;
     calls_to_messageiterhasnext = 0;
+    calls_to_writev = 0;
+    writev_limit = G_MAXSSIZE;
     expected_calls_to_messagesettype = 0;
     flush_and_shutdown = false;
     use_shared_memory = false;
@@ -247,9 +253,7 @@ _LSTransportMessageNewRef(unsigned long payload_size)
 {
     calls_to_messagenewref++;
 
-    _LSTransportMessage *message = g_slice_new0(_LSTransportMessage);
-    message->raw = g_malloc(sizeof(_LSTransportMessageRaw) + payload_size);
-    message->raw->header.len = payload_size;
+    _LSTransportMessage *message = _LSTransportMessageNew(payload_size);
     message->ref = 1;
 
     return message;
@@ -427,6 +431,21 @@ send(int sockfd, const void *buf, size_t len, int flags)
     return len;
 }
 
+ssize_t
+writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    calls_to_writev++;
+    g_assert_cmpint(iovcnt, <=, 2 * LS_TRANSPORT_OUTGOING_MAX_IOV);
+
+    ssize_t len = 0;
+    int i;
+    for (i = 0; i < iovcnt; i++)
+    {
+        len += iov[i].iov_len;
+    }
+    return MIN(len, writev_limit);
+}
+
 ssize_t
 recv(int sockfd, void *buf, size_t len, int flags)
 {
@@ -634,6 +653,7 @@ test_LSTransportSend_execute(const char *service_name, const char *category, con
     g_hash_table_unref(transport->clients);
     g_hash_table_unref(transport->pending);
     g_free(transport->global_token);
+    _LSTransportOutgoingCollect(transport->hub->outgoing);
     while (!g_queue_is_empty(transport->hub->outgoing->queue))
     {
         _LSTransportMessage *message = g_queue_pop_head(transport->hub->outgoing->queue);
@@ -683,6 +703,9 @@ test_LSTransportPushRole_execute(const char *path, gboolean expeced_success)
     _LSTransport *transport = g_new0(_LSTransport, 1);
     transport->hub = g_slice_new0(_LSTransportClient);
     transport->hub->transport = transport;
+    /* the reply is read through the client's staging buffer */
+    transport->hub->incoming = g_slice_new0(_LSTransportIncoming);
+    transport->hub->incoming->complete_messages = g_queue_new();
     transport->hub->outgoing = g_slice_new0(_LSTransportOutgoing);
     transport->hub->outgoing->queue = g_queue_new();
     transport->global_token = g_new0(_LSTransportGlobalToken, 1);
@@ -738,6 +761,7 @@ test_LSTransportSendMessageMonitorRequest()
 
     /* Cleanup. */
     g_free(transport->global_token);
+    _LSTransportOutgoingCollect(transport->hub->outgoing);
     while (!g_queue_is_empty(transport->hub->outgoing->queue))
     {
         _LSTransportMessage *message = g_queue_pop_head(transport->hub->outgoing->queue);
@@ -823,6 +847,7 @@ test_LSTransportCancelMethodCall_execute(char *service_name, int number_of_clien
     g_assert_cmpint(g_hash_table_size(transport->clients), ==, number_of_clients);
     g_hash_table_destroy(transport->clients);
     g_hash_table_destroy(transport->pending);
+    _LSTransportOutgoingCollect(transport->hub->outgoing);
     while (!g_queue_is_empty(transport->hub->outgoing->queue))
     {
         _LSTransportMessage *message = g_queue_pop_head(transport->hub->outgoing->queue);
@@ -889,6 +914,7 @@ test_LSTransportSendQueryServiceStatus_execute(char *service_name)
     g_assert_cmpint(calls_to_messagesettype, ==, 1);
 
     /* Cleanup. */
+    _LSTransportOutgoingCollect(transport->hub->outgoing);
     while (!g_queue_is_empty(transport->hub->outgoing->queue))
     {
         _LSTransportMessage *message = g_queue_pop_head(transport->hub->outgoing->queue);
@@ -912,6 +938,92 @@ test_LSTransportSendQueryServiceStatus()
     test_LSTransportSendQueryServiceStatus_execute(reallylong);
 }
 
+void
+test_LSTransportPrewarmPeers()
+{
+    clear_counters();
+
+    expected_calls_to_messagesettype = 5;
+    _LSTransportMessageType typelist[5] = {_LSTransportMessageTypeSignalRegister,
+                                           _LSTransportMessageTypeQueryName,
+                                           _LSTransportMessageTypeSignalRegister,
+                                           _LSTransportMessageTypeSignalRegister,
+                                           _LSTransportMessageTypeQueryNameBatch};
+    expected_message_types = typelist;
+    const char *peer[] = {"com.webos.peer", NULL};
+    const char *peers[] = {"com.webos.peer", "com.webos.peer2", "com.webos.peer3", NULL};
+
+    /*First let's create a minimal transport struct for the test.*/
+    _LSTransport *transport = g_new0(_LSTransport, 1);
+    transport->clients = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)_LSTransportClientUnref);
+    transport->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    transport->global_token = g_new0(_LSTransportGlobalToken, 1);
+    transport->global_token->value = LSMESSAGE_TOKEN_INVALID;
+    transport->hub = g_slice_new0(_LSTransportClient);
+    transport->hub->transport = transport;
+    transport->hub->outgoing = g_slice_new0(_LSTransportOutgoing);
+    transport->hub->outgoing->queue = g_queue_new();
+
+    LSError error;
+    LSErrorInit(&error);
+
+    /* Test: the peer is subscribed to and queried with an empty pending queue. */
+    g_assert(_LSTransportPrewarmPeers(transport, peer, false, &error));
+    g_assert_cmpint(calls_to_messagesettype, ==, 2);
+    _LSTransportOutgoingCollect(transport->hub->outgoing);
+    g_assert_cmpint(g_queue_get_length(transport->hub->outgoing->queue), ==, 2);
+
+    _LSTransportOutgoing *pending = g_hash_table_lookup(transport->pending, "com.webos.peer");
+    g_assert(pending != NULL);
+    g_assert(g_queue_is_empty(pending->queue));
+
+    /* Test: declaring the peer again while the query is in flight sends nothing. */
+    g_assert(_LSTransportPrewarmPeers(transport, peer, false, &error));
+    g_assert_cmpint(calls_to_messagesettype, ==, 2);
+    _LSTransportOutgoingCollect(transport->hub->outgoing);
+    g_assert_cmpint(g_queue_get_length(transport->hub->outgoing->queue), ==, 2);
+
+    /* Test: a failed pre-warm just closes the pending queue. */
+    _LSTransportMessage *reply = _LSTransportMessageNewRef(0);
+    reply->client = transport->hub;
+    _LSTransportHandleQueryNameFailure(reply, LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_EXIST, "com.webos.peer", false);
+    g_assert(g_hash_table_lookup(transport->pending, "com.webos.peer") == NULL);
+    reply->client = NULL;
+    _LSTransportMessageUnref(reply);
+
+    /* Test: a hub that answers batches gets the new peers in a single query,
+     * the peer already declared is queried along with them. */
+    transport->query_name_batch = true;
+    g_assert(_LSTransportPrewarmPeers(transport, peers, false, &error));
+    g_assert_cmpint(calls_to_messagesettype, ==, 5);
+    _LSTransportOutgoingCollect(transport->hub->outgoing);
+    g_assert_cmpint(g_queue_get_length(transport->hub->outgoing->queue), ==, 5);
+    g_assert_cmpint(g_hash_table_size(transport->pending), ==, 3);
+
+    /* Cleanup. */
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, transport->pending);
+    while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+        _LSTransportOutgoingFree(value);
+    }
+    g_hash_table_unref(transport->clients);
+    g_hash_table_unref(transport->pending);
+    g_hash_table_unref(transport->prewarm_peers);
+    g_free(transport->global_token);
+    _LSTransportOutgoingCollect(transport->hub->outgoing);
+    while (!g_queue_is_empty(transport->hub->outgoing->queue))
+    {
+        _LSTransportMessage *message = g_queue_pop_head(transport->hub->outgoing->queue);
+        _LSTransportMessageUnref(message);
+    }
+    g_queue_free(transport->hub->outgoing->queue);
+    g_slice_free(_LSTransportOutgoing, transport->hub->outgoing);
+    g_slice_free(_LSTransportClient, transport->hub);
+    g_free(transport);
+}
+
 void
 test_LSTransportSendClient_execute(int number_of_messages, int include_null, int include_wrong_type,
                                         int remaining_bytes)
@@ -1007,6 +1119,183 @@ test_LSTransportSendClient()
     sendfd_success = true;
 }
 
+void
+test_LSTransportSendClientBatch()
+{
+    clear_counters();
+
+    /* Build minimal transport client. */
+    _LSTransportClient *client = g_slice_new0(_LSTransportClient);
+    client->ref = 1;
+    client->outgoing = g_slice_new0(_LSTransportOutgoing);
+    client->outgoing->queue = g_queue_new();
+
+    const unsigned long message_size = sizeof(_LSTransportHeader) + 20;
+    int i;
+    for (i = 0; i < 100; i++)
+    {
+        _LSTransportMessage *message = _LSTransportMessageNewRef(20);
+        message->raw->header.type = _LSTransportMessageTypeReply;
+        message->tx_bytes_remaining = message_size;
+        g_queue_push_tail(client->outgoing->queue, message);
+    }
+
+    /* The socket takes one and a half messages */
+    writev_limit = message_size + message_size / 2;
+    g_assert(_LSTransportSendClient(NULL, 0, client));
+    g_assert_cmpint(calls_to_writev, ==, 1);
+    g_assert_cmpint(calls_to_messageunref, ==, 1);
+    g_assert_cmpint(g_queue_get_length(client->outgoing->queue), ==, 99);
+
+    _LSTransportMessage *partial = g_queue_peek_head(client->outgoing->queue);
+    g_assert_cmpint(partial->tx_bytes_remaining, ==, message_size - message_size / 2);
+
+    /* The rest is drained in batches of LS_TRANSPORT_OUTGOING_MAX_IOV */
+    writev_limit = G_MAXSSIZE;
+    g_assert(!_LSTransportSendClient(NULL, 0, client));
+    g_assert_cmpint(calls_to_writev, ==, 1 + (99 + LS_TRANSPORT_OUTGOING_MAX_IOV - 1) / LS_TRANSPORT_OUTGOING_MAX_IOV);
+    g_assert_cmpint(calls_to_messageunref, ==, 100);
+    g_assert(g_queue_is_empty(client->outgoing->queue));
+
+    g_queue_free(client->outgoing->queue);
+    g_slice_free(_LSTransportOutgoing, client->outgoing);
+    g_slice_free(_LSTransportClient, client);
+}
+
+void
+test_LSTransportSendClientMemfd()
+{
+    clear_counters();
+
+    unsigned long saved_threshold = _ls_memfd_threshold;
+    _ls_memfd_threshold = 64;
+
+    _LSTransportClient *client = g_slice_new0(_LSTransportClient);
+    client->ref = 1;
+    client->outgoing = g_slice_new0(_LSTransportOutgoing);
+    client->outgoing->queue = g_queue_new();
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(128);
+    message->raw->header.type = _LSTransportMessageTypeReply;
+    message->tx_bytes_remaining = sizeof(_LSTransportHeader) + 128;
+    g_queue_push_tail(client->outgoing->queue, message);
+
+    /* Test: a peer that didn't advertise memfd support gets the body inline. */
+    writev_limit = 1;
+    g_assert(_LSTransportSendClient(NULL, 0, client));
+    g_assert(g_queue_peek_head(client->outgoing->queue) == message);
+    g_assert(!_LSTransportMessageIsFdType(message));
+    g_assert_cmpint(message->tx_bytes_remaining, ==, sizeof(_LSTransportHeader) + 128 - 1);
+
+    /* Test: a peer that did gets the body in a memfd. */
+    message = _LSTransportMessageNewRef(128);
+    message->raw->header.type = _LSTransportMessageTypeReply;
+    message->tx_bytes_remaining = sizeof(_LSTransportHeader) + 128;
+
+    _LSTransportClient *memfd_client = g_slice_new0(_LSTransportClient);
+    memfd_client->ref = 1;
+    memfd_client->features = _LSTransportFeatureMemfd;
+    memfd_client->outgoing = g_slice_new0(_LSTransportOutgoing);
+    memfd_client->outgoing->queue = g_queue_new();
+    g_queue_push_tail(memfd_client->outgoing->queue, message);
+    _LSTransportOutgoingAccount(memfd_client->outgoing, message);
+
+    g_assert(_LSTransportSendClient(NULL, 0, memfd_client));
+    _LSTransportMessage *stub = g_queue_peek_head(memfd_client->outgoing->queue);
+    g_assert(stub != message);
+    g_assert(_LSTransportMessageIsFdType(stub));
+    g_assert(_LSTransportMessageGetHeader(stub)->body_in_fd);
+    g_assert_cmpint(_LSTransportMessageGetHeader(stub)->len, ==, 0);
+
+    /* Test: the stub leaves the queue with the depth of the message. */
+    g_assert_cmpint(memfd_client->outgoing->queued_messages, ==, 1);
+    g_assert_cmpint(memfd_client->outgoing->queued_bytes, ==, sizeof(_LSTransportHeader) + 128);
+
+    sendfd_success = true;
+    writev_limit = G_MAXSSIZE;
+    g_assert(!_LSTransportSendClient(NULL, 0, memfd_client));
+    g_assert(g_queue_is_empty(memfd_client->outgoing->queue));
+    g_assert_cmpint(memfd_client->outgoing->queued_messages, ==, 0);
+    g_assert_cmpint(memfd_client->outgoing->queued_bytes, ==, 0);
+
+    _LSTransportMessageUnref(g_queue_pop_head(client->outgoing->queue));
+    _ls_memfd_threshold = saved_threshold;
+    writev_limit = G_MAXSSIZE;
+
+    g_queue_free(client->outgoing->queue);
+    g_slice_free(_LSTransportOutgoing, client->outgoing);
+    g_slice_free(_LSTransportClient, client);
+    g_queue_free(memfd_client->outgoing->queue);
+    g_slice_free(_LSTransportOutgoing, memfd_client->outgoing);
+    g_slice_free(_LSTransportClient, memfd_client);
+}
+
+void
+test_LSTransportGetTrustLevelCode()
+{
+    _LSTransport *transport = g_new0(_LSTransport, 1);
+
+    /* Test: nothing is known before the hub sends its maps. */
+    g_assert_cmpint(LSTransportGetTrustLevelCode(transport, NULL), ==, -1);
+    g_assert_cmpint(LSTransportGetTrustLevelCode(transport, "oem"), ==, -1);
+
+    transport->provided_trust_level_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_hash_table_insert(transport->provided_trust_level_map, g_strdup("oem"), GINT_TO_POINTER(0));
+    g_hash_table_insert(transport->provided_trust_level_map, g_strdup(DEFAULT_TRUST_LEVEL), GINT_TO_POINTER(1));
+
+    g_assert_cmpint(LSTransportGetTrustLevelCode(transport, "oem"), ==, 0);
+    g_assert_cmpint(LSTransportGetTrustLevelCode(transport, "part"), ==, -1);
+
+    /* Test: a caller without trust level has the default one. */
+    g_assert_cmpint(LSTransportGetTrustLevelCode(transport, NULL), ==, 1);
+
+    g_hash_table_destroy(transport->provided_trust_level_map);
+    g_free(transport);
+}
+
+void
+test_LSTransportGetTrustFromGroupMask()
+{
+    _LSTransport *transport = g_new0(_LSTransport, 1);
+
+    /* groups: camera -> bit 0, media -> bit 1, all -> bit 2 */
+    transport->group_code_map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_hash_table_insert(transport->group_code_map, g_strdup("camera"), GINT_TO_POINTER(0));
+    g_hash_table_insert(transport->group_code_map, g_strdup("media"), GINT_TO_POINTER(1));
+    g_hash_table_insert(transport->group_code_map, g_strdup("all"), GINT_TO_POINTER(2));
+
+    /* trust levels: oem -> bit 0, dev -> bit 1; camera is oem, media is dev */
+    transport->trust_security_mask_size = 1;
+    LSTransportBitmaskWord *oem = g_new0(LSTransportBitmaskWord, 1);
+    BitMaskSetBit(oem, 0);
+    LSTransportBitmaskWord *dev = g_new0(LSTransportBitmaskWord, 1);
+    BitMaskSetBit(dev, 1);
+    transport->provided_trust_level_to_group_map =
+        g_slist_prepend(transport->provided_trust_level_to_group_map, LSTransportTrustLevelBitmaskNew("camera", oem));
+    transport->provided_trust_level_to_group_map =
+        g_slist_prepend(transport->provided_trust_level_to_group_map, LSTransportTrustLevelBitmaskNew("media", dev));
+
+    LSTransportBitmaskWord groups = 0;
+    BitMaskSetBit(&groups, 2);
+
+    /* Test: groups without trust level provide none. */
+    g_assert(LSTransportGetTrustFromGroupMask(transport, &groups) == NULL);
+
+    /* Test: a method in groups with different trust levels provides all of
+     * them, a caller passes with any one. */
+    BitMaskSetBit(&groups, 0);
+    BitMaskSetBit(&groups, 1);
+    LSTransportBitmaskWord *trusts = LSTransportGetTrustFromGroupMask(transport, &groups);
+    g_assert(trusts);
+    g_assert(BitMaskTestBit(trusts, 0));
+    g_assert(BitMaskTestBit(trusts, 1));
+    g_free(trusts);
+
+    g_slist_free_full(transport->provided_trust_level_to_group_map, (GDestroyNotify) LSTransportTrustLevelGroupBitmaskFree);
+    g_hash_table_destroy(transport->group_code_map);
+    g_free(transport);
+}
+
 /* Test suite **************************************************************/
 
 int
@@ -1020,7 +1309,12 @@ main(int argc, char *argv[])
     g_test_add_func("/luna-service2/LSTransportSendMessageMonitorRequest", test_LSTransportSendMessageMonitorRequest);
     g_test_add_func("/luna-service2/LSTransportCancelMethodCall", test_LSTransportCancelMethodCall);
     g_test_add_func("/luna-service2/LSTransportSendQueryServiceStatus", test_LSTransportSendQueryServiceStatus);
+    g_test_add_func("/luna-service2/LSTransportPrewarmPeers", test_LSTransportPrewarmPeers);
     g_test_add_func("/luna-service2/LSTransportSendClient", test_LSTransportSendClient);
+    g_test_add_func("/luna-service2/LSTransportSendClientBatch", test_LSTransportSendClientBatch);
+    g_test_add_func("/luna-service2/LSTransportSendClientMemfd", test_LSTransportSendClientMemfd);
+    g_test_add_func("/luna-service2/LSTransportGetTrustLevelCode", test_LSTransportGetTrustLevelCode);
+    g_test_add_func("/luna-service2/LSTransportGetTrustFromGroupMask", test_LSTransportGetTrustFromGroupMask);
 
     return g_test_run();
 }
@@ -1,4 +1,4 @@
-// Copyright (c) 2008-2018 LG Electronics, Inc.
+// Copyright (c) 2008-2021 LG Electronics, Inc.
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -15,10 +15,69 @@
 // SPDX-License-Identifier: Apache-2.0
 
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include <glib.h>
 #include "transport_message.h"
 #include "transport_incoming.h"
 
+/* Mocks **********************************************************************/
+
+static _LSTransportClient *mvar_client = (_LSTransportClient*)0x4242;
+
+void
+_LSTransportClientRef(_LSTransportClient *client)
+{
+    g_assert(client == mvar_client);
+}
+
+void
+_LSTransportClientUnref(_LSTransportClient *client)
+{
+    g_assert(client == mvar_client);
+}
+
+/* Helpers ********************************************************************/
+
+#define BURST_MESSAGES  10000
+
+static void
+write_all(int fd, const void *buf, size_t len)
+{
+    while (len)
+    {
+        ssize_t ret = write(fd, buf, len);
+        g_assert_cmpint(ret, >, 0);
+        buf = (const char*)buf + ret;
+        len -= ret;
+    }
+}
+
+static void
+write_message(int fd, _LSTransportMessageType type, LSMessageToken token, const char *body, unsigned long body_len)
+{
+    _LSTransportMessage *message = _LSTransportMessageNewRef(body_len);
+    _LSTransportMessageSetType(message, type);
+    _LSTransportMessageSetToken(message, token);
+    if (body_len) _LSTransportMessageSetBody(message, body, body_len);
+
+    write_all(fd, message->raw, sizeof(_LSTransportHeader) + body_len);
+
+    _LSTransportMessageUnref(message);
+}
+
+/* Read everything currently in the socket */
+static _LSTransportIncomingStatus
+receive_all(_LSTransportIncoming *incoming, int fd)
+{
+    _LSTransportIncomingStatus status = _LSTransportIncomingReceive(incoming, fd, mvar_client);
+    g_assert_cmpint(errno, ==, EAGAIN);
+    return status;
+}
+
 /* Test cases *****************************************************************/
 
 static void
@@ -81,6 +140,270 @@ test_LSTransportIncoming()
     test_LSTransportIncoming_execute(500);
 }
 
+static void
+test_LSTransportIncomingReceiveBurst()
+{
+    int sv[2];
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), ==, 0);
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+
+    _LSTransportIncoming *incoming = _LSTransportIncomingNew();
+
+    /* A burst of small replies, written faster than they are read. Don't
+     * overflow the socket buffer, so drain it every hundred messages. */
+    const char body[] = "{\"returnValue\":true}";
+    LSMessageToken token;
+    for (token = 1; token <= BURST_MESSAGES; token++)
+    {
+        write_message(sv[0], _LSTransportMessageTypeReply, token, body, sizeof(body));
+
+        if (token % 100 == 0)
+        {
+            g_assert_cmpint(receive_all(incoming, sv[1]), ==, _LSTransportIncomingStatusAgain);
+        }
+    }
+
+    g_assert_cmpint(g_queue_get_length(incoming->complete_messages), ==, BURST_MESSAGES);
+    g_assert_cmpint(incoming->rx_messages, ==, BURST_MESSAGES);
+
+    /* The legacy path needed two recv() calls per message */
+    g_test_message("%lu receive syscalls for %d messages", incoming->rx_syscalls, BURST_MESSAGES);
+    g_assert_cmpuint(incoming->rx_syscalls * 10, <, BURST_MESSAGES);
+
+    for (token = 1; token <= BURST_MESSAGES; token++)
+    {
+        _LSTransportMessage *message = g_queue_pop_head(incoming->complete_messages);
+        g_assert(message);
+        g_assert_cmpint(_LSTransportMessageGetType(message), ==, _LSTransportMessageTypeReply);
+        g_assert_cmpint(_LSTransportMessageGetToken(message), ==, token);
+        g_assert_cmpint(_LSTransportMessageGetBodySize(message), ==, sizeof(body));
+        g_assert_cmpstr(_LSTransportMessageGetBody(message), ==, body);
+        _LSTransportMessageUnref(message);
+    }
+
+    g_assert(!incoming->rx_partial);
+
+    close(sv[0]);
+    g_assert_cmpint(_LSTransportIncomingReceive(incoming, sv[1], mvar_client), ==, _LSTransportIncomingStatusShutdown);
+
+    _LSTransportIncomingFree(incoming);
+    close(sv[1]);
+}
+
+static void
+test_LSTransportIncomingReceivePartial()
+{
+    int sv[2];
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), ==, 0);
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+
+    _LSTransportIncoming *incoming = _LSTransportIncomingNew();
+
+    /* Header split across reads */
+    _LSTransportMessage *message = _LSTransportMessageNewRef(3);
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeSignal);
+    _LSTransportMessageSetToken(message, 7);
+    _LSTransportMessageSetBody(message, "ab", 3);
+
+    write_all(sv[0], message->raw, 5);
+    g_assert_cmpint(receive_all(incoming, sv[1]), ==, _LSTransportIncomingStatusAgain);
+    g_assert(incoming->rx_partial);
+    g_assert(incoming->rx_buf);
+    g_assert(g_queue_is_empty(incoming->complete_messages));
+
+    write_all(sv[0], (char*)message->raw + 5, sizeof(_LSTransportHeader) + 3 - 5);
+    g_assert_cmpint(receive_all(incoming, sv[1]), ==, _LSTransportIncomingStatusAgain);
+    g_assert(!incoming->rx_partial);
+    g_assert_cmpint(g_queue_get_length(incoming->complete_messages), ==, 1);
+    /* nothing left to parse, the staging buffer is released */
+    g_assert(!incoming->rx_buf);
+    _LSTransportMessageUnref(message);
+
+    message = g_queue_pop_head(incoming->complete_messages);
+    g_assert_cmpint(_LSTransportMessageGetToken(message), ==, 7);
+    g_assert_cmpstr(_LSTransportMessageGetBody(message), ==, "ab");
+    _LSTransportMessageUnref(message);
+
+    /* Body larger than the staging buffer is read directly into the message */
+    unsigned long large_len = LS_TRANSPORT_INCOMING_BUF_SIZE * 4;
+    char *large = g_malloc(large_len);
+    memset(large, 'x', large_len);
+
+    write_message(sv[0], _LSTransportMessageTypeReply, 8, large, 100);
+    write_message(sv[0], _LSTransportMessageTypeReply, 9, large, large_len);
+    write_message(sv[0], _LSTransportMessageTypeReply, 10, large, 100);
+    g_assert_cmpint(receive_all(incoming, sv[1]), ==, _LSTransportIncomingStatusAgain);
+    g_assert_cmpint(g_queue_get_length(incoming->complete_messages), ==, 3);
+
+    LSMessageToken token;
+    for (token = 8; token <= 10; token++)
+    {
+        message = g_queue_pop_head(incoming->complete_messages);
+        g_assert_cmpint(_LSTransportMessageGetToken(message), ==, token);
+        g_assert_cmpint(_LSTransportMessageGetBodySize(message), ==, token == 9 ? large_len : 100);
+        g_assert(memcmp(_LSTransportMessageGetBody(message), large, _LSTransportMessageGetBodySize(message)) == 0);
+        _LSTransportMessageUnref(message);
+    }
+
+    g_free(large);
+    _LSTransportIncomingFree(incoming);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static void
+send_fd(int fd, int fd_to_send)
+{
+    char cmsg_buf[CMSG_SPACE(sizeof(int))] = {0};
+    char marker = 0;
+    struct iovec iov = { &marker, 1 };
+    struct msghdr msg = { 0 };
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd_to_send, sizeof(int));
+
+    g_assert_cmpint(sendmsg(fd, &msg, 0), ==, 1);
+}
+
+static void
+test_LSTransportIncomingReceiveFd()
+{
+    int sv[2];
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), ==, 0);
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+
+    int pipe_fds[2];
+    g_assert_cmpint(pipe(pipe_fds), ==, 0);
+
+    _LSTransportIncoming *incoming = _LSTransportIncomingNew();
+
+    /* fd message, marker with an error code, regular message */
+    write_message(sv[0], _LSTransportMessageTypeReplyWithFd, 1, "{}", 3);
+    send_fd(sv[0], pipe_fds[1]);
+    write_message(sv[0], _LSTransportMessageTypeReplyWithFd, 2, "{}", 3);
+    char error_marker = 1;
+    write_all(sv[0], &error_marker, 1);
+    write_message(sv[0], _LSTransportMessageTypeReply, 3, "{}", 3);
+
+    g_assert_cmpint(receive_all(incoming, sv[1]), ==, _LSTransportIncomingStatusAgain);
+    g_assert_cmpint(g_queue_get_length(incoming->complete_messages), ==, 3);
+
+    _LSTransportMessage *message = g_queue_pop_head(incoming->complete_messages);
+    int recv_fd = _LSTransportMessageGetFd(message);
+    g_assert_cmpint(recv_fd, >=, 0);
+    g_assert_cmpint(write(recv_fd, "z", 1), ==, 1);
+    char c = 0;
+    g_assert_cmpint(read(pipe_fds[0], &c, 1), ==, 1);
+    g_assert_cmpint(c, ==, 'z');
+    _LSTransportMessageUnref(message);
+
+    message = g_queue_pop_head(incoming->complete_messages);
+    g_assert_cmpint(_LSTransportMessageGetToken(message), ==, 2);
+    g_assert_cmpint(_LSTransportMessageGetFd(message), ==, -1);
+    _LSTransportMessageUnref(message);
+
+    message = g_queue_pop_head(incoming->complete_messages);
+    g_assert_cmpint(_LSTransportMessageGetToken(message), ==, 3);
+    _LSTransportMessageUnref(message);
+
+    _LSTransportIncomingFree(incoming);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+static void
+test_LSTransportIncomingReceiveMemfd()
+{
+    int sv[2];
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), ==, 0);
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+
+    unsigned long saved_threshold = _ls_memfd_threshold;
+    _ls_memfd_threshold = 4096;
+
+    _LSTransportIncoming *incoming = _LSTransportIncomingNew();
+
+    /* Large reply goes in a memfd, small one over the socket */
+    unsigned long large_len = 3 * 4096 + 100;
+    char *large = g_malloc(large_len);
+    memset(large, 'x', large_len);
+    large[large_len - 1] = '\0';
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(large_len);
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeReply);
+    _LSTransportMessageSetToken(message, 1);
+    _LSTransportMessageSetBody(message, large, large_len);
+
+    _LSTransportMessage *memfd_message = _LSTransportMessageNewMemfdRef(message);
+    g_assert(memfd_message != NULL);
+    g_assert(_LSTransportMessageIsFdType(memfd_message));
+    g_assert_cmpint(_LSTransportMessageGetToken(memfd_message), ==, 1);
+    g_assert_cmpint(_LSTransportMessageGetBodySize(memfd_message), ==, 0);
+
+    /* the sender can't change the body anymore */
+    int memfd = _LSTransportMessageGetFd(memfd_message);
+    g_assert_cmpint(write(memfd, "y", 1), ==, -1);
+    g_assert_cmpint(ftruncate(memfd, 0), ==, -1);
+
+    write_all(sv[0], memfd_message->raw, sizeof(_LSTransportHeader));
+    send_fd(sv[0], memfd);
+    write_message(sv[0], _LSTransportMessageTypeReply, 2, "{}", 3);
+
+    g_assert(_LSTransportMessageNewMemfdRef(_LSTransportMessageEmpty()) == NULL);
+
+    /* An fd that isn't a sealed memfd is refused */
+    int pipe_fds[2];
+    g_assert_cmpint(pipe(pipe_fds), ==, 0);
+    write_all(sv[0], memfd_message->raw, sizeof(_LSTransportHeader));
+    send_fd(sv[0], pipe_fds[0]);
+    write_message(sv[0], _LSTransportMessageTypeReply, 3, "{}", 3);
+
+    g_assert_cmpint(receive_all(incoming, sv[1]), ==, _LSTransportIncomingStatusAgain);
+    g_assert_cmpint(g_queue_get_length(incoming->complete_messages), ==, 3);
+
+    _LSTransportMessage *received = g_queue_pop_head(incoming->complete_messages);
+    g_assert_cmpint(_LSTransportMessageGetToken(received), ==, 1);
+    g_assert_cmpint(_LSTransportMessageGetType(received), ==, _LSTransportMessageTypeReply);
+    g_assert_cmpint(_LSTransportMessageGetBodySize(received), ==, large_len);
+    g_assert_cmpint(_LSTransportMessageGetFd(received), ==, -1);
+    g_assert(!_LSTransportMessageIsFdType(received));
+    g_assert(memcmp(_LSTransportMessageGetBody(received), large, large_len) == 0);
+    /* the body is mapped page aligned, the header stays writable */
+    g_assert_cmpint((uintptr_t) _LSTransportMessageGetBody(received) % sysconf(_SC_PAGESIZE), ==, 0);
+    _LSTransportMessageSetToken(received, 42);
+    _LSTransportMessageUnref(received);
+
+    received = g_queue_pop_head(incoming->complete_messages);
+    g_assert_cmpint(_LSTransportMessageGetToken(received), ==, 2);
+    _LSTransportMessageUnref(received);
+
+    received = g_queue_pop_head(incoming->complete_messages);
+    g_assert_cmpint(_LSTransportMessageGetToken(received), ==, 3);
+    _LSTransportMessageUnref(received);
+
+    _LSTransportMessageUnref(memfd_message);
+    _LSTransportMessageUnref(message);
+    g_free(large);
+
+    _ls_memfd_threshold = saved_threshold;
+
+    _LSTransportIncomingFree(incoming);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    close(sv[0]);
+    close(sv[1]);
+}
+
 /* Test suite *****************************************************************/
 
 int
@@ -90,6 +413,14 @@ main(int argc, char *argv[])
 
     g_test_add_func("/luna-service2/LSTransportIncoming",
                      test_LSTransportIncoming);
+    g_test_add_func("/luna-service2/LSTransportIncomingReceiveBurst",
+                     test_LSTransportIncomingReceiveBurst);
+    g_test_add_func("/luna-service2/LSTransportIncomingReceivePartial",
+                     test_LSTransportIncomingReceivePartial);
+    g_test_add_func("/luna-service2/LSTransportIncomingReceiveFd",
+                     test_LSTransportIncomingReceiveFd);
+    g_test_add_func("/luna-service2/LSTransportIncomingReceiveMemfd",
+                     test_LSTransportIncomingReceiveMemfd);
 
     return g_test_run();
 }
@@ -0,0 +1,308 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "transport_client.h"
+#include "transport_iothread.h"
+
+/* Mock variables *************************************************************/
+
+#define POST_THREADS    4
+#define POST_PER_THREAD 1000
+
+/* Messages and clients are only passed around, never looked into */
+static char mvar_messages[POST_THREADS][POST_PER_THREAD];
+static char mvar_client;
+
+static gint mvar_message_refs = 0;
+static gint mvar_client_refs = 0;
+
+#define MESSAGE(thread, i)  ((_LSTransportMessage*) &mvar_messages[thread][i])
+#define CLIENT              ((_LSTransportClient*) &mvar_client)
+
+/* What the user context got, in order */
+typedef struct {
+    GThread *thread;
+    int handled;
+    int next[POST_THREADS];     /* next expected message of each thread */
+    int failures;
+    int disconnects;
+    bool in_order;
+    GString *log;
+} Dispatched;
+
+static Dispatched dispatched;
+
+static void
+dispatched_reset(void)
+{
+    if (dispatched.log) g_string_free(dispatched.log, TRUE);
+    memset(&dispatched, 0, sizeof(dispatched));
+    dispatched.thread = g_thread_self();
+    dispatched.in_order = true;
+    dispatched.log = g_string_new(NULL);
+    mvar_message_refs = 0;
+    mvar_client_refs = 0;
+}
+
+static void
+test_message_handler(_LSTransportMessage *message)
+{
+    g_assert(g_thread_self() == dispatched.thread);
+
+    ptrdiff_t at = (char*) message - &mvar_messages[0][0];
+    int thread = at / POST_PER_THREAD;
+    int i = at % POST_PER_THREAD;
+
+    if (i != dispatched.next[thread])
+        dispatched.in_order = false;
+    dispatched.next[thread] = i + 1;
+    dispatched.handled++;
+
+    g_string_append_printf(dispatched.log, "m%d ", i);
+}
+
+static void
+test_failure_handler(_LSTransportMessage *message, _LSTransportMessageFailureType failure_type, void *context)
+{
+    g_assert(g_thread_self() == dispatched.thread);
+    g_assert(context == &dispatched);
+    g_assert_cmpint(failure_type, ==, _LSTransportMessageFailureTypeServiceUnavailable);
+
+    dispatched.failures++;
+    g_string_append_printf(dispatched.log, "f%d ", (int) ((char*) message - &mvar_messages[0][0]));
+}
+
+static void
+test_disconnect_handler(_LSTransportClient *client, _LSTransportDisconnectType type, void *context)
+{
+    g_assert(g_thread_self() == dispatched.thread);
+    g_assert(context == &dispatched);
+    g_assert(client == CLIENT);
+    g_assert_cmpint(type, ==, _LSTransportDisconnectTypeDirty);
+
+    dispatched.disconnects++;
+    g_string_append(dispatched.log, "d ");
+}
+
+static void
+dispatch_until(GMainContext *context, int handled)
+{
+    gint64 deadline = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+
+    while (dispatched.handled + dispatched.failures + dispatched.disconnects < handled)
+    {
+        g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+        g_main_context_iteration(context, TRUE);
+    }
+}
+
+/* Test cases *****************************************************************/
+
+typedef struct {
+    _LSTransportIoThread *io_thread;
+    LSTransportHandlers handlers;
+    GThread *thread;
+} IoThreadWork;
+
+/* What the transport watches would do, from the I/O thread */
+static gboolean
+io_thread_work(gpointer data)
+{
+    IoThreadWork *work = data;
+    work->thread = g_thread_self();
+
+    _LSTransportIoThreadPostMessage(work->io_thread, MESSAGE(0, 0));
+    _LSTransportIoThreadPostMessage(work->io_thread, MESSAGE(0, 1));
+    work->handlers.message_failure_handler(MESSAGE(0, 2), _LSTransportMessageFailureTypeServiceUnavailable,
+                                           work->handlers.message_failure_context);
+    _LSTransportIoThreadPostMessage(work->io_thread, MESSAGE(0, 3));
+    work->handlers.disconnect_handler(CLIENT, _LSTransportDisconnectTypeDirty,
+                                      work->handlers.disconnect_context);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+test_LSTransportIoThreadDispatch(void)
+{
+    GMainContext *context = g_main_context_new();
+    dispatched_reset();
+
+    _LSTransportIoThread *io_thread = _LSTransportIoThreadNew(context, G_PRIORITY_DEFAULT, test_message_handler);
+    g_assert(NULL != io_thread);
+    g_assert(io_thread->context != context);
+
+    IoThreadWork work = {
+        .io_thread = io_thread,
+        .handlers = {
+            .message_failure_handler = test_failure_handler,
+            .message_failure_context = &dispatched,
+            .disconnect_handler = test_disconnect_handler,
+            .disconnect_context = &dispatched,
+        },
+    };
+
+    /* case: the transport's handlers are replaced by ones that post */
+    _LSTransportIoThreadWrapHandlers(io_thread, &work.handlers);
+    g_assert(work.handlers.message_failure_handler != test_failure_handler);
+    g_assert(work.handlers.disconnect_handler != test_disconnect_handler);
+
+    g_assert(_LSTransportIoThreadStart(io_thread, NULL));
+
+    GSource *source = g_idle_source_new();
+    g_source_set_callback(source, io_thread_work, &work, NULL);
+    g_source_attach(source, io_thread->context);
+    g_source_unref(source);
+
+    dispatch_until(context, 5);
+
+    /* case: the work ran on the I/O thread, the handlers in the user context,
+     * in the order they were posted */
+    g_assert(work.thread != NULL);
+    g_assert(work.thread != g_thread_self());
+    g_assert_cmpstr(dispatched.log->str, ==, "m0 m1 f2 m3 d ");
+
+    /* case: everything posted was released */
+    g_assert_cmpint(mvar_message_refs, ==, 0);
+    g_assert_cmpint(mvar_client_refs, ==, 0);
+
+    _LSTransportIoThreadFree(io_thread);
+    g_main_context_unref(context);
+}
+
+static gpointer
+post_thread(gpointer data)
+{
+    _LSTransportIoThread *io_thread = ((gpointer *) data)[0];
+    int thread = GPOINTER_TO_INT(((gpointer *) data)[1]);
+    int i;
+
+    for (i = 0; i < POST_PER_THREAD; i++)
+    {
+        _LSTransportIoThreadPostMessage(io_thread, MESSAGE(thread, i));
+    }
+    return NULL;
+}
+
+static void
+test_LSTransportIoThreadPost(void)
+{
+    GMainContext *context = g_main_context_new();
+    dispatched_reset();
+
+    _LSTransportIoThread *io_thread = _LSTransportIoThreadNew(context, G_PRIORITY_DEFAULT, test_message_handler);
+
+    GThread *threads[POST_THREADS];
+    gpointer args[POST_THREADS][2];
+    int i;
+
+    for (i = 0; i < POST_THREADS; i++)
+    {
+        args[i][0] = io_thread;
+        args[i][1] = GINT_TO_POINTER(i);
+        threads[i] = g_thread_new("post", post_thread, args[i]);
+    }
+
+    /* case: dispatched while still being posted, nothing lost, and the
+     * messages of every thread in the order they were posted */
+    dispatch_until(context, POST_THREADS * POST_PER_THREAD);
+    g_assert(dispatched.in_order);
+    for (i = 0; i < POST_THREADS; i++)
+    {
+        g_thread_join(threads[i]);
+        g_assert_cmpint(dispatched.next[i], ==, POST_PER_THREAD);
+    }
+    g_assert_cmpint(mvar_message_refs, ==, 0);
+
+    _LSTransportIoThreadFree(io_thread);
+    g_main_context_unref(context);
+}
+
+static void
+test_LSTransportIoThreadStop(void)
+{
+    GMainContext *context = g_main_context_new();
+    dispatched_reset();
+
+    _LSTransportIoThread *io_thread = _LSTransportIoThreadNew(context, G_PRIORITY_DEFAULT, test_message_handler);
+
+    /* case: stopped before the thread got to run its loop */
+    g_assert(_LSTransportIoThreadStart(io_thread, NULL));
+    _LSTransportIoThreadStop(io_thread);
+    g_assert(io_thread->thread == NULL);
+
+    /* case: nothing is dispatched once stopped */
+    _LSTransportIoThreadPostMessage(io_thread, MESSAGE(0, 0));
+    _LSTransportIoThreadPostMessage(io_thread, MESSAGE(0, 1));
+    while (g_main_context_iteration(context, FALSE));
+    g_assert_cmpint(dispatched.handled, ==, 0);
+
+    /* case: what was posted is dropped */
+    g_assert_cmpint(_LSTransportIoThreadDiscard(io_thread), ==, 2);
+    g_assert_cmpint(_LSTransportIoThreadDiscard(io_thread), ==, 0);
+    g_assert_cmpint(mvar_message_refs, ==, 0);
+
+    /* case: free after stop */
+    _LSTransportIoThreadFree(io_thread);
+    g_main_context_unref(context);
+}
+
+/* Mocks **********************************************************************/
+
+_LSTransportMessage*
+_LSTransportMessageRef(_LSTransportMessage *message)
+{
+    g_atomic_int_inc(&mvar_message_refs);
+    return message;
+}
+
+void
+_LSTransportMessageUnref(_LSTransportMessage *message)
+{
+    g_atomic_int_add(&mvar_message_refs, -1);
+}
+
+void
+_LSTransportClientRef(_LSTransportClient *client)
+{
+    g_atomic_int_inc(&mvar_client_refs);
+}
+
+void
+_LSTransportClientUnref(_LSTransportClient *client)
+{
+    g_atomic_int_add(&mvar_client_refs, -1);
+}
+
+/* Test suite *****************************************************************/
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/luna-service2/LSTransportIoThreadDispatch",
+                    test_LSTransportIoThreadDispatch);
+    g_test_add_func("/luna-service2/LSTransportIoThreadPost",
+                    test_LSTransportIoThreadPost);
+    g_test_add_func("/luna-service2/LSTransportIoThreadStop",
+                    test_LSTransportIoThreadStop);
+
+    return g_test_run();
+}
@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <locale.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <glib.h>
 #include <transport_message.h>
 #include <transport.h>
@@ -124,7 +126,8 @@ test_LSTransportMessageNewRef(void)
     g_assert_cmpint(msg->raw->header.token, ==, LSMESSAGE_TOKEN_INVALID);
     g_assert_cmpint(msg->raw->header.type, ==, _LSTransportMessageTypeUnknown);
 
-    g_assert_cmpint(msg->alloc_body_size, ==, 10);
+    /* rounded up to the smallest message pool class */
+    g_assert_cmpint(msg->alloc_body_size, ==, 64);
     g_assert_cmpint(msg->tx_bytes_remaining, ==, 10 + sizeof(_LSTransportHeader));
     g_assert_cmpint(msg->retries, ==, MAX_SEND_RETRIES);
     g_assert_cmpint(msg->connection_fd, ==, -1);
@@ -166,6 +169,195 @@ test_LSTransportMessageCopyNewRef(TestData *fixture, gconstpointer user_data)
     _LSTransportMessageUnref(msg);
 }
 
+static void
+test_LSTransportMessageShareNewRef(void)
+{
+    const char body[] = "{\"signal\":true}";
+    _LSTransportMessage *orig = _LSTransportMessageNewRef(sizeof(body));
+    _LSTransportMessageSetType(orig, _LSTransportMessageTypeSignal);
+    _LSTransportMessageSetToken(orig, 42);
+    _LSTransportMessageSetBody(orig, body, sizeof(body));
+
+    _LSTransportMessage *first = _LSTransportMessageShareNewRef(orig);
+    _LSTransportMessage *second = _LSTransportMessageShareNewRef(orig);
+    g_assert_cmpint(first->ref, ==, 1);
+
+    /* The body is shared, the header is per message */
+    g_assert(_LSTransportMessageGetBody(first) == _LSTransportMessageGetBody(orig));
+    g_assert(_LSTransportMessageGetBody(second) == _LSTransportMessageGetBody(orig));
+    g_assert_cmpint(_LSTransportMessageGetType(first), ==, _LSTransportMessageTypeSignal);
+    g_assert_cmpint(_LSTransportMessageGetBodySize(first), ==, sizeof(body));
+    g_assert_cmpint(_LSTransportMessageGetToken(first), ==, 42);
+
+    _LSTransportMessageSetToken(first, 1);
+    _LSTransportMessageSetToken(second, 2);
+    g_assert_cmpint(_LSTransportMessageGetToken(first), ==, 1);
+    g_assert_cmpint(_LSTransportMessageGetToken(second), ==, 2);
+    g_assert_cmpint(_LSTransportMessageGetToken(orig), ==, 42);
+
+    /* Own header goes over the wire followed by the shared body */
+    struct iovec iov[2];
+    first->tx_bytes_remaining = sizeof(_LSTransportHeader) + sizeof(body);
+    g_assert_cmpint(_LSTransportMessageGetTxVector(first, iov), ==, 2);
+    g_assert_cmpint(iov[0].iov_len, ==, sizeof(_LSTransportHeader));
+    g_assert_cmpint(((_LSTransportHeader*)iov[0].iov_base)->token, ==, 1);
+    g_assert(iov[1].iov_base == _LSTransportMessageGetBody(orig));
+    g_assert_cmpint(iov[1].iov_len, ==, sizeof(body));
+
+    first->tx_bytes_remaining = sizeof(_LSTransportHeader) + sizeof(body) - 4;
+    g_assert_cmpint(_LSTransportMessageGetTxVector(first, iov), ==, 2);
+    g_assert_cmpint(iov[0].iov_len, ==, sizeof(_LSTransportHeader) - 4);
+
+    first->tx_bytes_remaining = 3;
+    g_assert_cmpint(_LSTransportMessageGetTxVector(first, iov), ==, 1);
+    g_assert(iov[0].iov_base == _LSTransportMessageGetBody(orig) + sizeof(body) - 3);
+    g_assert_cmpint(iov[0].iov_len, ==, 3);
+
+    first->tx_bytes_remaining = 0;
+    g_assert_cmpint(_LSTransportMessageGetTxVector(first, iov), ==, 0);
+
+    /* The body outlives the message it was shared from */
+    _LSTransportMessageUnref(orig);
+    _LSTransportMessageUnref(first);
+    g_assert_cmpstr(_LSTransportMessageGetBody(second), ==, body);
+    _LSTransportMessageUnref(second);
+}
+
+static gpointer
+test_message_pool_thread(gpointer data)
+{
+    _LSTransportMessage *msgs[32];
+    for (int i = 0; i < G_N_ELEMENTS(msgs); ++i)
+        msgs[i] = _LSTransportMessageNewRef(100);
+    for (int i = 0; i < G_N_ELEMENTS(msgs); ++i)
+        _LSTransportMessageUnref(msgs[i]);
+    return NULL;
+}
+
+static void
+test_LSTransportMessagePool(void)
+{
+    /* The wrapper and the body are recycled together */
+    _LSTransportMessage *msg = _LSTransportMessageNewRef(10);
+    _LSTransportMessageRaw *raw = msg->raw;
+    _LSTransportMessage *wrapper = msg;
+    _LSTransportMessageUnref(msg);
+
+    msg = _LSTransportMessageNewRef(20);
+    g_assert(msg == wrapper);
+    g_assert(msg->raw == raw);
+    g_assert_cmpint(msg->ref, ==, 1);
+    g_assert_cmpint(msg->raw->header.len, ==, 20);
+    g_assert_cmpint(msg->raw->header.type, ==, _LSTransportMessageTypeUnknown);
+    g_assert(msg->client == NULL);
+    g_assert(msg->tx_header == NULL);
+    _LSTransportMessageUnref(msg);
+
+    /* Expanding moves the body to a bigger class keeping its contents */
+    char string[10000];
+    memset(string, 'a', sizeof(string));
+    string[99] = '\0';
+
+    msg = _LSTransportMessageNewRef(1);
+    _LSTransportMessageIter iter;
+    _LSTransportMessageIterInit(msg, &iter);
+    g_assert(_LSTransportMessageAppendString(&iter, "pooled"));
+    g_assert_cmpint(msg->alloc_body_size, ==, 64);
+    g_assert(_LSTransportMessageAppendString(&iter, string));
+    g_assert_cmpint(msg->alloc_body_size, >, 64);
+    g_assert_cmpint(msg->alloc_body_size, <=, 4096);
+    g_assert_cmpint(msg->alloc_body_size & (msg->alloc_body_size - 1), ==, 0);
+
+    /* Large bodies bypass the pools */
+    g_assert_cmpint(_LSTransportMessagePoolClass(4096), <, LS_TRANSPORT_MESSAGE_POOL_CLASSES);
+    g_assert_cmpint(_LSTransportMessagePoolClass(4097), ==, LS_TRANSPORT_MESSAGE_POOL_CLASSES);
+    string[99] = 'a';
+    string[sizeof(string) - 1] = '\0';
+    g_assert(_LSTransportMessageAppendString(&iter, string));
+    g_assert_cmpint(msg->alloc_body_size, ==, 16384);
+    g_assert(_LSTransportMessageAppendString(&iter, string));
+    g_assert_cmpint(msg->alloc_body_size, ==, 32768);
+
+    const char *value = NULL;
+    _LSTransportMessageIterInit(msg, &iter);
+    g_assert(_LSTransportMessageGetString(&iter, &value));
+    g_assert_cmpstr(value, ==, "pooled");
+    _LSTransportMessageIterNext(&iter);
+    g_assert(_LSTransportMessageGetString(&iter, &value));
+    g_assert_cmpint(strlen(value), ==, 99);
+    _LSTransportMessageIterNext(&iter);
+    g_assert(_LSTransportMessageGetString(&iter, &value));
+    g_assert_cmpint(strlen(value), ==, sizeof(string) - 1);
+    _LSTransportMessageUnref(msg);
+
+    char body[20] = "pooled";
+    /* Shared body goes back to the pool with the last message holding it */
+    msg = _LSTransportMessageNewRef(sizeof(body));
+    _LSTransportMessageSetBody(msg, body, sizeof(body));
+    _LSTransportMessage *shared = _LSTransportMessageShareNewRef(msg);
+    raw = msg->raw;
+    _LSTransportMessageUnref(msg);
+    g_assert_cmpstr(_LSTransportMessageGetBody(shared), ==, "pooled");
+    _LSTransportMessageUnref(shared);
+    msg = _LSTransportMessageNewRef(1);
+    g_assert(msg->raw == raw);
+    _LSTransportMessageUnref(msg);
+
+    /* Reservations are preallocated in the depot */
+    _LSTransportMessagePoolStats before, after;
+    unsigned long klass = _LSTransportMessagePoolClass(1000);
+    _LSTransportMessagePoolGetStats(&before);
+    _LSTransportMessagePoolReserve(klass, 100);
+    _LSTransportMessagePoolGetStats(&after);
+    g_assert_cmpint(after.blocks, ==, before.blocks + 100);
+    g_assert_cmpint(after.depot, ==, before.depot + 100);
+    _LSTransportMessagePoolReserve(klass, -100);
+    _LSTransportMessagePoolGetStats(&after);
+    g_assert_cmpint(after.blocks, ==, before.blocks + MIN(100, 64));
+    g_assert_cmpint(after.depot, ==, before.depot + MIN(100, 64));
+
+    /* Bodies cached by a thread are handed to the depot when it exits */
+    _LSTransportMessagePoolGetStats(&before);
+    g_thread_join(g_thread_new("pool", test_message_pool_thread, NULL));
+    _LSTransportMessagePoolGetStats(&after);
+    g_assert_cmpint(after.depot, ==, before.depot + 32);
+}
+
+static void
+test_LSTransportMessageBatchFds(void)
+{
+    int fds[2];
+    g_assert_cmpint(pipe(fds), ==, 0);
+
+    _LSTransportMessage *msg = _LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE);
+    _LSTransportMessageSetType(msg, _LSTransportMessageTypeQueryNameBatchReply);
+    g_assert(_LSTransportMessageIsFdType(msg));
+    g_assert_cmpint(_LSTransportMessageGetFdCount(msg), ==, 0);
+    g_assert(_LSTransportMessageGetFds(msg) == NULL);
+
+    _LSTransportMessageIter iter;
+    _LSTransportMessageIterInit(msg, &iter);
+    g_assert(_LSTransportMessageAppendInt32(&iter, 2));
+    g_assert_cmpint(_LSTransportQueryNameBatchReplyGetFdCount(msg), ==, 2);
+
+    _LSTransportMessageAddFd(msg, fds[0]);
+    _LSTransportMessageAddFd(msg, fds[1]);
+    g_assert_cmpint(_LSTransportMessageGetFdCount(msg), ==, 2);
+    g_assert_cmpint(_LSTransportMessageGetFds(msg)[1], ==, fds[1]);
+
+    /* A stolen fd belongs to the caller, the rest are closed with the message */
+    g_assert_cmpint(_LSTransportMessageStealFd(msg, 0), ==, fds[0]);
+    g_assert_cmpint(_LSTransportMessageStealFd(msg, 0), ==, -1);
+    g_assert_cmpint(_LSTransportMessageStealFd(msg, 2), ==, -1);
+    g_assert_cmpint(_LSTransportMessageGetFds(msg)[0], ==, -1);
+
+    _LSTransportMessageUnref(msg);
+
+    g_assert_cmpint(fcntl(fds[0], F_GETFD), !=, -1);
+    g_assert_cmpint(fcntl(fds[1], F_GETFD), ==, -1);
+    close(fds[0]);
+}
+
 static void
 test_LSTransportMessageCopy(TestData *fixture, gconstpointer user_data)
 {
@@ -210,7 +402,7 @@ test_LSTransportMessageFromVectorNewRef(TestData *fixture, gconstpointer user_da
     g_assert(NULL != msg);
     g_assert_cmpint(msg->ref, ==, 1);
 
-    g_assert_cmpint(msg->alloc_body_size, ==, category_len);
+    g_assert_cmpint(msg->alloc_body_size, ==, 64);
     g_assert_cmpstr(_LSTransportMessageGetCategory(msg), ==, category);
 
     _LSTransportMessageUnref(msg);
@@ -1102,6 +1294,9 @@ main(int argc, char *argv[])
     g_test_add_func("/luna-service2/LSTransportMessageEmpty", test_LSTransportMessageEmpty);
 
     LSTEST_ADD("/luna-service2/LSTransportMessageCopyNewRef", test_LSTransportMessageCopyNewRef);
+    g_test_add_func("/luna-service2/LSTransportMessageShareNewRef", test_LSTransportMessageShareNewRef);
+    g_test_add_func("/luna-service2/LSTransportMessagePool", test_LSTransportMessagePool);
+    g_test_add_func("/luna-service2/LSTransportMessageBatchFds", test_LSTransportMessageBatchFds);
     LSTEST_ADD("/luna-service2/LSTransportMessageCopy", test_LSTransportMessageCopy);
     LSTEST_ADD("/luna-service2/LSTransportMessageFromVectorNewRef", test_LSTransportMessageFromVectorNewRef);
     LSTEST_ADD("/luna-service2/LSTransportMessageReset", test_LSTransportMessageReset);
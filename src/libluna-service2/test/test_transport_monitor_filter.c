@@ -0,0 +1,288 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <string.h>
+#include <glib.h>
+#include <transport_monitor_filter.h>
+
+/* Test data ******************************************************************/
+
+/* Message of the type with "category/method" and the payload */
+static _LSTransportMessage*
+new_message(_LSTransportMessageType type, const char *category, const char *method)
+{
+    GString *body = g_string_new(category);
+    g_string_append_c(body, '\0');
+    g_string_append(body, method);
+    g_string_append_c(body, '\0');
+    g_string_append(body, "{}");
+    g_string_append_c(body, '\0');
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(body->len);
+    _LSTransportMessageSetType(message, type);
+    _LSTransportMessageSetBody(message, body->str, body->len);
+
+    g_string_free(body, TRUE);
+    return message;
+}
+
+/* Reply to the call with the token */
+static _LSTransportMessage*
+new_reply(LSMessageToken reply_token)
+{
+    GString *body = g_string_new(NULL);
+    g_string_append_len(body, (const char *) &reply_token, sizeof(reply_token));
+    g_string_append(body, "{}");
+    g_string_append_c(body, '\0');
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(body->len);
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeReply);
+    _LSTransportMessageSetBody(message, body->str, body->len);
+
+    g_string_free(body, TRUE);
+    return message;
+}
+
+static _LSTransportMonitorFilter*
+new_filter(const char *expression)
+{
+    LSError error;
+    LSErrorInit(&error);
+
+    _LSTransportMonitorFilter *filter = _LSTransportMonitorFilterNew(expression, &error);
+    g_assert(filter != NULL);
+    return filter;
+}
+
+/* sent by com.webos.a (A1) to com.webos.b (B1) */
+static bool
+match(_LSTransportMonitorFilter *filter, _LSTransportMessage *message)
+{
+    return _LSTransportMonitorFilterMatch(filter, message, "com.webos.a", "A1", "com.webos.b", "B1");
+}
+
+/* sent back by com.webos.b (B1) to com.webos.a (A1) */
+static bool
+match_reply(_LSTransportMonitorFilter *filter, _LSTransportMessage *message)
+{
+    return _LSTransportMonitorFilterMatch(filter, message, "com.webos.b", "B1", "com.webos.a", "A1");
+}
+
+static bool
+sample(_LSTransportMonitorFilter *filter, _LSTransportMessage *message)
+{
+    return _LSTransportMonitorFilterSample(filter, message, "A1", "B1");
+}
+
+static bool
+sample_reply(_LSTransportMonitorFilter *filter, _LSTransportMessage *message)
+{
+    return _LSTransportMonitorFilterSample(filter, message, "B1", "A1");
+}
+
+/* Test cases *****************************************************************/
+
+static void
+test_LSTransportMonitorFilterParse(void)
+{
+    static const char *invalid[] = {
+        "service",
+        "=com.webos.a",
+        "service=",
+        "unknown=1",
+        "service=a service=b",
+        "types=call,bogus",
+        "sample=0",
+        "sample=x",
+        NULL
+    };
+    const char **expression;
+
+    /* case: valid expressions, empty included */
+    _LSTransportMonitorFilterUnref(new_filter(""));
+    _LSTransportMonitorFilterUnref(new_filter("  service=com.webos.a\tmethod=/cat/* types=call,reply sample=10 "));
+
+    /* case: invalid ones */
+    for (expression = invalid; *expression; expression++)
+    {
+        LSError error;
+        LSErrorInit(&error);
+
+        g_assert(_LSTransportMonitorFilterNew(*expression, &error) == NULL);
+        g_assert(LSErrorIsSet(&error));
+        LSErrorFree(&error);
+    }
+}
+
+static void
+test_LSTransportMonitorFilterService(void)
+{
+    _LSTransportMessage *call = new_message(_LSTransportMessageTypeMethodCall, "/cat", "method");
+    _LSTransportMessage *signal = new_message(_LSTransportMessageTypeSignal, "/cat", "changed");
+
+    /* case: by sender */
+    _LSTransportMonitorFilter *filter = new_filter("service=webos.a");
+    g_assert(match(filter, call));
+    g_assert(match(filter, signal));
+    _LSTransportMonitorFilterUnref(filter);
+
+    /* case: by destination, not for signals */
+    filter = new_filter("service=B1");
+    g_assert(match(filter, call));
+    g_assert(!match(filter, signal));
+    _LSTransportMonitorFilterUnref(filter);
+
+    filter = new_filter("service=com.webos.c");
+    g_assert(!match(filter, call));
+    _LSTransportMonitorFilterUnref(filter);
+
+    _LSTransportMessageUnref(signal);
+    _LSTransportMessageUnref(call);
+}
+
+static void
+test_LSTransportMonitorFilterMethod(void)
+{
+    _LSTransportMessage *call = new_message(_LSTransportMessageTypeMethodCall, "/cat", "method");
+    _LSTransportMessage *root_call = new_message(_LSTransportMessageTypeMethodCall, "/", "method");
+    _LSTransportMessage *reply = new_reply(5);
+    _LSTransportMessage *root_reply = new_reply(6);
+    _LSTransportMessage *unknown_reply = new_reply(7);
+
+    _LSTransportMessageSetToken(call, 5);
+    _LSTransportMessageSetToken(root_call, 6);
+
+    _LSTransportMonitorFilter *filter = new_filter("method=/cat/*");
+
+    /* case: replies match by the method of their call, once it's seen */
+    g_assert(!match_reply(filter, reply));
+    g_assert(match(filter, call));
+    g_assert(!match(filter, root_call));
+    g_assert(match_reply(filter, reply));
+    g_assert(match_reply(filter, reply));
+    g_assert(!match_reply(filter, root_reply));
+    g_assert(!match_reply(filter, unknown_reply));
+
+    /* case: the call of another caller with the same token */
+    g_assert(!_LSTransportMonitorFilterMatch(filter, reply, "com.webos.b", "B1", "com.webos.c", "C1"));
+
+    /* case: the call didn't match the other terms, its reply does */
+    _LSTransportMonitorFilterUnref(filter);
+    filter = new_filter("method=/cat/* types=reply");
+    g_assert(!match(filter, call));
+    g_assert(match_reply(filter, reply));
+    _LSTransportMonitorFilterUnref(filter);
+
+    /* case: the root category */
+    filter = new_filter("method=/meth?d");
+    g_assert(!match(filter, call));
+    g_assert(match(filter, root_call));
+    _LSTransportMonitorFilterUnref(filter);
+
+    _LSTransportMessageUnref(unknown_reply);
+    _LSTransportMessageUnref(root_reply);
+    _LSTransportMessageUnref(reply);
+    _LSTransportMessageUnref(root_call);
+    _LSTransportMessageUnref(call);
+}
+
+static void
+test_LSTransportMonitorFilterTypes(void)
+{
+    _LSTransportMessage *call = new_message(_LSTransportMessageTypeMethodCall, "/cat", "method");
+    _LSTransportMessage *cancel = new_message(_LSTransportMessageTypeCancelMethodCall, "/cat", "method");
+    _LSTransportMessage *signal = new_message(_LSTransportMessageTypeSignal, "/cat", "changed");
+    _LSTransportMessage *reply = new_reply(1);
+
+    _LSTransportMonitorFilter *filter = new_filter("types=signal,reply");
+    g_assert(!match(filter, call));
+    g_assert(!match(filter, cancel));
+    g_assert(match(filter, signal));
+    g_assert(match(filter, reply));
+    _LSTransportMonitorFilterUnref(filter);
+
+    /* case: all terms have to match */
+    filter = new_filter("types=call method=/other/*");
+    g_assert(!match(filter, call));
+    _LSTransportMonitorFilterUnref(filter);
+
+    _LSTransportMessageUnref(reply);
+    _LSTransportMessageUnref(signal);
+    _LSTransportMessageUnref(cancel);
+    _LSTransportMessageUnref(call);
+}
+
+static void
+test_LSTransportMonitorFilterSample(void)
+{
+    _LSTransportMessage *call = new_message(_LSTransportMessageTypeMethodCall, "/cat", "method");
+    int kept = 0;
+    int i;
+
+    /* case: everything without sampling */
+    _LSTransportMonitorFilter *filter = new_filter("service=com.webos.a");
+    for (i = 0; i < 10; i++)
+    {
+        _LSTransportMessageSetToken(call, i);
+        g_assert(sample(filter, call));
+    }
+    _LSTransportMonitorFilterUnref(filter);
+
+    /* case: one of every N calls of a caller, each with its replies, the
+     * same on every side and every time */
+    filter = new_filter("sample=3");
+    _LSTransportMonitorFilter *other = new_filter("sample=3");
+    for (i = 1; i <= 30; i++)
+    {
+        _LSTransportMessage *reply = new_reply(i);
+        _LSTransportMessageSetToken(call, i);
+
+        bool kept_call = sample(filter, call);
+        g_assert(sample(filter, call) == kept_call);
+        g_assert(sample(other, call) == kept_call);
+        g_assert(sample_reply(other, reply) == kept_call);
+        if (kept_call)
+            kept++;
+
+        _LSTransportMessageUnref(reply);
+    }
+    g_assert_cmpint(kept, ==, 10);
+    _LSTransportMonitorFilterUnref(other);
+    _LSTransportMonitorFilterUnref(filter);
+
+    _LSTransportMessageUnref(call);
+}
+
+/* Test suite *****************************************************************/
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/luna-service2/LSTransportMonitorFilterParse",
+                    test_LSTransportMonitorFilterParse);
+    g_test_add_func("/luna-service2/LSTransportMonitorFilterService",
+                    test_LSTransportMonitorFilterService);
+    g_test_add_func("/luna-service2/LSTransportMonitorFilterMethod",
+                    test_LSTransportMonitorFilterMethod);
+    g_test_add_func("/luna-service2/LSTransportMonitorFilterTypes",
+                    test_LSTransportMonitorFilterTypes);
+    g_test_add_func("/luna-service2/LSTransportMonitorFilterSample",
+                    test_LSTransportMonitorFilterSample);
+
+    return g_test_run();
+}
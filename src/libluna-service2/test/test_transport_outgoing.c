@@ -16,6 +16,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 #include <glib.h>
 #include "transport_message.h"
 #include "transport_outgoing.h"
@@ -66,6 +67,248 @@ test_LSTransportOutgoing(void)
     g_assert_cmpint(mvar_serial_freed, !=, 0);
 }
 
+#define POST_THREADS    4
+#define POST_PER_THREAD 1000
+
+static _LSTransportMessage mvar_posted[POST_THREADS][POST_PER_THREAD];
+static _LSTransportMessageRaw mvar_posted_raw;
+
+static gpointer
+post_thread(gpointer data)
+{
+    _LSTransportOutgoing *outqueue = ((gpointer *) data)[0];
+    _LSTransportMessage *messages = ((gpointer *) data)[1];
+    int i;
+
+    for (i = 0; i < POST_PER_THREAD; i++)
+    {
+        _LSTransportOutgoingPost(outqueue, &messages[i]);
+    }
+    return NULL;
+}
+
+static void
+test_LSTransportOutgoingPost(void)
+{
+    _LSTransportOutgoing* outqueue = _LSTransportOutgoingNew();
+    _LSTransportMessage head = { 0 }, first = { 0 }, second = { 0 }, third = { 0 };
+
+    /* posting accounts the message size, which lives in the header */
+    first.raw = second.raw = third.raw = &mvar_posted_raw;
+
+    /* case: nothing posted to a new queue */
+    g_assert(!_LSTransportOutgoingHasPosted(outqueue));
+
+    /* case: only the first post finds the stack empty */
+    g_assert(_LSTransportOutgoingPost(outqueue, &first));
+    g_assert(!_LSTransportOutgoingPost(outqueue, &second));
+    g_assert(_LSTransportOutgoingHasPosted(outqueue));
+
+    /* case: posted messages are appended behind the queued ones in post order */
+    g_queue_push_tail(outqueue->queue, &head);
+    _LSTransportOutgoingCollect(outqueue);
+    g_assert(!_LSTransportOutgoingHasPosted(outqueue));
+    g_assert(_LSTransportOutgoingPost(outqueue, &third));
+    _LSTransportOutgoingCollect(outqueue);
+
+    g_assert_cmpint(g_queue_get_length(outqueue->queue), ==, 4);
+    g_assert(g_queue_pop_head(outqueue->queue) == &head);
+    g_assert(g_queue_pop_head(outqueue->queue) == &first);
+    g_assert(g_queue_pop_head(outqueue->queue) == &second);
+    g_assert(g_queue_pop_head(outqueue->queue) == &third);
+
+    /* case: concurrent producers lose nothing and keep their own order */
+    GThread *threads[POST_THREADS];
+    gpointer args[POST_THREADS][2];
+    int i, j;
+
+    for (i = 0; i < POST_THREADS; i++)
+    {
+        for (j = 0; j < POST_PER_THREAD; j++)
+        {
+            mvar_posted[i][j].raw = &mvar_posted_raw;
+        }
+        args[i][0] = outqueue;
+        args[i][1] = mvar_posted[i];
+        threads[i] = g_thread_new("post", post_thread, args[i]);
+    }
+
+    int collected = 0;
+    int next[POST_THREADS] = { 0 };
+    while (collected < POST_THREADS * POST_PER_THREAD)
+    {
+        _LSTransportOutgoingCollect(outqueue);
+
+        _LSTransportMessage *message;
+        while ((message = g_queue_pop_head(outqueue->queue)))
+        {
+            ptrdiff_t index = message - &mvar_posted[0][0];
+            int thread = index / POST_PER_THREAD;
+
+            g_assert_cmpint(index % POST_PER_THREAD, ==, next[thread]);
+            next[thread]++;
+            collected++;
+        }
+    }
+
+    for (i = 0; i < POST_THREADS; i++)
+    {
+        g_thread_join(threads[i]);
+    }
+    g_assert(!_LSTransportOutgoingHasPosted(outqueue));
+
+    _LSTransportOutgoingFree(outqueue);
+}
+
+static _LSTransportMessage*
+make_message(_LSTransportMessageType type, unsigned long len)
+{
+    _LSTransportMessage *message = g_new0(_LSTransportMessage, 1);
+    message->raw = g_malloc0(sizeof(_LSTransportMessageRaw) + len);
+    message->raw->header.type = type;
+    message->raw->header.len = len;
+    return message;
+}
+
+static void
+free_message(_LSTransportMessage *message)
+{
+    g_free(message->raw);
+    g_free(message);
+}
+
+static void
+test_LSTransportOutgoingHighWater(void)
+{
+    _LSTransportOutgoing* outqueue = _LSTransportOutgoingNew();
+    const unsigned long size = sizeof(_LSTransportHeader) + 100;
+
+    _LSTransportMessage *head = make_message(_LSTransportMessageTypeSignal, 100);
+    _LSTransportMessage *call = make_message(_LSTransportMessageTypeMethodCall, 100);
+    _LSTransportMessage *signal = make_message(_LSTransportMessageTypeSignal, 100);
+
+    _ls_outgoing_hwm_bytes = 3 * size;
+
+    /* case: an empty queue takes a message of any size */
+    g_assert(!_LSTransportOutgoingIsOverHighWater(outqueue, 10 * size));
+
+    /* case: queued messages count towards the mark */
+    _LSTransportOutgoingAccount(outqueue, head);
+    g_queue_push_tail(outqueue->queue, head);
+    _LSTransportOutgoingAccount(outqueue, call);
+    g_queue_push_tail(outqueue->queue, call);
+    g_assert(!_LSTransportOutgoingIsOverHighWater(outqueue, size));
+    _LSTransportOutgoingPost(outqueue, signal);
+    g_assert_cmpint(outqueue->queued_messages, ==, 3);
+    g_assert_cmpuint(outqueue->queued_bytes, ==, 3 * size);
+    g_assert(_LSTransportOutgoingIsOverHighWater(outqueue, size));
+
+    /* case: the oldest signal goes, but never the head or a call */
+    _LSTransportOutgoingCollect(outqueue);
+    g_assert_cmpint(_LSTransportOutgoingDropSignals(outqueue, size), ==, 1);
+    g_assert_cmpint(outqueue->dropped_messages, ==, 1);
+    g_assert(!_LSTransportOutgoingIsOverHighWater(outqueue, size));
+    g_assert_cmpint(g_queue_get_length(outqueue->queue), ==, 2);
+    g_assert(g_queue_peek_head(outqueue->queue) == head);
+    g_assert(g_queue_peek_tail(outqueue->queue) == call);
+
+    /* case: the message limit applies as well */
+    _ls_outgoing_hwm_messages = 2;
+    g_assert(_LSTransportOutgoingIsOverHighWater(outqueue, 1));
+    _ls_outgoing_hwm_messages = 0;
+
+    /* case: a drained queue is back under the mark */
+    outqueue->high_water = 1;
+    g_assert(_LSTransportOutgoingPopHead(outqueue) == head);
+    g_assert(_LSTransportOutgoingPopHead(outqueue) == call);
+    g_assert(_LSTransportOutgoingPopHead(outqueue) == NULL);
+    g_assert_cmpint(outqueue->queued_messages, ==, 0);
+    g_assert_cmpuint(outqueue->queued_bytes, ==, 0);
+    g_assert_cmpint(outqueue->high_water, ==, 0);
+    g_assert_cmpuint(head->queued_size, ==, 0);
+
+    _ls_outgoing_hwm_bytes = 0;
+    _LSTransportOutgoingFree(outqueue);
+    free_message(head);
+    free_message(call);
+    free_message(signal);
+}
+
+static _LSTransportMessage*
+make_signal(const char *category, const char *method, bool coalesce)
+{
+    char body[64];
+    int len = g_snprintf(body, sizeof(body), "%s%c%s%c{}", category, 0, method, 0) + 1;
+
+    _LSTransportMessage *message = make_message(_LSTransportMessageTypeSignal, len);
+    memcpy(message->raw->data, body, len);
+    message->raw->header.coalesce = coalesce;
+    return message;
+}
+
+static void
+test_LSTransportOutgoingCoalesce(void)
+{
+    _LSTransportOutgoing* outqueue = _LSTransportOutgoingNew();
+
+    _LSTransportMessage *head = make_signal("/a", "x", true);
+    _LSTransportMessage *first = make_signal("/a", "x", true);
+    _LSTransportMessage *call = make_message(_LSTransportMessageTypeMethodCall, 100);
+    _LSTransportMessage *newer = make_signal("/a", "x", true);
+    _LSTransportMessage *other = make_signal("/a", "y", true);
+    _LSTransportMessage *plain = make_signal("/a", "y", false);
+
+    _LSTransportOutgoingAccount(outqueue, head);
+    g_queue_push_tail(outqueue->queue, head);
+
+    /* case: the head is never replaced */
+    g_assert(!_LSTransportOutgoingCoalesce(outqueue, first));
+    _LSTransportOutgoingAccount(outqueue, first);
+    g_queue_push_tail(outqueue->queue, first);
+    _LSTransportOutgoingAccount(outqueue, call);
+    g_queue_push_tail(outqueue->queue, call);
+
+    /* case: a newer instance takes the place of the queued one */
+    g_assert(_LSTransportOutgoingCoalesce(outqueue, newer));
+    g_assert_cmpint(g_queue_get_length(outqueue->queue), ==, 3);
+    g_assert(g_queue_peek_nth(outqueue->queue, 1) == newer);
+    g_assert_cmpint(outqueue->queued_messages, ==, 3);
+    g_assert_cmpint(outqueue->coalesced_messages, ==, 1);
+    g_assert_cmpuint(first->queued_size, ==, 0);
+
+    /* case: other methods, and instances not queued as latest-value, stay */
+    g_assert(!_LSTransportOutgoingCoalesce(outqueue, other));
+    _LSTransportOutgoingAccount(outqueue, plain);
+    g_queue_push_tail(outqueue->queue, plain);
+    g_assert(!_LSTransportOutgoingCoalesce(outqueue, other));
+
+    while (_LSTransportOutgoingPopHead(outqueue));
+    _LSTransportOutgoingFree(outqueue);
+    free_message(head);
+    free_message(first);
+    free_message(call);
+    free_message(newer);
+    free_message(other);
+    free_message(plain);
+}
+
+static void
+test_LSTransportQueuePolicy(void)
+{
+    _LSTransportQueuePolicy policy;
+
+    g_assert(_LSTransportQueuePolicyFromString("push-back", &policy));
+    g_assert_cmpint(policy, ==, _LSTransportQueuePolicyPushBack);
+    g_assert(_LSTransportQueuePolicyFromString("disconnect", &policy));
+    g_assert_cmpint(policy, ==, _LSTransportQueuePolicyDisconnect);
+    g_assert(_LSTransportQueuePolicyFromString("drop-signals", &policy));
+    g_assert_cmpint(policy, ==, _LSTransportQueuePolicyDropSignals);
+    g_assert(!_LSTransportQueuePolicyFromString("drop-everything", &policy));
+    g_assert_cmpint(policy, ==, _LSTransportQueuePolicyDropSignals);
+
+    g_assert_cmpstr(_LSTransportQueuePolicyToString(_LSTransportQueuePolicyPushBack), ==, "push-back");
+}
+
 /* Mocks **********************************************************************/
 
 _LSTransportSerial*
@@ -104,6 +347,14 @@ main(int argc, char *argv[])
 
     g_test_add_func("/luna-service2/LSTransportOutgoing",
                     test_LSTransportOutgoing);
+    g_test_add_func("/luna-service2/LSTransportOutgoingPost",
+                    test_LSTransportOutgoingPost);
+    g_test_add_func("/luna-service2/LSTransportOutgoingHighWater",
+                    test_LSTransportOutgoingHighWater);
+    g_test_add_func("/luna-service2/LSTransportOutgoingCoalesce",
+                    test_LSTransportOutgoingCoalesce);
+    g_test_add_func("/luna-service2/LSTransportQueuePolicy",
+                    test_LSTransportQueuePolicy);
 
     return g_test_run();
 }
@@ -16,10 +16,15 @@
 
 
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <glib.h>
 #include <sys/mman.h>
 #include <transport_shm.h>
 
+#define THREADS             4
+#define SERIALS_PER_THREAD  10000
+
 /* Test cases *****************************************************************/
 
 static void
@@ -58,6 +63,85 @@ test_LSTransportShm(void)
     g_assert(NULL == shm);
 }
 
+static gpointer
+take_serials(gpointer data)
+{
+    _LSTransportMonitorSerial *serials = data;
+    LSError error;
+    LSErrorInit(&error);
+    _LSTransportShm *shm = NULL;
+    int i;
+
+    g_assert(_LSTransportShmInit(&shm, &error));
+    for (i = 0; i < SERIALS_PER_THREAD; i++)
+    {
+        serials[i] = _LSTransportShmGetSerial(shm);
+    }
+    _LSTransportShmDeinit(&shm);
+
+    return NULL;
+}
+
+static void
+test_LSTransportShmConcurrent(void)
+{
+    static _LSTransportMonitorSerial serials[THREADS][SERIALS_PER_THREAD];
+    GThread *threads[THREADS];
+    int i, j;
+
+    for (i = 0; i < THREADS; i++)
+    {
+        threads[i] = g_thread_new("serials", take_serials, serials[i]);
+    }
+    for (i = 0; i < THREADS; i++)
+    {
+        g_thread_join(threads[i]);
+    }
+
+    /* case: every serial is taken once, increasing within a thread */
+    GHashTable *seen = g_hash_table_new(g_int64_hash, g_int64_equal);
+    for (i = 0; i < THREADS; i++)
+    {
+        for (j = 0; j < SERIALS_PER_THREAD; j++)
+        {
+            g_assert_cmpuint(serials[i][j], !=, MONITOR_SERIAL_INVALID);
+            g_assert(j == 0 || serials[i][j] > serials[i][j - 1]);
+            g_assert(!g_hash_table_contains(seen, &serials[i][j]));
+            g_hash_table_add(seen, &serials[i][j]);
+        }
+    }
+    g_hash_table_unref(seen);
+}
+
+static void
+test_LSTransportShmLayoutMismatch(void)
+{
+    _LSTransportShm *shm = NULL;
+    LSError error;
+    LSErrorInit(&error);
+
+    g_assert(_LSTransportShmInit(&shm, &error));
+    g_assert_cmpuint(_LSTransportShmGetSerial(shm), !=, MONITOR_SERIAL_INVALID);
+
+    /* a second view of the region, as another process would have */
+    int fd = shm_open("/ls2.monitor.shm", O_RDWR, 0);
+    g_assert(fd != -1);
+    uint32_t *front_fence = mmap(NULL, sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    g_assert(front_fence != MAP_FAILED);
+    close(fd);
+
+    /* case: a region of another layout gives no serials */
+    uint32_t fence = *front_fence;
+    *front_fence = 0xdeadbeef;
+    g_assert_cmpuint(_LSTransportShmGetSerial(shm), ==, MONITOR_SERIAL_INVALID);
+
+    *front_fence = fence;
+    g_assert_cmpuint(_LSTransportShmGetSerial(shm), !=, MONITOR_SERIAL_INVALID);
+
+    munmap(front_fence, sizeof(uint32_t));
+    _LSTransportShmDeinit(&shm);
+}
+
 /* Test suite *****************************************************************/
 
 int
@@ -66,6 +150,8 @@ main(int argc, char *argv[])
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/luna-service2/LSTransportShm", test_LSTransportShm);
+    g_test_add_func("/luna-service2/LSTransportShmConcurrent", test_LSTransportShmConcurrent);
+    g_test_add_func("/luna-service2/LSTransportShmLayoutMismatch", test_LSTransportShmLayoutMismatch);
 
     return g_test_run();
 }
@@ -26,6 +26,7 @@
 typedef struct TestData
 {
     int lstransportsendmessage_call_count;
+    bool lstransportsendmessage_coalesced;
 } TestData;
 
 static TestData *test_data = NULL;
@@ -36,6 +37,7 @@ test_setup(TestData *fixture, gconstpointer user_data)
     test_data = fixture;
 
     fixture->lstransportsendmessage_call_count = 0;
+    fixture->lstransportsendmessage_coalesced = false;
 }
 
 static void
@@ -61,13 +63,19 @@ test_LSTransportRegisterSignal(TestData *fixture, gconstpointer user_data)
     const char *category = "a";
     const char *method = "b";
 
-    g_assert(LSTransportRegisterSignal(&transport, category, method, false, &token, &error));
+    g_assert(LSTransportRegisterSignal(&transport, category, method, false, false, &token, &error));
 
     g_assert_cmpint(fixture->lstransportsendmessage_call_count, ==, 1);
+    g_assert(!fixture->lstransportsendmessage_coalesced);
 
-    g_assert(LSTransportRegisterSignal(&transport, category, NULL, false, &token, &error));
+    g_assert(LSTransportRegisterSignal(&transport, category, NULL, false, false, &token, &error));
 
     g_assert_cmpint(fixture->lstransportsendmessage_call_count, ==, 2);
+
+    g_assert(LSTransportRegisterSignal(&transport, category, method, true, false, &token, &error));
+
+    g_assert_cmpint(fixture->lstransportsendmessage_call_count, ==, 3);
+    g_assert(fixture->lstransportsendmessage_coalesced);
 }
 
 static void
@@ -85,7 +93,7 @@ test_LSTransportUnregisterSignal(TestData *fixture, gconstpointer user_data)
     const char *category = "a";
     const char *method = "b";
 
-    g_assert(LSTransportUnregisterSignal(&transport, category, method, false, &token, &error));
+    g_assert(LSTransportUnregisterSignal(&transport, category, method, false, false, &token, &error));
 
     g_assert_cmpint(fixture->lstransportsendmessage_call_count, ==, 1);
 }
@@ -158,9 +166,15 @@ test_LSTransportSendSignal(TestData *fixture, gconstpointer user_data)
     const char *category = "a";
     const char *method = "b";
     const char *payload = "{}";
-    g_assert(LSTransportSendSignal(&transport, category, method, payload, false, &error));
+    g_assert(LSTransportSendSignal(&transport, category, method, payload, false, false, &error));
 
     g_assert_cmpint(fixture->lstransportsendmessage_call_count, ==, 1);
+    g_assert(!fixture->lstransportsendmessage_coalesced);
+
+    g_assert(LSTransportSendSignal(&transport, category, method, payload, false, true, &error));
+
+    g_assert_cmpint(fixture->lstransportsendmessage_call_count, ==, 2);
+    g_assert(fixture->lstransportsendmessage_coalesced);
 }
 
 static void
@@ -197,6 +211,7 @@ _LSTransportSendMessage(_LSTransportMessage *message, _LSTransportClient *client
                         LSMessageToken *token, LSError *lserror)
 {
     ++test_data->lstransportsendmessage_call_count;
+    test_data->lstransportsendmessage_coalesced = _LSTransportMessageIsCoalesced(message);
     return true;
 }
 
@@ -0,0 +1,282 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <transport_priv.h>
+#include <transport_client.h>
+#include <transport_trace.h>
+
+/* Test data ******************************************************************/
+
+static _LSTransport mvar_transport;
+
+typedef struct {
+    _LSTransportTraceRing *ring;
+    _LSTransportTraceRecord *record;
+} TestData;
+
+static void
+test_setup(TestData *fixture, gconstpointer user_data)
+{
+    fixture->ring = g_malloc0(_LSTransportTraceRingSize());
+    fixture->record = g_malloc0(TRACE_RECORD_SIZE);
+    _LSTransportTraceRingInit(fixture->ring, 42);
+}
+
+static void
+test_teardown(TestData *fixture, gconstpointer user_data)
+{
+    g_free(fixture->record);
+    g_free(fixture->ring);
+}
+
+/* Signal "category/method" with the payload */
+static _LSTransportMessage*
+new_signal(const char *payload, LSMessageToken token)
+{
+    GString *body = g_string_new("/category");
+    g_string_append_c(body, '\0');
+    g_string_append(body, "method");
+    g_string_append_c(body, '\0');
+    g_string_append(body, payload);
+    g_string_append_c(body, '\0');
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(body->len);
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeSignal);
+    _LSTransportMessageSetToken(message, token);
+    _LSTransportMessageSetBody(message, body->str, body->len);
+
+    g_string_free(body, TRUE);
+    return message;
+}
+
+static bool
+append(_LSTransportTraceRing *ring, _LSTransportMessage *message, _LSTransportMonitorSerial serial)
+{
+    _LSMonitorMessageData message_data = { .serial = serial, .type = _LSMonitorMessageTypeTx };
+
+    return _LSTransportTraceRingAppend(ring, message, "com.name.sender", "SENDER",
+                                       "com.name.dest", "DEST", &message_data);
+}
+
+/* Test cases *****************************************************************/
+
+static void
+test_LSTransportTraceRingOrder(TestData *fixture, gconstpointer user_data)
+{
+    int i;
+
+    /* case: nothing to read */
+    g_assert(!_LSTransportTraceRingRead(fixture->ring, fixture->record));
+
+    /* case: the records come out in the order they went in, lap after lap */
+    for (i = 0; i < 3 * TRACE_RING_SLOTS; i++)
+    {
+        _LSTransportMessage *message = new_signal("{}", i);
+        g_assert(append(fixture->ring, message, i));
+        _LSTransportMessageUnref(message);
+
+        g_assert(_LSTransportTraceRingRead(fixture->ring, fixture->record));
+        g_assert_cmpint(fixture->record->token, ==, i);
+        g_assert_cmpint(fixture->record->message_data.serial, ==, i);
+    }
+    g_assert(!_LSTransportTraceRingRead(fixture->ring, fixture->record));
+    g_assert_cmpint(fixture->ring->dropped, ==, 0);
+}
+
+static void
+test_LSTransportTraceRingFull(TestData *fixture, gconstpointer user_data)
+{
+    _LSTransportMessage *message = new_signal("{}", 1);
+    int i;
+
+    for (i = 0; i < TRACE_RING_SLOTS; i++)
+    {
+        g_assert(append(fixture->ring, message, i));
+    }
+
+    /* case: a full ring drops the record */
+    g_assert(!append(fixture->ring, message, i));
+    g_assert_cmpint(fixture->ring->dropped, ==, 1);
+
+    /* case: reading makes room */
+    g_assert(_LSTransportTraceRingRead(fixture->ring, fixture->record));
+    g_assert_cmpint(fixture->record->message_data.serial, ==, 0);
+    g_assert(append(fixture->ring, message, i));
+    g_assert_cmpint(fixture->ring->dropped, ==, 1);
+
+    _LSTransportMessageUnref(message);
+}
+
+static void
+test_LSTransportTraceRecordToMessage(TestData *fixture, gconstpointer user_data)
+{
+    _LSTransportClient *sender = _LSTransportClientNewRef(&mvar_transport, -1, "com.name.sender", "SENDER", NULL);
+    g_assert(sender != NULL);
+
+    _LSTransportMessage *message = new_signal("{\"returnValue\":true}", 7);
+    g_assert(append(fixture->ring, message, 100));
+    _LSTransportMessageUnref(message);
+
+    g_assert(_LSTransportTraceRingRead(fixture->ring, fixture->record));
+    g_assert(_LSTransportTraceRecordValid(fixture->record));
+    g_assert(!fixture->record->truncated);
+    g_assert_cmpstr(_LSTransportTraceRecordGetName(fixture->record, 0), ==, "com.name.sender");
+    g_assert_cmpstr(_LSTransportTraceRecordGetName(fixture->record, 1), ==, "SENDER");
+
+    /* case: the monitor gets what it would get over its socket */
+    message = _LSTransportTraceRecordToMessage(fixture->record, sender);
+    g_assert(_LSTransportMessageGetClient(message) == sender);
+    g_assert_cmpint(_LSTransportMessageGetType(message), ==, _LSTransportMessageTypeSignal);
+    g_assert_cmpint(_LSTransportMessageGetToken(message), ==, 7);
+    g_assert_cmpstr(_LSTransportMessageGetCategory(message), ==, "/category");
+    g_assert_cmpstr(_LSTransportMessageGetMethod(message), ==, "method");
+    g_assert_cmpstr(_LSTransportMessageGetPayload(message), ==, "{\"returnValue\":true}");
+    g_assert_cmpstr(_LSTransportMessageGetDestServiceName(message), ==, "com.name.dest");
+    g_assert_cmpstr(_LSTransportMessageGetDestUniqueName(message), ==, "DEST");
+
+    const _LSMonitorMessageData *message_data = _LSTransportMessageGetMonitorMessageData(message);
+    g_assert_cmpint(message_data->serial, ==, 100);
+    g_assert_cmpint(message_data->type, ==, _LSMonitorMessageTypeTx);
+
+    _LSTransportMessageUnref(message);
+    _LSTransportClientUnref(sender);
+}
+
+static void
+test_LSTransportTraceRecordTruncated(TestData *fixture, gconstpointer user_data)
+{
+    char *payload = g_strnfill(4 * TRACE_RECORD_SIZE, 'x');
+
+    _LSTransportMessage *message = new_signal(payload, 1);
+    g_assert(append(fixture->ring, message, 1));
+    _LSTransportMessageUnref(message);
+
+    /* case: the payload is cut to fit, the rest of the message is intact */
+    g_assert(_LSTransportTraceRingRead(fixture->ring, fixture->record));
+    g_assert(fixture->record->truncated);
+    g_assert_cmpuint(fixture->record->names_size + fixture->record->body_size, <=, TRACE_RECORD_DATA_SIZE);
+
+    _LSTransportClient *sender = _LSTransportClientNewRef(&mvar_transport, -1, "com.name.sender", "SENDER", NULL);
+    message = _LSTransportTraceRecordToMessage(fixture->record, sender);
+
+    const char *kept = _LSTransportMessageGetPayload(message);
+    g_assert_cmpuint(strlen(kept), >, 0);
+    g_assert(strncmp(kept, payload, strlen(kept)) == 0);
+    g_assert_cmpstr(_LSTransportMessageGetMethod(message), ==, "method");
+    g_assert_cmpstr(_LSTransportMessageGetDestUniqueName(message), ==, "DEST");
+
+    _LSTransportMessageUnref(message);
+    _LSTransportClientUnref(sender);
+    g_free(payload);
+}
+
+static void
+test_LSTransportTraceRecordValid(TestData *fixture, gconstpointer user_data)
+{
+    _LSTransportTraceRecord *record = fixture->record;
+
+    _LSTransportMessage *message = new_signal("{}", 1);
+    g_assert(append(fixture->ring, message, 1));
+    _LSTransportMessageUnref(message);
+
+    g_assert(_LSTransportTraceRingRead(fixture->ring, record));
+    g_assert(_LSTransportTraceRecordValid(record));
+
+    uint16_t names_size = record->names_size;
+    uint32_t body_size = record->body_size;
+
+    /* case: sizes past the end of the record */
+    record->body_size = TRACE_RECORD_DATA_SIZE - names_size + 1;
+    g_assert(!_LSTransportTraceRecordValid(record));
+    record->body_size = body_size;
+    record->names_size = UINT16_MAX;
+    g_assert(!_LSTransportTraceRecordValid(record));
+
+    /* case: the last name isn't terminated within the names */
+    record->names_size = names_size - 1;
+    g_assert(!_LSTransportTraceRecordValid(record));
+
+    /* case: no NUL at all */
+    record->names_size = names_size;
+    memset(record->data, 'x', names_size);
+    g_assert(!_LSTransportTraceRecordValid(record));
+
+    /* case: more than the four names */
+    memcpy(record->data, "a\0b\0c\0d\0e", 10);
+    record->names_size = 10;
+    record->body_size = 0;
+    g_assert(!_LSTransportTraceRecordValid(record));
+    record->names_size = 8;
+    g_assert(_LSTransportTraceRecordValid(record));
+    g_assert_cmpstr(_LSTransportTraceRecordGetName(record, 3), ==, "d");
+}
+
+static void
+test_LSTransportTraceRingLifetime(TestData *fixture, gconstpointer user_data)
+{
+    static _LSTransport transport;
+    LSError error;
+    LSErrorInit(&error);
+    g_assert(_LSTransportShmInit(&transport.shm, &error));
+
+    _LSTransportClient *client = _LSTransportClientNewRef(&transport, -1, "com.name.dest", "DEST", NULL);
+    _LSTransportMessage *message = new_signal("{}", 1);
+    char *path = g_strdup_printf("/dev/shm/ls2.trace.%d", (int) getpid());
+
+    /* case: the ring comes with the first message traced */
+    _LSTransportTraceSetEnabled(&transport, true);
+    g_assert(_LSTransportTraceEnabled(&transport));
+    g_assert(!g_file_test(path, G_FILE_TEST_EXISTS));
+    _LSTransportTraceMessage(message, client, _LSMonitorMessageTypeTx, NULL);
+    g_assert(g_file_test(path, G_FILE_TEST_EXISTS));
+
+    /* case: and goes when tracing stops */
+    _LSTransportTraceSetEnabled(&transport, false);
+    g_assert(!_LSTransportTraceEnabled(&transport));
+    g_assert(!g_file_test(path, G_FILE_TEST_EXISTS));
+
+    /* case: a message racing with the switch doesn't bring it back */
+    _LSTransportTraceMessage(message, client, _LSMonitorMessageTypeTx, NULL);
+    g_assert(!g_file_test(path, G_FILE_TEST_EXISTS));
+
+    g_free(path);
+    _LSTransportMessageUnref(message);
+    _LSTransportClientUnref(client);
+    _LSTransportShmDeinit(&transport.shm);
+}
+
+/* Test suite *****************************************************************/
+
+#define LSTEST_ADD(name, func) \
+    g_test_add(name, TestData, NULL, test_setup, func, test_teardown)
+
+int
+main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    LSTEST_ADD("/luna-service2/LSTransportTraceRingOrder", test_LSTransportTraceRingOrder);
+    LSTEST_ADD("/luna-service2/LSTransportTraceRingFull", test_LSTransportTraceRingFull);
+    LSTEST_ADD("/luna-service2/LSTransportTraceRecordToMessage", test_LSTransportTraceRecordToMessage);
+    LSTEST_ADD("/luna-service2/LSTransportTraceRecordTruncated", test_LSTransportTraceRecordTruncated);
+    LSTEST_ADD("/luna-service2/LSTransportTraceRecordValid", test_LSTransportTraceRecordValid);
+    LSTEST_ADD("/luna-service2/LSTransportTraceRingLifetime", test_LSTransportTraceRingLifetime);
+
+    return g_test_run();
+}
@@ -1,4 +1,4 @@
-// Copyright (c) 2008-2018 LG Electronics, Inc.
+// Copyright (c) 2008-2021 LG Electronics, Inc.
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -29,6 +29,7 @@
 
 #include "timersource.h"
 #include "clock.h"
+#include "error.h"
 #include "log.h"
 
 /** @cond INTERNAL */
@@ -258,4 +259,528 @@ g_timer_source_get_interval_ms(GTimerSource *tsource)
     return tsource->interval_ms;
 }
 
+/**
+ * Timer wheel - one GSource per GMainContext that drives any number of
+ * one-shot or periodic timeouts.
+ *
+ * Every attached GSource costs the main loop a prepare and a check on each
+ * iteration, so tens of thousands of pending call timeouts made idle
+ * iterations linear in their number. The wheel keeps them in hashed slots
+ * instead: 4 levels of 64 slots each with a 1 ms tick, the lowest level
+ * covering the next 64 ms, the highest about 4.6 hours (longer timeouts
+ * park in its last slot and are re-hashed when it comes around). Adding
+ * and removing a timeout is O(1), and so is preparing the source: the
+ * next expiration is found from a bitmap of the occupied slots of each
+ * level.
+ *
+ * The timeouts are addressed with ids like GSource ids, so that the users
+ * keep the g_timeout_add_full()/g_source_remove() pattern.
+ */
+
+#define TIMER_WHEEL_LEVELS      4
+#define TIMER_WHEEL_SLOT_BITS   6
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK   (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_SPAN        (G_GUINT64_CONSTANT(1) << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))
+
+typedef struct _LSTimerWheel _LSTimerWheel;
+typedef struct _LSTimer _LSTimer;
+
+struct _LSTimer
+{
+    _LSTimer       *next;           /* next timer in the slot, or in the due list */
+    _LSTimer      **pprev;          /* link pointing at this timer (NULL while due) */
+    _LSTimerWheel  *wheel;
+    guint           id;
+    guint           interval_ms;
+    guint64         expires;        /* tick to fire at */
+    gint8           level;
+    guint8          slot;
+    gboolean        cancelled;      /* removed while due or running */
+    GSourceFunc     function;
+    gpointer        data;
+    GDestroyNotify  notify;
+};
+
+struct _LSTimerWheel
+{
+    GSource         source;
+    GMainContext   *context;
+    gint64          origin_ms;                  /* monotonic time of tick 0 */
+    guint64         tick;                       /* last tick processed */
+    guint64         wakeup;                     /* tick the context is sleeping until */
+    guint           count;                      /* timers in the slots */
+    guint64         occupied[TIMER_WHEEL_LEVELS];
+    _LSTimer       *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+/* One lock covers all the wheels: timeouts are added and removed from any
+ * thread, and the work under it is a few pointer updates. */
+static GMutex timer_wheel_lock;
+static GHashTable *timer_wheels;    /* GMainContext* -> _LSTimerWheel* */
+static GHashTable *timer_ids;       /* id -> _LSTimer* */
+static guint timer_last_id;
+
+static gint64
+timer_wheel_now_ms(void)
+{
+    struct timespec now;
+    ClockGetTime(&now);
+    return (gint64) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static guint64
+timer_wheel_now(_LSTimerWheel *wheel)
+{
+    return timer_wheel_now_ms() - wheel->origin_ms;
+}
+
+/* Wheel time is truncated to whole milliseconds, so count from the end of
+ * the current one: a timeout never fires early */
+static guint64
+timer_wheel_expires(_LSTimerWheel *wheel, guint64 now, guint interval_ms)
+{
+    return MAX(now, wheel->tick) + interval_ms + 1;
+}
+
+static void
+timer_wheel_insert(_LSTimerWheel *wheel, _LSTimer *timer)
+{
+    guint64 delta = timer->expires - wheel->tick;
+    guint64 hash_tick = timer->expires;
+    gint level = 0;
+
+    LS_ASSERT(timer->expires >= wheel->tick);
+
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= G_GUINT64_CONSTANT(1) << (TIMER_WHEEL_SLOT_BITS * (level + 1)))
+    {
+        level++;
+    }
+    if (delta >= TIMER_WHEEL_SPAN)
+    {
+        hash_tick = wheel->tick + TIMER_WHEEL_SPAN - 1;
+    }
+
+    timer->level = level;
+    timer->slot = (hash_tick >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+
+    _LSTimer **head = &wheel->slots[level][timer->slot];
+    timer->next = *head;
+    if (timer->next) timer->next->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+
+    wheel->occupied[level] |= G_GUINT64_CONSTANT(1) << timer->slot;
+    wheel->count++;
+}
+
+static void
+timer_wheel_unlink(_LSTimerWheel *wheel, _LSTimer *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->pprev = NULL;
+    timer->next = NULL;
+
+    if (!wheel->slots[timer->level][timer->slot])
+    {
+        wheel->occupied[timer->level] &= ~(G_GUINT64_CONSTANT(1) << timer->slot);
+    }
+    wheel->count--;
+}
+
+/* Take all timers out of a slot */
+static _LSTimer*
+timer_wheel_take_slot(_LSTimerWheel *wheel, gint level, guint slot)
+{
+    _LSTimer *list = wheel->slots[level][slot];
+    _LSTimer *timer;
+
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(G_GUINT64_CONSTANT(1) << slot);
+
+    for (timer = list; timer; timer = timer->next)
+    {
+        timer->pprev = NULL;
+        wheel->count--;
+    }
+    return list;
+}
+
+/* Process ticks up to now, returning the timers that are due */
+static _LSTimer*
+timer_wheel_advance(_LSTimerWheel *wheel, guint64 now)
+{
+    _LSTimer *due = NULL;
+
+    while (wheel->tick < now)
+    {
+        /* nothing to fire on the lowest level: skip to its next turn */
+        if (!wheel->occupied[0])
+        {
+            guint64 turn = (wheel->tick | TIMER_WHEEL_SLOT_MASK) + 1;
+            if (turn > now)
+            {
+                wheel->tick = now;
+                break;
+            }
+            wheel->tick = turn - 1;
+        }
+
+        guint64 tick = ++wheel->tick;
+        gint level;
+
+        /* when a level completes a turn, spread the next slot of the level
+         * above over the levels below, highest first */
+        for (level = 1; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            if (tick & ((G_GUINT64_CONSTANT(1) << (TIMER_WHEEL_SLOT_BITS * level)) - 1))
+                break;
+        }
+        while (--level > 0)
+        {
+            guint slot = (tick >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+            _LSTimer *timer = timer_wheel_take_slot(wheel, level, slot);
+            while (timer)
+            {
+                _LSTimer *next = timer->next;
+                timer_wheel_insert(wheel, timer);
+                timer = next;
+            }
+        }
+
+        _LSTimer *timer = timer_wheel_take_slot(wheel, 0, tick & TIMER_WHEEL_SLOT_MASK);
+        while (timer)
+        {
+            _LSTimer *next = timer->next;
+            timer->next = due;
+            due = timer;
+            timer = next;
+        }
+    }
+
+    return due;
+}
+
+/* Earliest tick at which something is due or a slot has to be spread */
+static guint64
+timer_wheel_next(_LSTimerWheel *wheel)
+{
+    guint64 next = G_MAXUINT64;
+    gint level;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        if (!wheel->occupied[level])
+            continue;
+
+        guint shift = TIMER_WHEEL_SLOT_BITS * level;
+        guint from = (((wheel->tick >> shift) & TIMER_WHEEL_SLOT_MASK) + 1) & TIMER_WHEEL_SLOT_MASK;
+        guint64 bits = wheel->occupied[level];
+
+        /* rotate so that bit 0 is the slot after the current one */
+        if (from)
+            bits = (bits >> from) | (bits << (TIMER_WHEEL_SLOTS - from));
+
+        guint64 offset = __builtin_ctzll(bits) + 1;
+        guint64 at = level == 0
+                   ? wheel->tick + offset
+                   : ((wheel->tick >> shift) + offset) << shift;
+
+        next = MIN(next, at);
+    }
+
+    return next;
+}
+
+static gboolean
+timer_wheel_prepare(GSource *source, gint *timeout_ms)
+{
+    _LSTimerWheel *wheel = (_LSTimerWheel*) source;
+    gboolean ready = FALSE;
+
+    g_mutex_lock(&timer_wheel_lock);
+
+    wheel->wakeup = wheel->count ? timer_wheel_next(wheel) : G_MAXUINT64;
+    if (wheel->wakeup == G_MAXUINT64)
+    {
+        *timeout_ms = -1;
+    }
+    else
+    {
+        guint64 now = timer_wheel_now(wheel);
+        ready = wheel->wakeup <= now;
+        *timeout_ms = ready ? 0 : (gint) MIN(wheel->wakeup - now, G_MAXINT);
+    }
+
+    g_mutex_unlock(&timer_wheel_lock);
+
+    return ready;
+}
+
+static gboolean
+timer_wheel_check(GSource *source)
+{
+    _LSTimerWheel *wheel = (_LSTimerWheel*) source;
+
+    g_mutex_lock(&timer_wheel_lock);
+    gboolean ready = wheel->wakeup <= timer_wheel_now(wheel);
+    g_mutex_unlock(&timer_wheel_lock);
+
+    return ready;
+}
+
+/* @attention must be called with the lock held */
+static void
+timer_wheel_forget(_LSTimer *timer)
+{
+    g_hash_table_remove(timer_ids, GUINT_TO_POINTER(timer->id));
+}
+
+static void
+timer_free(_LSTimer *timer)
+{
+    if (timer->notify)
+        timer->notify(timer->data);
+    g_slice_free(_LSTimer, timer);
+}
+
+static gboolean
+timer_wheel_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    _LSTimerWheel *wheel = (_LSTimerWheel*) source;
+
+    g_mutex_lock(&timer_wheel_lock);
+    _LSTimer *due = timer_wheel_advance(wheel, timer_wheel_now(wheel));
+    g_mutex_unlock(&timer_wheel_lock);
+
+    while (due)
+    {
+        _LSTimer *timer = due;
+        due = timer->next;
+        timer->next = NULL;
+
+        g_mutex_lock(&timer_wheel_lock);
+        gboolean again = !timer->cancelled;
+        g_mutex_unlock(&timer_wheel_lock);
+
+        if (again)
+        {
+            again = timer->function(timer->data);
+        }
+
+        g_mutex_lock(&timer_wheel_lock);
+        if (again && !timer->cancelled)
+        {
+            timer->expires = timer_wheel_expires(wheel, timer_wheel_now(wheel), timer->interval_ms);
+            timer_wheel_insert(wheel, timer);
+            timer = NULL;
+        }
+        else
+        {
+            timer_wheel_forget(timer);
+        }
+        g_mutex_unlock(&timer_wheel_lock);
+
+        if (timer)
+            timer_free(timer);
+    }
+
+    /* an empty wheel leaves the context; the next timeout creates a new one */
+    gboolean keep = TRUE;
+    g_mutex_lock(&timer_wheel_lock);
+    if (!wheel->count && g_hash_table_lookup(timer_wheels, wheel->context) == wheel)
+    {
+        g_hash_table_remove(timer_wheels, wheel->context);
+        keep = FALSE;
+    }
+    g_mutex_unlock(&timer_wheel_lock);
+
+    return keep;
+}
+
+static void
+timer_wheel_finalize(GSource *source)
+{
+    _LSTimerWheel *wheel = (_LSTimerWheel*) source;
+    _LSTimer *left = NULL;
+    gint level;
+    guint slot;
+
+    /* the context went away with timeouts pending: they never fire */
+    g_mutex_lock(&timer_wheel_lock);
+    if (g_hash_table_lookup(timer_wheels, wheel->context) == wheel)
+    {
+        g_hash_table_remove(timer_wheels, wheel->context);
+    }
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            _LSTimer *timer = timer_wheel_take_slot(wheel, level, slot);
+            while (timer)
+            {
+                _LSTimer *next = timer->next;
+                timer_wheel_forget(timer);
+                timer->next = left;
+                left = timer;
+                timer = next;
+            }
+        }
+    }
+    g_mutex_unlock(&timer_wheel_lock);
+
+    while (left)
+    {
+        _LSTimer *timer = left;
+        left = timer->next;
+        timer_free(timer);
+    }
+}
+
+static GSourceFuncs timer_wheel_funcs = {
+    .prepare  = timer_wheel_prepare,
+    .check    = timer_wheel_check,
+    .dispatch = timer_wheel_dispatch,
+    .finalize = timer_wheel_finalize,
+};
+
+/* @attention must be called with the lock held */
+static _LSTimerWheel*
+timer_wheel_get(GMainContext *context)
+{
+    if (!timer_wheels)
+    {
+        timer_wheels = g_hash_table_new(g_direct_hash, g_direct_equal);
+        timer_ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+
+    _LSTimerWheel *wheel = g_hash_table_lookup(timer_wheels, context);
+    if (!wheel)
+    {
+        wheel = (_LSTimerWheel*) g_source_new(&timer_wheel_funcs, sizeof(_LSTimerWheel));
+        wheel->context = context;
+        wheel->origin_ms = timer_wheel_now_ms();
+        wheel->wakeup = G_MAXUINT64;
+        g_source_set_name((GSource*) wheel, "LSTimerWheel");
+        g_source_attach((GSource*) wheel, context);
+        g_source_unref((GSource*) wheel);
+
+        g_hash_table_insert(timer_wheels, context, wheel);
+    }
+    return wheel;
+}
+
+/**
+ *******************************************************************************
+ * @brief Call a function after a timeout, from the timer wheel of a main
+ * context.
+ *
+ * Like g_timeout_add_full(), the function is called again every
+ * @p interval_ms for as long as it returns TRUE. Thread safe.
+ *
+ * @param  context      IN  main context to call @p function from (NULL for
+ *                          the default one)
+ * @param  interval_ms  IN  timeout in milliseconds
+ * @param  function     IN  function to call
+ * @param  data         IN  data to pass to @p function
+ * @param  notify       IN  called with @p data once the timeout is gone (or NULL)
+ *
+ * @retval id of the timeout, for @ref _LSTimerWheelRemove
+ *******************************************************************************
+ */
+guint
+_LSTimerWheelAdd(GMainContext *context, guint interval_ms,
+                 GSourceFunc function, gpointer data, GDestroyNotify notify)
+{
+    LS_ASSERT(function != NULL);
+
+    if (!context)
+        context = g_main_context_default();
+
+    _LSTimer *timer = g_slice_new0(_LSTimer);
+    timer->interval_ms = interval_ms;
+    timer->function = function;
+    timer->data = data;
+    timer->notify = notify;
+
+    g_mutex_lock(&timer_wheel_lock);
+
+    _LSTimerWheel *wheel = timer_wheel_get(context);
+    timer->wheel = wheel;
+
+    do
+    {
+        timer->id = ++timer_last_id;
+    } while (timer->id == 0 || g_hash_table_contains(timer_ids, GUINT_TO_POINTER(timer->id)));
+    g_hash_table_insert(timer_ids, GUINT_TO_POINTER(timer->id), timer);
+
+    /* the wheel may not have caught up with time while the context slept;
+     * an empty one has nothing to catch up on */
+    guint64 now = timer_wheel_now(wheel);
+    if (!wheel->count && now > wheel->tick)
+        wheel->tick = now;
+    timer->expires = timer_wheel_expires(wheel, now, interval_ms);
+    timer_wheel_insert(wheel, timer);
+
+    guint id = timer->id;
+    gboolean wakeup = timer->expires < wheel->wakeup;
+    if (wakeup)
+        wheel->wakeup = timer->expires;
+
+    g_mutex_unlock(&timer_wheel_lock);
+
+    /* the context may be sleeping past the new timeout */
+    if (wakeup)
+        g_main_context_wakeup(context);
+
+    return id;
+}
+
+/**
+ *******************************************************************************
+ * @brief Remove a timeout added with @ref _LSTimerWheelAdd.
+ *
+ * The function of the timeout isn't called after this returns, unless it
+ * is running already (possibly removing the timeout itself).
+ *
+ * @param  id   IN  timeout id
+ *
+ * @retval true if the timeout was found
+ *******************************************************************************
+ */
+bool
+_LSTimerWheelRemove(guint id)
+{
+    g_mutex_lock(&timer_wheel_lock);
+
+    _LSTimer *timer = timer_ids ? g_hash_table_lookup(timer_ids, GUINT_TO_POINTER(id)) : NULL;
+    if (!timer)
+    {
+        g_mutex_unlock(&timer_wheel_lock);
+        return false;
+    }
+
+    if (!timer->pprev)
+    {
+        /* due or running: the dispatch frees it */
+        timer->cancelled = TRUE;
+        timer = NULL;
+    }
+    else
+    {
+        timer_wheel_unlink(timer->wheel, timer);
+        timer_wheel_forget(timer);
+    }
+
+    g_mutex_unlock(&timer_wheel_lock);
+
+    if (timer)
+        timer_free(timer);
+
+    return true;
+}
+
+
 /** @endcond */
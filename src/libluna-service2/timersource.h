@@ -1,4 +1,4 @@
-// Copyright (c) 2008-2018 LG Electronics, Inc.
+// Copyright (c) 2008-2021 LG Electronics, Inc.
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -18,6 +18,7 @@
 #define _TIME_SOURCE_H_
 
 #include <stdbool.h>
+#include <glib.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,6 +36,11 @@ void g_timer_source_set_interval(GTimerSource *tsource, guint interval, gboolean
 
 guint g_timer_source_get_interval_ms(GTimerSource *tsource);
 
+guint _LSTimerWheelAdd(GMainContext *context, guint interval_ms,
+                       GSourceFunc function, gpointer data, GDestroyNotify notify);
+
+bool _LSTimerWheelRemove(guint id);
+
 /** @endcond */
 
 #ifdef __cplusplus
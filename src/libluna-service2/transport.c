@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <sys/un.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <pthread.h>
 #include <errno.h>
 #include <unistd.h>
@@ -29,6 +30,7 @@
 
 #include "transport.h"
 #include "transport_priv.h"
+#include "transport_trace.h"
 #include "transport_utils.h"
 #include "base.h"
 #include "message.h"
@@ -116,7 +118,9 @@ bool _LSTransportProcessIncomingMessages(_LSTransportClient *client, LSError *ls
 
 bool _LSTransportSendMessageClientInfo(_LSTransportClient *client, const char *service_name, const char *unique_name, bool prepend, LSError *lserror);
 static bool _LSTransportSendMessageMonitor(_LSTransportMessage *message, _LSTransportClient *monitor, _LSMonitorMessageType type, const struct timespec *timestamp, LSError *lserror);
+static void _LSTransportSetMonitorFilter(_LSTransport *transport, _LSTransportMonitorFilter *filter);
 static bool _LSTransportSendMessageRaw(_LSTransportMessage *message, _LSTransportClient *client, bool set_token, LSMessageToken *token, bool prepend, LSError *lserror);
+static void _LSTransportRunUserMessageHandler(_LSTransportMessage *message);
 bool _LSTransportAddPendingMessageWithToken(_LSTransport *transport, const char *origin_exe, const char *origin_id, const char *origin_name, const char *service_name, _LSTransportMessage *message, LSMessageToken msg_token, LSError *lserror);
 bool _LSTransportAddPendingMessage(_LSTransport *transport, const char *origin_exe, const char *origin_id, const char *origin_name, const char *service_name, _LSTransportMessage *message, LSMessageToken *token, LSError *lserror);
 
@@ -128,6 +132,13 @@ bool _LSTransportQueryProxyName(_LSTransportClient *hub, const char *origin_exe,
                            const char *service_name, LSError *lserror);
 bool _LSTransportQueryName(_LSTransportClient *hub, _LSTransportMessage *trigger_message,
                       const char *service_name, LSError *lserror);
+const char* _LSTransportQueryNameReplyGetAppId(_LSTransportMessage *message);
+const char* _LSTransportQueryNameReplyGetGroups(_LSTransportMessage *message);
+const char* _LSTransportQueryNameReplyGetTrustlevelString(_LSTransportMessage *message);
+const char* _LSTransportQueryNameReplyGetExePath(_LSTransportMessage *message);
+unsigned _LSTransportQueryNameReplyGetFeatures(_LSTransportMessage *message);
+bool _LSTransportQueryNameReplyGetIsDynamic(_LSTransportMessage *message);
+_LSTransportClientPermissions _LSTransportQueryNameReplyGetPermissions(_LSTransportMessage *message);
 
 static void _LSTransportSetTransportFlags(_LSTransport *transport, int32_t transport_flags);
 // Initialize "provides" groups. json - an array of object, each object - category(or pattern) with array of string,each string - security group
@@ -386,12 +397,13 @@ _LSTransportClientShutdownProcessQueue(_LSTransport *transport, _LSTransportOutg
         LOG_LS_DEBUG("last serial: %d\n", (int)last_serial);
 
         OUTGOING_LOCK(&outgoing->lock);
+        _LSTransportOutgoingCollect(outgoing);
 
         /* for each item in outbound queue */
         while (!g_queue_is_empty(outgoing->queue))
         {
             /* grab message off queue */
-            _LSTransportMessage *failed_message = (_LSTransportMessage*)g_queue_pop_head(outgoing->queue);
+            _LSTransportMessage *failed_message = _LSTransportOutgoingPopHead(outgoing);
 
             // We can be reentered from the callback. So don't hold the lock during the callback
             OUTGOING_UNLOCK(&outgoing->lock);
@@ -629,6 +641,7 @@ _LSTransportHandleShutdown(_LSTransportMessage *message)
         TRANSPORT_LOCK(&client->transport->lock);
 
         OUTGOING_LOCK(&client->outgoing->lock);
+        _LSTransportOutgoingCollect(client->outgoing);
 
         LS_ASSERT(g_hash_table_lookup(client->transport->pending, client->service_name) == NULL);
 
@@ -659,7 +672,7 @@ _LSTransportHandleShutdown(_LSTransportMessage *message)
                    (outgoing_message_token = _LSTransportMessageGetToken(outgoing_message)) <= serial_message_token
             )
             {
-                outgoing_message = g_queue_pop_head(client->outgoing->queue);
+                outgoing_message = _LSTransportOutgoingPopHead(client->outgoing);
 
                 if (outgoing_message_token < serial_message_token)
                 {
@@ -679,7 +692,7 @@ _LSTransportHandleShutdown(_LSTransportMessage *message)
         }
 
         // Move the remaining contents (if any) of the outgoing queue to the new pending queue
-        while ((outgoing_message = g_queue_pop_head(client->outgoing->queue)) != NULL)
+        while ((outgoing_message = _LSTransportOutgoingPopHead(client->outgoing)) != NULL)
         {
             LS_ASSERT(_LSTransportMessageTypeMethodCall != _LSTransportMessageGetType(outgoing_message));
             LS_ASSERT(_LSTransportMessageGetToken(outgoing_message) > serial_message_token);
@@ -804,10 +817,59 @@ _LSTransportAddInitialWatches(_LSTransport *transport, GMainContext *context)
         _LSTransportChannelAddAcceptWatch(&transport->listen_channel, context, transport);
 }
 
+/**
+ *******************************************************************************
+ * @brief Start the I/O thread of a transport being attached to @p context.
+ *
+ * @param  transport    IN  transport
+ * @param  context      IN  user's main loop context
+ *
+ * @retval  context to attach the watches to: the internal one of the I/O
+ *          thread, or @p context if the thread couldn't be started
+ *******************************************************************************
+ */
+static GMainContext*
+_LSTransportStartIoThread(_LSTransport *transport, GMainContext *context)
+{
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    _LSTransportIoThread *io_thread = _LSTransportIoThreadNew(context, transport->source_priority,
+                                                              _LSTransportRunUserMessageHandler);
+    if (!_LSTransportIoThreadStart(io_thread, &lserror))
+    {
+        LOG_LSERROR(MSGID_LS_IO_THREAD_ERR, &lserror);
+        LSErrorFree(&lserror);
+        _LSTransportIoThreadFree(io_thread);
+        return context;
+    }
+
+    /* Nothing is watched yet, so no handler can run while they are swapped */
+    LSTransportHandlers handlers = {
+        .message_failure_handler = transport->message_failure_handler,
+        .message_failure_context = transport->message_failure_context,
+        .disconnect_handler = transport->disconnect_handler,
+        .disconnect_context = transport->disconnect_context,
+    };
+    _LSTransportIoThreadWrapHandlers(io_thread, &handlers);
+
+    transport->message_failure_handler = handlers.message_failure_handler;
+    transport->message_failure_context = handlers.message_failure_context;
+    transport->disconnect_handler = handlers.disconnect_handler;
+    transport->disconnect_context = handlers.disconnect_context;
+
+    transport->io_thread = io_thread;
+    return io_thread->context;
+}
+
 /**
  *******************************************************************************
  * @brief Associate a GMainContext set of sources with this transport.
  *
+ * With an I/O thread (see @ref _LSTransportSetIoThread) the sources go to the
+ * internal context of the thread instead, and only the user's callbacks run
+ * from @p context.
+ *
  * @param  transport    IN  transport
  * @param  context      IN  main loop context
  *******************************************************************************
@@ -820,6 +882,11 @@ _LSTransportGmainAttach(_LSTransport *transport, GMainContext *context)
 
     LOG_LS_DEBUG("%s: mainloop_context: %p\n", __func__, transport->mainloop_context);
 
+    if (transport->use_io_thread)
+    {
+        context = _LSTransportStartIoThread(transport, context);
+    }
+
     transport->mainloop_context = g_main_context_ref(context);
 
     _LSTransportAddInitialWatches(transport, transport->mainloop_context);
@@ -841,6 +908,48 @@ _LSTransportGetGmainContext(const _LSTransport *transport)
     return transport->mainloop_context;
 }
 
+/**
+ *******************************************************************************
+ * @brief Get the GMainContext the user's callbacks run in. It's the one the
+ * watches are attached to unless there is an I/O thread.
+ *
+ * @param  transport    IN  transport
+ *
+ * @retval  GMainContext or NULL if not attached yet
+ *******************************************************************************
+ */
+GMainContext*
+_LSTransportGetUserContext(const _LSTransport *transport)
+{
+    LS_ASSERT(transport != NULL);
+    return transport->io_thread ? transport->io_thread->user_context : transport->mainloop_context;
+}
+
+/**
+ *******************************************************************************
+ * @brief Choose whether the transport runs its watches on an I/O thread of
+ * its own once it's attached to a main loop.
+ *
+ * @param  transport    IN  transport
+ * @param  enable       IN  true to use an I/O thread
+ * @param  lserror      OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false if the transport is attached already
+ *******************************************************************************
+ */
+bool
+_LSTransportSetIoThread(_LSTransport *transport, bool enable, LSError *lserror)
+{
+    LS_ASSERT(transport != NULL);
+
+    _LSErrorIfFailMsg(!transport->mainloop_context, lserror, MSGID_LS_IO_THREAD_ERR, -1,
+                      "The I/O thread has to be chosen before attaching to a main loop");
+
+    transport->use_io_thread = enable;
+    return true;
+}
+
 /**
  *******************************************************************************
  * @brief Set the glib mainloop priority for sending and receiving.
@@ -886,6 +995,12 @@ _LSTransportGmainSetPriority(_LSTransport *transport, int priority, LSError *lse
     /* set the priority for our accept watch */
     _LSTransportChannelSetPriority(&transport->listen_channel, priority);
 
+    /* and for the user callbacks when they come from the I/O thread */
+    if (transport->io_thread)
+    {
+        _LSTransportIoThreadSetPriority(transport->io_thread, priority);
+    }
+
     /* keep track of priority for future source creation */
     transport->source_priority = priority;
 
@@ -1007,7 +1122,9 @@ _LSTransportAddClientHash(_LSTransport *transport, _LSTransportClient *client, c
     _LSTransportClientRef(client);
 
     /* TODO: insert or replace ? */
+    pthread_rwlock_wrlock(&transport->clients_lock);
     g_hash_table_insert(transport->clients, (gpointer)name, client);
+    pthread_rwlock_unlock(&transport->clients_lock);
 
     return true;
 }
@@ -1055,11 +1172,44 @@ _LSTransportRemoveClientHash(_LSTransport *transport, _LSTransportClient *client
      * TODO: this is a linear search; it's only done on shutdown, but we should
      * still probably change it.
      */
+    pthread_rwlock_wrlock(&transport->clients_lock);
     int ret = g_hash_table_foreach_remove(transport->clients, _LSTransportClientHashRemoveFunc, client);
+    pthread_rwlock_unlock(&transport->clients_lock);
 
     LS_ASSERT(ret == 1 || ret == 0);
 }
 
+/**
+ *******************************************************************************
+ * @brief Look up a client by service name without taking the transport lock.
+ *
+ * Clients are only added and removed under the transport lock, so senders
+ * just need to keep the hash from changing under them. They take the read
+ * side of the clients lock and don't wait for each other.
+ *
+ * @param  transport    IN  transport
+ * @param  client_name  IN  client service name
+ *
+ * @retval client, ref'd, on success
+ * @retval NULL if there is no such client
+ *******************************************************************************
+ */
+static _LSTransportClient*
+_LSTransportLookupClientRef(_LSTransport *transport, const char *client_name)
+{
+    pthread_rwlock_rdlock(&transport->clients_lock);
+
+    _LSTransportClient *client = g_hash_table_lookup(transport->clients, client_name);
+    if (client)
+    {
+        _LSTransportClientRef(client);
+    }
+
+    pthread_rwlock_unlock(&transport->clients_lock);
+
+    return client;
+}
+
 /**
  *******************************************************************************
  * @brief Add client to hash of all clients. Key is file descriptor and value
@@ -1111,6 +1261,7 @@ _LSTransportRemoveAllConnectionHash(_LSTransport *transport, _LSTransportClient
         /* we had a ref associated with this */
         _LSTransportClientUnref(client);
         transport->monitor = NULL;
+        _LSTransportSetMonitorFilter(transport, NULL);
     }
 
     /* destroy function will unref client */
@@ -1310,10 +1461,12 @@ error:
 #define FD_CMSG_LEN     CMSG_LEN(sizeof(int))
 #define FD_CMSG_SPACE   CMSG_SPACE(sizeof(int))
 
+/* Batch replies pass all of their fds with a single marker; the fds after the
+ * first one are queued in @p extra_fds */
 static bool
-_LSTransportRecvFd(int fd, int *fd_to_recv, bool *retry, LSError *lserror)
+_LSTransportRecvFd(int fd, int *fd_to_recv, GQueue *extra_fds, bool *retry, LSError *lserror)
 {
-    char cmsg_buf[FD_CMSG_SPACE];
+    char cmsg_buf[CMSG_SPACE(sizeof(int) * LS_TRANSPORT_INCOMING_MAX_FDS)];
     struct msghdr fdmsg;
     struct cmsghdr *cmsg = NULL;
     struct iovec iov[1];
@@ -1361,25 +1514,35 @@ _LSTransportRecvFd(int fd, int *fd_to_recv, bool *retry, LSError *lserror)
         return true;
     }
 
-    if (fdmsg.msg_controllen != sizeof(cmsg_buf))
+    cmsg = CMSG_FIRSTHDR(&fdmsg);
+
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len < FD_CMSG_LEN)
     {
         /* expecting to get an fd, but it wasn't there */
-        _LSErrorSet(lserror, MSGID_LS_SOCK_ERROR, -1, "Expected an fd in message, but didn't receive one (expected len: %zd actual len: %zd)", sizeof(cmsg_buf), fdmsg.msg_controllen);
+        _LSErrorSet(lserror, MSGID_LS_SOCK_ERROR, -1, "Expected an fd in message, but didn't receive one (expected len: %zd actual len: %zd)", FD_CMSG_SPACE, fdmsg.msg_controllen);
         return false;
     }
 
-    cmsg = CMSG_FIRSTHDR(&fdmsg);
-
     int *cmsg_data = (int*)CMSG_DATA(cmsg);
-    *fd_to_recv = *cmsg_data;
+    size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    size_t i;
+
+    *fd_to_recv = cmsg_data[0];
+
+    for (i = 1; i < num_fds; i++)
+    {
+        g_queue_push_tail(extra_fds, GINT_TO_POINTER(cmsg_data[i]));
+    }
 
     return true;
 }
 
 static bool
-_LSTransportSendFd(int fd, int fd_to_send, bool *retry, LSError *lserror)
+_LSTransportSendFds(int fd, const int *fds_to_send, unsigned int count, bool *retry, LSError *lserror)
 {
-    char cmsg_buf[FD_CMSG_SPACE] = {0};
+    LS_ASSERT(count <= LS_TRANSPORT_INCOMING_MAX_FDS);
+
+    char cmsg_buf[CMSG_SPACE(sizeof(int) * LS_TRANSPORT_INCOMING_MAX_FDS)] = {0};
     struct msghdr fdmsg;
     struct iovec iov[1];
     char iov_buf[1] = {0};
@@ -1394,7 +1557,7 @@ _LSTransportSendFd(int fd, int fd_to_send, bool *retry, LSError *lserror)
     fdmsg.msg_namelen = 0;
     fdmsg.msg_flags = 0;
 
-    if (fd_to_send < 0)
+    if (count == 0)
     {
         fdmsg.msg_control = NULL;
         fdmsg.msg_controllen = 0;
@@ -1407,15 +1570,14 @@ _LSTransportSendFd(int fd, int fd_to_send, bool *retry, LSError *lserror)
         struct cmsghdr *cmsg = NULL;
 
         fdmsg.msg_control = cmsg_buf;
-        fdmsg.msg_controllen = sizeof(cmsg_buf);
+        fdmsg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
 
         cmsg = CMSG_FIRSTHDR(&fdmsg);
         cmsg->cmsg_level = SOL_SOCKET;
         cmsg->cmsg_type = SCM_RIGHTS;
-        cmsg->cmsg_len = FD_CMSG_LEN;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
 
-        int *cmsg_data = (int*)CMSG_DATA(cmsg);
-        *cmsg_data = fd_to_send;
+        memcpy(CMSG_DATA(cmsg), fds_to_send, sizeof(int) * count);
     }
 
     if ((ret = sendmsg(fd, &fdmsg, 0)) != 1)
@@ -1435,6 +1597,24 @@ _LSTransportSendFd(int fd, int fd_to_send, bool *retry, LSError *lserror)
     return true;
 }
 
+static bool
+_LSTransportSendFd(int fd, int fd_to_send, bool *retry, LSError *lserror)
+{
+    return _LSTransportSendFds(fd, &fd_to_send, fd_to_send < 0 ? 0 : 1, retry, lserror);
+}
+
+/* Send the fds that follow the body of an fd carrying message */
+static bool
+_LSTransportSendMessageFds(int fd, const _LSTransportMessage *message, bool *retry, LSError *lserror)
+{
+    if (_LSTransportMessageGetType(message) == _LSTransportMessageTypeQueryNameBatchReply)
+    {
+        return _LSTransportSendFds(fd, _LSTransportMessageGetFds(message),
+                                   _LSTransportMessageGetFdCount(message), retry, lserror);
+    }
+    return _LSTransportSendFd(fd, _LSTransportMessageGetFd(message), retry, lserror);
+}
+
 /**
  *******************************************************************************
  * @brief Send data until all has been sent or an error is encountered.
@@ -1532,6 +1712,40 @@ _LSTransportRecvComplete(int fd, void *buf, int len, LSError *lserror)
     return total_bytes_recvd;
 }
 
+/**
+ *******************************************************************************
+ * @brief Receive data until all has been received or an error is encountered.
+ * Data already read ahead into the client's staging buffer is consumed first.
+ *
+ * @param  client   IN  client
+ * @param  buf      IN  buf to store data
+ * @param  len      IN  size of @p buf
+ * @param  lserror  IN  set on error
+ *
+ * @retval bytes read on success (same as len)
+ * @retval -1 on failure
+ *******************************************************************************
+ */
+static int
+_LSTransportRecvBuffered(_LSTransportClient *client, void *buf, int len, LSError *lserror)
+{
+    int buffered = _LSTransportIncomingTakeBuffered(client->incoming, buf, len);
+
+    if (buffered == len)
+    {
+        return len;
+    }
+
+    int bytes_recvd = _LSTransportRecvComplete(client->channel.fd, (char*)buf + buffered, len - buffered, lserror);
+
+    if (bytes_recvd == -1)
+    {
+        return -1;
+    }
+
+    return buffered + bytes_recvd;
+}
+
 /**
  *******************************************************************************
  * @brief  Block until we receive the complete message of the specified type.
@@ -1579,7 +1793,7 @@ _LSTransportRecvMessageBlocking(_LSTransportClient *client, _LSTransportMessageT
      * to be handled later -- how do we kick the message handler? */
 
     /* TODO: use poll() with timeout value */
-    int bytes_recvd = _LSTransportRecvComplete(client->channel.fd, &header, sizeof(header), lserror);
+    int bytes_recvd = _LSTransportRecvBuffered(client, &header, sizeof(header), lserror);
 
     if (bytes_recvd == -1)
     {
@@ -1607,7 +1821,7 @@ _LSTransportRecvMessageBlocking(_LSTransportClient *client, _LSTransportMessageT
 
     _LSTransportMessageSetHeader(message, &header);
 
-    bytes_recvd = _LSTransportRecvComplete(client->channel.fd, _LSTransportMessageGetBody(message), message->raw->header.len, lserror);
+    bytes_recvd = _LSTransportRecvBuffered(client, _LSTransportMessageGetBody(message), message->raw->header.len, lserror);
 
     if (bytes_recvd == -1)
     {
@@ -1625,7 +1839,8 @@ _LSTransportRecvMessageBlocking(_LSTransportClient *client, _LSTransportMessageT
     {
         int recv_fd = -1;
         bool need_retry = false;
-        if (!_LSTransportRecvFd(client->channel.fd, &recv_fd, &need_retry, lserror))
+        if (!_LSTransportIncomingTakeFd(client->incoming, &recv_fd) &&
+            !_LSTransportRecvFd(client->channel.fd, &recv_fd, client->incoming->rx_fds, &need_retry, lserror))
         {
             LS_ASSERT(!need_retry);
             _LSTransportMessageUnref(message);
@@ -1633,7 +1848,18 @@ _LSTransportRecvMessageBlocking(_LSTransportClient *client, _LSTransportMessageT
             goto exit;
         }
 
-        _LSTransportMessageSetFd(message, recv_fd);
+        if (_LSTransportMessageGetType(message) == _LSTransportMessageTypeQueryNameBatchReply)
+            _LSTransportIncomingTakeBatchFds(client->incoming, message, recv_fd);
+        else
+            _LSTransportMessageSetFd(message, recv_fd);
+
+        if (message->raw->header.body_in_fd && !_LSTransportMessageMapMemfd(message))
+        {
+            _LSErrorSet(lserror, MSGID_LS_MEMFD_ERR, -EINVAL, "Unable to map message body");
+            _LSTransportMessageUnref(message);
+            message = NULL;
+            goto exit;
+        }
     }
 
 exit:
@@ -1699,16 +1925,25 @@ _LSTransportSendMessageBlocking(_LSTransportMessage *message, _LSTransportClient
 
     message->tx_bytes_remaining = message->raw->header.len + sizeof(_LSTransportHeader);
 
-    int send_ret = _LSTransportSendComplete(client->channel.fd, (char*)message->raw + message->raw->header.len + sizeof(_LSTransportHeader) - message->tx_bytes_remaining, message->tx_bytes_remaining, lserror);
+    struct iovec iov[2];
+    int iovcnt = _LSTransportMessageGetTxVector(message, iov);
+    int i;
 
-    if (send_ret == -1)
+    for (i = 0; i < iovcnt; i++)
     {
-        ret = false;
-        goto exit;
+        int send_ret = _LSTransportSendComplete(client->channel.fd, iov[i].iov_base, iov[i].iov_len, lserror);
+
+        if (send_ret == -1)
+        {
+            ret = false;
+            goto exit;
+        }
+
+        LS_ASSERT(send_ret == iov[i].iov_len);
+        message->tx_bytes_remaining -= send_ret;
     }
 
-    LS_ASSERT(send_ret == message->tx_bytes_remaining);
-    message->tx_bytes_remaining = 0;
+    LS_ASSERT(message->tx_bytes_remaining == 0);
 
     if (token)
     {
@@ -1731,10 +1966,75 @@ exit:
     return ret;
 }
 
+/**
+ *******************************************************************************
+ * @brief Set the filter of the messages sent to the monitor.
+ *
+ * @attention locks transport lock
+ *
+ * @param  transport    IN  transport
+ * @param  filter       IN  filter (ref'd), NULL to send every message
+ *******************************************************************************
+ */
+static void
+_LSTransportSetMonitorFilter(_LSTransport *transport, _LSTransportMonitorFilter *filter)
+{
+    TRANSPORT_LOCK(&transport->lock);
+    _LSTransportMonitorFilter *old_filter = transport->monitor_filter;
+    transport->monitor_filter = filter ? _LSTransportMonitorFilterRef(filter) : NULL;
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    if (old_filter) _LSTransportMonitorFilterUnref(old_filter);
+}
+
+/**
+ *******************************************************************************
+ * @brief Check if the monitor wants a copy of a message.
+ *
+ * @attention locks transport lock
+ *
+ * @param  transport    IN  transport
+ * @param  message      IN  message
+ * @param  client       IN  client the message is sent to or was received from
+ * @param  type         IN  sent or received
+ *
+ * @retval  true if the message should be sent to the monitor
+ *******************************************************************************
+ */
+static bool
+_LSTransportMonitorWants(_LSTransport *transport, _LSTransportMessage *message,
+                         _LSTransportClient *client, _LSMonitorMessageType type)
+{
+    TRANSPORT_LOCK(&transport->lock);
+    _LSTransportMonitorFilter *filter = transport->monitor_filter;
+    if (filter) _LSTransportMonitorFilterRef(filter);
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    if (!filter)
+        return true;
+
+    bool sent = type == _LSMonitorMessageTypeTx;
+    _LSTransportClient *sender = sent ? NULL : client;
+    _LSTransportClient *dest = sent ? client : NULL;
+
+    const char *sender_unique_name = sender ? sender->unique_name : transport->unique_name;
+    const char *dest_unique_name = dest ? dest->unique_name : transport->unique_name;
+
+    bool ret = _LSTransportMonitorFilterMatch(filter, message,
+                                              sender ? sender->service_name : transport->service_name,
+                                              sender_unique_name,
+                                              dest ? dest->service_name : transport->service_name,
+                                              dest_unique_name) &&
+               _LSTransportMonitorFilterSample(filter, message, sender_unique_name, dest_unique_name);
+
+    _LSTransportMonitorFilterUnref(filter);
+    return ret;
+}
+
 /**
  *******************************************************************************
  * @brief Process a monitor message, which involves connecting to the monitor
- * and sending our client info to it.
+ * and sending our client info to it, or tracing for it if the hub says so.
  *
  * @attention locks transport lock
  *
@@ -1757,14 +2057,45 @@ _LSTransportHandleMonitor(_LSTransportMessage *message)
     _LSTransportMessageGetString(&iter, &unique_name);
 
     /* This means that there is no monitor in the system -- we receive
-     * this message when first connecting to the hub */
+     * this message when first connecting to the hub, and when a tracing
+     * monitor goes away */
     if (unique_name == NULL)
     {
+        _LSTransportTraceSetEnabled(transport, false);
         return;
     }
 
     LS_ASSERT(_LSTransportMessageGetType(message) != _LSTransportMessageTypeMonitorNotConnected);
 
+    /* the messages the monitor wants, if it said (before it gets any) */
+    const char *filter_expression = NULL;
+    _LSTransportMonitorFilter *filter = NULL;
+
+    _LSTransportMessageIterNext(&iter);
+    if (_LSTransportMessageGetString(&iter, &filter_expression) && filter_expression && *filter_expression)
+    {
+        filter = _LSTransportMonitorFilterNew(filter_expression, &lserror);
+        if (!filter)
+        {
+            /* from a newer monitor perhaps, send it everything */
+            LOG_LSERROR(MSGID_LS_MONITOR_FILTER_ERR, &lserror);
+            LSErrorFree(&lserror);
+        }
+    }
+    _LSTransportSetMonitorFilter(transport, filter);
+    if (filter) _LSTransportMonitorFilterUnref(filter);
+
+    /* a tracing monitor reads our trace ring, there's nothing to connect to */
+    int32_t trace = 0;
+    _LSTransportMessageIterNext(&iter);
+    _LSTransportMessageGetInt32(&iter, &trace);
+    _LSTransportTraceSetEnabled(transport, trace != 0);
+    if (trace)
+    {
+        LOG_LS_DEBUG("%s: tracing for monitor: %s\n", __func__, unique_name);
+        return;
+    }
+
     LOG_LS_DEBUG("%s: connecting to monitor: %s\n", __func__, unique_name);
 
     transport->monitor = _LSTransportConnectClient(transport, NULL, unique_name, dup(_LSTransportMessageGetFd(message)), NULL, _LSClientAllowBoth, &lserror);
@@ -1799,13 +2130,20 @@ _LSTransportHandleMonitor(_LSTransportMessage *message)
  *******************************************************************************
  */
 static void
-_LSTransportHandleUserMessageHandler(_LSTransportMessage *message)
+_LSTransportRunUserMessageHandler(_LSTransportMessage *message)
 {
     LOG_LS_DEBUG("%s: calling user's msg_handler\n", __func__);
 
     _LSTransportClient *client = _LSTransportMessageGetClient(message);
     void *msg_context = client->transport->msg_context;
 
+    if (_LSTransportMessageGetType(message) == _LSTransportMessageTypeMethodCall)
+    {
+        /* Save message serial so we know what has been processed; the
+         * shutdown message may read it from the I/O thread */
+        g_atomic_pointer_set(&client->incoming->last_serial_processed, _LSTransportMessageGetToken(message));
+    }
+
     LSMessageHandlerResult ret = (*client->transport->msg_handler)(message, msg_context);
 
     /*
@@ -1858,6 +2196,28 @@ _LSTransportHandleUserMessageHandler(_LSTransportMessage *message)
     g_free(error_msg);
 }
 
+/**
+ *******************************************************************************
+ * @brief Have the user's message handler run for the message, right away or,
+ * with an I/O thread, from the user context.
+ *
+ * @param  message  IN  message
+ *******************************************************************************
+ */
+static void
+_LSTransportHandleUserMessageHandler(_LSTransportMessage *message)
+{
+    _LSTransport *transport = _LSTransportMessageGetClient(message)->transport;
+
+    if (transport->io_thread)
+    {
+        _LSTransportIoThreadPostMessage(transport->io_thread, message);
+        return;
+    }
+
+    _LSTransportRunUserMessageHandler(message);
+}
+
 /**
  *******************************************************************************
  * @brief Get the status of the monitor when first connecting to the hub so we
@@ -1935,6 +2295,7 @@ _LSTransportRequestName(const char *requested_name,
     if (_LSTransportMessageAppendInt32(&iter, LS_TRANSPORT_PROTOCOL_VERSION) &&
         _LSTransportMessageAppendString(&iter, requested_name) &&
         _LSTransportMessageAppendString(&iter, app_id) &&
+        _LSTransportMessageAppendInt32(&iter, LS_TRANSPORT_FEATURES_SUPPORTED) &&
         _LSTransportMessageAppendInvalid(&iter))
     {
         (void)_LSTransportSendMessageBlocking(message, client, true, NULL, lserror);
@@ -2130,35 +2491,29 @@ error:
 
 /**
  *******************************************************************************
- * @brief Send a "QueryName" message to the hub.
+ * @brief Send a "QueryName" message for a service to the hub.
  *
- * @param  hub                   IN  client info for hub
- * @param  trigger_message       IN  message that triggered this "QueryName"
- * @param  service_name          IN  service name to look up
- * @param  lserror               OUT set on error
+ * @param  hub            IN  client info for hub
+ * @param  is_public_bus  IN
+ * @param  app_id         IN  application Id the query is made for
+ * @param  service_name   IN  service name to look up
+ * @param  lserror        OUT set on error
  *
  * @retval true on success
  * @retval false on failure
  *******************************************************************************
  */
-bool
-_LSTransportQueryName(_LSTransportClient *hub, _LSTransportMessage *trigger_message,
-                      const char *service_name, LSError *lserror)
+static bool
+_LSTransportSendQueryName(_LSTransportClient *hub, bool is_public_bus, const char *app_id,
+                          const char *service_name, LSError *lserror)
 {
     bool ret = true;
 
-    LOG_LS_DEBUG("%s: service_name %s, hub: %p\n", __func__, service_name, hub);
-
-    const char *app_id = _LSTransportMessageGetAppId(trigger_message);
-    /* if no application Id in trigger message - use application Id from transport */
-    if (NULL == app_id)
-        app_id = hub->transport->app_id;
-
     /* allocate query message */
     _LSTransportMessage *message = _LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE);
     if (!message) goto error;
 
-    message->raw->header.is_public_bus = trigger_message->raw->header.is_public_bus;
+    message->raw->header.is_public_bus = is_public_bus;
     _LSTransportMessageSetType(message, _LSTransportMessageTypeQueryName);
 
     _LSTransportMessageIter iter;
@@ -2186,27 +2541,364 @@ error:
 
 /**
  *******************************************************************************
- * @brief Get the return value out of a "QueryName" reply message.
+ * @brief Send a "QueryName" message to the hub.
  *
- * @param  message  IN  query name message
+ * @param  hub                   IN  client info for hub
+ * @param  trigger_message       IN  message that triggered this "QueryName"
+ * @param  service_name          IN  service name to look up
+ * @param  lserror               OUT set on error
  *
- * @retval  return val (numeric value)
+ * @retval true on success
+ * @retval false on failure
  *******************************************************************************
  */
-int32_t
-_LSTransportQueryNameReplyGetReturnVal(_LSTransportMessage *message)
+bool
+_LSTransportQueryName(_LSTransportClient *hub, _LSTransportMessage *trigger_message,
+                      const char *service_name, LSError *lserror)
 {
-    LS_ASSERT(message != NULL);
-    LS_ASSERT(_LSTransportMessageGetType(message) == _LSTransportMessageTypeQueryNameReply);
-    _LSTransportMessageIter iter;
-    int32_t ret;
+    LOG_LS_DEBUG("%s: service_name %s, hub: %p\n", __func__, service_name, hub);
 
-    _LSTransportMessageIterInit(message, &iter);
+    const char *app_id = _LSTransportMessageGetAppId(trigger_message);
+    /* if no application Id in trigger message - use application Id from transport */
+    if (NULL == app_id)
+        app_id = hub->transport->app_id;
 
-    if (_LSTransportMessageGetInt32(&iter, &ret))
-    {
-        return ret;
-    }
+    return _LSTransportSendQueryName(hub, trigger_message->raw->header.is_public_bus,
+                                     app_id, service_name, lserror);
+}
+
+/**
+ *******************************************************************************
+ * @brief Send a "QueryNameBatch" message for several services to the hub.
+ *
+ * The hub answers the services it can resolve right away with a single
+ * "QueryNameBatchReply". Services it has to wait for are answered later
+ * with a "QueryNameReply" each, like single queries.
+ *
+ * @param  hub            IN  client info for hub
+ * @param  is_public_bus  IN
+ * @param  app_id         IN  application Id the query is made for
+ * @param  services       IN  service names to look up
+ * @param  count          IN  number of @p services, at most
+ *                            @ref LS_TRANSPORT_QUERY_NAME_BATCH_MAX
+ * @param  lserror        OUT set on error
+ *
+ * @retval true on success
+ * @retval false on failure
+ *******************************************************************************
+ */
+static bool
+_LSTransportSendQueryNameBatch(_LSTransportClient *hub, bool is_public_bus, const char *app_id,
+                               const char * const *services, unsigned int count, LSError *lserror)
+{
+    LS_ASSERT(count <= LS_TRANSPORT_QUERY_NAME_BATCH_MAX);
+
+    bool ret = true;
+    unsigned int i;
+
+    LOG_LS_DEBUG("%s: %u services, hub: %p\n", __func__, count, hub);
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE);
+    if (!message) goto error;
+
+    message->raw->header.is_public_bus = is_public_bus;
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeQueryNameBatch);
+
+    _LSTransportMessageIter iter;
+    _LSTransportMessageIterInit(message, &iter);
+
+    if (!_LSTransportMessageAppendString(&iter, app_id)) goto error;
+    if (!_LSTransportMessageAppendInt32(&iter, count)) goto error;
+    for (i = 0; i < count; i++)
+    {
+        if (!_LSTransportMessageAppendString(&iter, services[i])) goto error;
+    }
+    if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
+
+    if (!_LSTransportSendMessage(message, hub, NULL, lserror))
+    {
+        ret = false;
+    }
+
+    _LSTransportMessageUnref(message);
+
+    return ret;
+
+error:
+    if (message) _LSTransportMessageUnref(message);
+    _LSErrorSetOOM(lserror);
+    return false;
+}
+
+/**
+ *******************************************************************************
+ * @brief Open an empty pending queue for a service nobody called yet, so that
+ * calls made before the reply arrives wait for the pre-warm query instead of
+ * sending their own.
+ *
+ * @attention must be called with transport lock
+ *
+ * @param  transport      IN  transport
+ * @param  service_name   IN  service name
+ *
+ * @retval true if the service needs to be queried
+ * @retval false if it's connected or being queried already
+ *******************************************************************************
+ */
+static bool
+_LSTransportPrewarmOpen(_LSTransport *transport, const char *service_name)
+{
+    if (g_hash_table_lookup(transport->clients, service_name) ||
+        g_hash_table_lookup(transport->pending, service_name))
+    {
+        return false;
+    }
+
+    _LSTransportOutgoing *pending = _LSTransportOutgoingNew();
+    if (!pending)
+    {
+        /* the first call will query it */
+        return false;
+    }
+
+    g_hash_table_insert(transport->pending, g_strdup(service_name), pending);
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Close the queue of a pre-warm query that couldn't be sent.
+ *
+ * @attention locks the transport lock
+ *
+ * @param  transport      IN  transport
+ * @param  service_name   IN  service name
+ *******************************************************************************
+ */
+static void
+_LSTransportPrewarmAbort(_LSTransport *transport, const char *service_name)
+{
+    TRANSPORT_LOCK(&transport->lock);
+
+    /* Calls queued meanwhile stay pending, like for a failed call-triggered query */
+    _LSTransportOutgoing *pending = g_hash_table_lookup(transport->pending, service_name);
+    if (pending && g_queue_is_empty(pending->queue))
+    {
+        g_hash_table_remove(transport->pending, service_name);
+        _LSTransportOutgoingFree(pending);
+    }
+
+    TRANSPORT_UNLOCK(&transport->lock);
+}
+
+/**
+ *******************************************************************************
+ * @brief Query the hub for services nobody called yet.
+ *
+ * If the hub understands batches, the services are looked up with as few
+ * "QueryNameBatch" messages as possible, otherwise one by one.
+ *
+ * @attention locks the transport lock
+ *
+ * @param  transport      IN  transport
+ * @param  services       IN  service names to connect to
+ * @param  count          IN  number of @p services
+ * @param  is_public_bus  IN
+ * @param  lserror        OUT set on error
+ *
+ * @retval true on success (services already connected or queried are skipped)
+ * @retval false on failure
+ *******************************************************************************
+ */
+static bool
+_LSTransportPrewarmConnect(_LSTransport *transport, const char * const *services,
+                           unsigned int count, bool is_public_bus, LSError *lserror)
+{
+    GPtrArray *queried = g_ptr_array_sized_new(count);
+    unsigned int i;
+
+    TRANSPORT_LOCK(&transport->lock);
+
+    for (i = 0; i < count; i++)
+    {
+        if (_LSTransportPrewarmOpen(transport, services[i]))
+            g_ptr_array_add(queried, (gpointer) services[i]);
+    }
+
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    LS_ASSERT(queried->len == 0 || transport->hub != NULL);
+
+    bool ret = true;
+    unsigned int sent = 0;
+
+    while (ret && sent < queried->len)
+    {
+        const char **names = (const char **) queried->pdata + sent;
+        unsigned int chunk = MIN(queried->len - sent, LS_TRANSPORT_QUERY_NAME_BATCH_MAX);
+
+        if (chunk > 1 && transport->query_name_batch)
+        {
+            ret = _LSTransportSendQueryNameBatch(transport->hub, is_public_bus, transport->app_id,
+                                                 names, chunk, lserror);
+        }
+        else
+        {
+            chunk = 1;
+            ret = _LSTransportSendQueryName(transport->hub, is_public_bus, transport->app_id,
+                                            names[0], lserror);
+        }
+
+        if (ret) sent += chunk;
+    }
+
+    for (i = sent; i < queried->len; i++)
+    {
+        _LSTransportPrewarmAbort(transport, g_ptr_array_index(queried, i));
+    }
+
+    g_ptr_array_free(queried, TRUE);
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Declare peers of this process and connect to them ahead of the first
+ * call.
+ *
+ * The transport subscribes to the service status of each peer, so that a peer
+ * coming up again is reconnected right away. A peer whose subscription
+ * couldn't be sent isn't declared, and can be declared again later.
+ *
+ * @param  transport      IN  transport
+ * @param  peers          IN  NULL-terminated list of service names
+ * @param  is_public_bus  IN
+ * @param  lserror        OUT set on error
+ *
+ * @retval true on success
+ * @retval false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportPrewarmPeers(_LSTransport *transport, const char * const *peers,
+                         bool is_public_bus, LSError *lserror)
+{
+    LS_ASSERT(transport != NULL);
+    LS_ASSERT(peers != NULL);
+
+    GPtrArray *declared = g_ptr_array_new();
+    unsigned int count;
+    unsigned int i;
+    bool ret = true;
+
+    TRANSPORT_LOCK(&transport->lock);
+
+    if (!transport->prewarm_peers)
+    {
+        transport->prewarm_peers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    for (count = 0; peers[count]; count++)
+    {
+        if (!g_hash_table_lookup_extended(transport->prewarm_peers, peers[count], NULL, NULL))
+        {
+            g_hash_table_insert(transport->prewarm_peers, g_strdup(peers[count]), GINT_TO_POINTER(is_public_bus));
+            g_ptr_array_add(declared, (gpointer) peers[count]);
+        }
+    }
+
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    for (i = 0; i < declared->len; i++)
+    {
+        if (!LSTransportRegisterSignalServiceStatus(transport, g_ptr_array_index(declared, i),
+                                                    is_public_bus, NULL, lserror))
+        {
+            ret = false;
+            break;
+        }
+    }
+
+    if (!ret)
+    {
+        /* forget the peers we aren't subscribed to, so they can be retried */
+        TRANSPORT_LOCK(&transport->lock);
+        for (; i < declared->len; i++)
+        {
+            g_hash_table_remove(transport->prewarm_peers, g_ptr_array_index(declared, i));
+        }
+        TRANSPORT_UNLOCK(&transport->lock);
+    }
+
+    g_ptr_array_free(declared, TRUE);
+
+    return ret && _LSTransportPrewarmConnect(transport, peers, count, is_public_bus, lserror);
+}
+
+/**
+ *******************************************************************************
+ * @brief Reconnect a declared peer on its "ServiceUp" signal.
+ *
+ * @param  message  IN  service status signal
+ *******************************************************************************
+ */
+static void
+_LSTransportHandleServiceStatus(_LSTransportMessage *message)
+{
+    _LSTransport *transport = _LSTransportClientGetTransport(_LSTransportMessageGetClient(message));
+
+    if (_LSTransportMessageGetType(message) != _LSTransportMessageTypeServiceUpSignal)
+        return;
+
+    char *service_name = LSTransportServiceStatusSignalGetServiceName(message);
+    if (!service_name) return;
+
+    gpointer is_public_bus = NULL;
+
+    TRANSPORT_LOCK(&transport->lock);
+    bool declared = transport->prewarm_peers &&
+                    g_hash_table_lookup_extended(transport->prewarm_peers, service_name,
+                                                 NULL, &is_public_bus);
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    if (declared &&
+        !_LSTransportPrewarmConnect(transport, (const char * const *) &service_name, 1,
+                                    GPOINTER_TO_INT(is_public_bus), &lserror))
+    {
+        LOG_LSERROR(MSGID_LS_TRANSPORT_CONNECT_ERR, &lserror);
+        LSErrorFree(&lserror);
+    }
+
+    g_free(service_name);
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the return value out of a "QueryName" reply message.
+ *
+ * @param  message  IN  query name message
+ *
+ * @retval  return val (numeric value)
+ *******************************************************************************
+ */
+int32_t
+_LSTransportQueryNameReplyGetReturnVal(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+    LS_ASSERT(_LSTransportMessageGetType(message) == _LSTransportMessageTypeQueryNameReply);
+    _LSTransportMessageIter iter;
+    int32_t ret;
+
+    _LSTransportMessageIterInit(message, &iter);
+
+    if (_LSTransportMessageGetInt32(&iter, &ret))
+    {
+        return ret;
+    }
     return LS_TRANSPORT_QUERY_NAME_MESSAGE_CONTENT_ERROR;
 }
 
@@ -2276,6 +2968,34 @@ _LSTransportQueryNameReplyGetUniqueName(_LSTransportMessage *message)
     return NULL;
 }
 
+/**
+ *******************************************************************************
+ * @brief Get the number of connection fds passed with a "QueryNameBatchReply"
+ * message.
+ *
+ * @param  message  IN  query name batch reply message
+ *
+ * @retval number of fds, 0 if the message is malformed
+ *******************************************************************************
+ */
+unsigned int
+_LSTransportQueryNameBatchReplyGetFdCount(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+    LS_ASSERT(_LSTransportMessageGetType(message) == _LSTransportMessageTypeQueryNameBatchReply);
+    _LSTransportMessageIter iter;
+    int32_t count = 0;
+
+    _LSTransportMessageIterInit(message, &iter);
+
+    if (!_LSTransportMessageGetInt32(&iter, &count) ||
+        count < 0 || count > LS_TRANSPORT_QUERY_NAME_BATCH_MAX)
+    {
+        return 0;
+    }
+    return count;
+}
+
 /**
  *******************************************************************************
  * @brief Get is_dynamic boolean out of a "QueryName" reply message.
@@ -2500,6 +3220,34 @@ _LSTransportQueryNameReplyGetExePath(_LSTransportMessage *message)
     return NULL;
 }
 
+/**
+ *******************************************************************************
+ * @brief Get the features of the peer from a "QueryName" reply message.
+ *
+ * @param  message  IN  message
+ *
+ * @retval mask of _LSTransportFeatures, 0 if the hub didn't send them
+ *******************************************************************************
+ */
+unsigned
+_LSTransportQueryNameReplyGetFeatures(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+    LS_ASSERT(_LSTransportMessageGetType(message) == _LSTransportMessageTypeQueryNameReply);
+    _LSTransportMessageIter iter;
+    int32_t ret;
+
+    _LSTransportMessageIterInit(message, &iter);
+    /* move past return code, service name, unique name, dynamic flag, app_id, groups,
+       permissions, required trustlevel, trustlevel string, exe_path */
+    _LSTransportMessageIterAdvance(&iter, 10);
+
+    if (_LSTransportMessageGetInt32(&iter, &ret)) {
+        return (unsigned) ret;
+    }
+    return 0;
+}
+
 /**
  *******************************************************************************
  * @brief Get the return value out of a "QueryProxyName" reply message.
@@ -2867,10 +3615,17 @@ _LSTransportQueryProxyNameReplyGetTrustlevelString(_LSTransportMessage *message)
 static void
 _LSTransportSendMessageMonitorHelper(_LSTransportMessage *message, _LSTransportClient *client)
 {
-    if (_LSTransportMessageIsMonitorType(message))
+    if (!_LSTransportMessageIsMonitorType(message))
+        return;
+
+    if (client->transport->monitor)
     {
         _LSTransportSendMessageMonitor(message, client, _LSMonitorMessageTypeTx, NULL, NULL);
     }
+    else
+    {
+        _LSTransportTraceMessage(message, client, _LSMonitorMessageTypeTx, NULL);
+    }
 }
 
 /**
@@ -3203,7 +3958,7 @@ _LSTransportHandleQueryProxyNameReply(_LSTransportMessage *message) {
      */
 
     /* kickstart sending to the monitor */
-    if (transport->monitor && pending) {
+    if ((transport->monitor || _LSTransportTraceEnabled(transport)) && pending) {
         /* MONITOR -- we need to send any pending method calls to the monitor
          * and add the destination info to the message */
         _LSTransportSendPendingMonitorMessages(transport, client, pending);
@@ -3269,7 +4024,20 @@ _LSTransportHandleQueryNameFailure(_LSTransportMessage *message, long err_code,
      * destined for has failed in some manner */
     _LSTransportMessage *failed_message = g_queue_pop_head(pending->queue);
 
-    LS_ASSERT(failed_message);
+    if (!failed_message)
+    {
+        /* Nothing but a pre-warm was waiting for the service, the first call
+         * will query again */
+        if (!g_hash_table_remove(transport->pending, service_name))
+        {
+            LS_ASSERT(0);
+        }
+
+        OUTGOING_UNLOCK(&pending->lock);
+        _LSTransportOutgoingFree(pending);
+        TRANSPORT_UNLOCK(&transport->lock);
+        return;
+    }
 
     /* At the point where we're querying for a name we should only be
      * queuing up method calls or canceling method calls
@@ -3484,6 +4252,8 @@ _LSTransportHandleQueryNameReply(_LSTransportMessage *message)
     // Initialize trust level for client
     _LSTransportClientInitializeTrustLevel(client, _LSTransportQueryNameReplyGetTrustlevelString(message));
     _LSTransportClientSetExePath(client, _LSTransportQueryNameReplyGetExePath(message));
+    client->features = _LSTransportQueryNameReplyGetFeatures(message);
+
     /* We successfully connected to the far side, so remove the service from
      * the transport lookup queue.
      *
@@ -3506,33 +4276,167 @@ _LSTransportHandleQueryNameReply(_LSTransportMessage *message)
         LS_ASSERT(0);
     }
 
-    /* client ref +1 (total = 3) */
-    _LSTransportAddAllConnectionHash(transport, client);
+    /* client ref +1 (total = 3) */
+    _LSTransportAddAllConnectionHash(transport, client);
+
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    LS_ASSERT(client->transport->mainloop_context);
+
+    /* MONITOR -- send our info to the newly connected client
+     */
+
+    /* kickstart sending to the monitor */
+    if ((transport->monitor || _LSTransportTraceEnabled(transport)) && pending)
+    {
+        /* MONITOR -- we need to send any pending method calls to the monitor
+         * and add the destination info to the message */
+        _LSTransportSendPendingMonitorMessages(transport, client, pending);
+    }
+
+    /* By definition, when we receive this message, there is at least
+     * one item on the queue to send, unless the connection was pre-warmed */
+    _LSTransportChannelAddSendWatch(&client->channel, client->transport->mainloop_context, client);
+
+    _LSTransportChannelAddReceiveWatch(&client->channel, client->transport->mainloop_context, client);
+
+    /* client ref -1 (total = 2) */
+    LOG_LS_DEBUG("%s: unref'ing\n", __func__);
+    _LSTransportClientUnref(client);
+}
+
+/**
+ *******************************************************************************
+ * @brief Copy arguments from one message to another.
+ *
+ * @param  from    IN  iterator on the source message, advanced past the copy
+ * @param  to      IN  iterator on the destination message
+ * @param  fields  IN  argument types to copy: 'i' for int32, 's' for string
+ *
+ * @retval true on success
+ * @retval false if the source doesn't match @p fields or on OOM
+ *******************************************************************************
+ */
+static bool
+_LSTransportMessageCopyArgs(_LSTransportMessageIter *from, _LSTransportMessageIter *to,
+                            const char *fields)
+{
+    for (; *fields; fields++)
+    {
+        if (*fields == 'i')
+        {
+            int32_t value;
+            if (!_LSTransportMessageGetInt32(from, &value) ||
+                !_LSTransportMessageAppendInt32(to, value))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            const char *value;
+            if (!_LSTransportMessageGetString(from, &value) ||
+                !_LSTransportMessageAppendString(to, value))
+            {
+                return false;
+            }
+        }
+        _LSTransportMessageIterNext(from);
+    }
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Process a "QueryNameBatchReply" message.
+ *
+ * The reply lists the service names of its entries first. Every entry is
+ * then handled as the "QueryNameReply" the hub would have sent for a single
+ * query, with the connection fds handed out in entry order. From the first
+ * entry that can't be read on, the services are failed as unavailable, so
+ * that the calls waiting for them don't wait forever.
+ *
+ * @param  message  IN  query name batch reply message
+ *******************************************************************************
+ */
+static void
+_LSTransportHandleQueryNameBatchReply(_LSTransportMessage *message)
+{
+    _LSTransportMessageIter iter;
+    const char *names[LS_TRANSPORT_QUERY_NAME_BATCH_MAX];
+    int32_t fd_count = 0;
+    int32_t entry_count = 0;
+    int32_t i;
+    unsigned int fd_index = 0;
+
+    _LSTransportMessageIterInit(message, &iter);
+
+    if (!_LSTransportMessageGetInt32(&iter, &fd_count) ||
+        !_LSTransportMessageGetInt32(_LSTransportMessageIterNext(&iter), &entry_count) ||
+        entry_count < 0 || entry_count > (int32_t) G_N_ELEMENTS(names))
+    {
+        LOG_LS_ERROR(MSGID_LS_MSG_ERR, 0, "%s: malformed batch reply", __func__);
+        return;
+    }
+
+    for (i = 0; i < entry_count; i++)
+    {
+        if (!_LSTransportMessageGetString(_LSTransportMessageIterNext(&iter), &names[i]) || !names[i])
+        {
+            LOG_LS_ERROR(MSGID_LS_MSG_ERR, 0, "%s: malformed batch reply", __func__);
+            return;
+        }
+    }
+    _LSTransportMessageIterNext(&iter);
+
+    for (i = 0; i < entry_count; i++)
+    {
+        _LSTransportMessage *reply = _LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE);
+        if (!reply) break;
 
-    TRANSPORT_UNLOCK(&transport->lock);
+        reply->raw->header.is_public_bus = message->raw->header.is_public_bus;
+        _LSTransportMessageSetType(reply, _LSTransportMessageTypeQueryNameReply);
+        _LSTransportMessageSetClient(reply, _LSTransportMessageGetClient(message));
 
-    LS_ASSERT(client->transport->mainloop_context);
+        _LSTransportMessageIter reply_iter;
+        _LSTransportMessageIterInit(reply, &reply_iter);
 
-    /* MONITOR -- send our info to the newly connected client
-     */
+        _LSTransportMessageIter peek = iter;
+        int32_t err_code = -1;
+        const char *service_name = NULL;
+        bool ok = _LSTransportMessageGetInt32(&iter, &err_code) &&
+                  _LSTransportMessageGetString(_LSTransportMessageIterNext(&peek), &service_name) &&
+                  g_strcmp0(service_name, names[i]) == 0 &&
+                  _LSTransportMessageCopyArgs(&iter, &reply_iter, "issi");
 
-    /* kickstart sending to the monitor */
-    if (transport->monitor && pending)
-    {
-        /* MONITOR -- we need to send any pending method calls to the monitor
-         * and add the destination info to the message */
-        _LSTransportSendPendingMonitorMessages(transport, client, pending);
-    }
+        if (ok && err_code == LS_TRANSPORT_QUERY_NAME_SUCCESS)
+        {
+            ok = _LSTransportMessageCopyArgs(&iter, &reply_iter, "ssisssi") &&
+                 _LSTransportMessageAppendInvalid(&reply_iter) &&
+                 fd_index < _LSTransportMessageGetFdCount(message);
+            if (ok)
+            {
+                _LSTransportMessageSetFd(reply, _LSTransportMessageStealFd(message, fd_index++));
+            }
+        }
 
-    /* By definition, when we receive this message, there is at least
-     * one item on the queue to send */
-    _LSTransportChannelAddSendWatch(&client->channel, client->transport->mainloop_context, client);
+        if (!ok)
+        {
+            LOG_LS_ERROR(MSGID_LS_MSG_ERR, 1, PMLOGKS("APP_ID", names[i]),
+                         "%s: malformed batch reply entry", __func__);
+            _LSTransportMessageUnref(reply);
+            break;
+        }
 
-    _LSTransportChannelAddReceiveWatch(&client->channel, client->transport->mainloop_context, client);
+        _LSTransportHandleQueryNameReply(reply);
+        _LSTransportMessageUnref(reply);
+    }
 
-    /* client ref -1 (total = 2) */
-    LOG_LS_DEBUG("%s: unref'ing\n", __func__);
-    _LSTransportClientUnref(client);
+    /* the entries past a malformed one can't be found anymore */
+    for (; i < entry_count; i++)
+    {
+        _LSTransportHandleQueryNameFailure(message, LS_TRANSPORT_QUERY_NAME_SERVICE_NOT_AVAILABLE, names[i], false);
+    }
 }
 
 /**
@@ -3747,10 +4651,6 @@ _LSTransportReceiveClient(GIOChannel *source, GIOCondition condition,
 
     LOG_LS_DEBUG("%s: client: %p\n", __func__, client);
 
-    /* calculate bytes remaining in buf */
-    int num_bytes_to_read;
-    unsigned long offset;
-
     /* we're using the client's incoming buffer, so ref it */
     _LSTransportClientRef(client);
     _LSTransportIncoming *incoming = client->incoming;
@@ -3758,187 +4658,64 @@ _LSTransportReceiveClient(GIOChannel *source, GIOCondition condition,
     bool shutdown = false;
 
     /*
-     * TODO: limit the number of messages that we queue up before processing
-     * them. We don't want to starve other parts of the program's operation
-     * and we don't want to use too much memory; this should be configurable
+     * The number of messages queued up before processing them is limited by
+     * the incoming high-water mark (see _ls_incoming_hwm_messages), so that
+     * a chatty peer neither starves other parts of the program nor makes us
+     * use too much memory
      */
 
     /* TODO: review locking */
 
     //INCOMING_LOCK(&incoming->lock);
 
-    while (1)
+    switch (_LSTransportIncomingReceive(incoming, client->channel.fd, client))
     {
-        char* buf = (char*)&incoming->tmp_header;
+    case _LSTransportIncomingStatusAgain:
+        break;
 
-        if (incoming->tmp_msg)
+    case _LSTransportIncomingStatusShutdown:
+        LOG_LS_DEBUG("%s: Orderly shutdown\n", __func__);
+        shutdown = true;
+        break;
+
+    case _LSTransportIncomingStatusError:
+        if (errno == ECONNRESET)
         {
-            /* We have a message with at least a header, so attempt to read
-             * in the rest of the message */
-            num_bytes_to_read = incoming->tmp_msg->raw->header.len - incoming->tmp_msg_offset;
-            buf = incoming->tmp_msg->raw->data;
-            offset = incoming->tmp_msg_offset;
+            /* Client disappearance isn't LS2 problem */
+            LOG_LS_WARNING(MSGID_LS_MSG_ERR, 5,
+                           PMLOGKFV("ERROR_CODE", "%d", errno),
+                           PMLOGKS("ERROR", g_strerror(errno)),
+                           PMLOGKS("EXE", _LSTransportCredGetExePath(_LSTransportClientGetCred(client))),
+                           PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
+                           PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
+                           "Encountered ECONNRESET during recv: fd: %d", client->channel.fd);
         }
         else
         {
-            /* We haven't read in a complete header yet, so attempt to construct
-             * a complete header */
-            num_bytes_to_read = sizeof(client->incoming->tmp_header) - incoming->tmp_header_offset;
-            offset = incoming->tmp_header_offset;
-        }
-
-        if (num_bytes_to_read > 0)
-        {
-            int ret = recv(client->channel.fd, buf + offset, num_bytes_to_read, MSG_DONTWAIT);
-
-            /* If there was an error or we would block, we're done reading in data */
-            if (ret <= 0)
-            {
-                if (ret == 0)
-                {
-                    LOG_LS_DEBUG("%s: Orderly shutdown\n", __func__);
-                    shutdown = true;
-                    break;
-                }
-                else if (errno == EAGAIN || errno == EINTR)
-                {
-                    /* We don't retry immediately relying on the main loop
-                     * to signal socket readiness again.
-                     */
-                    break;
-                }
-                else if (errno == ECONNRESET)
-                {
-                    /* Client disappearance isn't LS2 problem */
-                    LOG_LS_WARNING(MSGID_LS_MSG_ERR, 5,
-                                   PMLOGKFV("ERROR_CODE", "%d", errno),
-                                   PMLOGKS("ERROR", g_strerror(errno)),
-                                   PMLOGKS("EXE", _LSTransportCredGetExePath(_LSTransportClientGetCred(client))),
-                                   PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
-                                   PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
-                                   "Encountered ECONNRESET during recv: fd: %d", client->channel.fd);
-                    shutdown = true;
-                    break;
-                }
-                else
-                {
-                    LOG_LS_ERROR(MSGID_LS_MSG_ERR, 5,
-                                 PMLOGKFV("ERROR_CODE", "%d", errno),
-                                 PMLOGKS("ERROR", g_strerror(errno)),
-                                 PMLOGKS("EXE", _LSTransportCredGetExePath(_LSTransportClientGetCred(client))),
-                                 PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
-                                 PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
-                                 "Encountered error during recv: fd: %d", client->channel.fd);
-                    shutdown = true;
-                    break;
-                }
-            }
-
-            /* ret > 0 */
-            LS_ASSERT(ret > 0);
-
-            if (incoming->tmp_msg)
-            {
-                /* We're continuing an already allocated msg */
-                incoming->tmp_msg_offset += ret;
-            }
-            else
-            {
-                /* We're reading in the header */
-                incoming->tmp_header_offset += ret;
-            }
+            LOG_LS_ERROR(MSGID_LS_MSG_ERR, 5,
+                         PMLOGKFV("ERROR_CODE", "%d", errno),
+                         PMLOGKS("ERROR", g_strerror(errno)),
+                         PMLOGKS("EXE", _LSTransportCredGetExePath(_LSTransportClientGetCred(client))),
+                         PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
+                         PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
+                         "Encountered error during recv: fd: %d", client->channel.fd);
         }
+        shutdown = true;
+        break;
 
-        if (incoming->tmp_msg)
-        {
-            /* complete message */
-            if (incoming->tmp_msg_offset == incoming->tmp_msg->raw->header.len)
-            {
-                //printf("recvd message: token %d, type: %d, len: %d\n", (int)incoming->tmp_msg->raw->header.token, (int)incoming->tmp_msg->raw->header.type, (int)incoming->tmp_msg->raw->header.len);
-
-                /* check to see if we need to read in the special file
-                 * descriptor message for this type of message */
-                if (_LSTransportMessageIsFdType(incoming->tmp_msg))
-                {
-                    LSError lserror;
-                    LSErrorInit(&lserror);
-                    int recv_fd = -1;
-                    bool need_retry = false;
-
-                    if (!_LSTransportRecvFd(client->channel.fd, &recv_fd, &need_retry, &lserror))
-                    {
-                        if (need_retry)
-                        {
-                            /* We would have blocked, so now we retry by
-                             * breaking out of the while loop */
-                            break;
-                        }
-                        else
-                        {
-                            /* real error */
-                            LOG_LSERROR(MSGID_LS_TRANSPORT_NETWORK_ERR, &lserror);
-                            LSErrorFree(&lserror);
-                        }
-                    }
-
-                    _LSTransportMessageSetFd(incoming->tmp_msg, recv_fd);
-                }
-
-                g_queue_push_tail(incoming->complete_messages, incoming->tmp_msg);
-                incoming->tmp_msg = NULL;
-                incoming->tmp_msg_offset = 0;
-            }
-        }
-        else
+    case _LSTransportIncomingStatusTooLarge:
         {
-            LS_ASSERT(incoming->tmp_header_offset <= sizeof(_LSTransportHeader));
-
-            /* Just received beginnig of message, mark activity */
-            if (offset == 0)
-            {
-                ACTIVITY_INC();
-            }
-
-            if (incoming->tmp_header_offset == sizeof(incoming->tmp_header))
-            {
-                /* construct the new message */
-                LS_ASSERT(incoming->tmp_msg == NULL);
-
-                if (incoming->tmp_header.len > MAX_MESSAGE_SIZE_BYTES)
-                {
-                    G_GNUC_UNUSED const _LSTransportCred *cred = _LSTransportClientGetCred(client);
-                    LOG_LS_ERROR(MSGID_LS_MSG_ERR, 4,
-                                 PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
-                                 PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
-                                 PMLOGKS("EXE", _LSTransportCredGetExePath(cred)),
-                                 PMLOGKS("CMD", _LSTransportCredGetCmdLine(cred)),
-                                 "Received message of size %ld bytes; shutting down client",
-                                 incoming->tmp_header.len);
-                    shutdown = true;
-                    break;
-                }
-
-                incoming->tmp_msg = _LSTransportMessageNewRef(incoming->tmp_header.len);
-
-                ACTIVITY_DEC();
-
-                /* copy header and sender */
-                _LSTransportMessageSetHeader(incoming->tmp_msg, &incoming->tmp_header);
-                //printf("recvd message alloc: token %d, type: %d, len: %d\n", (int)incoming->tmp_msg->raw->header.token, (int)incoming->tmp_msg->raw->header.type, (int)incoming->tmp_msg->raw->header.len);
-
-                _LSTransportMessageSetClient(incoming->tmp_msg, client);
-
-                /* TODO: can we fold this in better to the above code? */
-                if (_LSTransportMessageGetHeader(incoming->tmp_msg)->len == 0)
-                {
-                    g_queue_push_tail(incoming->complete_messages, incoming->tmp_msg);
-                    incoming->tmp_msg = NULL;
-                }
-
-                incoming->tmp_msg_offset = 0;
-                incoming->tmp_header_offset = 0;
-            }
+            G_GNUC_UNUSED const _LSTransportCred *cred = _LSTransportClientGetCred(client);
+            LOG_LS_ERROR(MSGID_LS_MSG_ERR, 4,
+                         PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
+                         PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
+                         PMLOGKS("EXE", _LSTransportCredGetExePath(cred)),
+                         PMLOGKS("CMD", _LSTransportCredGetCmdLine(cred)),
+                         "Received message of size %ld bytes; shutting down client",
+                         incoming->tmp_header.len);
+            shutdown = true;
         }
+        break;
     }
 
     /*
@@ -3973,7 +4750,7 @@ _LSTransportReceiveClient(GIOChannel *source, GIOCondition condition,
             _LSTransportClientShutdownDirty(client);
         }
 
-        if (incoming->tmp_header_offset || incoming->tmp_msg)
+        if (incoming->rx_partial || incoming->tmp_msg)
         {
             ACTIVITY_DEC();
         }
@@ -4071,15 +4848,122 @@ _LSTransportAcceptConnection(GIOChannel *source, GIOCondition condition,
     return TRUE;    /* FALSE means this source should be removed */
 }
 
+/**
+ *******************************************************************************
+ * @brief Apply the high-water policy of the outgoing queues to a message about
+ * to be queued for a client.
+ *
+ * @attention tries the outgoing lock
+ *
+ * @param  client   IN  client
+ * @param  type     IN  type of the message
+ * @param  size     IN  size of the message, including the header
+ * @param  drop     OUT set if the message is a signal to be dropped silently,
+ *                      NULL if the caller can't drop messages
+ * @param  lserror  OUT set on error
+ *
+ * @retval true if the message should be queued, unless @p drop is set
+ * @retval false if it's refused
+ *******************************************************************************
+ */
+static bool
+_LSTransportCheckHighWater(_LSTransportClient *client, _LSTransportMessageType type,
+                           unsigned long size, bool *drop, LSError *lserror)
+{
+    _LSTransportOutgoing *outgoing = client->outgoing;
+
+    if (drop) *drop = false;
+
+    if (!_LSTransportOutgoingIsOverHighWater(outgoing, size))
+        return true;
+
+    if (g_atomic_int_compare_and_exchange(&outgoing->high_water, 0, 1))
+    {
+        LOG_LS_WARNING(MSGID_LS_QUEUE_FULL, 3,
+                       PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
+                       PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
+                       PMLOGKS("POLICY", _LSTransportQueuePolicyToString(_ls_outgoing_hwm_policy)),
+                       "Outgoing queue over its high-water mark: %d messages, %lu bytes",
+                       g_atomic_int_get(&outgoing->queued_messages),
+                       (unsigned long) g_atomic_pointer_get(&outgoing->queued_bytes));
+    }
+
+    switch (_ls_outgoing_hwm_policy)
+    {
+    case _LSTransportQueuePolicyDropSignals:
+        /* if somebody else holds the lock, the queue is being sent anyway */
+        if (OUTGOING_TRYLOCK(&outgoing->lock))
+        {
+            _LSTransportOutgoingCollect(outgoing);
+            _LSTransportOutgoingDropSignals(outgoing, size);
+            OUTGOING_UNLOCK(&outgoing->lock);
+        }
+
+        if (drop && type == _LSTransportMessageTypeSignal &&
+            _LSTransportOutgoingIsOverHighWater(outgoing, size))
+        {
+            g_atomic_int_inc(&outgoing->dropped_messages);
+            *drop = true;
+        }
+        return true;
+
+    case _LSTransportQueuePolicyDisconnect:
+        /* the receive watch sees the end of the stream and cleans up the
+         * client on the main loop */
+        shutdown(client->channel.fd, SHUT_RDWR);
+        _LSErrorSet(lserror, MSGID_LS_QUEUE_FULL, LS_ERROR_CODE_CONNECT_FAILURE,
+                    "Disconnecting \"%s\": outgoing queue over its high-water mark",
+                    _LSTransportClientGetServiceName(client));
+        return false;
+
+    case _LSTransportQueuePolicyPushBack:
+        _LSErrorSet(lserror, MSGID_LS_QUEUE_FULL, LS_ERROR_CODE_EAGAIN,
+                    "Outgoing queue of \"%s\" over its high-water mark",
+                    _LSTransportClientGetServiceName(client));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Post a message to the outgoing queue of a client and make sure the
+ * send watch will pick it up.
+ *
+ * @param  client   IN  client
+ * @param  message  IN  message, the queue takes over the caller's ref
+ *******************************************************************************
+ */
+static void
+_LSTransportPostOutgoing(_LSTransportClient *client, _LSTransportMessage *message)
+{
+    /* Only the first message posted since the last collection needs to
+     * add the watch, the others find it in place */
+    if (_LSTransportOutgoingPost(client->outgoing, message))
+    {
+        /* we can only do this once the mainloop has been attached with
+         * LSGmainAttach */
+        if (client->transport->mainloop_context)
+        {
+            _LSTransportChannelAddSendWatch(&client->channel, client->transport->mainloop_context, client);
+        }
+    }
+}
+
 /**
  *******************************************************************************
  * @brief Send a message that has been constructed as an io vector.
  *
+ * If nothing is queued and no other thread is sending to the client, as
+ * much of the message as possible is written right away. Otherwise it's
+ * posted to the outgoing queue without waiting for the outgoing lock.
+ *
  * @warning This function does NOT set the token like @ref
  * _LSTransportSendMessage since it does not know where in the vector the
  * token lies.
  *
- * @attention locks outgoing lock
+ * @attention tries the outgoing lock
  *
  * @param  iov              IN  array of io vectors
  * @param  iovcnt           IN  size of @p iov array
@@ -4101,11 +4985,31 @@ _LSTransportSendVector(const struct iovec *iov, int iovcnt, unsigned long total_
 
     LOG_LS_DEBUG("%s: client: %p\n", __func__, client);
 
+    bool drop;
+    const _LSTransportHeader *header = iov[0].iov_base;
+    if (!_LSTransportCheckHighWater(client, header->type, total_len, &drop, lserror))
+        return false;
+    if (drop)
+        return true;
+
+    /* Another thread is writing to the socket, don't wait for it */
+    if (!OUTGOING_TRYLOCK(&client->outgoing->lock))
+    {
+        _LSTransportMessage *message = _LSTransportMessageFromVectorNewRef(iov, iovcnt, total_len);
+        if (!message)
+        {
+            _LSErrorSetOOM(lserror);
+            return false;
+        }
+
+        _LSTransportMessageSetAppId(message, _LSTransportMessageGetBody(message) + app_id_offset);
+        _LSTransportPostOutgoing(client, message);
+        return true;
+    }
+
     /* If there is anything in the queue, we can't do a fast send
      * or we risk re-ordering the messages */
-    OUTGOING_LOCK(&client->outgoing->lock);
-
-    if (g_queue_is_empty(client->outgoing->queue))
+    if (g_queue_is_empty(client->outgoing->queue) && !_LSTransportOutgoingHasPosted(client->outgoing))
     {
         //int total_bytes = 0;
 
@@ -4173,6 +5077,12 @@ _LSTransportSendVector(const struct iovec *iov, int iovcnt, unsigned long total_
 
     message->tx_bytes_remaining = total_len - bytes_written;
 
+    /* posted messages go first, unless part of this one is on the wire already */
+    if (bytes_written == 0)
+    {
+        _LSTransportOutgoingCollect(client->outgoing);
+    }
+
     /* if the queue is empty, there's no send watch set on it, so we
      * need to add one */
     if (g_queue_is_empty(client->outgoing->queue))
@@ -4185,6 +5095,7 @@ _LSTransportSendVector(const struct iovec *iov, int iovcnt, unsigned long total_
         }
     }
 
+    _LSTransportOutgoingAccount(client->outgoing, message);
     g_queue_push_tail(client->outgoing->queue, message);
 
     OUTGOING_UNLOCK(&client->outgoing->lock);
@@ -4192,6 +5103,26 @@ _LSTransportSendVector(const struct iovec *iov, int iovcnt, unsigned long total_
     return true;
 }
 
+/**
+ *******************************************************************************
+ * @brief Check if the body of a message to the client goes in a memfd.
+ *
+ * Only peers that advertised @ref _LSTransportFeatureMemfd get such messages,
+ * others would take the memfd stub for a message with an empty body.
+ *
+ * @param  client   IN  destination
+ * @param  message  IN  message
+ *
+ * @retval true if the body is to be passed in a memfd
+ *******************************************************************************
+ */
+static inline bool
+_LSTransportUseMemfd(const _LSTransportClient *client, const _LSTransportMessage *message)
+{
+    return _ls_memfd_threshold && message->raw->header.len >= _ls_memfd_threshold &&
+           (_LSTransportClientGetFeatures(client) & _LSTransportFeatureMemfd);
+}
+
 /**
  *******************************************************************************
  * @brief Send a message that has been constructed as an io vector.
@@ -4200,7 +5131,7 @@ _LSTransportSendVector(const struct iovec *iov, int iovcnt, unsigned long total_
  * _LSTransportSendMessage since it does not know where in the vector the
  * token lies.
  *
- * @attention locks outgoing lock
+ * @attention tries the outgoing lock, see @ref _LSTransportSendVector
  *
  * @param  iov              IN  array of io vectors
  * @param  iovcnt           IN  size of @p iov array
@@ -4222,23 +5153,36 @@ _LSTransportSendVectorRet(const struct iovec *iov, int iovcnt, unsigned long tot
 
     LOG_LS_DEBUG("%s: client: %p\n", __func__, client);
 
-    /* If there is anything in the queue, we can't do a fast send
-     * or we risk re-ordering the messages */
-    OUTGOING_LOCK(&client->outgoing->lock);
+    const _LSTransportHeader *header = iov[0].iov_base;
+    if (!_LSTransportCheckHighWater(client, header->type, total_len, NULL, lserror))
+        return NULL;
 
     _LSTransportMessage *message = _LSTransportMessageFromVectorNewRef(iov, iovcnt, total_len);
 
     if (!message)
     {
         LS_ASSERT(0);
-        OUTGOING_UNLOCK(&client->outgoing->lock);
         return NULL;
     }
 
     (void)_LSTransportSerialSave(client->outgoing->serial, message, lserror);
     _LSTransportMessageSetAppId(message, _LSTransportMessageGetBody(message) + app_id_offset);
 
-    if (g_queue_is_empty(client->outgoing->queue))
+    /* Another thread is writing to the socket, don't wait for it */
+    if (!OUTGOING_TRYLOCK(&client->outgoing->lock))
+    {
+        _LSTransportMessageRef(message);
+        _LSTransportPostOutgoing(client, message);
+        return message;
+    }
+
+    /* bodies passed in a memfd are sent from the queue, see _LSTransportGatherOutgoing() */
+    bool large_body = _LSTransportUseMemfd(client, message);
+
+    /* If there is anything in the queue, we can't do a fast send
+     * or we risk re-ordering the messages */
+    if (!large_body && g_queue_is_empty(client->outgoing->queue) &&
+        !_LSTransportOutgoingHasPosted(client->outgoing))
     {
         //int total_bytes = 0;
 
@@ -4296,6 +5240,12 @@ _LSTransportSendVectorRet(const struct iovec *iov, int iovcnt, unsigned long tot
 
     message->tx_bytes_remaining -= bytes_written;
 
+    /* posted messages go first, unless part of this one is on the wire already */
+    if (bytes_written == 0)
+    {
+        _LSTransportOutgoingCollect(client->outgoing);
+    }
+
     /* if the queue is empty, there's no send watch set on it, so we
      * need to add one */
     if (g_queue_is_empty(client->outgoing->queue))
@@ -4309,6 +5259,7 @@ _LSTransportSendVectorRet(const struct iovec *iov, int iovcnt, unsigned long tot
     }
 
     _LSTransportMessageRef(message);
+    _LSTransportOutgoingAccount(client->outgoing, message);
     g_queue_push_tail(client->outgoing->queue, message);
 
     OUTGOING_UNLOCK(&client->outgoing->lock);
@@ -4339,6 +5290,9 @@ _LSTransportSendMessageMonitor(_LSTransportMessage *message, _LSTransportClient
 {
     bool ret = true;
 
+    if (!_LSTransportMonitorWants(client->transport, message, client, type))
+        return true;
+
     _LSMonitorMessageData message_data;
     /* Get a serial number from the shared memory area (global serial) */
     message_data.serial = _LSTransportShmGetSerial(client->transport->shm);
@@ -4352,43 +5306,16 @@ _LSTransportSendMessageMonitor(_LSTransportMessage *message, _LSTransportClient
         ClockGetTime(&message_data.timestamp);
     }
 
-    unsigned long message_data_size = sizeof(_LSMonitorMessageData);
-
     /* do the message copy and add the destination info */
-    char nul = '\0';
-    unsigned long orig_msg_size = _LSTransportMessageGetBodySize(message);
-    const char *dest_service_name = client->service_name;
-    const char *dest_unique_name = client->unique_name;
-    unsigned long dest_service_name_len = strlen_safe(client->service_name) + 1;
-    if (dest_service_name_len == 1)
-    {
-        dest_service_name = &nul;
-    }
-
-    LS_ASSERT(dest_unique_name != NULL);
-    unsigned long dest_unique_name_len = strlen(client->unique_name) + 1;
-
-    unsigned long monitor_message_body_size = orig_msg_size + dest_service_name_len + dest_unique_name_len;
-
-    unsigned long padding_bytes = PADDING_BYTES_TYPE(void *, sizeof(_LSTransportHeader) + monitor_message_body_size);
-
-    monitor_message_body_size += padding_bytes + message_data_size;
-
-    _LSTransportMessage *monitor_message = _LSTransportMessageNewRef(monitor_message_body_size);
-    monitor_message->raw->header.is_public_bus = message->raw->header.is_public_bus;
-    _LSTransportMessageCopy(monitor_message, message);
-
-    char *body = _LSTransportMessageGetBody(monitor_message);
-    body += orig_msg_size;
-    memcpy(body, dest_service_name, dest_service_name_len);
-    body += dest_service_name_len;
-    memcpy(body, dest_unique_name, dest_unique_name_len);
-    body += dest_unique_name_len;
-
-    /* padding for alignment */
-    body += padding_bytes;
-
-    memcpy(body, &message_data, message_data_size);
+    LS_ASSERT(client->unique_name != NULL);
+    _LSTransportMessage *monitor_message =
+        _LSTransportMessageNewMonitorRef(_LSTransportMessageGetType(message),
+                                         _LSTransportMessageGetToken(message),
+                                         _LSTransportMessageGetHeader(message)->is_public_bus,
+                                         _LSTransportMessageGetBody(message),
+                                         _LSTransportMessageGetBodySize(message),
+                                         client->service_name, client->unique_name,
+                                         &message_data);
 
     if (!_LSTransportSendMessageRaw(monitor_message, client->transport->monitor, false, NULL, false, NULL))
     {
@@ -4413,15 +5340,35 @@ _LSTransportSendMessageMonitor(_LSTransportMessage *message, _LSTransportClient
  */
 bool
 LSTransportSendMessageMonitorRequest(_LSTransport *transport, LSError *lserror)
+{
+    return LSTransportSendMessageMonitorRequestFiltered(transport, NULL, lserror);
+}
+
+static bool
+_LSTransportSendMessageMonitorRequestCommon(_LSTransport *transport, const char *filter, bool trace,
+                                            LSError *lserror)
 {
     LS_ASSERT(transport != NULL);
     LS_ASSERT(transport->hub != NULL);
 
-    _LSTransportMessage *message = _LSTransportMessageNewRef(0);
+    _LSTransportMessage *message = _LSTransportMessageNewRef(filter || trace ? LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE : 0);
 
     _LSTransportMessageSetType(message, _LSTransportMessageTypeMonitorRequest);
 
-    /* no body for the message */
+    /* no body for the message, but for the filter and the trace flag */
+    if (filter || trace)
+    {
+        _LSTransportMessageIter iter;
+        _LSTransportMessageIterInit(message, &iter);
+        if (!_LSTransportMessageAppendString(&iter, filter ? filter : "") ||
+            (trace && !_LSTransportMessageAppendInt32(&iter, 1)) ||
+            !_LSTransportMessageAppendInvalid(&iter))
+        {
+            _LSErrorSetOOM(lserror);
+            _LSTransportMessageUnref(message);
+            return false;
+        }
+    }
 
     /* send special message to the hub so that it can tell clients
      * to connect */
@@ -4432,6 +5379,46 @@ LSTransportSendMessageMonitorRequest(_LSTransport *transport, LSError *lserror)
     return true;
 }
 
+/**
+ *******************************************************************************
+ * @brief Send a "MonitorRequest" message with a filter, which the hub passes
+ * to the clients, so that they only send the monitor the messages it wants.
+ *
+ * @param  transport    IN   transport
+ * @param  filter       IN   filter expression (see @ref LunaServiceTransportMonitorFilter),
+ *                           NULL for all messages
+ * @param  lserror      OUT  set on error
+ *
+ * @retval true on success
+ * @retval false on failure
+ *******************************************************************************
+ */
+bool
+LSTransportSendMessageMonitorRequestFiltered(_LSTransport *transport, const char *filter, LSError *lserror)
+{
+    return _LSTransportSendMessageMonitorRequestCommon(transport, filter, false, lserror);
+}
+
+/**
+ *******************************************************************************
+ * @brief Send a "MonitorRequest" message for a tracing monitor: the hub tells
+ * the clients that can to append their messages to their trace rings (see
+ * @ref _LSTransportTraceReaderNew), and the others to connect as usual.
+ *
+ * @param  transport    IN   transport
+ * @param  filter       IN   filter expression, NULL for all messages
+ * @param  lserror      OUT  set on error
+ *
+ * @retval true on success
+ * @retval false on failure
+ *******************************************************************************
+ */
+bool
+LSTransportSendMessageMonitorRequestTraced(_LSTransport *transport, const char *filter, LSError *lserror)
+{
+    return _LSTransportSendMessageMonitorRequestCommon(transport, filter, true, lserror);
+}
+
 /**
  *******************************************************************************
  * @brief Send a message to the hub requesting a list of all connected clients.
@@ -4561,6 +5548,13 @@ _LSTransportHandleClientInfo(_LSTransportMessage *message)
     else
         LS_ASSERT(unique_name  && !(strcmp(client->unique_name, unique_name)));
 
+    _LSTransportMessageIterNext(&iter);
+
+    /* Older clients don't advertise any features */
+    int32_t features = 0;
+    _LSTransportMessageGetInt32(&iter, &features);
+    client->features = features;
+
     LOG_LS_DEBUG("%s: client: %p, service_name: %s, unique_name: %s\n", __func__, client, client->service_name, client->unique_name);
 }
 
@@ -4684,6 +5678,7 @@ _LSTransportMessageClientInfoNewRef(const char *service_name, const char *unique
     _LSTransportMessageIterInit(message, &iter);
     if (!_LSTransportMessageAppendString(&iter, service_name)) goto error;
     if (!_LSTransportMessageAppendString(&iter, unique_name)) goto error;
+    if (!_LSTransportMessageAppendInt32(&iter, LS_TRANSPORT_FEATURES_SUPPORTED)) goto error;
     if (!_LSTransportMessageAppendInvalid(&iter)) goto error;
 
     return message;
@@ -4792,8 +5787,46 @@ _LSTransportSendMessageRaw(_LSTransportMessage *message, _LSTransportClient *cli
         }
     }
 
-    /* TODO: lock the hash table of queues as well? (or only that?) */
+    if (!prepend)
+    {
+        /* a latest-value signal takes the place of its queued instance, if
+         * any; that needs the lock, so only these senders wait for it */
+        if (_LSTransportMessageIsCoalesced(message) &&
+            _LSTransportMessageGetType(message) == _LSTransportMessageTypeSignal)
+        {
+            OUTGOING_LOCK(&client->outgoing->lock);
+            _LSTransportOutgoingCollect(client->outgoing);
+            bool replaced = _LSTransportOutgoingCoalesce(client->outgoing, message);
+            OUTGOING_UNLOCK(&client->outgoing->lock);
+
+            if (replaced)
+            {
+                return true;
+            }
+        }
+
+        bool drop;
+        if (!_LSTransportCheckHighWater(client, _LSTransportMessageGetType(message),
+                                        message->tx_bytes_remaining, &drop, lserror))
+        {
+            _LSTransportMessageUnref(message);
+            return false;
+        }
+        if (drop)
+        {
+            _LSTransportMessageUnref(message);
+            return true;
+        }
+
+        /* no lock: senders on other threads don't wait for each other or
+         * for the send watch; control messages put in front of the queue
+         * below are never held back */
+        _LSTransportPostOutgoing(client, message);
+        return true;
+    }
+
     OUTGOING_LOCK(&client->outgoing->lock);
+    _LSTransportOutgoingCollect(client->outgoing);
 
     /* if the queue is empty, there's no send watch set on it, so we
      * need to add one */
@@ -4803,32 +5836,20 @@ _LSTransportSendMessageRaw(_LSTransportMessage *message, _LSTransportClient *cli
          * LSGmainAttach */
         if (client->transport->mainloop_context)
         {
-            /* TODO */
-            /* <eeh> There's an optimization in dbus whereby IFF the socket is
-               writable and the queue is empty it tries to write immediately
-               rather than enqueue and schedule for later write.  I suspect
-               that's a really common case.  Worth considering?  I'll grant
-               this things are beautifully simple this way.  */
-
             _LSTransportChannelAddSendWatch(&client->channel, client->transport->mainloop_context, client);
         }
     }
 
-    if (prepend)
-    {
-        /*
-         * Note that we don't preserve the ordering of serial numbers
-         * when we do this. If we re-ordered the serial numbers as shown above,
-         * we would be changing the serial number that could have been saved
-         * by a caller. In our current usage, that means that we would break
-         * the callmap lookups for a message.
-         */
-        g_queue_push_head(client->outgoing->queue, message);
-    }
-    else
-    {
-        g_queue_push_tail(client->outgoing->queue, message);
-    }
+    /*
+     * Note that we don't preserve the ordering of serial numbers
+     * when we do this. If we re-ordered the serial numbers as shown above,
+     * we would be changing the serial number that could have been saved
+     * by a caller. In our current usage, that means that we would break
+     * the callmap lookups for a message.
+     */
+    _LSTransportOutgoingAccount(client->outgoing, message);
+    g_queue_push_head(client->outgoing->queue, message);
+
     OUTGOING_UNLOCK(&client->outgoing->lock);
 
     return true;
@@ -4853,8 +5874,9 @@ _LSTransportSendMessage(_LSTransportMessage *message, _LSTransportClient *client
 {
     /* current time to add proper timestamp into the monitor message copy */
     struct timespec now;
+    bool traced = !client->transport->monitor && _LSTransportTraceEnabled(client->transport);
 
-    if (client->transport->monitor)
+    if (client->transport->monitor || traced)
     {
         ClockGetTime(&now);
     }
@@ -4870,6 +5892,13 @@ _LSTransportSendMessage(_LSTransportMessage *message, _LSTransportClient *client
             _LSTransportSendMessageMonitor(message, client, _LSMonitorMessageTypeTx, &now, lserror);
         }
     }
+    else if (traced)
+    {
+        if (_LSTransportMessageIsMonitorType(message))
+        {
+            _LSTransportTraceMessage(message, client, _LSMonitorMessageTypeTx, &now);
+        }
+    }
 
     return ret;
 }
@@ -5026,13 +6055,12 @@ LSTransportCancelMethodCall(_LSTransport *transport, const char *service_name, L
     message_body += method_len;
     memcpy(message_body, payload, payload_len);
 
-    TRANSPORT_LOCK(&transport->lock);
-    client = g_hash_table_lookup(transport->clients, service_name);
-    TRANSPORT_UNLOCK(&transport->lock);
+    client = _LSTransportLookupClientRef(transport, service_name);
 
     if (client)
     {
         ret = _LSTransportSendMessage(message, client, NULL, lserror);
+        _LSTransportClientUnref(client);
     }
 
     g_free(payload);
@@ -5416,8 +6444,6 @@ LSTransportSend(_LSTransport *transport, const char *origin_exe,
 
     // Note: lookup for proxy connection: origin_name:service_name
     /* Look up destination and connect to it if we haven't already */
-    TRANSPORT_LOCK(&transport->lock);
-
     const char *concatenated_name = NULL;
     bool status = true;
 
@@ -5429,9 +6455,7 @@ LSTransportSend(_LSTransport *transport, const char *origin_exe,
         concatenated_name = g_strconcat(origin_name, ":", service_name, NULL);
     }
 
-    _LSTransportClient *client = g_hash_table_lookup(transport->clients, concatenated_name);
-
-    TRANSPORT_UNLOCK(&transport->lock);
+    _LSTransportClient *client = _LSTransportLookupClientRef(transport, concatenated_name);
 
     do {
         if (!client) {
@@ -5469,7 +6493,8 @@ LSTransportSend(_LSTransport *transport, const char *origin_exe,
             LSMessageToken msg_token = _LSTransportGetNextToken(transport);
 
             _LSTransportMonitorSerial monitor_serial = 0;
-            if (transport->monitor) {
+            bool traced = !transport->monitor && _LSTransportTraceEnabled(transport);
+            if (transport->monitor || traced) {
                 monitor_serial = _LSTransportShmGetSerial(client->transport->shm);
                 ClockGetTime(&now);
             }
@@ -5489,7 +6514,7 @@ LSTransportSend(_LSTransport *transport, const char *origin_exe,
             *token = msg_token;
 
             /* MONITOR */
-            if (transport->monitor) {
+            if (transport->monitor && _LSTransportMonitorWants(transport, message, client, _LSMonitorMessageTypeTx)) {
                 /*
                 * Add destination service name and destination unique name
                 * so that the monitor knows where this message was going. It
@@ -5541,11 +6566,16 @@ LSTransportSend(_LSTransport *transport, const char *origin_exe,
                 * monitor goes down */
                 (void)_LSTransportSendVector(iov_monitor, ARRAY_SIZE(iov_monitor), monitor_total_size, app_id_offset, transport->monitor, lserror);
             }
+            else if (traced) {
+                _LSTransportTraceMessage(message, client, _LSMonitorMessageTypeTx, &now);
+            }
         }
         _LSTransportMessageUnref(message);
 
     } while (false);
 
+    if (client) _LSTransportClientUnref(client);
+
     if ((NULL != origin_name) && ('\0' != origin_name[0])) {
         g_free(concatenated_name);
     }
@@ -5553,10 +6583,89 @@ LSTransportSend(_LSTransport *transport, const char *origin_exe,
     return status;
 }
 
+/**
+ *******************************************************************************
+ * @brief Gather the unsent parts of the messages at the head of the outgoing
+ * queue into an io vector.
+ *
+ * Messages posted from other threads are collected first. Stops after the
+ * first message that carries an fd, since the fd marker has to follow that
+ * message's bytes on the wire (see @ref _LSTransportSendFd). NULL entries
+ * found on the queue are dropped.
+ *
+ * @attention must be called with the outgoing lock held
+ *
+ * @param  client       IN   client
+ * @param  iov          OUT  io vector, at least 2 * LS_TRANSPORT_OUTGOING_MAX_IOV long
+ * @param  iovcnt       OUT  number of entries filled in @p iov
+ *
+ * @retval  number of messages from the queue head covered by @p iov
+ *******************************************************************************
+ */
+static int
+_LSTransportGatherOutgoing(_LSTransportClient *client, struct iovec *iov, int *iovcnt)
+{
+    GQueue *queue = client->outgoing->queue;
+    int messages = 0;
+
+    _LSTransportOutgoingCollect(client->outgoing);
+
+    GList *link = g_queue_peek_head_link(queue);
+
+    *iovcnt = 0;
+
+    while (link && messages < LS_TRANSPORT_OUTGOING_MAX_IOV)
+    {
+        _LSTransportMessage *message = link->data;
+
+        /* Warn and drop if we find a null */
+        if (!message)
+        {
+            GList *next = link->next;
+            LOG_LS_WARNING(MSGID_LS_QUEUE_ERROR, 0, "%s: Found null message in outgoing queue", __func__);
+            g_queue_delete_link(queue, link);
+            link = next;
+            continue;
+        }
+
+        /* large bodies go in a memfd, swap the message for its stub before
+         * any of it is sent */
+        if (_LSTransportUseMemfd(client, message) &&
+            message->tx_bytes_remaining == sizeof(_LSTransportHeader) + message->raw->header.len &&
+            !message->tx_header && !_LSTransportMessageIsFdType(message))
+        {
+            _LSTransportMessage *memfd_message = _LSTransportMessageNewMemfdRef(message);
+            if (memfd_message)
+            {
+                /* the stub leaves the queue in place of the message */
+                memfd_message->queued_size = message->queued_size;
+                message->queued_size = 0;
+
+                link->data = memfd_message;
+                _LSTransportMessageUnref(message);
+                message = memfd_message;
+            }
+        }
+
+        *iovcnt += _LSTransportMessageGetTxVector(message, iov + *iovcnt);
+        messages++;
+        link = link->next;
+
+        if (_LSTransportMessageIsFdType(message))
+            break;
+    }
+
+    return messages;
+}
+
 /**
  *******************************************************************************
  * @brief Callback that is called when a watch is ready to send.
  *
+ * Up to LS_TRANSPORT_OUTGOING_MAX_IOV queued messages are written with a
+ * single writev(). A partially written message stays at the head of the queue
+ * with its tx_bytes_remaining updated.
+ *
  * @attention locks the outgoing lock
  *
  * @param  source       IN  io source
@@ -5575,6 +6684,7 @@ _LSTransportSendClient(GIOChannel *source, GIOCondition condition,
      * and quit if the call will block */
 
     _LSTransportClient *client = (_LSTransportClient*)data;
+    struct iovec iov[2 * LS_TRANSPORT_OUTGOING_MAX_IOV];
 
     WAKEUP();
 
@@ -5585,80 +6695,84 @@ _LSTransportSendClient(GIOChannel *source, GIOCondition condition,
 
     while (1)
     {
-        int ret = 0;
+        int iovcnt = 0;
+        int messages = _LSTransportGatherOutgoing(client, iov, &iovcnt);
+        ssize_t ret = 0;
 
-        if (g_queue_is_empty (client->outgoing->queue))
+        if (messages == 0)
         {
                 /* remove the watch since we're done sending */
                 _LSTransportChannelRemoveSendWatch(&client->channel);
 
+                /* a message posted meanwhile may have found the watch still
+                 * in place */
+                if (_LSTransportOutgoingHasPosted(client->outgoing))
+                {
+                    _LSTransportChannelAddSendWatch(&client->channel, client->transport->mainloop_context, client);
+                }
+
                 OUTGOING_UNLOCK(&client->outgoing->lock);
                 return FALSE;
         }
 
-        /* grab message off queue */
-        _LSTransportMessage *message = g_queue_pop_head(client->outgoing->queue);
-
-        /* Warn and exit if we dequeue a null */
-        if (!message)
+        if (iovcnt > 0)
         {
-            LOG_LS_WARNING(MSGID_LS_QUEUE_ERROR, 0, "%s: Found null message in outgoing queue", __func__);
-            continue;
-        }
+            /* attempt to send the batch */
+            ret = writev(client->channel.fd, iov, iovcnt);
 
-        //printf("SendClient: sending message: token %d, type: %d, len: %d, data: %s\n", (int)_LSTransportMessageGetToken(message), (int)_LSTransportMessageGetType(message), (int)message->raw->header.len, _LSTransportMessageGetBody(message));
-        //printf("sending %ld bytes\n", message->tx_bytes_remaining);
+            if (ret < 0)
+            {
+                if (errno == EAGAIN || errno == EINTR)
+                {
+                    /* still have data left, messages stay on the queue */
+                    goto Done;
+                }
 
-        if (message->tx_bytes_remaining > 0)
-        {
-            /* attempt to send message */
+                if (errno == EPIPE)
+                {
+                    /* Broken pipe is considered a normal situation, because it means
+                     * the peer has disconnected suddenly.
+                     */
+                    LOG_LS_WARNING(MSGID_LS_SOCK_ERROR, 4,
+                                   PMLOGKFV("ERROR_CODE", "%d", errno),
+                                   PMLOGKS("ERROR", g_strerror(errno)),
+                                   PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
+                                   PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
+                                   "Error when attempting to send to fd: %d", client->channel.fd);
+                }
+                else
+                {
+                    /* TODO: Handle better */
+                    LOG_LS_ERROR(MSGID_LS_SOCK_ERROR, 4,
+                                 PMLOGKFV("ERROR_CODE", "%d", errno),
+                                 PMLOGKS("ERROR", g_strerror(errno)),
+                                 PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
+                                 PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
+                                 "Error when attempting to send to fd: %d", client->channel.fd);
+                }
 
-            /* TODO */
-            /* <eeh> This is a lot of math.  Can you calc a ptr upfront and increment it by ret? */
-            ret = send(client->channel.fd, (char*)message->raw + message->raw->header.len + sizeof(_LSTransportHeader) - message->tx_bytes_remaining, message->tx_bytes_remaining, MSG_DONTWAIT);
+                /* drop the message we failed to send */
+                _LSTransportMessageUnref(_LSTransportOutgoingPopHead(client->outgoing));
+                goto Done;     /* <eeh> You're going to return TRUE here.  Want that? */
+            }
+        }
 
-            if (ret >= 0)
-            {
-                message->tx_bytes_remaining -= ret;
+        /* account the written bytes to the messages of the batch */
+        for (; messages > 0; messages--)
+        {
+            _LSTransportMessage *message = g_queue_peek_head(client->outgoing->queue);
+            unsigned long sent = MIN((unsigned long)ret, message->tx_bytes_remaining);
 
-            }
-            else if (errno == EAGAIN || errno == EINTR)
-            {
-                /* still have data left, so put it back on the queue
-                 * from where we took it off */
-                g_queue_push_head(client->outgoing->queue, message);
-                goto Done;
-            }
-            else if (errno == EPIPE)
+            message->tx_bytes_remaining -= sent;
+            ret -= sent;
+
+            if (message->tx_bytes_remaining > 0)
             {
-                /* Broken pipe is considered a normal situation, because it means
-                 * the peer has disconnected suddenly.
-                 */
-                LOG_LS_WARNING(MSGID_LS_SOCK_ERROR, 4,
-                               PMLOGKFV("ERROR_CODE", "%d", errno),
-                               PMLOGKS("ERROR", g_strerror(errno)),
-                               PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
-                               PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
-                               "Error when attempting to send to fd: %d", client->channel.fd);
-                _LSTransportMessageUnref(message);
+                /* still have data left, so leave it at the head of the queue;
+                 * the socket is full, we'll get EAGAIN if we try again */
                 goto Done;
             }
-            else
-            {
-                /* TODO: Handle better */
-                LOG_LS_ERROR(MSGID_LS_SOCK_ERROR, 4,
-                             PMLOGKFV("ERROR_CODE", "%d", errno),
-                             PMLOGKS("ERROR", g_strerror(errno)),
-                             PMLOGKS("APP_ID", _LSTransportClientGetServiceName(client)),
-                             PMLOGKS("UNIQUE_NAME", _LSTransportClientGetUniqueName(client)),
-                             "Error when attempting to send to fd: %d", client->channel.fd);
-                _LSTransportMessageUnref(message);
-                goto Done;     /* <eeh> You're going to return TRUE here.  Want that? */
-            }
-        }
 
-        if (message->tx_bytes_remaining == 0)
-        {
             /* transmitted entire message */
 
             /* Send the connection fd if we have one
@@ -5671,14 +6785,13 @@ _LSTransportSendClient(GIOChannel *source, GIOCondition condition,
                 LSError lserror;
                 LSErrorInit(&lserror);
 
-                if (!_LSTransportSendFd(client->channel.fd, _LSTransportMessageGetFd(message), &need_retry, &lserror))
+                if (!_LSTransportSendMessageFds(client->channel.fd, message, &need_retry, &lserror))
                 {
                     if (need_retry)
                     {
-                        /* Still need to send fd, so push message back on
-                         * queue where it was and wait for fd to become
-                         * ready for sending */
-                        g_queue_push_head(client->outgoing->queue, message);
+                        /* Still need to send fd, so leave message on the
+                         * queue head and wait for fd to become ready for
+                         * sending */
                         goto Done;
                     }
                     else
@@ -5691,7 +6804,6 @@ _LSTransportSendClient(GIOChannel *source, GIOCondition condition,
 
             /* the fd is closed when the message ref count goes to 0 */
 
-            //_LSTransportHeader *header = &message->raw->header;
             LOG_LS_DEBUG("%s: sent message: client: %p, token %d, type: %d, len: %d\n",
                         __func__,
                         client,
@@ -5699,19 +6811,10 @@ _LSTransportSendClient(GIOChannel *source, GIOCondition condition,
                         (int)_LSTransportMessageGetType(message),
                         (int)message->raw->header.len);
 
-            _LSTransportMessageUnref(message);
-        }
-        else
-        {
-            /* still have data left, so put it back on the queue from
-             * where we took it off.
-             *
-             * TODO: we don't actually have to exit the loop here; as long as we're
-             * calling send with MSG_DONTWAIT, it won't block and we can
-             * give it another shot.. we'll get EAGAIN if we would block */
-            g_queue_push_head(client->outgoing->queue, message);
-            goto Done;
+            _LSTransportMessageUnref(_LSTransportOutgoingPopHead(client->outgoing));
         }
+
+        LS_ASSERT(ret == 0);
     }
 
 Done:
@@ -5833,6 +6936,8 @@ _LSTransportInit(_LSTransport **ret_transport, const char *service_name, const c
 
     transport->shm = NULL;      /* Set in _LSTransportConnect */
 
+    transport->trust_level_generation = 1;
+
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
@@ -5848,6 +6953,12 @@ _LSTransportInit(_LSTransport **ret_transport, const char *service_name, const c
         LOG_LS_ERROR(MSGID_LS_TOKEN_ERR, 0, "Could not allocate new global token");
     }
 
+    if (pthread_rwlock_init(&transport->clients_lock, NULL))
+    {
+        _LSErrorSet(lserror, MSGID_LS_MUTEX_ERR, -1, "Could not initialize rwlock");
+        goto error;
+    }
+
     /* TODO: wrap this? */
     transport->clients = g_hash_table_new_full(g_str_hash, g_str_equal,
         (GDestroyNotify)g_free, (GDestroyNotify)_LSTransportClientUnref);
@@ -5908,7 +7019,8 @@ _LSTransportSendShutdownMessageBlocking(_LSTransportClient *client, LSError *lse
 
     _LSTransportMessageSetType(message, _LSTransportMessageTypeShutdown);
 
-    _LSTransportMessageSetBody(message, (char*)&client->incoming->last_serial_processed, sizeof(LSMessageToken));
+    LSMessageToken last_serial_processed = (LSMessageToken) g_atomic_pointer_get(&client->incoming->last_serial_processed);
+    _LSTransportMessageSetBody(message, (char*)&last_serial_processed, sizeof(LSMessageToken));
 
     if (!_LSTransportSendMessageBlocking(message, client, true, NULL, lserror))
     {
@@ -5965,6 +7077,13 @@ _LSTransportProcessIncomingMessages(_LSTransportClient *client, LSError *lserror
                 _LSTransportSendMessageMonitor(tmsg, client, _LSMonitorMessageTypeRx, NULL, lserror);
             }
         }
+        else if (_LSTransportTraceEnabled(client->transport))
+        {
+            if (_LSTransportMessageIsMonitorType(tmsg))
+            {
+                _LSTransportTraceMessage(tmsg, client, _LSMonitorMessageTypeRx, NULL);
+            }
+        }
 
         /* Handle "internal" messages, otherwise, let the registered handler take over */
         LOG_LS_DEBUG("%s: received message token %d, type: %d, len: %d\n", __func__, (int)tmsg->raw->header.token, (int)tmsg->raw->header.type, (int)tmsg->raw->header.len);
@@ -5979,6 +7098,10 @@ _LSTransportProcessIncomingMessages(_LSTransportClient *client, LSError *lserror
                 _LSTransportHandleQueryProxyNameReply(tmsg);
                 break;
 
+            case _LSTransportMessageTypeQueryNameBatchReply:
+                _LSTransportHandleQueryNameBatchReply(tmsg);
+                break;
+
             case _LSTransportMessageTypeShutdown:
                 _LSTransportHandleShutdown(tmsg);
                 break;
@@ -6010,10 +7133,11 @@ _LSTransportProcessIncomingMessages(_LSTransportClient *client, LSError *lserror
                 _LSTransportHandleClientInfo(tmsg);
                 break;
 
-            case _LSTransportMessageTypeMethodCall:
-                /* Save message serial so we know what has been processed */
-                incoming->last_serial_processed = _LSTransportMessageGetToken(tmsg);
-                /* fallthrough */
+            case _LSTransportMessageTypeServiceDownSignal:
+            case _LSTransportMessageTypeServiceUpSignal:
+                _LSTransportHandleServiceStatus(tmsg);
+                _LSTransportHandleUserMessageHandler(tmsg);
+                break;
 
             default:
                 _LSTransportHandleUserMessageHandler(tmsg);
@@ -6053,10 +7177,11 @@ _LSTransportFlushOutgoingMessages(_LSTransportClient *client, LSError *lserror)
     LOG_LS_DEBUG("%s: client: %p\n", __func__, client);
 
     OUTGOING_LOCK(&client->outgoing->lock);
+    _LSTransportOutgoingCollect(client->outgoing);
 
     while (!g_queue_is_empty(client->outgoing->queue))
     {
-        _LSTransportMessage *message = g_queue_pop_head(client->outgoing->queue);
+        _LSTransportMessage *message = _LSTransportOutgoingPopHead(client->outgoing);
         if (!message)
         {
             /* LOCKED */
@@ -6244,15 +7369,33 @@ _LSTransportDisconnect(_LSTransport *transport, bool flush_and_send_shutdown)
 
     LOG_LS_DEBUG("%s: transport: %p\n", __func__, transport);
 
+    /* Nothing runs in the I/O thread from now on, the rest is done here */
+    if (transport->io_thread)
+    {
+        _LSTransportIoThreadStop(transport->io_thread);
+    }
+
     TRANSPORT_LOCK(&transport->lock);
     g_hash_table_foreach(transport->all_connections, _LSTransportSendShutdownMessages, GINT_TO_POINTER((gint)flush_and_send_shutdown));
     TRANSPORT_UNLOCK(&transport->lock);
 
     _LSTransportDiscardAllClientIncoming(transport);
 
+    if (transport->io_thread)
+    {
+        int discards = _LSTransportIoThreadDiscard(transport->io_thread);
+        if (discards)
+        {
+            LOG_LS_WARNING(MSGID_LS_QUEUE_ERROR, 0, "%s: discarded %d events", __func__, discards);
+        }
+    }
+
     _LSTransportChannelClose(&transport->listen_channel, flush_and_send_shutdown);
     _LSTransportChannelDeinit(&transport->listen_channel);
 
+    /* lets go of the trace ring if nothing else traces */
+    _LSTransportTraceSetEnabled(transport, false);
+
     if (transport->shm) _LSTransportShmDeinit(&transport->shm);
 
     return true;
@@ -6297,6 +7440,7 @@ _LSTransportDeinit(_LSTransport *transport)
 
         if (transport->clients) g_hash_table_unref(transport->clients);
         transport->clients = NULL;
+        pthread_rwlock_destroy(&transport->clients_lock);
 
         if (transport->all_connections) g_hash_table_unref(transport->all_connections);
         transport->all_connections = NULL;
@@ -6305,9 +7449,15 @@ _LSTransportDeinit(_LSTransport *transport)
         if (transport->pending) g_hash_table_unref(transport->pending);
         transport->pending = NULL;
 
+        if (transport->prewarm_peers) g_hash_table_unref(transport->prewarm_peers);
+        transport->prewarm_peers = NULL;
+
         if (transport->hub) _LSTransportClientUnref(transport->hub);
         transport->hub = NULL;
 
+        if (transport->monitor_filter) _LSTransportMonitorFilterUnref(transport->monitor_filter);
+        transport->monitor_filter = NULL;
+
         if (transport->global_token) _LSTransportGlobalTokenFree(transport->global_token);
         transport->global_token = NULL;
 
@@ -6315,6 +7465,9 @@ _LSTransportDeinit(_LSTransport *transport)
         if (transport->mainloop_context) g_main_context_unref(transport->mainloop_context);
         transport->mainloop_context = NULL;
 
+        if (transport->io_thread) _LSTransportIoThreadFree(transport->io_thread);
+        transport->io_thread = NULL;
+
         g_free(transport->service_name);
         transport->service_name = NULL;
 
@@ -6445,6 +7598,7 @@ static void _LSTransportSetTransportFlags(_LSTransport *transport, int32_t trans
     transport->is_old_config = (transport_flags & _LSTransportFlagOldConfig);
     transport->is_private_allowed = (transport_flags & _LSTransportFlagPrivateBus);
     transport->is_public_allowed = (transport_flags & _LSTransportFlagPublicBus);
+    transport->query_name_batch = (transport_flags & _LSTransportFlagQueryNameBatch);
 }
 
 //Initialize trust level provided in groups.json
@@ -6567,6 +7721,7 @@ bool _LSTransportInitializeTrustLevel(_LSTransport *transport, const char * prov
     transport->trust_security_mask_size = mask_size;
     transport->provided_trust_level_map = provided_trust_level_map;
     transport->provided_trust_level_to_group_map = provided_trust_level_to_group_map;
+    transport->trust_level_generation++;
 
     j_release(&jmap);
 
@@ -6687,6 +7842,7 @@ bool _LSTransportInitializeSecurityGroups(_LSTransport *transport, const char *m
     transport->security_mask_size = mask_size;
     transport->group_code_map = group_code_map;
     transport->category_groups = category_groups;
+    transport->trust_level_generation++;
 
     j_release(&jmap);
     return true;
@@ -6932,6 +8088,93 @@ void LSTransportRemoveMessage(_LSTransport *transport, LSMessage *message)
 }
 #endif
 
+/**
+ *******************************************************************************
+ * @brief Describe the depth of the message queues of every connection and
+ * the high-water marks they are held to.
+ *
+ * @param  transport    IN  transport
+ *
+ * @retval  object with "limits" and "clients"
+ *******************************************************************************
+ */
+jvalue_ref
+LSTransportGetQueues(_LSTransport *transport)
+{
+    jvalue_ref outgoing_limits = jobject_create();
+    jobject_put(outgoing_limits, J_CSTR_TO_JVAL("bytes"), jnumber_create_i64(_ls_outgoing_hwm_bytes));
+    jobject_put(outgoing_limits, J_CSTR_TO_JVAL("messages"), jnumber_create_i64(_ls_outgoing_hwm_messages));
+    jobject_put(outgoing_limits, J_CSTR_TO_JVAL("policy"),
+                jstring_create(_LSTransportQueuePolicyToString(_ls_outgoing_hwm_policy)));
+
+    jvalue_ref incoming_limits = jobject_create();
+    jobject_put(incoming_limits, J_CSTR_TO_JVAL("bytes"), jnumber_create_i64(_ls_incoming_hwm_bytes));
+    jobject_put(incoming_limits, J_CSTR_TO_JVAL("messages"), jnumber_create_i64(_ls_incoming_hwm_messages));
+
+    jvalue_ref limits = jobject_create();
+    jobject_put(limits, J_CSTR_TO_JVAL("outgoing"), outgoing_limits);
+    jobject_put(limits, J_CSTR_TO_JVAL("incoming"), incoming_limits);
+
+    jvalue_ref clients = jarray_create(NULL);
+
+    TRANSPORT_LOCK(&transport->lock);
+    if (transport->all_connections)
+    {
+        GHashTableIter iter;
+        gpointer value;
+
+        g_hash_table_iter_init(&iter, transport->all_connections);
+        while (g_hash_table_iter_next(&iter, NULL, &value))
+        {
+            _LSTransportClient *client = value;
+
+            jvalue_ref entry = jobject_create();
+            jobject_put(entry, J_CSTR_TO_JVAL("fd"), jnumber_create_i32(client->channel.fd));
+            jobject_put(entry, J_CSTR_TO_JVAL("unique_name"), client->unique_name ?
+                jstring_create(client->unique_name) : jstring_create("null"));
+            jobject_put(entry, J_CSTR_TO_JVAL("service_name"), client->service_name ?
+                jstring_create(client->service_name) : jstring_create("null"));
+
+            if (client->outgoing)
+            {
+                _LSTransportOutgoing *outgoing = client->outgoing;
+                jvalue_ref depth = jobject_create();
+                jobject_put(depth, J_CSTR_TO_JVAL("messages"),
+                            jnumber_create_i32(g_atomic_int_get(&outgoing->queued_messages)));
+                jobject_put(depth, J_CSTR_TO_JVAL("bytes"),
+                            jnumber_create_i64(g_atomic_pointer_get(&outgoing->queued_bytes)));
+                jobject_put(depth, J_CSTR_TO_JVAL("dropped"),
+                            jnumber_create_i32(g_atomic_int_get(&outgoing->dropped_messages)));
+                jobject_put(depth, J_CSTR_TO_JVAL("coalesced"),
+                            jnumber_create_i32(g_atomic_int_get(&outgoing->coalesced_messages)));
+                jobject_put(depth, J_CSTR_TO_JVAL("over_high_water"),
+                            jboolean_create(g_atomic_int_get(&outgoing->high_water)));
+                jobject_put(entry, J_CSTR_TO_JVAL("outgoing"), depth);
+            }
+
+            if (client->incoming)
+            {
+                _LSTransportIncoming *incoming = client->incoming;
+                jvalue_ref depth = jobject_create();
+                jobject_put(depth, J_CSTR_TO_JVAL("messages"),
+                            jnumber_create_i32(g_queue_get_length(incoming->complete_messages)));
+                jobject_put(depth, J_CSTR_TO_JVAL("bytes"), jnumber_create_i64(incoming->rx_queued_bytes));
+                jobject_put(depth, J_CSTR_TO_JVAL("throttled"), jnumber_create_i64(incoming->rx_throttled));
+                jobject_put(entry, J_CSTR_TO_JVAL("incoming"), depth);
+            }
+
+            jarray_append(clients, entry);
+        }
+    }
+    TRANSPORT_UNLOCK(&transport->lock);
+
+    jvalue_ref queues = jobject_create();
+    jobject_put(queues, J_CSTR_TO_JVAL("limits"), limits);
+    jobject_put(queues, J_CSTR_TO_JVAL("clients"), clients);
+
+    return queues;
+}
+
 jvalue_ref
 LSTransportGetTrustFromMask(_LSTransport *transport, LSTransportBitmaskWord *mask)
 {
@@ -6950,6 +8193,96 @@ LSTransportGetTrustFromMask(_LSTransport *transport, LSTransportBitmaskWord *mas
     return trusts;
 }
 
+/**
+ * @brief Get trust levels provided by groups
+ *
+ * Every group takes the trust levels of the first trust level pattern, which
+ * matches its name.
+ *
+ * @param[in] transport
+ * @param[in] group_mask  ACG bit set (see security_mask_size)
+ *
+ * @return newly allocated trust level bit set (see trust_security_mask_size),
+ *         NULL if none of the groups matches a trust level pattern
+ */
+LSTransportBitmaskWord *
+LSTransportGetTrustFromGroupMask(_LSTransport *transport, LSTransportBitmaskWord *group_mask)
+{
+    if (!transport->provided_trust_level_to_group_map || !transport->group_code_map || !group_mask)
+        return NULL;
+
+    LSTransportBitmaskWord *trusts = NULL;
+    GHashTableIter iter_groups;
+    gpointer group;
+    gpointer bit;
+
+    g_hash_table_iter_init(&iter_groups, transport->group_code_map);
+    while (g_hash_table_iter_next(&iter_groups, &group, &bit)) {
+        if (!BitMaskTestBit(group_mask, GPOINTER_TO_INT(bit)))
+            continue;
+
+        GSList *list = transport->provided_trust_level_to_group_map;
+        for (; list; list = g_slist_next(list))
+        {
+            const LSTransportTrustLevelGroupBitmask *trust_bitmask = list->data;
+
+            if (trust_bitmask->trustLevel_group_bitmask &&
+                g_pattern_match_string(trust_bitmask->group_pattern, group))
+            {
+                if (!trusts)
+                    trusts = g_malloc0_n(transport->trust_security_mask_size, sizeof(LSTransportBitmaskWord));
+                BitMaskBitwiseOr(trusts, trust_bitmask->trustLevel_group_bitmask,
+                                 transport->trust_security_mask_size);
+                break;
+            }
+        }
+    }
+
+    return trusts;
+}
+
+/**
+ * @brief Get bit number of a trust level
+ *
+ * A client without trust level is an unsigned one, it gets the bit of
+ * DEFAULT_TRUST_LEVEL.
+ *
+ * @param[in] transport
+ * @param[in] trust_level  trust level, or NULL for DEFAULT_TRUST_LEVEL
+ *
+ * @return bit in trust level bit sets, -1 if the trust level isn't provided
+ */
+int
+LSTransportGetTrustLevelCode(_LSTransport *transport, const char *trust_level)
+{
+    gpointer bit;
+
+    if (!trust_level)
+        trust_level = DEFAULT_TRUST_LEVEL;
+
+    if (!transport->provided_trust_level_map ||
+        !g_hash_table_lookup_extended(transport->provided_trust_level_map, trust_level, NULL, &bit))
+        return -1;
+
+    return GPOINTER_TO_INT(bit);
+}
+
+/**
+ * @brief Get generation of the group and trust level maps
+ *
+ * The generation changes whenever the maps are reinitialized, so that
+ * anything computed from them can be checked for staleness.
+ *
+ * @param[in] transport
+ *
+ * @return generation, never 0
+ */
+unsigned
+LSTransportGetTrustLevelGeneration(_LSTransport *transport)
+{
+    return transport->trust_level_generation;
+}
+
 // TBD : Write function to get trust level and group from mask
 #ifdef SECURITY_COMPATIBILITY
 
@@ -44,6 +44,7 @@ typedef struct LSTransport _LSTransport;
 #include "transport_serial.h"
 #include "transport_outgoing.h"
 #include "transport_incoming.h"
+#include "transport_iothread.h"
 #include "transport_client.h"
 #include "transport_security.h"
 #include "transport_utils.h"
@@ -93,6 +94,10 @@ _padding_bytes(unsigned int align_bytes, unsigned int size_bytes)
 */
 #define MAX_SEND_RETRIES 10
 
+/** Most services looked up with a single "QueryNameBatch", bounded by the fds
+ *  the reply can carry */
+#define LS_TRANSPORT_QUERY_NAME_BATCH_MAX   LS_TRANSPORT_INCOMING_MAX_FDS
+
 /** Messages larger than 10 MB are dropped */
 #define MAX_MESSAGE_SIZE_BYTES  10485760
 
@@ -104,6 +109,7 @@ typedef enum LSTransportFlags {
     _LSTransportFlagOldConfig = 1,  /**< Known to have legacy-style configuration */
     _LSTransportFlagPrivateBus = 2, /**< Has private handle */
     _LSTransportFlagPublicBus = 4,  /**< Has public handle */
+    _LSTransportFlagQueryNameBatch = 8, /**< Hub answers "QueryNameBatch" */
 } _LSTransportFlags;
 
 bool _LSTransportInit(_LSTransport **ret_transport, const char *service_name, const char *app_id, const LSTransportHandlers *handlers, LSError *lserror);
@@ -111,6 +117,8 @@ bool _LSTransportDisconnect(_LSTransport *transport, bool flush_and_send_shutdow
 void _LSTransportDeinit(_LSTransport *transport);
 void _LSTransportGmainAttach(_LSTransport *transport, GMainContext *context);
 GMainContext* _LSTransportGetGmainContext(const _LSTransport *transport);
+GMainContext* _LSTransportGetUserContext(const _LSTransport *transport);
+bool _LSTransportSetIoThread(_LSTransport *transport, bool enable, LSError *lserror);
 bool _LSTransportGmainSetPriority(_LSTransport *transport, int priority, LSError *lserror);
 bool _LSTransportConnect(_LSTransport *transport, LSError *lserror);
 bool _LSTransportAppendCategory(_LSTransport *transport, bool is_public_bus, const char *category, LSMethod *methods, LSError *lserror);
@@ -146,6 +154,8 @@ bool LSTransportPushRole(_LSTransport *transport, const char *path, bool is_publ
 
 /* TODO: move these */
 bool LSTransportSendMessageMonitorRequest(_LSTransport *transport, LSError *lserror);
+bool LSTransportSendMessageMonitorRequestFiltered(_LSTransport *transport, const char *filter, LSError *lserror);
+bool LSTransportSendMessageMonitorRequestTraced(_LSTransport *transport, const char *filter, LSError *lserror);
 bool _LSTransportSendMessageListClients(_LSTransport *transport, LSError *lserror);
 bool _LSTransportSendMessageDumpHubData(_LSTransport *transport, LSError *lserror);
 bool _LSTransportSendMessageListServiceMethods(_LSTransport *transport, const char *service_name, bool is_public_bus, LSError *lserror);
@@ -155,6 +165,9 @@ bool LSTransportSendQueryServiceCategory(_LSTransport *transport, bool is_public
                                          LSMessageToken *serial, LSError *lserror);
 
 const char* _LSTransportQueryNameReplyGetUniqueName(_LSTransportMessage *message);
+unsigned int _LSTransportQueryNameBatchReplyGetFdCount(_LSTransportMessage *message);
+
+bool _LSTransportPrewarmPeers(_LSTransport *transport, const char * const *peers, bool is_public_bus, LSError *lserror);
 
 bool _LSTransportNodeUp(_LSTransport *transport, bool is_public_bus, LSError *lserror);
 
@@ -189,12 +202,19 @@ LSTransportCategoryBitmask *LSTransportTrustLevelBitmaskNew(const char *pattern,
 void LSTransportCategoryBitmaskFree(LSTransportCategoryBitmask *v);
 void LSTransportTrustLevelGroupBitmaskFree(LSTransportTrustLevelGroupBitmask *v);
 
+/** Trust level of the apps and services that aren't signed */
+#define DEFAULT_TRUST_LEVEL "dev"
+
 size_t LSTransportGetSecurityMaskSize(_LSTransport *transport);
 GSList *LSTransportGetCategoryGroups(_LSTransport *transport);
 jvalue_ref LSTransportGetGroupsFromMask(_LSTransport *transport, LSTransportBitmaskWord *mask);
 
 jvalue_ref LSTransportGetTrustFromMask(_LSTransport *transport, LSTransportBitmaskWord *mask);
+LSTransportBitmaskWord *LSTransportGetTrustFromGroupMask(_LSTransport *transport, LSTransportBitmaskWord *group_mask);
+int LSTransportGetTrustLevelCode(_LSTransport *transport, const char *trust_level);
+unsigned LSTransportGetTrustLevelGeneration(_LSTransport *transport);
 GSList *LSTransportGetTrustLevelToGroups(_LSTransport *transport);
+jvalue_ref LSTransportGetQueues(_LSTransport *transport);
 
 #ifdef LS_TRACK_MESSAGE
 jvalue_ref LSTransportGetConnections(_LSTransport *transport);
@@ -96,7 +96,7 @@ RemoveWatch(_LSTransportChannel *channel, GSource **out_watch)
  * @brief Initialize a channel.
  *
  * @param  channel      IN  channel to initialize
- * @param  fd           IN  fd
+ * @param  fd           IN  fd, -1 for a channel that is never read or written
  * @param  priority     IN  priority
  *
  * @retval true on success
@@ -110,7 +110,7 @@ _LSTransportChannelInit(_LSTransportChannel *channel, int fd, int priority)
 
     channel->fd = fd;
     channel->priority = priority;
-    channel->channel = g_io_channel_unix_new(fd);
+    channel->channel = fd >= 0 ? g_io_channel_unix_new(fd) : NULL;
     channel->send_watch = NULL;
     channel->recv_watch = NULL;
     channel->accept_watch = NULL;
@@ -73,7 +73,7 @@ void DumpToFileTransportClient(const char* filename, const char* dump, _LSTransp
  * @brief Allocate a new client.
  *
  * @param  transport        IN  transport
- * @param  fd               IN  fd
+ * @param  fd               IN  fd, -1 for a client known by name only
  * @param  service_name     IN  client service name
  * @param  unique_name      IN  client unique name
  * @param  outgoing         IN  outgoing queue (NULL means allocate)
@@ -105,7 +105,7 @@ _LSTransportClientNew(_LSTransport* transport, int fd, const char *service_name,
     LSError lserror;
     LSErrorInit(&lserror);
 
-    if (!_LSTransportGetCredentials(fd, new_client->cred, &lserror))
+    if (fd >= 0 && !_LSTransportGetCredentials(fd, new_client->cred, &lserror))
     {
         LOG_LSERROR(MSGID_LS_TRANSPORT_NETWORK_ERR, &lserror);
         LSErrorFree(&lserror);
@@ -353,6 +353,7 @@ void _LSTransportClientSetTrustString(_LSTransportClient *client, const char *tr
     LS_ASSERT(client != NULL);
     g_free(client->trust_level_string);
     client->trust_level_string = g_strdup(trust);
+    client->trust_level_generation = 0;
 }
 
 /**
@@ -475,6 +476,20 @@ bool _LSTransportClientAllowOutboundCalls(const _LSTransportClient *client)
     return client->permissions & _LSClientAllowOutbound;
 }
 
+/**
+ *******************************************************************************
+ * @brief Get the protocol features the client advertised.
+ *
+ * @param  client   IN  client
+ *
+ * @retval  mask of _LSTransportFeatures, 0 if nothing is known
+ *******************************************************************************
+ */
+unsigned _LSTransportClientGetFeatures(const _LSTransportClient *client)
+{
+    return client ? client->features : 0;
+}
+
 /**
  * @brief  Initialize mask for required groups by client
  *
@@ -550,6 +565,7 @@ bool _LSTransportClientInitializeTrustLevel(_LSTransportClient *client, const ch
     LS_ASSERT(trust_level);
     g_free(client->trust_level_string);
     client->trust_level_string = g_strdup(trust_level);
+    client->trust_level_generation = 0;
     return true;
 }
 
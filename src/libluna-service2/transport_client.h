@@ -49,6 +49,24 @@ typedef enum  {
     _LSClientAllowBoth = _LSClientAllowInbound | _LSClientAllowOutbound,
 } _LSTransportClientPermissions;
 
+/**
+ * Optional parts of the protocol a peer can handle. Every client advertises
+ * its features to the hub in "RequestName" and "ClientInfo", and the hub
+ * passes the features of a peer on in the "QueryNameReply" that connects to
+ * it. Peers that don't advertise anything (older ones, the hub, the monitor)
+ * get none of these.
+ */
+typedef enum {
+    _LSTransportFeatureMemfd = 1,   /**< receives message bodies in a sealed memfd
+                                         (see LSTransportHeader::body_in_fd) */
+    _LSTransportFeatureTrace = 2,   /**< appends its messages to its trace ring for
+                                         a tracing monitor (see transport_trace.h)
+                                         instead of connecting to it */
+} _LSTransportFeatures;
+
+/** Features this library implements */
+#define LS_TRANSPORT_FEATURES_SUPPORTED     (_LSTransportFeatureMemfd | _LSTransportFeatureTrace)
+
 /**
  * A "client" encapsulates a connection to someone that you want to
  * communicate with. In the Luna Service world, the name is a bit misleading
@@ -75,8 +93,14 @@ struct LSTransportClient {
     bool is_dynamic;                    /**< true for a dynamic service */
     LSTransportBitmaskWord *security_required_groups; /**< bitmask (see security_mask_size in struct LSTransport) */
     _LSTransportClientPermissions permissions;
+    unsigned features;                  /**< _LSTransportFeatures the peer advertised */
     LSTransportBitmaskWord *required_trust_level;  /**< bitmask (see security_mask_size in struct LSTransport) */
     char *trust_level_string;                      /** < trust level as string */
+    unsigned trust_level_generation;               /**< trust level maps generation trust_level_code and
+                                                        trust_level_rank are computed for (0 - not yet) */
+    int trust_level_code;                          /**< bit of trust_level_string in trust level map of
+                                                        the transport (-1 if it isn't there) */
+    int trust_level_rank;                          /**< rank of trust_level_string */
     //TBD: We still need trust level here?
 };
 
@@ -100,6 +124,7 @@ _LSTransport* _LSTransportClientGetTransport(const _LSTransportClient *client);
 const _LSTransportCred* _LSTransportClientGetCred(const _LSTransportClient *client);
 bool _LSTransportClientAllowInboundCalls(const _LSTransportClient *client);
 bool _LSTransportClientAllowOutboundCalls(const _LSTransportClient *client);
+unsigned _LSTransportClientGetFeatures(const _LSTransportClient *client);
 void _LSTransportClientSetTrustString(_LSTransportClient *client, const char *trust);
 // Requires groups initialization. json - array of strings. a string - security group
 // Ex.: ["camera", "torch"]
@@ -1,4 +1,4 @@
-// Copyright (c) 2008-2018 LG Electronics, Inc.
+// Copyright (c) 2008-2021 LG Electronics, Inc.
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -15,9 +15,14 @@
 // SPDX-License-Identifier: Apache-2.0
 
 
+#include <errno.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #include "error.h"
+#include "base.h"
+#include "transport.h"
 #include "transport_incoming.h"
 
 /**
@@ -27,6 +32,11 @@
  * @{
  */
 
+unsigned long _ls_incoming_hwm_bytes = 0;       /**< high-water mark of received bytes waiting to be
+                                                     processed per client, 0 - unlimited */
+unsigned long _ls_incoming_hwm_messages = 0;    /**< high-water mark of received messages waiting to
+                                                     be processed per client, 0 - unlimited */
+
 /**
  *******************************************************************************
  * @brief Allocate a new incoming queue.
@@ -46,6 +56,7 @@ _LSTransportIncoming* _LSTransportIncomingNew(void)
         goto error;
     }
     incoming->complete_messages = g_queue_new();
+    incoming->rx_fds = g_queue_new();
 
     return incoming;
 
@@ -70,6 +81,15 @@ void _LSTransportIncomingFree(_LSTransportIncoming *incoming)
     LS_ASSERT(g_queue_is_empty(incoming->complete_messages));
     g_queue_free(incoming->complete_messages);
 
+    /* fds that arrived without a matching message are ours to close */
+    while (!g_queue_is_empty(incoming->rx_fds))
+    {
+        close(GPOINTER_TO_INT(g_queue_pop_head(incoming->rx_fds)));
+    }
+    g_queue_free(incoming->rx_fds);
+
+    g_free(incoming->rx_buf);
+
 #ifdef MEMCHECK
     memset(incoming, 0xFF, sizeof(_LSTransportIncoming));
 #endif
@@ -77,6 +97,407 @@ void _LSTransportIncomingFree(_LSTransportIncoming *incoming)
     g_slice_free(_LSTransportIncoming, incoming);
 }
 
+/**
+ *******************************************************************************
+ * @brief Refill the staging buffer with a single recvmsg(). Any fds passed
+ * along with the data are queued in the order they arrive.
+ *
+ * @param  incoming IN  incoming
+ * @param  fd       IN  socket to read from
+ *
+ * @retval number of bytes read, 0 on orderly shutdown, -1 on error (errno set)
+ *******************************************************************************
+ */
+static int
+_LSTransportIncomingFill(_LSTransportIncoming *incoming, int fd)
+{
+    if (!incoming->rx_buf)
+    {
+        incoming->rx_buf = g_malloc(LS_TRANSPORT_INCOMING_BUF_SIZE);
+    }
+
+    /* Move the unparsed tail to the front so that the read gets all the
+     * free space. The tail is never longer than a header or a small body. */
+    unsigned long pending = incoming->rx_end - incoming->rx_start;
+    if (incoming->rx_start > 0)
+    {
+        memmove(incoming->rx_buf, incoming->rx_buf + incoming->rx_start, pending);
+        incoming->rx_start = 0;
+        incoming->rx_end = pending;
+    }
+
+    LS_ASSERT(incoming->rx_end < LS_TRANSPORT_INCOMING_BUF_SIZE);
+
+    char cmsg_buf[CMSG_SPACE(sizeof(int) * LS_TRANSPORT_INCOMING_MAX_FDS)];
+    struct iovec iov;
+    struct msghdr msg;
+
+    iov.iov_base = incoming->rx_buf + incoming->rx_end;
+    iov.iov_len = LS_TRANSPORT_INCOMING_BUF_SIZE - incoming->rx_end;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_name = NULL;
+    msg.msg_namelen = 0;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+    msg.msg_flags = 0;
+
+    int ret = recvmsg(fd, &msg, MSG_DONTWAIT);
+    incoming->rx_syscalls++;
+
+    if (ret <= 0)
+    {
+        return ret;
+    }
+
+    incoming->rx_end += ret;
+
+    struct cmsghdr *cmsg = NULL;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        int *fds = (int*)CMSG_DATA(cmsg);
+        size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        size_t i;
+        for (i = 0; i < num_fds; i++)
+        {
+            g_queue_push_tail(incoming->rx_fds, GINT_TO_POINTER(fds[i]));
+        }
+    }
+
+    if (msg.msg_flags & MSG_CTRUNC)
+    {
+        LOG_LS_ERROR(MSGID_LS_SOCK_ERROR, 0, "Control data truncated, passed fds are lost: fd: %d", fd);
+    }
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Free the staging buffer once everything in it is consumed, so that
+ * idle clients don't hold on to it. It's allocated again by the next fill.
+ *
+ * @param  incoming IN  incoming
+ *******************************************************************************
+ */
+static void
+_LSTransportIncomingReleaseDrained(_LSTransportIncoming *incoming)
+{
+    if (incoming->rx_buf && incoming->rx_start == incoming->rx_end)
+    {
+        g_free(incoming->rx_buf);
+        incoming->rx_buf = NULL;
+        incoming->rx_start = 0;
+        incoming->rx_end = 0;
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Check if the complete messages waiting to be processed reached the
+ * high-water mark.
+ *
+ * @param  incoming IN  incoming
+ *
+ * @retval true if they did
+ *******************************************************************************
+ */
+static bool
+_LSTransportIncomingIsOverHighWater(const _LSTransportIncoming *incoming)
+{
+    if (_ls_incoming_hwm_messages && g_queue_get_length(incoming->complete_messages) >= _ls_incoming_hwm_messages)
+        return true;
+
+    if (_ls_incoming_hwm_bytes && incoming->rx_queued_bytes >= _ls_incoming_hwm_bytes)
+        return true;
+
+    return false;
+}
+
+/**
+ *******************************************************************************
+ * @brief Receive as much as is available on the socket without blocking and
+ * split it into messages.
+ *
+ * Data is read in large chunks into the staging buffer and headers and small
+ * bodies are carved out of it, so a burst of small messages costs a single
+ * system call. Bodies that don't fit the staging buffer comfortably are read
+ * directly into the message.
+ *
+ * Complete messages are appended to @ref LSTransportIncoming::complete_messages.
+ * Once they reach the high-water mark nothing more is read, the rest stays in
+ * the socket and pushes back on the sender until they are processed.
+ *
+ * @param  incoming IN  incoming
+ * @param  fd       IN  socket to read from
+ * @param  client   IN  client that received messages are associated with
+ *
+ * @retval status, see @ref LSTransportIncomingStatus
+ *******************************************************************************
+ */
+_LSTransportIncomingStatus
+_LSTransportIncomingReceive(_LSTransportIncoming *incoming, int fd, _LSTransportClient *client)
+{
+    int ret = 0;
+    bool throttled = false;
+
+    if (g_queue_is_empty(incoming->complete_messages))
+    {
+        incoming->rx_queued_bytes = 0;
+    }
+
+    while (1)
+    {
+        unsigned long buffered = incoming->rx_end - incoming->rx_start;
+
+        if (incoming->tmp_msg)
+        {
+            _LSTransportMessage *message = incoming->tmp_msg;
+            unsigned long missing = message->raw->header.len - incoming->tmp_msg_offset;
+
+            if (missing == 0)
+            {
+                /* the fd follows the body as a one-byte marker carrying
+                 * SCM_RIGHTS, see _LSTransportSendFd() */
+                if (_LSTransportMessageIsFdType(message))
+                {
+                    int recv_fd = -1;
+                    if (!_LSTransportIncomingTakeFd(incoming, &recv_fd))
+                        goto fill;
+
+                    if (_LSTransportMessageGetType(message) == _LSTransportMessageTypeQueryNameBatchReply)
+                        _LSTransportIncomingTakeBatchFds(incoming, message, recv_fd);
+                    else
+                        _LSTransportMessageSetFd(message, recv_fd);
+
+                    /* a message that can't be mapped is dropped, its sender
+                     * broke the protocol */
+                    if (message->raw->header.body_in_fd && !_LSTransportMessageMapMemfd(message))
+                    {
+                        _LSTransportMessageUnref(message);
+                        message = NULL;
+                    }
+                }
+
+                if (message)
+                {
+                    g_queue_push_tail(incoming->complete_messages, message);
+                    incoming->rx_messages++;
+                    incoming->rx_queued_bytes += sizeof(_LSTransportHeader) + message->raw->header.len;
+                }
+                incoming->tmp_msg = NULL;
+                incoming->tmp_msg_offset = 0;
+                continue;
+            }
+
+            if (buffered > 0)
+            {
+                unsigned long len = MIN(buffered, missing);
+                memcpy(message->raw->data + incoming->tmp_msg_offset, incoming->rx_buf + incoming->rx_start, len);
+                incoming->rx_start += len;
+                incoming->tmp_msg_offset += len;
+                continue;
+            }
+
+            if (missing > LS_TRANSPORT_INCOMING_BUF_SIZE / 2)
+            {
+                /* Large body: skip the staging buffer to avoid the extra copy.
+                 * Never ask for more than the body, so the fd marker stays
+                 * in the socket for recvmsg(). */
+                ret = recv(fd, message->raw->data + incoming->tmp_msg_offset, missing, MSG_DONTWAIT);
+                incoming->rx_syscalls++;
+                if (ret <= 0)
+                    break;
+
+                incoming->tmp_msg_offset += ret;
+                continue;
+            }
+        }
+        else if (buffered >= sizeof(_LSTransportHeader))
+        {
+            /* the staging buffer has no alignment guarantees, so copy */
+            memcpy(&incoming->tmp_header, incoming->rx_buf + incoming->rx_start, sizeof(_LSTransportHeader));
+
+            if (incoming->tmp_header.len > MAX_MESSAGE_SIZE_BYTES)
+            {
+                return _LSTransportIncomingStatusTooLarge;
+            }
+
+            incoming->rx_start += sizeof(_LSTransportHeader);
+
+            incoming->tmp_msg = _LSTransportMessageNewRef(incoming->tmp_header.len);
+            incoming->tmp_msg_offset = 0;
+
+            if (incoming->rx_partial)
+            {
+                /* the message now accounts for the activity itself */
+                incoming->rx_partial = false;
+                ACTIVITY_DEC();
+            }
+
+            /* copy header and sender */
+            _LSTransportMessageSetHeader(incoming->tmp_msg, &incoming->tmp_header);
+            _LSTransportMessageSetClient(incoming->tmp_msg, client);
+            continue;
+        }
+
+fill:
+        /* the socket stays readable, so the main loop comes back once the
+         * complete messages are processed */
+        if (_LSTransportIncomingIsOverHighWater(incoming))
+        {
+            incoming->rx_throttled++;
+            throttled = true;
+            break;
+        }
+
+        ret = _LSTransportIncomingFill(incoming, fd);
+        if (ret <= 0)
+            break;
+    }
+
+    /* Just received beginning of a message, mark activity */
+    if (!incoming->tmp_msg && !incoming->rx_partial && incoming->rx_end > incoming->rx_start)
+    {
+        incoming->rx_partial = true;
+        ACTIVITY_INC();
+    }
+
+    _LSTransportIncomingReleaseDrained(incoming);
+
+    if (throttled)
+    {
+        return _LSTransportIncomingStatusAgain;
+    }
+    else if (ret == 0)
+    {
+        return _LSTransportIncomingStatusShutdown;
+    }
+    else if (errno == EAGAIN || errno == EINTR)
+    {
+        /* We don't retry immediately relying on the main loop
+         * to signal socket readiness again. */
+        return _LSTransportIncomingStatusAgain;
+    }
+
+    return _LSTransportIncomingStatusError;
+}
+
+/**
+ *******************************************************************************
+ * @brief Consume data already read into the staging buffer. Used by the
+ * blocking receive path, so that nothing read ahead by
+ * @ref _LSTransportIncomingReceive is lost.
+ *
+ * @param  incoming IN  incoming
+ * @param  buf      OUT destination
+ * @param  len      IN  max bytes to copy
+ *
+ * @retval number of bytes copied to @p buf
+ *******************************************************************************
+ */
+unsigned long
+_LSTransportIncomingTakeBuffered(_LSTransportIncoming *incoming, void *buf, unsigned long len)
+{
+    unsigned long buffered = incoming->rx_end - incoming->rx_start;
+    unsigned long copied = MIN(buffered, len);
+
+    if (copied)
+    {
+        memcpy(buf, incoming->rx_buf + incoming->rx_start, copied);
+        incoming->rx_start += copied;
+        _LSTransportIncomingReleaseDrained(incoming);
+    }
+
+    return copied;
+}
+
+/**
+ *******************************************************************************
+ * @brief Consume the fd marker that follows the body of fd carrying messages
+ * from the staging buffer.
+ *
+ * @param  incoming IN  incoming
+ * @param  fd       OUT received fd, -1 if the far side sent no fd
+ *
+ * @retval true if the marker was in the staging buffer
+ * @retval false if more data needs to be read first
+ *******************************************************************************
+ */
+bool
+_LSTransportIncomingTakeFd(_LSTransportIncoming *incoming, int *fd)
+{
+    if (incoming->rx_end == incoming->rx_start)
+        return false;
+
+    char marker = incoming->rx_buf[incoming->rx_start++];
+
+    *fd = -1;
+
+    /* non-zero marker means the far side sent an error code instead of an fd */
+    if (marker == 0)
+    {
+        if (g_queue_is_empty(incoming->rx_fds))
+        {
+            LOG_LS_ERROR(MSGID_LS_SOCK_ERROR, 0, "Expected an fd in message, but didn't receive one");
+        }
+        else
+        {
+            *fd = GPOINTER_TO_INT(g_queue_pop_head(incoming->rx_fds));
+        }
+    }
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Move the fds of a batch reply to the message. All of them arrive
+ * with the one marker that follows the body.
+ *
+ * @param  incoming IN  incoming holding the rest of the fds
+ * @param  message  IN  batch reply
+ * @param  first_fd IN  fd that came with the marker, -1 if none
+ *******************************************************************************
+ */
+void
+_LSTransportIncomingTakeBatchFds(_LSTransportIncoming *incoming, _LSTransportMessage *message, int first_fd)
+{
+    unsigned int count = _LSTransportQueryNameBatchReplyGetFdCount(message);
+
+    if (first_fd == -1)
+    {
+        if (count > 0)
+        {
+            LOG_LS_ERROR(MSGID_LS_SOCK_ERROR, 0, "Expected %u fds in batch reply, but didn't receive any", count);
+        }
+        return;
+    }
+
+    if (count == 0)
+    {
+        close(first_fd);
+        return;
+    }
+
+    _LSTransportMessageAddFd(message, first_fd);
+
+    while (_LSTransportMessageGetFdCount(message) < count)
+    {
+        if (g_queue_is_empty(incoming->rx_fds))
+        {
+            LOG_LS_ERROR(MSGID_LS_SOCK_ERROR, 0, "Expected %u fds in batch reply, but received %u",
+                         count, _LSTransportMessageGetFdCount(message));
+            break;
+        }
+        _LSTransportMessageAddFd(message, GPOINTER_TO_INT(g_queue_pop_head(incoming->rx_fds)));
+    }
+}
+
 /**
  * @} END OF LunaServiceTransportIncoming
  * @endcond
@@ -1,4 +1,4 @@
-// Copyright (c) 2008-2018 LG Electronics, Inc.
+// Copyright (c) 2008-2021 LG Electronics, Inc.
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -23,23 +23,70 @@
 #include <luna-service2/lunaservice.h>
 #include "transport_message.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /** @cond INTERNAL */
 
+#define LS_TRANSPORT_INCOMING_BUF_SIZE  16384   /**< size of the per-client staging
+                                                     buffer; message bodies larger than
+                                                     half of it are read directly into
+                                                     the message */
+
+#define LS_TRANSPORT_INCOMING_MAX_FDS   64      /**< fds accepted with a single recvmsg(),
+                                                     a batch reply carries at most as many */
+
 struct LSTransportIncoming {
     pthread_mutex_t lock;
-    LSMessageToken last_serial_processed;   /**< last reply processed -- see LSTransportSerial */
-    _LSTransportHeader tmp_header;          /**< temp location when reading in the header */
-    unsigned long tmp_header_offset;        /**< end of valid data in temp header */
+    LSMessageToken last_serial_processed;   /**< last reply processed -- see LSTransportSerial,
+                                                 accessed with g_atomic_pointer_* */
+    _LSTransportHeader tmp_header;          /**< header of the last message carved out of staging buffer */
     _LSTransportMessage *tmp_msg;           /**< temp location when building up a message */
     unsigned long tmp_msg_offset;           /**< end of data in temp message */
     GQueue *complete_messages;              /**< completed messages; ready for processing */
+    char *rx_buf;                           /**< staging buffer, allocated by a receive and
+                                                 freed once drained */
+    unsigned long rx_start;                 /**< offset of the first unparsed byte in @ref rx_buf */
+    unsigned long rx_end;                   /**< end of valid data in @ref rx_buf */
+    bool rx_partial;                        /**< staging buffer holds an incomplete header */
+    GQueue *rx_fds;                         /**< fds received with SCM_RIGHTS, not yet
+                                                 matched to a message */
+    unsigned long rx_syscalls;              /**< number of receive system calls made */
+    unsigned long rx_messages;              /**< number of messages received */
+    unsigned long rx_queued_bytes;          /**< size of the messages in @ref complete_messages */
+    unsigned long rx_throttled;             /**< number of times reading stopped at the
+                                                 high-water mark */
 };
 
 typedef struct LSTransportIncoming _LSTransportIncoming;
 
+/**
+ * Outcome of @ref _LSTransportIncomingReceive
+ */
+typedef enum LSTransportIncomingStatus {
+    _LSTransportIncomingStatusAgain,        /**< socket drained, wait until it becomes readable */
+    _LSTransportIncomingStatusShutdown,     /**< orderly shutdown of the connection */
+    _LSTransportIncomingStatusError,        /**< receive failed, errno is set */
+    _LSTransportIncomingStatusTooLarge,     /**< message announced in tmp_header exceeds
+                                                 MAX_MESSAGE_SIZE_BYTES */
+} _LSTransportIncomingStatus;
+
 _LSTransportIncoming* _LSTransportIncomingNew(void);
 void _LSTransportIncomingFree(_LSTransportIncoming *incoming);
 
+_LSTransportIncomingStatus _LSTransportIncomingReceive(_LSTransportIncoming *incoming, int fd, _LSTransportClient *client);
+unsigned long _LSTransportIncomingTakeBuffered(_LSTransportIncoming *incoming, void *buf, unsigned long len);
+bool _LSTransportIncomingTakeFd(_LSTransportIncoming *incoming, int *fd);
+void _LSTransportIncomingTakeBatchFds(_LSTransportIncoming *incoming, _LSTransportMessage *message, int first_fd);
+
+extern unsigned long _ls_incoming_hwm_bytes;
+extern unsigned long _ls_incoming_hwm_messages;
+
 /** @endcond */
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif      // _TRANSPORT_INCOMING_H_
@@ -0,0 +1,435 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#include <string.h>
+
+#include "error.h"
+#include "log.h"
+#include "transport_client.h"
+#include "transport_iothread.h"
+
+/**
+ * @cond INTERNAL
+ * @defgroup LunaServiceTransportIoThread Transport I/O thread
+ * @ingroup LunaServiceTransport
+ *
+ * With an I/O thread, the transport watches (accept, receive, send) run in an
+ * internal main context on a thread of their own. Reading, framing and
+ * handling of the hub protocol never wait for the user's callbacks.
+ *
+ * Whatever has to reach the user (user-level messages, delivery failures and
+ * disconnects) is posted as an event to a lock-free stack and dispatched from
+ * the context the handle was attached to, in the order it was posted.
+ *
+ * @{
+ */
+
+typedef struct LSTransportIoThreadSource {
+    GSource source;
+    _LSTransportIoThread *io_thread;    /**< not to be touched once the source is destroyed */
+} _LSTransportIoThreadSource;
+
+static _LSTransportEvent*
+_LSTransportEventNew(_LSTransportEventType type)
+{
+    _LSTransportEvent *event = g_slice_new0(_LSTransportEvent);
+    event->type = type;
+    return event;
+}
+
+static void
+_LSTransportEventFree(_LSTransportEvent *event)
+{
+    if (event->message) _LSTransportMessageUnref(event->message);
+    if (event->client) _LSTransportClientUnref(event->client);
+
+    g_slice_free(_LSTransportEvent, event);
+}
+
+/* Push an event and make sure the user context will dispatch it */
+static void
+_LSTransportIoThreadPost(_LSTransportIoThread *io_thread, _LSTransportEvent *event)
+{
+    _LSTransportEvent *head;
+
+    do
+    {
+        head = g_atomic_pointer_get(&io_thread->posted);
+        event->next = head;
+    }
+    while (!g_atomic_pointer_compare_and_exchange(&io_thread->posted, head, event));
+
+    /* Only the first event since the stack was taken needs to wake up the
+     * user context, the dispatch takes the others along */
+    if (!head)
+    {
+        g_source_set_ready_time(io_thread->dispatch_source, 0);
+    }
+}
+
+/* Take all posted events, oldest first */
+static _LSTransportEvent*
+_LSTransportIoThreadTake(_LSTransportIoThread *io_thread)
+{
+    _LSTransportEvent *posted;
+
+    /* Producers only push, so if the head is still the one we read, nothing
+     * was posted meanwhile */
+    do
+    {
+        posted = g_atomic_pointer_get(&io_thread->posted);
+        if (!posted)
+            return NULL;
+    }
+    while (!g_atomic_pointer_compare_and_exchange(&io_thread->posted, posted, NULL));
+
+    _LSTransportEvent *events = NULL;
+    while (posted)
+    {
+        _LSTransportEvent *next = posted->next;
+        posted->next = events;
+        events = posted;
+        posted = next;
+    }
+    return events;
+}
+
+static void
+_LSTransportIoThreadRunEvent(_LSTransportIoThread *io_thread, _LSTransportEvent *event)
+{
+    switch (event->type)
+    {
+    case _LSTransportEventMessage:
+        io_thread->message_handler(event->message);
+        break;
+
+    case _LSTransportEventFailure:
+        io_thread->handlers.message_failure_handler(event->message, event->failure_type,
+                                                    io_thread->handlers.message_failure_context);
+        break;
+
+    case _LSTransportEventDisconnect:
+        io_thread->handlers.disconnect_handler(event->client, event->disconnect_type,
+                                               io_thread->handlers.disconnect_context);
+        break;
+    }
+}
+
+static gboolean
+_LSTransportIoThreadDispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    _LSTransportIoThread *io_thread = ((_LSTransportIoThreadSource*) source)->io_thread;
+
+    /* Disarm before taking the stack: an event posted after that re-arms it */
+    g_source_set_ready_time(source, -1);
+
+    _LSTransportEvent *events = _LSTransportIoThreadTake(io_thread);
+    while (events)
+    {
+        _LSTransportEvent *event = events;
+        events = event->next;
+
+        /* A callback may have unregistered the handle, which takes the
+         * I/O thread along: drop the rest */
+        if (!g_source_is_destroyed(source))
+        {
+            _LSTransportIoThreadRunEvent(io_thread, event);
+        }
+        _LSTransportEventFree(event);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs io_thread_source_funcs = {
+    .dispatch = _LSTransportIoThreadDispatch,
+};
+
+static void
+_LSTransportIoThreadFailureHandler(_LSTransportMessage *message, _LSTransportMessageFailureType failure_type,
+                                   void *context)
+{
+    _LSTransportEvent *event = _LSTransportEventNew(_LSTransportEventFailure);
+    event->message = _LSTransportMessageRef(message);
+    event->failure_type = failure_type;
+
+    _LSTransportIoThreadPost((_LSTransportIoThread*) context, event);
+}
+
+static void
+_LSTransportIoThreadDisconnectHandler(_LSTransportClient *client, _LSTransportDisconnectType type, void *context)
+{
+    _LSTransportEvent *event = _LSTransportEventNew(_LSTransportEventDisconnect);
+    _LSTransportClientRef(client);
+    event->client = client;
+    event->disconnect_type = type;
+
+    _LSTransportIoThreadPost((_LSTransportIoThread*) context, event);
+}
+
+static gpointer
+_LSTransportIoThreadFunc(gpointer data)
+{
+    _LSTransportIoThread *io_thread = (_LSTransportIoThread*) data;
+
+    g_main_context_push_thread_default(io_thread->context);
+    g_main_loop_run(io_thread->loop);
+    g_main_context_pop_thread_default(io_thread->context);
+
+    return NULL;
+}
+
+static gboolean
+_LSTransportIoThreadQuit(gpointer data)
+{
+    g_main_loop_quit((GMainLoop*) data);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ *******************************************************************************
+ * @brief Allocate a new I/O thread. It isn't running until @ref
+ * _LSTransportIoThreadStart.
+ *
+ * @param  user_context     IN  context to dispatch the events from
+ * @param  priority         IN  priority of the dispatch source
+ * @param  message_handler  IN  runs the user's message handler
+ *
+ * @retval  I/O thread
+ *******************************************************************************
+ */
+_LSTransportIoThread*
+_LSTransportIoThreadNew(GMainContext *user_context, int priority,
+                        LSTransportIoThreadMessageHandler message_handler)
+{
+    LS_ASSERT(user_context != NULL);
+    LS_ASSERT(message_handler != NULL);
+
+    _LSTransportIoThread *io_thread = g_slice_new0(_LSTransportIoThread);
+
+    io_thread->context = g_main_context_new();
+    io_thread->loop = g_main_loop_new(io_thread->context, FALSE);
+    io_thread->user_context = g_main_context_ref(user_context);
+    io_thread->message_handler = message_handler;
+
+    io_thread->dispatch_source = g_source_new(&io_thread_source_funcs, sizeof(_LSTransportIoThreadSource));
+    ((_LSTransportIoThreadSource*) io_thread->dispatch_source)->io_thread = io_thread;
+    g_source_set_priority(io_thread->dispatch_source, priority);
+    g_source_set_name(io_thread->dispatch_source, "LSTransportIoThread");
+    g_source_attach(io_thread->dispatch_source, user_context);
+
+    return io_thread;
+}
+
+/**
+ *******************************************************************************
+ * @brief Stop the thread and free the I/O thread. Events that weren't
+ * dispatched yet are dropped.
+ *
+ * @param  io_thread    IN  I/O thread
+ *******************************************************************************
+ */
+void
+_LSTransportIoThreadFree(_LSTransportIoThread *io_thread)
+{
+    LS_ASSERT(io_thread != NULL);
+
+    _LSTransportIoThreadStop(io_thread);
+    _LSTransportIoThreadDiscard(io_thread);
+
+    g_source_unref(io_thread->dispatch_source);
+    g_main_loop_unref(io_thread->loop);
+    g_main_context_unref(io_thread->context);
+    g_main_context_unref(io_thread->user_context);
+
+#ifdef MEMCHECK
+    memset(io_thread, 0xFF, sizeof(_LSTransportIoThread));
+#endif
+
+    g_slice_free(_LSTransportIoThread, io_thread);
+}
+
+/**
+ *******************************************************************************
+ * @brief Have the failure and disconnect handlers of a transport run from the
+ * user context.
+ *
+ * The handlers are saved and replaced in @p handlers by ones that post an
+ * event. The message handler is left alone, see @ref
+ * _LSTransportIoThreadPostMessage.
+ *
+ * @param  io_thread    IN      I/O thread
+ * @param  handlers     IN/OUT  transport handlers
+ *******************************************************************************
+ */
+void
+_LSTransportIoThreadWrapHandlers(_LSTransportIoThread *io_thread, LSTransportHandlers *handlers)
+{
+    LS_ASSERT(io_thread != NULL);
+    LS_ASSERT(handlers != NULL);
+
+    io_thread->handlers = *handlers;
+
+    if (handlers->message_failure_handler)
+    {
+        handlers->message_failure_handler = _LSTransportIoThreadFailureHandler;
+        handlers->message_failure_context = io_thread;
+    }
+    if (handlers->disconnect_handler)
+    {
+        handlers->disconnect_handler = _LSTransportIoThreadDisconnectHandler;
+        handlers->disconnect_context = io_thread;
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Start running the internal context on a thread of its own.
+ *
+ * @param  io_thread    IN  I/O thread
+ * @param  lserror      OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+bool
+_LSTransportIoThreadStart(_LSTransportIoThread *io_thread, LSError *lserror)
+{
+    LS_ASSERT(io_thread != NULL);
+    LS_ASSERT(io_thread->thread == NULL);
+
+    GError *error = NULL;
+
+    io_thread->thread = g_thread_try_new("ls-io", _LSTransportIoThreadFunc, io_thread, &error);
+    if (!io_thread->thread)
+    {
+        _LSErrorSetFromGError(lserror, MSGID_LS_IO_THREAD_ERR, error);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Stop the thread and the dispatching of events. Nothing runs in the
+ * internal context afterwards, so the transport can be torn down from the
+ * calling thread.
+ *
+ * @param  io_thread    IN  I/O thread
+ *******************************************************************************
+ */
+void
+_LSTransportIoThreadStop(_LSTransportIoThread *io_thread)
+{
+    LS_ASSERT(io_thread != NULL);
+
+    if (io_thread->thread)
+    {
+        /* Quit from within the loop: a quit before the thread got around to
+         * running it would be lost */
+        GSource *quit = g_idle_source_new();
+        g_source_set_priority(quit, G_PRIORITY_HIGH);
+        g_source_set_callback(quit, _LSTransportIoThreadQuit, io_thread->loop, NULL);
+        g_source_attach(quit, io_thread->context);
+        g_source_unref(quit);
+
+        if (g_thread_self() != io_thread->thread)
+        {
+            g_thread_join(io_thread->thread);
+        }
+        else
+        {
+            g_thread_unref(io_thread->thread);
+        }
+        io_thread->thread = NULL;
+    }
+
+    if (!g_source_is_destroyed(io_thread->dispatch_source))
+    {
+        g_source_destroy(io_thread->dispatch_source);
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Set the priority events are dispatched with in the user context.
+ *
+ * @param  io_thread    IN  I/O thread
+ * @param  priority     IN  glib mainloop priority
+ *******************************************************************************
+ */
+void
+_LSTransportIoThreadSetPriority(_LSTransportIoThread *io_thread, int priority)
+{
+    LS_ASSERT(io_thread != NULL);
+
+    g_source_set_priority(io_thread->dispatch_source, priority);
+}
+
+/**
+ *******************************************************************************
+ * @brief Have the user's message handler run for a message from the user
+ * context.
+ *
+ * @param  io_thread    IN  I/O thread
+ * @param  message      IN  message, ref'd until it's handled
+ *******************************************************************************
+ */
+void
+_LSTransportIoThreadPostMessage(_LSTransportIoThread *io_thread, _LSTransportMessage *message)
+{
+    LS_ASSERT(io_thread != NULL);
+    LS_ASSERT(message != NULL);
+
+    _LSTransportEvent *event = _LSTransportEventNew(_LSTransportEventMessage);
+    event->message = _LSTransportMessageRef(message);
+
+    _LSTransportIoThreadPost(io_thread, event);
+}
+
+/**
+ *******************************************************************************
+ * @brief Drop the events that weren't dispatched yet.
+ *
+ * @param  io_thread    IN  I/O thread
+ *
+ * @retval  number of dropped events
+ *******************************************************************************
+ */
+int
+_LSTransportIoThreadDiscard(_LSTransportIoThread *io_thread)
+{
+    LS_ASSERT(io_thread != NULL);
+
+    int discards = 0;
+    _LSTransportEvent *events = _LSTransportIoThreadTake(io_thread);
+
+    while (events)
+    {
+        _LSTransportEvent *event = events;
+        events = event->next;
+        _LSTransportEventFree(event);
+        discards++;
+    }
+
+    return discards;
+}
+
+/** @} END OF LunaServiceTransportIoThread */
+/** @endcond */
@@ -0,0 +1,80 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef _TRANSPORT_IOTHREAD_H_
+#define _TRANSPORT_IOTHREAD_H_
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "transport_message.h"
+#include "transport_handlers.h"
+
+/** @cond INTERNAL */
+
+/** What the user context is told about */
+typedef enum LSTransportEventType {
+    _LSTransportEventMessage,       /**< user-level message (method call, reply, signal) */
+    _LSTransportEventFailure,       /**< a message failed to be delivered */
+    _LSTransportEventDisconnect,    /**< a client disconnected */
+} _LSTransportEventType;
+
+typedef struct LSTransportEvent _LSTransportEvent;
+
+struct LSTransportEvent {
+    _LSTransportEvent *next;            /**< next event on the posted stack */
+    _LSTransportEventType type;
+    _LSTransportMessage *message;       /**< ref'd message (message and failure events) */
+    _LSTransportClient *client;         /**< ref'd client (disconnect events) */
+    _LSTransportMessageFailureType failure_type;
+    _LSTransportDisconnectType disconnect_type;
+};
+
+/** Runs the user's message handler for a message, from the user context */
+typedef void (*LSTransportIoThreadMessageHandler)(_LSTransportMessage *message);
+
+typedef struct LSTransportIoThread _LSTransportIoThread;
+
+struct LSTransportIoThread {
+    GMainContext *context;              /**< internal context with the transport watches */
+    GMainLoop *loop;                    /**< run by @ref thread */
+    GThread *thread;                    /**< reads, writes and handles the hub protocol */
+
+    GMainContext *user_context;         /**< context the handle was attached to */
+
+    GSource *dispatch_source;           /**< dispatches the events in the user context */
+    _LSTransportEvent *posted;          /**< lock-free stack of events, newest first */
+
+    LSTransportIoThreadMessageHandler message_handler;
+    LSTransportHandlers handlers;       /**< the transport's failure and disconnect
+                                             handlers, run from the user context */
+};
+
+_LSTransportIoThread* _LSTransportIoThreadNew(GMainContext *user_context, int priority,
+                                              LSTransportIoThreadMessageHandler message_handler);
+void _LSTransportIoThreadFree(_LSTransportIoThread *io_thread);
+void _LSTransportIoThreadWrapHandlers(_LSTransportIoThread *io_thread, LSTransportHandlers *handlers);
+bool _LSTransportIoThreadStart(_LSTransportIoThread *io_thread, LSError *lserror);
+void _LSTransportIoThreadStop(_LSTransportIoThread *io_thread);
+void _LSTransportIoThreadSetPriority(_LSTransportIoThread *io_thread, int priority);
+
+void _LSTransportIoThreadPostMessage(_LSTransportIoThread *io_thread, _LSTransportMessage *message);
+int _LSTransportIoThreadDiscard(_LSTransportIoThread *io_thread);
+
+/** @endcond */
+
+#endif // _TRANSPORT_IOTHREAD_H_
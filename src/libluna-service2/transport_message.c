@@ -15,8 +15,11 @@
 // SPDX-License-Identifier: Apache-2.0
 
 
+#include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "error.h"
 #include "base.h"
@@ -71,6 +74,320 @@ static _LSTransportMessage EMPTY_MESSAGE =
     .connect_state = _LSTransportConnectStateOtherFailure,
 };
 
+/** Method calls and replies with bodies of this size or larger are passed in
+ * a sealed memfd, 0 disables it (LS_MEMFD_THRESHOLD in the environment) */
+unsigned long _ls_memfd_threshold = LS_TRANSPORT_MEMFD_DEFAULT_THRESHOLD;
+
+/**
+ * Message pools.
+ *
+ * Raw message bodies are recycled in power-of-two size classes to keep small
+ * replies and hub control messages from churning the heap. Every body is
+ * preceded by a block header remembering its class, so that whichever message
+ * drops the last reference to a shared body can return it to the right class.
+ * A message freed together with its body leaves its wrapper in the block, the
+ * next message of the class reuses both.
+ *
+ * Every thread caches a magazine of blocks per class without locking, full and
+ * empty magazines are balanced against a common depot. The depot keeps up to
+ * @ref MESSAGE_POOL_DEPOT_SIZE blocks per class plus what the handles reserved
+ * with @ref LSReserveMessagePool(), the rest goes back to the heap. Bodies
+ * larger than the largest class are allocated from the heap directly.
+ */
+#define MESSAGE_POOL_MIN_SHIFT      6   /**< smallest class has 64 bytes of body */
+#define MESSAGE_POOL_MAGAZINE_SIZE  16  /**< blocks cached per class by a thread */
+#define MESSAGE_POOL_DEPOT_SIZE     64  /**< blocks kept per class in the depot by default */
+#define MESSAGE_POOL_UNPOOLED       LS_TRANSPORT_MESSAGE_POOL_CLASSES
+#define MESSAGE_POOL_MAPPED         (LS_TRANSPORT_MESSAGE_POOL_CLASSES + 1)
+
+typedef struct _LSMessageBlock {
+    union {
+        struct _LSMessageBlock *next;   /**< link in a magazine or the depot */
+        size_t map_size;                /**< size of the mapping of a @ref MESSAGE_POOL_MAPPED body */
+    };
+    _LSTransportMessage *wrapper;   /**< wrapper recycled together with the body (or NULL) */
+    unsigned long klass;            /**< size class, @ref MESSAGE_POOL_UNPOOLED for heap bodies,
+                                         @ref MESSAGE_POOL_MAPPED for bodies mapped from a memfd */
+} _LSMessageBlock;
+
+typedef struct _LSMessageMagazine {
+    _LSMessageBlock *head[LS_TRANSPORT_MESSAGE_POOL_CLASSES];
+    unsigned int count[LS_TRANSPORT_MESSAGE_POOL_CLASSES];
+} _LSMessageMagazine;
+
+static struct {
+    GMutex lock;
+    _LSMessageBlock *head[LS_TRANSPORT_MESSAGE_POOL_CLASSES];
+    unsigned int count[LS_TRANSPORT_MESSAGE_POOL_CLASSES];
+    unsigned int reserved[LS_TRANSPORT_MESSAGE_POOL_CLASSES];  /**< reservations of the handles */
+    _LSTransportMessagePoolStats stats;
+} message_pool;
+
+static void _LSMessageMagazineFree(gpointer data);
+
+static GPrivate message_magazine = G_PRIVATE_INIT(_LSMessageMagazineFree);
+
+#define BLOCK_RAW(block) ((_LSTransportMessageRaw *) ((block) + 1))
+#define RAW_BLOCK(raw) (((_LSMessageBlock *) (raw)) - 1)
+
+static inline unsigned long
+_LSMessagePoolClassSize(unsigned long klass)
+{
+    return 1UL << (klass + MESSAGE_POOL_MIN_SHIFT);
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the message pool class fitting the payload.
+ *
+ * @param  payload_size  IN  size of payload
+ *
+ * @retval  class
+ * @retval  LS_TRANSPORT_MESSAGE_POOL_CLASSES if the payload is too big to be pooled
+ *******************************************************************************
+ */
+unsigned long
+_LSTransportMessagePoolClass(unsigned long payload_size)
+{
+    unsigned long klass = 0;
+    while (klass < MESSAGE_POOL_UNPOOLED && _LSMessagePoolClassSize(klass) < payload_size)
+        ++klass;
+    return klass;
+}
+
+static void
+_LSMessageBlockDestroy(_LSMessageBlock *block)
+{
+    if (block->wrapper)
+        g_slice_free(_LSTransportMessage, block->wrapper);
+    g_free(block);
+}
+
+/* Call with the pool locked. Keeps in the depot what it may keep of the chain
+ * of blocks of the class, frees the rest. */
+static void
+_LSMessagePoolDeposit(unsigned long klass, _LSMessageBlock *head)
+{
+    while (head)
+    {
+        _LSMessageBlock *block = head;
+        head = head->next;
+
+        if (message_pool.count[klass] < MESSAGE_POOL_DEPOT_SIZE + message_pool.reserved[klass])
+        {
+            block->next = message_pool.head[klass];
+            message_pool.head[klass] = block;
+            message_pool.count[klass]++;
+        }
+        else
+        {
+            _LSMessageBlockDestroy(block);
+            g_atomic_int_add(&message_pool.stats.blocks, -1);
+        }
+    }
+}
+
+static void
+_LSMessageMagazineFree(gpointer data)
+{
+    _LSMessageMagazine *magazine = data;
+
+    g_mutex_lock(&message_pool.lock);
+    for (unsigned long klass = 0; klass < LS_TRANSPORT_MESSAGE_POOL_CLASSES; ++klass)
+    {
+        _LSMessagePoolDeposit(klass, magazine->head[klass]);
+    }
+    g_mutex_unlock(&message_pool.lock);
+
+    g_free(magazine);
+}
+
+static inline _LSMessageMagazine*
+_LSMessageMagazineGet(void)
+{
+    _LSMessageMagazine *magazine = g_private_get(&message_magazine);
+    if (G_UNLIKELY(!magazine))
+    {
+        magazine = g_new0(_LSMessageMagazine, 1);
+        g_private_set(&message_magazine, magazine);
+    }
+    return magazine;
+}
+
+/**
+ *******************************************************************************
+ * @brief Allocate a block for the raw message.
+ *
+ * @param  body_size  IN   size of the body to fit
+ * @param  try_alloc  IN   return NULL instead of aborting if out of memory
+ *
+ * @retval  block, its body size is the class size for pooled classes
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+static _LSMessageBlock*
+_LSMessageBlockNew(unsigned long body_size, bool try_alloc)
+{
+    unsigned long klass = _LSTransportMessagePoolClass(body_size);
+
+    if (klass == MESSAGE_POOL_UNPOOLED)
+    {
+        size_t size = sizeof(_LSMessageBlock) + sizeof(_LSTransportMessageRaw) + body_size;
+        _LSMessageBlock *block = try_alloc ? g_try_malloc(size) : g_malloc(size);
+        if (block)
+        {
+            block->wrapper = NULL;
+            block->klass = klass;
+        }
+        return block;
+    }
+
+    _LSMessageMagazine *magazine = _LSMessageMagazineGet();
+    if (!magazine->head[klass])
+    {
+        /* refill half of the magazine from the depot */
+        g_mutex_lock(&message_pool.lock);
+        while (message_pool.head[klass] && magazine->count[klass] < MESSAGE_POOL_MAGAZINE_SIZE / 2)
+        {
+            _LSMessageBlock *block = message_pool.head[klass];
+            message_pool.head[klass] = block->next;
+            message_pool.count[klass]--;
+
+            block->next = magazine->head[klass];
+            magazine->head[klass] = block;
+            magazine->count[klass]++;
+        }
+        if (!magazine->head[klass]) message_pool.stats.misses++;
+        g_mutex_unlock(&message_pool.lock);
+    }
+
+    _LSMessageBlock *block = magazine->head[klass];
+    if (block)
+    {
+        magazine->head[klass] = block->next;
+        magazine->count[klass]--;
+        return block;
+    }
+
+    size_t size = sizeof(_LSMessageBlock) + sizeof(_LSTransportMessageRaw) + _LSMessagePoolClassSize(klass);
+    block = try_alloc ? g_try_malloc(size) : g_malloc(size);
+    if (block)
+    {
+        block->wrapper = NULL;
+        block->klass = klass;
+        g_atomic_int_inc(&message_pool.stats.blocks);
+    }
+    return block;
+}
+
+/**
+ *******************************************************************************
+ * @brief Return a block to its class or to the heap.
+ *
+ * @param  block  IN  block to release
+ *******************************************************************************
+ */
+static void
+_LSMessageBlockRelease(_LSMessageBlock *block)
+{
+    unsigned long klass = block->klass;
+
+    if (klass == MESSAGE_POOL_UNPOOLED)
+    {
+        _LSMessageBlockDestroy(block);
+        return;
+    }
+
+    if (klass == MESSAGE_POOL_MAPPED)
+    {
+        /* the block sits at the end of the first page of the mapping */
+        munmap((char *) BLOCK_RAW(block)->data - sysconf(_SC_PAGESIZE), block->map_size);
+        return;
+    }
+
+    _LSMessageMagazine *magazine = _LSMessageMagazineGet();
+    block->next = magazine->head[klass];
+    magazine->head[klass] = block;
+
+    if (++magazine->count[klass] < MESSAGE_POOL_MAGAZINE_SIZE)
+        return;
+
+    /* flush half of the magazine to the depot */
+    _LSMessageBlock *tail = magazine->head[klass];
+    for (unsigned int i = 1; i < MESSAGE_POOL_MAGAZINE_SIZE / 2; ++i)
+        tail = tail->next;
+
+    g_mutex_lock(&message_pool.lock);
+    _LSMessagePoolDeposit(klass, tail->next);
+    g_mutex_unlock(&message_pool.lock);
+
+    tail->next = NULL;
+    magazine->count[klass] = MESSAGE_POOL_MAGAZINE_SIZE / 2;
+}
+
+/**
+ *******************************************************************************
+ * @brief Reserve (or release if negative) room for more messages of the class
+ * in the message pool.
+ *
+ * Reserved blocks are preallocated right away.
+ *
+ * @param  klass  IN  class, see @ref _LSTransportMessagePoolClass()
+ * @param  count  IN  number of messages to reserve or release
+ *******************************************************************************
+ */
+void
+_LSTransportMessagePoolReserve(unsigned long klass, int count)
+{
+    LS_ASSERT(klass < LS_TRANSPORT_MESSAGE_POOL_CLASSES);
+
+    g_mutex_lock(&message_pool.lock);
+
+    LS_ASSERT(count >= 0 || message_pool.reserved[klass] >= (unsigned int) -count);
+    message_pool.reserved[klass] += count;
+
+    for (; count > 0; --count)
+    {
+        _LSMessageBlock *block = g_malloc(sizeof(_LSMessageBlock) + sizeof(_LSTransportMessageRaw) +
+                                          _LSMessagePoolClassSize(klass));
+        block->next = message_pool.head[klass];
+        block->wrapper = NULL;
+        block->klass = klass;
+        message_pool.head[klass] = block;
+        message_pool.count[klass]++;
+        g_atomic_int_inc(&message_pool.stats.blocks);
+    }
+
+    while (message_pool.count[klass] > MESSAGE_POOL_DEPOT_SIZE + message_pool.reserved[klass])
+    {
+        _LSMessageBlock *block = message_pool.head[klass];
+        message_pool.head[klass] = block->next;
+        message_pool.count[klass]--;
+        _LSMessageBlockDestroy(block);
+        g_atomic_int_add(&message_pool.stats.blocks, -1);
+    }
+
+    g_mutex_unlock(&message_pool.lock);
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the message pool statistics.
+ *
+ * @param  stats  OUT  statistics
+ *******************************************************************************
+ */
+void
+_LSTransportMessagePoolGetStats(_LSTransportMessagePoolStats *stats)
+{
+    g_mutex_lock(&message_pool.lock);
+    *stats = message_pool.stats;
+    stats->depot = 0;
+    for (unsigned long klass = 0; klass < LS_TRANSPORT_MESSAGE_POOL_CLASSES; ++klass)
+        stats->depot += message_pool.count[klass];
+    g_mutex_unlock(&message_pool.lock);
+}
+
 /**
  *******************************************************************************
  * @brief Empty transport message stub.
@@ -99,14 +416,28 @@ _LSTransportMessageNew(unsigned long payload_size)
 {
     ACTIVITY_INC();
 
-    _LSTransportMessage *ret = g_slice_new0(_LSTransportMessage);
+    _LSMessageBlock *block = _LSMessageBlockNew(payload_size, false);
 
-    ret->raw = g_malloc0(sizeof(_LSTransportMessageRaw) + payload_size);
+    _LSTransportMessage *ret = block->wrapper;
+    if (ret)
+    {
+        block->wrapper = NULL;
+        memset(ret, 0, sizeof(_LSTransportMessage));
+    }
+    else
+    {
+        ret = g_slice_new0(_LSTransportMessage);
+    }
+
+    ret->raw = BLOCK_RAW(block);
+    memset(ret->raw, 0, sizeof(_LSTransportMessageRaw) + payload_size);
 
     ret->raw->header.len = payload_size;
     ret->raw->header.token = LSMESSAGE_TOKEN_INVALID;
     ret->raw->header.type = _LSTransportMessageTypeUnknown;
-    ret->alloc_body_size = payload_size;
+    ret->alloc_body_size = block->klass == MESSAGE_POOL_UNPOOLED
+                         ? payload_size
+                         : _LSMessagePoolClassSize(block->klass);
     ret->tx_bytes_remaining = payload_size + sizeof(_LSTransportHeader);
     ret->connection_fd = -1;
     ret->retries = MAX_SEND_RETRIES;
@@ -176,15 +507,50 @@ _LSTransportMessageFree(_LSTransportMessage *message)
         close(connection_fd);
     }
 
+    if (message->fds)
+    {
+        unsigned int i;
+        for (i = 0; i < message->fds->len; i++)
+        {
+            if (g_array_index(message->fds, int, i) != -1)
+                close(g_array_index(message->fds, int, i));
+        }
+        g_array_free(message->fds, TRUE);
+    }
+
     message->app_id = NULL;    /* just for sanity; this points inside the raw message */
 
-    g_free(message->raw);
+    if (message->tx_header)
+    {
+        g_slice_free(_LSTransportHeader, message->tx_header);
+    }
+
+    _LSMessageBlock *block = RAW_BLOCK(message->raw);
+    int *raw_ref = message->raw_ref;
 
 #ifdef MEMCHECK
     memset(message, 0xFF, sizeof(_LSTransportMessage));
 #endif
 
-    g_slice_free(_LSTransportMessage, message);
+    /* raw bytes shared with other messages are released by the last of them,
+     * the owner of the raw bytes leaves its wrapper with them */
+    if (!raw_ref)
+    {
+        if (block->klass < LS_TRANSPORT_MESSAGE_POOL_CLASSES)
+        {
+            block->wrapper = message;
+            message = NULL;
+        }
+        _LSMessageBlockRelease(block);
+    }
+    else if (g_atomic_int_dec_and_test(raw_ref))
+    {
+        g_slice_free(int, raw_ref);
+        _LSMessageBlockRelease(block);
+    }
+
+    if (message)
+        g_slice_free(_LSTransportMessage, message);
 
     /* For inactive message we already did ACTIVITY_DEC() in
      * LSMessageMarkInactive() */
@@ -208,7 +574,7 @@ _LSTransportMessageCopyNewRef(_LSTransportMessage *message)
 {
     int body_size = _LSTransportMessageGetBodySize(message);
     _LSTransportMessage *ret = _LSTransportMessageNewRef(body_size);
-    ret->raw->header.is_public_bus = message->raw->header.is_public_bus;
+    ret->raw->header.is_public_bus = _LSTransportMessageGetHeader(message)->is_public_bus;
     /* NOTE: tx_bytes_remaining is set when we actually put the message
      * on the queue with _LSTransportSendMessage */
 
@@ -230,6 +596,257 @@ _LSTransportMessageCopyNewRef(_LSTransportMessage *message)
     return ret;
 }
 
+/**
+*******************************************************************************
+* @brief Create a new message with ref count of 1 that shares the raw bytes of
+* the passed in message.
+*
+* Meant for sending the same message to many destinations (e.g., signals):
+* every destination gets its own token and transmit count, but the body isn't
+* copied. The body must not be modified afterwards by any of the messages
+* sharing it.
+*
+* @param  message   IN  message to share, must not carry an fd
+*
+* @retval new message
+*******************************************************************************
+*/
+_LSTransportMessage*
+_LSTransportMessageShareNewRef(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+    LS_ASSERT(!_LSTransportMessageIsFdType(message));
+
+    if (!message->raw_ref)
+    {
+        message->raw_ref = g_slice_new(int);
+        *message->raw_ref = 1;
+    }
+    g_atomic_int_inc(message->raw_ref);
+
+    ACTIVITY_INC();
+
+    _LSTransportMessage *ret = g_slice_new0(_LSTransportMessage);
+
+    ret->ref = 1;
+    ret->raw = message->raw;
+    ret->raw_ref = message->raw_ref;
+    ret->tx_header = g_slice_new(_LSTransportHeader);
+    *ret->tx_header = *_LSTransportMessageGetHeader(message);
+    ret->app_id = message->app_id;
+    ret->alloc_body_size = ret->tx_header->len;
+    /* NOTE: tx_bytes_remaining is set when we actually put the message
+     * on the queue with _LSTransportSendMessage */
+    ret->connection_fd = -1;
+    ret->retries = MAX_SEND_RETRIES;
+    ret->connect_state = _LSTransportConnectStateNoError;
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Create a new message with ref count of 1 to be sent instead of the
+ * passed in one, which carries its body in a sealed memfd.
+ *
+ * Method calls and replies with bodies of @ref _ls_memfd_threshold bytes or
+ * more go out this way: the header goes over the socket followed by the memfd
+ * passed with SCM_RIGHTS, and the receiver maps the body instead of reading it
+ * out of the socket buffer (see @ref _LSTransportMessageMapMemfd()). The type,
+ * token and the rest of the header are copied, so the message has to be
+ * complete.
+ *
+ * @param  message   IN  message to send
+ *
+ * @retval new message
+ * @retval NULL if the message should be sent as is
+ *******************************************************************************
+ */
+_LSTransportMessage*
+_LSTransportMessageNewMemfdRef(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+
+    const _LSTransportHeader *header = _LSTransportMessageGetHeader(message);
+
+    if (!_ls_memfd_threshold || header->len < _ls_memfd_threshold)
+        return NULL;
+
+    if (header->type != _LSTransportMessageTypeMethodCall && header->type != _LSTransportMessageTypeReply)
+        return NULL;
+
+    int fd = memfd_create("ls2-body", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1)
+    {
+        LOG_LS_WARNING(MSGID_LS_MEMFD_ERR, 1, PMLOGKS("ERROR", g_strerror(errno)),
+                       "Unable to create memfd, sending the message body over the socket");
+        return NULL;
+    }
+
+    const char *body = _LSTransportMessageGetBody(message);
+    unsigned long written = 0;
+    while (written < header->len)
+    {
+        ssize_t ret = write(fd, body + written, header->len - written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;
+        written += ret;
+    }
+
+    /* the receiver maps the body, it must stay as it is */
+    if (written != header->len ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+    {
+        LOG_LS_WARNING(MSGID_LS_MEMFD_ERR, 1, PMLOGKS("ERROR", g_strerror(errno)),
+                       "Unable to fill memfd, sending the message body over the socket");
+        close(fd);
+        return NULL;
+    }
+
+    _LSTransportMessage *ret = _LSTransportMessageNewRef(0);
+    _LSTransportMessageSetHeader(ret, (_LSTransportHeader *) header);
+    ret->raw->header.len = 0;
+    ret->raw->header.body_in_fd = true;
+    ret->tx_bytes_remaining = sizeof(_LSTransportHeader);
+    _LSTransportMessageSetFd(ret, fd);
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Map the body of a received message from the memfd it came with.
+ *
+ * The body is mapped read-only and shared with the sender, only the page with
+ * the header is private to the message. The memfd is closed.
+ *
+ * @param  message   IN  message with @ref LSTransportHeader::body_in_fd
+ *                       and the memfd received
+ *
+ * @retval true on success
+ * @retval false if the memfd is missing, isn't sealed or can't be mapped
+ *******************************************************************************
+ */
+bool
+_LSTransportMessageMapMemfd(_LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+    LS_ASSERT(message->raw->header.body_in_fd);
+
+    bool ret = false;
+    int fd = _LSTransportMessageGetFd(message);
+    _LSTransportMessageSetFd(message, -1);
+
+    const int required_seals = F_SEAL_SHRINK | F_SEAL_WRITE;
+    struct stat st;
+    int seals = fd == -1 ? -1 : fcntl(fd, F_GET_SEALS);
+
+    if (seals == -1 || (seals & required_seals) != required_seals)
+    {
+        LOG_LS_ERROR(MSGID_LS_MEMFD_ERR, 1, PMLOGKFV("FD", "%d", fd),
+                     "Message body passed in an fd which isn't a sealed memfd");
+        goto exit;
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size <= 0)
+    {
+        LOG_LS_ERROR(MSGID_LS_MEMFD_ERR, 1, PMLOGKFV("FD", "%d", fd),
+                     "Empty message body passed in memfd");
+        goto exit;
+    }
+
+    /* The first page is private and holds the block and the header, so that
+     * the body starts page aligned right after it. */
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t map_size = page + st.st_size;
+
+    char *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        LOG_LS_ERROR(MSGID_LS_MEMFD_ERR, 1, PMLOGKS("ERROR", g_strerror(errno)),
+                     "Unable to map message body");
+        goto exit;
+    }
+
+    if (mmap(base + page, st.st_size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        LOG_LS_ERROR(MSGID_LS_MEMFD_ERR, 1, PMLOGKS("ERROR", g_strerror(errno)),
+                     "Unable to map message body");
+        munmap(base, map_size);
+        goto exit;
+    }
+
+    _LSTransportMessageRaw *raw = (_LSTransportMessageRaw *) (base + page - sizeof(_LSTransportMessageRaw));
+    _LSMessageBlock *block = RAW_BLOCK(raw);
+    block->map_size = map_size;
+    block->wrapper = NULL;
+    block->klass = MESSAGE_POOL_MAPPED;
+
+    raw->header = message->raw->header;
+    raw->header.len = st.st_size;
+    raw->header.body_in_fd = false;
+
+    _LSMessageBlockRelease(RAW_BLOCK(message->raw));
+    message->raw = raw;
+    message->alloc_body_size = st.st_size;
+    ret = true;
+
+exit:
+    if (fd != -1) close(fd);
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the part of the message that still needs to be transmitted
+ * according to its tx_bytes_remaining.
+ *
+ * @param  message  IN   message
+ * @param  iov      OUT  io vectors to send
+ *
+ * @retval  number of io vectors filled in (0 if nothing is left)
+ *******************************************************************************
+ */
+int
+_LSTransportMessageGetTxVector(const _LSTransportMessage *message, struct iovec iov[2])
+{
+    unsigned long remaining = message->tx_bytes_remaining;
+    unsigned long body_size = message->raw->header.len;
+    int iovcnt = 0;
+
+    if (!remaining)
+        return 0;
+
+    if (!message->tx_header)
+    {
+        iov[0].iov_base = (char*)message->raw + sizeof(_LSTransportHeader) + body_size - remaining;
+        iov[0].iov_len = remaining;
+        return 1;
+    }
+
+    /* own header followed by the shared body */
+    if (remaining > body_size)
+    {
+        unsigned long header_remaining = remaining - body_size;
+
+        iov[iovcnt].iov_base = (char*)message->tx_header + sizeof(_LSTransportHeader) - header_remaining;
+        iov[iovcnt].iov_len = header_remaining;
+        iovcnt++;
+        remaining = body_size;
+    }
+
+    if (remaining)
+    {
+        iov[iovcnt].iov_base = message->raw->data + body_size - remaining;
+        iov[iovcnt].iov_len = remaining;
+        iovcnt++;
+    }
+
+    return iovcnt;
+}
+
 /**
  *******************************************************************************
  * @brief Copies the message type, token, and body from src to dest.
@@ -272,6 +889,64 @@ _LSTransportMessageCopy(_LSTransportMessage *dest, const _LSTransportMessage *sr
     return dest;
 }
 
+/**
+ *******************************************************************************
+ * @brief Allocate the copy of a message that the monitor gets: the body of
+ * the message followed by the destination names and the monitor data (see
+ * @ref _LSTransportMessageGetMonitorMessageData).
+ *
+ * @param  type                 IN  message type
+ * @param  token                IN  message token
+ * @param  is_public_bus        IN  sent from a public handle
+ * @param  body                 IN  message body
+ * @param  body_size            IN  size of @p body
+ * @param  dest_service_name    IN  destination service name (NULL if none)
+ * @param  dest_unique_name     IN  destination unique name
+ * @param  message_data         IN  monitor data
+ *
+ * @retval message with ref count of 1
+ *******************************************************************************
+ */
+_LSTransportMessage*
+_LSTransportMessageNewMonitorRef(_LSTransportMessageType type, LSMessageToken token, bool is_public_bus,
+                                 const char *body, unsigned long body_size,
+                                 const char *dest_service_name, const char *dest_unique_name,
+                                 const _LSMonitorMessageData *message_data)
+{
+    LS_ASSERT(dest_unique_name != NULL);
+    LS_ASSERT(message_data != NULL);
+
+    if (!dest_service_name)
+    {
+        dest_service_name = "";
+    }
+
+    unsigned long dest_service_name_len = strlen(dest_service_name) + 1;
+    unsigned long dest_unique_name_len = strlen(dest_unique_name) + 1;
+    unsigned long monitor_message_body_size = body_size + dest_service_name_len + dest_unique_name_len;
+
+    unsigned long padding_bytes = PADDING_BYTES_TYPE(void *, sizeof(_LSTransportHeader) + monitor_message_body_size);
+
+    monitor_message_body_size += padding_bytes + sizeof(_LSMonitorMessageData);
+
+    _LSTransportMessage *monitor_message = _LSTransportMessageNewRef(monitor_message_body_size);
+    _LSTransportMessageSetType(monitor_message, type);
+    _LSTransportMessageSetToken(monitor_message, token);
+    monitor_message->raw->header.is_public_bus = is_public_bus;
+
+    /* the padding is zeroed already */
+    char *dest = _LSTransportMessageGetBody(monitor_message);
+    memcpy(dest, body, body_size);
+    dest += body_size;
+    memcpy(dest, dest_service_name, dest_service_name_len);
+    dest += dest_service_name_len;
+    memcpy(dest, dest_unique_name, dest_unique_name_len);
+    dest += dest_unique_name_len + padding_bytes;
+    memcpy(dest, message_data, sizeof(_LSMonitorMessageData));
+
+    return monitor_message;
+}
+
 /**
  *******************************************************************************
  * @brief Increment the ref count of a message.
@@ -475,11 +1150,15 @@ _LSTransportMessageIsReplyType(const _LSTransportMessage *message)
 inline bool
 _LSTransportMessageIsFdType(const _LSTransportMessage *message)
 {
+    if (_LSTransportMessageGetHeader(message)->body_in_fd)
+        return true;
+
     switch (_LSTransportMessageGetType(message))
     {
     case _LSTransportMessageTypeReplyWithFd:
     case _LSTransportMessageTypeQueryNameReply:
     case _LSTransportMessageTypeQueryProxyNameReply:
+    case _LSTransportMessageTypeQueryNameBatchReply:
     case _LSTransportMessageTypeMonitorConnected:
     case _LSTransportMessageTypeMonitorAcceptClient:
         return true;
@@ -528,7 +1207,7 @@ _LSTransportMessageGetTimeoutId(const _LSTransportMessage *message)
  * @brief Set the timeout source id associated with the message.
  *
  * @param  message      IN  message
- * @param  timeout_id   IN  timeout source id (ret val from g_timeout_add())
+ * @param  timeout_id   IN  timeout id (ret val from _LSTimerWheelAdd())
  *******************************************************************************
  */
 inline void
@@ -586,6 +1265,85 @@ _LSTransportMessageSetFd(_LSTransportMessage *message, int fd)
     message->connection_fd = fd;
 }
 
+/**
+ *******************************************************************************
+ * @brief Add an fd to be passed along with a batch reply. The message owns
+ * the fd from now on.
+ *
+ * @param  message  IN  message
+ * @param  fd       IN  fd
+ *******************************************************************************
+ */
+void
+_LSTransportMessageAddFd(_LSTransportMessage *message, int fd)
+{
+    LS_ASSERT(message != NULL);
+    LS_ASSERT(fd != -1);
+
+    if (!message->fds)
+    {
+        message->fds = g_array_new(FALSE, FALSE, sizeof(int));
+    }
+    g_array_append_val(message->fds, fd);
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the number of fds passed along with a batch reply.
+ *
+ * @param  message  IN  message
+ *
+ * @retval number of fds, stolen ones included
+ *******************************************************************************
+ */
+unsigned int
+_LSTransportMessageGetFdCount(const _LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+    return message->fds ? message->fds->len : 0;
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the fds passed along with a batch reply.
+ *
+ * @param  message  IN  message
+ *
+ * @retval array of @ref _LSTransportMessageGetFdCount fds, -1 for stolen ones
+ * @retval NULL if there are none
+ *******************************************************************************
+ */
+const int*
+_LSTransportMessageGetFds(const _LSTransportMessage *message)
+{
+    LS_ASSERT(message != NULL);
+    return message->fds ? &g_array_index(message->fds, int, 0) : NULL;
+}
+
+/**
+ *******************************************************************************
+ * @brief Take an fd passed along with a batch reply out of the message.
+ *
+ * @param  message  IN  message
+ * @param  index    IN  position of the fd
+ *
+ * @retval fd, which the caller owns now
+ * @retval -1 if there is no such fd
+ *******************************************************************************
+ */
+int
+_LSTransportMessageStealFd(_LSTransportMessage *message, unsigned int index)
+{
+    LS_ASSERT(message != NULL);
+
+    if (!message->fds || index >= message->fds->len)
+        return -1;
+
+    int fd = g_array_index(message->fds, int, index);
+    g_array_index(message->fds, int, index) = -1;
+    return fd;
+}
+
 
 /**
  *******************************************************************************
@@ -637,7 +1395,7 @@ inline _LSTransportHeader*
 _LSTransportMessageGetHeader(const _LSTransportMessage *message)
 {
     LS_ASSERT(message != NULL);
-    return &message->raw->header;
+    return message->tx_header ? message->tx_header : &message->raw->header;
 }
 
 /**
@@ -697,7 +1455,7 @@ _LSTransportMessageSetType(_LSTransportMessage *message, _LSTransportMessageType
 inline void
 _LSTransportMessageSetToken(_LSTransportMessage *message, LSMessageToken token)
 {
-    message->raw->header.token = token;
+    _LSTransportMessageGetHeader(message)->token = token;
 }
 
 /**
@@ -712,7 +1470,36 @@ _LSTransportMessageSetToken(_LSTransportMessage *message, LSMessageToken token)
 inline LSMessageToken
 _LSTransportMessageGetToken(const _LSTransportMessage *message)
 {
-    return message->raw->header.token;
+    return _LSTransportMessageGetHeader(message)->token;
+}
+
+/**
+ *******************************************************************************
+ * @brief Mark a message as latest-value, see @ref LSTransportHeader::coalesce.
+ *
+ * @param  message  IN  message
+ * @param  coalesce IN  true to replace queued instances of the same signal
+ *******************************************************************************
+ */
+inline void
+_LSTransportMessageSetCoalesced(_LSTransportMessage *message, bool coalesce)
+{
+    _LSTransportMessageGetHeader(message)->coalesce = coalesce;
+}
+
+/**
+ *******************************************************************************
+ * @brief Check whether a message is marked as latest-value.
+ *
+ * @param  message  IN  message
+ *
+ * @retval  true if the message replaces queued instances of the same signal
+ *******************************************************************************
+ */
+inline bool
+_LSTransportMessageIsCoalesced(const _LSTransportMessage *message)
+{
+    return _LSTransportMessageGetHeader(message)->coalesce;
 }
 
 /**
@@ -945,6 +1732,9 @@ _LSTransportMessageBodyExpand(_LSTransportMessage *message, unsigned long bytes_
     _LSTransportMessageRaw *raw = _LSTransportMessageGetRawMessage(message);
 
     LS_ASSERT(alloc_body_size >= body_size);
+    /* shared and mapped bodies are immutable */
+    LS_ASSERT(message->raw_ref == NULL);
+    LS_ASSERT(RAW_BLOCK(raw)->klass != MESSAGE_POOL_MAPPED);
 
     unsigned long new_body_size = body_size + bytes_needed;
 
@@ -956,16 +1746,35 @@ _LSTransportMessageBodyExpand(_LSTransportMessage *message, unsigned long bytes_
 
     if (need_realloc)
     {
-        raw = g_try_realloc(raw, sizeof(_LSTransportMessageRaw) + alloc_body_size);
+        _LSMessageBlock *block = RAW_BLOCK(raw);
+        _LSMessageBlock *new_block;
 
-        if (!raw)
+        if (block->klass == MESSAGE_POOL_UNPOOLED)
+        {
+            new_block = g_try_realloc(block, sizeof(_LSMessageBlock) + sizeof(_LSTransportMessageRaw) +
+                                             alloc_body_size);
+        }
+        else
+        {
+            /* pooled bodies move to a bigger class (or to the heap) */
+            new_block = _LSMessageBlockNew(alloc_body_size, true);
+            if (new_block)
+            {
+                memcpy(BLOCK_RAW(new_block), raw, sizeof(_LSTransportMessageRaw) + body_size);
+                _LSMessageBlockRelease(block);
+            }
+        }
+
+        if (!new_block)
         {
-            new_body_size = 0;
-            alloc_body_size = 0;
             LOG_LS_CRITICAL(MSGID_LS_OOM_ERR, 0, "Unable to re-allocate message body, OOM");
+            return NULL;
         }
 
-        _LSTransportMessageSetRawMessage(message, raw);
+        if (new_block->klass != MESSAGE_POOL_UNPOOLED)
+            alloc_body_size = _LSMessagePoolClassSize(new_block->klass);
+
+        _LSTransportMessageSetRawMessage(message, BLOCK_RAW(new_block));
         _LSTransportMessageSetAllocBodySize(message, alloc_body_size);
     }
 
@@ -38,6 +38,12 @@ extern "C" {
                                                              size when creating
                                                              variable-length messages */
 
+#define LS_TRANSPORT_MEMFD_DEFAULT_THRESHOLD    (1024 * 1024)   /**< default for
+                                                                     @ref _ls_memfd_threshold */
+
+#define LS_TRANSPORT_MESSAGE_POOL_CLASSES   7   /**< size classes of pooled message
+                                                     bodies, 64 bytes to 4 KiB */
+
 /** @brief Transport client */
 typedef struct LSTransportClient _LSTransportClient;
 
@@ -85,6 +91,8 @@ typedef enum LSTransportMessageType
     _LSTransportMessageTypeDumpHubDataReply,         /**< reply with the hub data (the data may come in chunks) */
     _LSTransportMessageTypeQueryProxyName,           /**< look up a service name from the hub as proxy (on behalf)*/
     _LSTransportMessageTypeQueryProxyNameReply,
+    _LSTransportMessageTypeQueryNameBatch,           /**< look up several service names from the hub at once */
+    _LSTransportMessageTypeQueryNameBatchReply,      /**< replies for a batch, with the connected fds of all of them */
 
 } _LSTransportMessageType;
 
@@ -161,6 +169,12 @@ struct LSTransportHeader {
 #ifdef SECURITY_COMPATIBILITY
     bool is_public_bus;           /**< was the message sent from a public handle? */
 #endif //SECURITY_COMPATIBILITY
+    bool body_in_fd;              /**< the body isn't in the stream, but in a sealed memfd
+                                       following the header (len is 0 then) */
+    bool coalesce;                /**< latest-value signal: a queued undelivered instance
+                                       with the same category and method is replaced
+                                       instead of appended to (on signal registrations:
+                                       the subscriber wants that for its signals) */
 };
 
 typedef struct LSTransportHeader _LSTransportHeader;
@@ -183,7 +197,7 @@ struct LSTransportMessage {
     int ref;
     _LSTransportClient *client;         /**< only valid for received messages -- client from which a message came */
     unsigned long tx_bytes_remaining;   /**< bytes of raw message left to transmit */
-    guint timeout_id;                   /**< timeout source id (currently only used by hub) */
+    guint timeout_id;                   /**< timer wheel timeout id (currently only used by hub) */
     unsigned long alloc_body_size;      /**< size of allocated memory for the body of
                                              the message (not including header). This
                                              can be larger than the actual len of the
@@ -192,12 +206,23 @@ struct LSTransportMessage {
     int connection_fd;                  /**< fd passed from the hub that is already
                                              connected to the far side. This is only
                                              set for certain messages (-1 otherwise) */
+    GArray *fds;                        /**< fds passed along with a batch reply, all
+                                             sent with a single marker (NULL otherwise) */
     const char *app_id;                 /**< cached app id -- points inside the raw message */
     _LSTransportMessageRaw *raw;        /**< raw bytes sent over the wire */
+    int *raw_ref;                       /**< ref count of @ref raw when it's shared with
+                                             other messages (NULL if owned by this message) */
+    _LSTransportHeader *tx_header;      /**< own header of a message sharing the body of
+                                             @ref raw, sent instead of raw->header (NULL
+                                             otherwise) */
     int retries;                        /**< remaining send retries */
     _LSTransportConnectState connect_state;   /**< state of connect() -- e.g., if we fail to connect()
                                                    due to non-blocking sockets we save the state here */
     bool inactive;                      /**< true if message shouldn't inhibit idle callback */
+    struct LSTransportMessage *posted_next; /**< next older message posted to the same
+                                                 outgoing queue, see @ref _LSTransportOutgoingPost */
+    unsigned long queued_size;              /**< bytes accounted to the outgoing queue holding
+                                                 the message, see @ref _LSTransportOutgoingAccount */
 };
 
 typedef struct LSTransportMessage _LSTransportMessage;
@@ -218,6 +243,24 @@ struct LSMonitorMessageData {
 
 typedef struct LSMonitorMessageData _LSMonitorMessageData;
 
+/**
+ * Message pool statistics.
+ */
+typedef struct LSTransportMessagePoolStats {
+    gint blocks;            /**< bodies allocated for the pooled classes */
+    unsigned int depot;     /**< bodies waiting in the depot */
+    unsigned int misses;    /**< allocations which found the depot empty */
+} _LSTransportMessagePoolStats;
+
+extern unsigned long _ls_memfd_threshold;
+
+_LSTransportMessage* _LSTransportMessageNewMemfdRef(_LSTransportMessage *message);
+bool _LSTransportMessageMapMemfd(_LSTransportMessage *message);
+
+unsigned long _LSTransportMessagePoolClass(unsigned long payload_size);
+void _LSTransportMessagePoolReserve(unsigned long klass, int count);
+void _LSTransportMessagePoolGetStats(_LSTransportMessagePoolStats *stats);
+
 bool LSTransportMessageFilterMatch(_LSTransportMessage *message, const char *filter);
 void LSTransportMessagePrint(_LSTransportMessage *message, FILE *file);
 int LSTransportMessagePrintCompactHeader(_LSTransportMessage *message, FILE *file);
@@ -231,7 +274,13 @@ void _LSTransportMessageFree(_LSTransportMessage *message);
 _LSTransportMessage* _LSTransportMessageRef(_LSTransportMessage *message);
 void _LSTransportMessageUnref(_LSTransportMessage *message);
 _LSTransportMessage* _LSTransportMessageCopyNewRef(_LSTransportMessage *message);
+_LSTransportMessage* _LSTransportMessageShareNewRef(_LSTransportMessage *message);
+int _LSTransportMessageGetTxVector(const _LSTransportMessage *message, struct iovec iov[2]);
 _LSTransportMessage* _LSTransportMessageCopy(_LSTransportMessage *dest, const _LSTransportMessage *src);
+_LSTransportMessage* _LSTransportMessageNewMonitorRef(_LSTransportMessageType type, LSMessageToken token,
+                                                      bool is_public_bus, const char *body, unsigned long body_size,
+                                                      const char *dest_service_name, const char *dest_unique_name,
+                                                      const _LSMonitorMessageData *message_data);
 
 _LSTransportMessage* _LSTransportMessageFromVectorNewRef(const struct iovec *iov, int iovcnt, unsigned long total_len);
 
@@ -241,6 +290,10 @@ _LSTransportConnectState _LSTransportMessageGetConnectState(const _LSTransportMe
 void _LSTransportMessageSetConnectState(_LSTransportMessage *message, _LSTransportConnectState state);
 int _LSTransportMessageGetFd(const _LSTransportMessage *message);
 void _LSTransportMessageSetFd(_LSTransportMessage *message, int fd);
+void _LSTransportMessageAddFd(_LSTransportMessage *message, int fd);
+unsigned int _LSTransportMessageGetFdCount(const _LSTransportMessage *message);
+const int* _LSTransportMessageGetFds(const _LSTransportMessage *message);
+int _LSTransportMessageStealFd(_LSTransportMessage *message, unsigned int index);
 _LSTransportClient* _LSTransportMessageGetClient(const _LSTransportMessage *message);
 void _LSTransportMessageSetClient(_LSTransportMessage *message, _LSTransportClient *client);
 _LSTransportHeader* _LSTransportMessageGetHeader(const _LSTransportMessage *message);
@@ -249,6 +302,8 @@ _LSTransportMessageType _LSTransportMessageGetType(const _LSTransportMessage *me
 void _LSTransportMessageSetType(_LSTransportMessage *message, _LSTransportMessageType type);
 void _LSTransportMessageSetToken(_LSTransportMessage *message, LSMessageToken token);
 LSMessageToken _LSTransportMessageGetToken(const _LSTransportMessage *message);
+void _LSTransportMessageSetCoalesced(_LSTransportMessage *message, bool coalesce);
+bool _LSTransportMessageIsCoalesced(const _LSTransportMessage *message);
 LSMessageToken _LSTransportMessageGetReplyToken(const _LSTransportMessage *message);
 char* _LSTransportMessageGetBody(const _LSTransportMessage *message);
 char* _LSTransportMessageSetBody(_LSTransportMessage *message, const void *body, int body_len);
@@ -0,0 +1,420 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "log.h"
+#include "transport_monitor_filter.h"
+
+/**
+ * @cond INTERNAL
+ * @defgroup LunaServiceTransportMonitorFilter Monitor filter
+ * @ingroup LunaServiceTransport
+ *
+ * Which messages the monitor wants.
+ *
+ * The monitor passes a filter expression along with its request, and the hub
+ * hands it to every client together with the monitor's address. The clients
+ * then copy only the messages that match, instead of the monitor throwing
+ * away what it doesn't want.
+ *
+ * The expression is made of terms separated by spaces, all of which have to
+ * match:
+ *
+ *   - service=NAME     the service or unique name of the sender or of the
+ *                      destination (not for signals) contains NAME
+ *   - method=GLOB      "category/method" of method calls, cancels and
+ *                      signals matches GLOB, where * and ? are wildcards
+ *                      (e.g., "/com/webos/service*"); replies match by the
+ *                      method of the call they answer, among the last
+ *                      FILTER_CALLS_MAX calls seen
+ *   - types=LIST       comma-separated message types: call, cancel, signal
+ *                      and reply
+ *   - sample=N         only about one of every N matching messages, picked
+ *                      by the caller and the token of their call, so that
+ *                      all the clients keep the same calls and their replies
+ *
+ * @{
+ */
+
+#define TYPE_CALL       (1 << 0)
+#define TYPE_CANCEL     (1 << 1)
+#define TYPE_SIGNAL     (1 << 2)
+#define TYPE_REPLY      (1 << 3)
+
+#define FILTER_CALLS_MAX    4096    /**< calls remembered to match their replies by method */
+
+struct LSTransportMonitorFilter {
+    gint ref;
+    char *service;              /**< NULL for any */
+    GPatternSpec *method;       /**< NULL for any */
+    unsigned types;             /**< TYPE_* mask, 0 for any */
+    guint sample;               /**< 1 keeps every message */
+    GMutex lock;                /**< protects calls and call_order */
+    GHashTable *calls;          /**< "caller/token" of the calls that matched method, for their replies */
+    GQueue *call_order;         /**< the keys of calls, oldest first */
+};
+
+static unsigned
+_LSTransportMonitorFilterType(_LSTransportMessageType type)
+{
+    switch (type)
+    {
+    case _LSTransportMessageTypeMethodCall:
+        return TYPE_CALL;
+    case _LSTransportMessageTypeCancelMethodCall:
+        return TYPE_CANCEL;
+    case _LSTransportMessageTypeSignal:
+        return TYPE_SIGNAL;
+    case _LSTransportMessageTypeReply:
+    case _LSTransportMessageTypeReplyWithFd:
+        return TYPE_REPLY;
+    default:
+        return 0;
+    }
+}
+
+static bool
+_LSTransportMonitorFilterParseTypes(_LSTransportMonitorFilter *filter, const char *value, LSError *lserror)
+{
+    static const struct {
+        const char *name;
+        unsigned type;
+    } types[] = {
+        { "call", TYPE_CALL },
+        { "cancel", TYPE_CANCEL },
+        { "signal", TYPE_SIGNAL },
+        { "reply", TYPE_REPLY },
+    };
+
+    char **names = g_strsplit(value, ",", -1);
+    char **name;
+    bool ret = true;
+
+    for (name = names; *name; name++)
+    {
+        size_t i;
+        for (i = 0; i < G_N_ELEMENTS(types); i++)
+        {
+            if (strcmp(*name, types[i].name) == 0)
+                break;
+        }
+
+        if (i == G_N_ELEMENTS(types))
+        {
+            _LSErrorSet(lserror, MSGID_LS_MONITOR_FILTER_ERR, -1,
+                        "Unknown message type \"%s\" (call, cancel, signal or reply)", *name);
+            ret = false;
+            break;
+        }
+        filter->types |= types[i].type;
+    }
+
+    g_strfreev(names);
+    return ret;
+}
+
+static bool
+_LSTransportMonitorFilterParseTerm(_LSTransportMonitorFilter *filter, const char *term, LSError *lserror)
+{
+    const char *value = strchr(term, '=');
+
+    if (!value || value == term || value[1] == '\0')
+    {
+        _LSErrorSet(lserror, MSGID_LS_MONITOR_FILTER_ERR, -1, "Expected key=value, got \"%s\"", term);
+        return false;
+    }
+
+    size_t key_len = value++ - term;
+
+    if (key_len == strlen("service") && strncmp(term, "service", key_len) == 0 && !filter->service)
+    {
+        filter->service = g_strdup(value);
+    }
+    else if (key_len == strlen("method") && strncmp(term, "method", key_len) == 0 && !filter->method)
+    {
+        filter->method = g_pattern_spec_new(value);
+        filter->calls = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        filter->call_order = g_queue_new();
+    }
+    else if (key_len == strlen("types") && strncmp(term, "types", key_len) == 0 && !filter->types)
+    {
+        return _LSTransportMonitorFilterParseTypes(filter, value, lserror);
+    }
+    else if (key_len == strlen("sample") && strncmp(term, "sample", key_len) == 0 && filter->sample == 1)
+    {
+        char *end = NULL;
+        unsigned long sample = strtoul(value, &end, 10);
+
+        if (*end != '\0' || sample == 0 || sample > G_MAXINT)
+        {
+            _LSErrorSet(lserror, MSGID_LS_MONITOR_FILTER_ERR, -1, "Invalid sampling rate \"%s\"", value);
+            return false;
+        }
+        filter->sample = sample;
+    }
+    else
+    {
+        _LSErrorSet(lserror, MSGID_LS_MONITOR_FILTER_ERR, -1,
+                    "Unknown or repeated filter term \"%s\"", term);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Parse a filter expression.
+ *
+ * @param  expression   IN  filter expression (see @ref LunaServiceTransportMonitorFilter)
+ * @param  lserror      OUT set on error
+ *
+ * @retval  filter with ref count of 1 on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSTransportMonitorFilter*
+_LSTransportMonitorFilterNew(const char *expression, LSError *lserror)
+{
+    LS_ASSERT(expression != NULL);
+
+    _LSTransportMonitorFilter *filter = g_slice_new0(_LSTransportMonitorFilter);
+    filter->ref = 1;
+    filter->sample = 1;
+    g_mutex_init(&filter->lock);
+
+    char **terms = g_strsplit_set(expression, " \t", -1);
+    char **term;
+
+    for (term = terms; *term; term++)
+    {
+        if (**term == '\0')
+            continue;
+
+        if (!_LSTransportMonitorFilterParseTerm(filter, *term, lserror))
+        {
+            _LSTransportMonitorFilterUnref(filter);
+            filter = NULL;
+            break;
+        }
+    }
+
+    g_strfreev(terms);
+    return filter;
+}
+
+_LSTransportMonitorFilter*
+_LSTransportMonitorFilterRef(_LSTransportMonitorFilter *filter)
+{
+    LS_ASSERT(filter != NULL);
+    LS_ASSERT(g_atomic_int_get(&filter->ref) > 0);
+
+    g_atomic_int_inc(&filter->ref);
+    return filter;
+}
+
+void
+_LSTransportMonitorFilterUnref(_LSTransportMonitorFilter *filter)
+{
+    LS_ASSERT(filter != NULL);
+    LS_ASSERT(g_atomic_int_get(&filter->ref) > 0);
+
+    if (!g_atomic_int_dec_and_test(&filter->ref))
+        return;
+
+    g_free(filter->service);
+    if (filter->method)
+    {
+        g_pattern_spec_free(filter->method);
+        /* the keys are freed with the table */
+        g_queue_free(filter->call_order);
+        g_hash_table_unref(filter->calls);
+    }
+    g_mutex_clear(&filter->lock);
+    g_slice_free(_LSTransportMonitorFilter, filter);
+}
+
+static bool
+_LSTransportMonitorFilterNameMatch(const _LSTransportMonitorFilter *filter,
+                                   const char *service_name, const char *unique_name)
+{
+    return (service_name && strstr(service_name, filter->service)) ||
+           (unique_name && strstr(unique_name, filter->service));
+}
+
+static bool
+_LSTransportMonitorFilterMethodMatch(const _LSTransportMonitorFilter *filter, _LSTransportMessage *message)
+{
+    const char *category = _LSTransportMessageGetCategory(message);
+    const char *method = _LSTransportMessageGetMethod(message);
+
+    if (!category || !method)
+        return false;
+
+    /* "/" + "foo" is "/foo", "/cat" + "foo" is "/cat/foo" */
+    size_t category_len = strlen(category);
+    if (category_len > 0 && category[category_len - 1] == '/')
+        category_len--;
+
+    char *path = g_strdup_printf("%.*s/%s", (int) category_len, category, method);
+    bool ret = g_pattern_match_string(filter->method, path);
+    g_free(path);
+
+    return ret;
+}
+
+/* The caller and the token of the call a message is part of: the message
+ * itself, or the call a reply answers */
+static const char*
+_LSTransportMonitorFilterCall(unsigned type, _LSTransportMessage *message,
+                              const char *sender_unique_name, const char *dest_unique_name,
+                              LSMessageToken *token)
+{
+    if (type == TYPE_REPLY)
+    {
+        *token = _LSTransportMessageGetReplyToken(message);
+        return dest_unique_name ? dest_unique_name : "";
+    }
+
+    *token = _LSTransportMessageGetToken(message);
+    return sender_unique_name ? sender_unique_name : "";
+}
+
+/* Remember a call that matched by method, or check if the call a reply
+ * answers did */
+static bool
+_LSTransportMonitorFilterCallMatched(_LSTransportMonitorFilter *filter, unsigned type,
+                                     const char *caller, LSMessageToken token)
+{
+    char *key = g_strdup_printf("%s/%lu", caller, token);
+    bool ret = true;
+
+    g_mutex_lock(&filter->lock);
+    if (type == TYPE_REPLY)
+    {
+        ret = g_hash_table_contains(filter->calls, key);
+        g_free(key);
+    }
+    else if (!g_hash_table_contains(filter->calls, key))
+    {
+        /* calls stay for all their replies (subscriptions), the oldest go */
+        if (g_queue_get_length(filter->call_order) == FILTER_CALLS_MAX)
+        {
+            g_hash_table_remove(filter->calls, g_queue_pop_head(filter->call_order));
+        }
+        g_hash_table_add(filter->calls, key);
+        g_queue_push_tail(filter->call_order, key);
+    }
+    else
+    {
+        g_free(key);
+    }
+    g_mutex_unlock(&filter->lock);
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Check if a message matches the filter (sampling aside).
+ *
+ * Method calls are to be passed in, matching or not, for their replies to
+ * match by method.
+ *
+ * @param  filter               IN  filter
+ * @param  message              IN  message
+ * @param  sender_service_name  IN  names of the sender
+ * @param  sender_unique_name   IN
+ * @param  dest_service_name    IN  names of the destination
+ * @param  dest_unique_name     IN
+ *
+ * @retval  true if it matches
+ *******************************************************************************
+ */
+bool
+_LSTransportMonitorFilterMatch(_LSTransportMonitorFilter *filter, _LSTransportMessage *message,
+                               const char *sender_service_name, const char *sender_unique_name,
+                               const char *dest_service_name, const char *dest_unique_name)
+{
+    unsigned type = _LSTransportMonitorFilterType(_LSTransportMessageGetType(message));
+    bool method_matched = true;
+
+    /* before the other terms: the reply of a call can match them when the call doesn't */
+    if (filter->method && (type == TYPE_CALL || type == TYPE_REPLY))
+    {
+        LSMessageToken token;
+        const char *caller = _LSTransportMonitorFilterCall(type, message, sender_unique_name,
+                                                           dest_unique_name, &token);
+
+        method_matched = (type == TYPE_REPLY || _LSTransportMonitorFilterMethodMatch(filter, message)) &&
+                         _LSTransportMonitorFilterCallMatched(filter, type, caller, token);
+    }
+    else if (filter->method)
+    {
+        method_matched = _LSTransportMonitorFilterMethodMatch(filter, message);
+    }
+
+    if (filter->types && !(filter->types & type))
+        return false;
+
+    if (filter->service &&
+        !_LSTransportMonitorFilterNameMatch(filter, sender_service_name, sender_unique_name) &&
+        (type == TYPE_SIGNAL || !_LSTransportMonitorFilterNameMatch(filter, dest_service_name, dest_unique_name)))
+    {
+        return false;
+    }
+
+    return method_matched;
+}
+
+/**
+ *******************************************************************************
+ * @brief Check if a matching message is kept by the sampling rate.
+ *
+ * The same for a call and its replies, on both sides: the pick goes by a
+ * hash of the unique name of the caller and the token of the call.
+ *
+ * @param  filter               IN  filter
+ * @param  message              IN  message
+ * @param  sender_unique_name   IN  unique name of the sender
+ * @param  dest_unique_name     IN  unique name of the destination
+ *
+ * @retval  true if the message is to be kept
+ *******************************************************************************
+ */
+bool
+_LSTransportMonitorFilterSample(const _LSTransportMonitorFilter *filter, _LSTransportMessage *message,
+                                const char *sender_unique_name, const char *dest_unique_name)
+{
+    if (filter->sample == 1)
+        return true;
+
+    unsigned type = _LSTransportMonitorFilterType(_LSTransportMessageGetType(message));
+    LSMessageToken token;
+    const char *caller = _LSTransportMonitorFilterCall(type, message, sender_unique_name,
+                                                       dest_unique_name, &token);
+
+    /* consecutive tokens of a caller take turns */
+    guint hash = g_str_hash(caller) * 31 + (guint) (token ^ ((guint64) token >> 32));
+    return hash % filter->sample == 0;
+}
+
+/** @} END OF LunaServiceTransportMonitorFilter */
+/** @endcond */
@@ -0,0 +1,50 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef _TRANSPORT_MONITOR_FILTER_H_
+#define _TRANSPORT_MONITOR_FILTER_H_
+
+#include <stdbool.h>
+
+#include "error.h"
+#include "transport_message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @cond INTERNAL */
+
+typedef struct LSTransportMonitorFilter _LSTransportMonitorFilter;
+
+_LSTransportMonitorFilter* _LSTransportMonitorFilterNew(const char *expression, LSError *lserror);
+_LSTransportMonitorFilter* _LSTransportMonitorFilterRef(_LSTransportMonitorFilter *filter);
+void _LSTransportMonitorFilterUnref(_LSTransportMonitorFilter *filter);
+
+bool _LSTransportMonitorFilterMatch(_LSTransportMonitorFilter *filter, _LSTransportMessage *message,
+                                    const char *sender_service_name, const char *sender_unique_name,
+                                    const char *dest_service_name, const char *dest_unique_name);
+bool _LSTransportMonitorFilterSample(const _LSTransportMonitorFilter *filter, _LSTransportMessage *message,
+                                     const char *sender_unique_name, const char *dest_unique_name);
+
+/** @endcond */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TRANSPORT_MONITOR_FILTER_H_
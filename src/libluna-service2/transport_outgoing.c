@@ -28,6 +28,17 @@
  * @{
  */
 
+unsigned long _ls_outgoing_hwm_bytes = 0;       /**< high-water mark of queued bytes per client, 0 - unlimited */
+unsigned long _ls_outgoing_hwm_messages = 0;    /**< high-water mark of queued messages per client, 0 - unlimited */
+_LSTransportQueuePolicy _ls_outgoing_hwm_policy = _LSTransportQueuePolicyDropSignals;   /**< what to do over
+                                                                                             the high-water mark */
+
+static const char *queue_policy_names[] = {
+    [_LSTransportQueuePolicyDropSignals] = "drop-signals",
+    [_LSTransportQueuePolicyDisconnect] = "disconnect",
+    [_LSTransportQueuePolicyPushBack] = "push-back",
+};
+
 /**
  *******************************************************************************
  * @brief Allocate a new outgoing queue.
@@ -79,6 +90,8 @@ _LSTransportOutgoingFree(_LSTransportOutgoing *outgoing)
     LS_ASSERT(outgoing->queue != NULL);
     LS_ASSERT(outgoing->serial != NULL);
 
+    _LSTransportOutgoingCollect(outgoing);
+
     while (!g_queue_is_empty(outgoing->queue))
     {
         _LSTransportMessage *message = g_queue_pop_head(outgoing->queue);
@@ -95,6 +108,366 @@ _LSTransportOutgoingFree(_LSTransportOutgoing *outgoing)
     g_slice_free(_LSTransportOutgoing, outgoing);
 }
 
+/**
+ *******************************************************************************
+ * @brief Post a message to an outgoing queue without taking its lock.
+ *
+ * Any number of threads may post at the same time. The message is pushed on
+ * a lock-free stack and only joins the queue the next time the sending side
+ * collects the posted messages, so a sender never waits for another one
+ * writing to the socket.
+ *
+ * @param  outgoing     IN  outgoing queue
+ * @param  message      IN  message, the queue takes over the caller's ref
+ *
+ * @retval  true if nothing was posted before, so the sending side may need to
+ *          be woken up
+ * @retval  false otherwise
+ *******************************************************************************
+ */
+bool
+_LSTransportOutgoingPost(_LSTransportOutgoing *outgoing, _LSTransportMessage *message)
+{
+    LS_ASSERT(outgoing != NULL);
+    LS_ASSERT(message != NULL);
+
+    _LSTransportMessage *head;
+
+    _LSTransportOutgoingAccount(outgoing, message);
+
+    do
+    {
+        head = g_atomic_pointer_get(&outgoing->posted);
+        message->posted_next = head;
+    }
+    while (!g_atomic_pointer_compare_and_exchange(&outgoing->posted, head, message));
+
+    return head == NULL;
+}
+
+/**
+ *******************************************************************************
+ * @brief Check if there are posted messages waiting to be collected.
+ *
+ * The check is a read-modify-write, so it is ordered after the stores the
+ * caller made before it (e.g., removing the send watch) the same way a
+ * concurrent @ref _LSTransportOutgoingPost is. Either the check sees the
+ * posted message, or the poster sees the stores.
+ *
+ * @param  outgoing     IN  outgoing queue
+ *
+ * @retval  true if there are
+ *******************************************************************************
+ */
+bool
+_LSTransportOutgoingHasPosted(_LSTransportOutgoing *outgoing)
+{
+    LS_ASSERT(outgoing != NULL);
+
+    return !g_atomic_pointer_compare_and_exchange(&outgoing->posted, NULL, NULL);
+}
+
+/**
+ *******************************************************************************
+ * @brief Move the posted messages to the tail of the queue, in the order they
+ * were posted.
+ *
+ * @attention must be called with the outgoing lock held, since the queue is
+ * changed
+ *
+ * @param  outgoing     IN  outgoing queue
+ *******************************************************************************
+ */
+void
+_LSTransportOutgoingCollect(_LSTransportOutgoing *outgoing)
+{
+    LS_ASSERT(outgoing != NULL);
+
+    _LSTransportMessage *posted;
+
+    /* Take the whole stack. Producers only push, so if the head is still the
+     * one we read, nothing was posted meanwhile */
+    do
+    {
+        posted = g_atomic_pointer_get(&outgoing->posted);
+        if (!posted)
+            return;
+    }
+    while (!g_atomic_pointer_compare_and_exchange(&outgoing->posted, posted, NULL));
+
+    /* The stack is newest first, so insert each message before the older ones */
+    GList *sibling = NULL;
+
+    for (; posted; posted = posted->posted_next)
+    {
+        if (sibling)
+        {
+            g_queue_insert_before(outgoing->queue, sibling, posted);
+            sibling = sibling->prev;
+        }
+        else
+        {
+            g_queue_push_tail(outgoing->queue, posted);
+            sibling = g_queue_peek_tail_link(outgoing->queue);
+        }
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Account a message to the depth of an outgoing queue.
+ *
+ * Called for every message that joins the queue or is posted to it, so that
+ * senders on any thread can check the high-water mark without the lock.
+ *
+ * @param  outgoing     IN  outgoing queue
+ * @param  message      IN  message
+ *******************************************************************************
+ */
+void
+_LSTransportOutgoingAccount(_LSTransportOutgoing *outgoing, _LSTransportMessage *message)
+{
+    LS_ASSERT(outgoing != NULL);
+    LS_ASSERT(message != NULL);
+    LS_ASSERT(message->queued_size == 0);
+
+    message->queued_size = sizeof(_LSTransportHeader) + message->raw->header.len;
+
+    g_atomic_pointer_add(&outgoing->queued_bytes, message->queued_size);
+    g_atomic_int_inc(&outgoing->queued_messages);
+}
+
+/**
+ *******************************************************************************
+ * @brief Take a message that leaves an outgoing queue off its depth.
+ *
+ * Messages that were never accounted (e.g., ones that waited in a pending
+ * queue) are ignored.
+ *
+ * @param  outgoing     IN  outgoing queue
+ * @param  message      IN  message
+ *******************************************************************************
+ */
+void
+_LSTransportOutgoingUnaccount(_LSTransportOutgoing *outgoing, _LSTransportMessage *message)
+{
+    LS_ASSERT(outgoing != NULL);
+    LS_ASSERT(message != NULL);
+
+    if (!message->queued_size)
+        return;
+
+    g_atomic_pointer_add(&outgoing->queued_bytes, -(gssize) message->queued_size);
+    message->queued_size = 0;
+
+    if (g_atomic_int_dec_and_test(&outgoing->queued_messages))
+    {
+        g_atomic_int_set(&outgoing->high_water, 0);
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Remove the first message from the queue.
+ *
+ * @attention must be called with the outgoing lock held
+ *
+ * @param  outgoing     IN  outgoing queue
+ *
+ * @retval  message, the caller takes over the queue's ref
+ * @retval  NULL if the queue is empty
+ *******************************************************************************
+ */
+_LSTransportMessage*
+_LSTransportOutgoingPopHead(_LSTransportOutgoing *outgoing)
+{
+    LS_ASSERT(outgoing != NULL);
+
+    _LSTransportMessage *message = g_queue_pop_head(outgoing->queue);
+    if (message)
+    {
+        _LSTransportOutgoingUnaccount(outgoing, message);
+    }
+    return message;
+}
+
+/**
+ *******************************************************************************
+ * @brief Check if one more message would take the queue past its high-water
+ * mark.
+ *
+ * An empty queue always takes a message, whatever its size.
+ *
+ * @param  outgoing     IN  outgoing queue
+ * @param  size         IN  size of the message to be queued
+ *
+ * @retval  true if it would
+ *******************************************************************************
+ */
+bool
+_LSTransportOutgoingIsOverHighWater(_LSTransportOutgoing *outgoing, unsigned long size)
+{
+    LS_ASSERT(outgoing != NULL);
+
+    unsigned long messages = g_atomic_int_get(&outgoing->queued_messages);
+    if (messages == 0)
+        return false;
+
+    if (_ls_outgoing_hwm_messages && messages + 1 > _ls_outgoing_hwm_messages)
+        return true;
+
+    if (_ls_outgoing_hwm_bytes && g_atomic_pointer_get(&outgoing->queued_bytes) + size > _ls_outgoing_hwm_bytes)
+        return true;
+
+    return false;
+}
+
+/**
+ *******************************************************************************
+ * @brief Drop the oldest queued signals until a message of @p size fits
+ * under the high-water mark.
+ *
+ * The head of the queue is kept, since part of it may be on the wire
+ * already. Other message types are never dropped.
+ *
+ * @attention must be called with the outgoing lock held
+ *
+ * @param  outgoing     IN  outgoing queue
+ * @param  size         IN  size of the message to make room for
+ *
+ * @retval  number of signals dropped
+ *******************************************************************************
+ */
+int
+_LSTransportOutgoingDropSignals(_LSTransportOutgoing *outgoing, unsigned long size)
+{
+    LS_ASSERT(outgoing != NULL);
+
+    int dropped = 0;
+    GList *link = g_queue_peek_head_link(outgoing->queue);
+
+    while (link && _LSTransportOutgoingIsOverHighWater(outgoing, size))
+    {
+        GList *next = link->next;
+        _LSTransportMessage *message = link->data;
+
+        if (link != outgoing->queue->head &&
+            _LSTransportMessageGetType(message) == _LSTransportMessageTypeSignal)
+        {
+            g_queue_delete_link(outgoing->queue, link);
+            _LSTransportOutgoingUnaccount(outgoing, message);
+            _LSTransportMessageUnref(message);
+            dropped++;
+        }
+        link = next;
+    }
+
+    g_atomic_int_add(&outgoing->dropped_messages, dropped);
+    return dropped;
+}
+
+/**
+ *******************************************************************************
+ * @brief Replace a queued instance of a latest-value signal with a newer one.
+ *
+ * Looks for an undelivered signal with the same category and method as
+ * @p message that was itself queued with @ref LSTransportHeader::coalesce,
+ * and puts @p message in its place. The head of the queue is never
+ * replaced, since part of it may be on the wire already.
+ *
+ * @attention must be called with the outgoing lock held
+ *
+ * @param  outgoing     IN  outgoing queue
+ * @param  message      IN  signal to queue, the queue takes over the caller's ref
+ *                          if it returns true
+ *
+ * @retval  true if @p message replaced a queued signal
+ * @retval  false if there was nothing to replace
+ *******************************************************************************
+ */
+bool
+_LSTransportOutgoingCoalesce(_LSTransportOutgoing *outgoing, _LSTransportMessage *message)
+{
+    LS_ASSERT(outgoing != NULL);
+    LS_ASSERT(_LSTransportMessageGetType(message) == _LSTransportMessageTypeSignal);
+
+    const char *category = _LSTransportMessageGetCategory(message);
+    const char *method = _LSTransportMessageGetMethod(message);
+    GList *link;
+
+    /* the newest instance is the one to look for, and there is at most one
+     * after the head anyway */
+    for (link = g_queue_peek_tail_link(outgoing->queue);
+         link && link != outgoing->queue->head;
+         link = link->prev)
+    {
+        _LSTransportMessage *queued = link->data;
+
+        if (_LSTransportMessageGetType(queued) != _LSTransportMessageTypeSignal ||
+            !_LSTransportMessageIsCoalesced(queued) ||
+            strcmp(_LSTransportMessageGetCategory(queued), category) != 0 ||
+            strcmp(_LSTransportMessageGetMethod(queued), method) != 0)
+        {
+            continue;
+        }
+
+        link->data = message;
+        _LSTransportOutgoingUnaccount(outgoing, queued);
+        _LSTransportOutgoingAccount(outgoing, message);
+        _LSTransportMessageUnref(queued);
+
+        g_atomic_int_inc(&outgoing->coalesced_messages);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ *******************************************************************************
+ * @brief Parse a high-water policy name.
+ *
+ * @param  str      IN  "drop-signals", "disconnect" or "push-back"
+ * @param  policy   OUT policy
+ *
+ * @retval  true if @p str names a policy
+ *******************************************************************************
+ */
+bool
+_LSTransportQueuePolicyFromString(const char *str, _LSTransportQueuePolicy *policy)
+{
+    LS_ASSERT(str != NULL);
+    LS_ASSERT(policy != NULL);
+
+    int i;
+    for (i = 0; i < G_N_ELEMENTS(queue_policy_names); i++)
+    {
+        if (strcmp(str, queue_policy_names[i]) == 0)
+        {
+            *policy = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the name of a high-water policy.
+ *
+ * @param  policy   IN  policy
+ *
+ * @retval  name, see @ref _LSTransportQueuePolicyFromString
+ *******************************************************************************
+ */
+const char*
+_LSTransportQueuePolicyToString(_LSTransportQueuePolicy policy)
+{
+    LS_ASSERT(policy < G_N_ELEMENTS(queue_policy_names));
+
+    return queue_policy_names[policy];
+}
+
 /**
  * @} END OF LunaServiceTransportOutgoing
  * @endcond
@@ -24,16 +24,57 @@
 
 /** @cond INTERNAL */
 
+/** Maximum number of queued messages written with one writev() */
+#define LS_TRANSPORT_OUTGOING_MAX_IOV   64
+
+/**
+ * What happens to a message that would take the outgoing queue of a client
+ * past its high-water mark
+ */
+typedef enum LSTransportQueuePolicy {
+    _LSTransportQueuePolicyDropSignals,     /**< drop the oldest queued signals, and the new
+                                                 one if that isn't enough; other messages
+                                                 are always queued */
+    _LSTransportQueuePolicyDisconnect,      /**< disconnect the client */
+    _LSTransportQueuePolicyPushBack,        /**< refuse the message, the sender gets an error */
+} _LSTransportQueuePolicy;
+
 struct LSTransportOutgoing {
-    pthread_mutex_t lock;           /**< protects queue */
+    pthread_mutex_t lock;           /**< protects queue and serializes writes to the socket */
     GQueue *queue;                  /**< queue of LSTransportMessages that need to be sent */
+    _LSTransportMessage *posted;    /**< lock-free stack of messages posted from any thread,
+                                         newest first; moved to @ref queue by
+                                         @ref _LSTransportOutgoingCollect */
     _LSTransportSerial *serial;     /**< keeps track of clean shutdown state */
+    gsize queued_bytes;             /**< size of the queued and posted messages */
+    gint queued_messages;           /**< number of the queued and posted messages */
+    gint high_water;                /**< set from going over the high-water mark until
+                                         the queue drains */
+    gint dropped_messages;          /**< signals dropped over the high-water mark */
+    gint coalesced_messages;        /**< queued signals replaced by a newer instance */
 };
 
 typedef struct LSTransportOutgoing _LSTransportOutgoing;
 
 _LSTransportOutgoing* _LSTransportOutgoingNew(void);
 void _LSTransportOutgoingFree(_LSTransportOutgoing *outgoing);
+bool _LSTransportOutgoingPost(_LSTransportOutgoing *outgoing, _LSTransportMessage *message);
+bool _LSTransportOutgoingHasPosted(_LSTransportOutgoing *outgoing);
+void _LSTransportOutgoingCollect(_LSTransportOutgoing *outgoing);
+
+void _LSTransportOutgoingAccount(_LSTransportOutgoing *outgoing, _LSTransportMessage *message);
+void _LSTransportOutgoingUnaccount(_LSTransportOutgoing *outgoing, _LSTransportMessage *message);
+_LSTransportMessage* _LSTransportOutgoingPopHead(_LSTransportOutgoing *outgoing);
+bool _LSTransportOutgoingIsOverHighWater(_LSTransportOutgoing *outgoing, unsigned long size);
+int _LSTransportOutgoingDropSignals(_LSTransportOutgoing *outgoing, unsigned long size);
+bool _LSTransportOutgoingCoalesce(_LSTransportOutgoing *outgoing, _LSTransportMessage *message);
+
+bool _LSTransportQueuePolicyFromString(const char *str, _LSTransportQueuePolicy *policy);
+const char* _LSTransportQueuePolicyToString(_LSTransportQueuePolicy policy);
+
+extern unsigned long _ls_outgoing_hwm_bytes;
+extern unsigned long _ls_outgoing_hwm_messages;
+extern _LSTransportQueuePolicy _ls_outgoing_hwm_policy;
 
 /** @endcond */
 
@@ -28,6 +28,7 @@
 #include "transport_outgoing.h"
 #include "transport_incoming.h"
 #include "transport_channel.h"
+#include "transport_monitor_filter.h"
 #include "transport_signal.h"
 #include "transport_shm.h"
 
@@ -59,6 +60,10 @@ struct LSTransport {
 
     int                  source_priority;    /*<< io watch priority (for glib mainloop) */
 
+    bool                 use_io_thread;      /*<< run the watches on an I/O thread once attached */
+    _LSTransportIoThread *io_thread;         /*<< owns @ref mainloop_context when set; user callbacks
+                                                  run in its user context */
+
     _LSTransportChannel  listen_channel;     /*<< accept incoming connections */
 
     _LSTransportShm      *shm;               /*<< shared memory for ordering of monitor messages */
@@ -76,13 +81,17 @@ struct LSTransport {
 
     _LSTransportClient      *hub;           /*<< client info for hub; should always be valid after connecting */
     _LSTransportClient      *monitor;       /*<< client info for monitor; NULL when there is no monitor */
+    _LSTransportMonitorFilter *monitor_filter; /*<< messages the monitor wants (under lock); NULL for all */
+    gint                    trace;          /*<< a monitor reads our trace ring, as the hub said (atomic) */
 
     _LSTransportGlobalToken *global_token;  /*<< global token that provides unique identity for messages sent by this transport */
 
     pthread_mutex_t         lock;               /*<< lock for clients, all_connections, pending */
     GHashTable              *clients;           /*<< hash of _LSTransportClients by *service* name */
+    pthread_rwlock_t        clients_lock;       /*<< taken for writing (under lock) to change clients, for reading to look up without lock */
     GHashTable              *all_connections;   /*<< hash of fd to _LSTransportClient */
     GHashTable              *pending;           /*<< hash of _LSTransportOutgoing by service name */
+    GHashTable              *prewarm_peers;     /*<< set of service names connected ahead of the first call */
 
     GHashTable              *group_code_map;    /*<< group : bit number */
     GSList                  *category_groups;   /*<< List of LSTransportCategoryBitmask */
@@ -93,9 +102,11 @@ struct LSTransport {
 
     size_t                  trust_security_mask_size; /*<< count of LSTransportBitmaskWord (each bit represent one security group) */
     char                    *trust_as_string; /* << trust level as string */
+    unsigned                trust_level_generation; /*<< bumped whenever group or trust level maps change */
 
     bool                    privileged;         /*<< true if we are a privileged service */
     bool                    proxy;              /*<< true if we are a proxy service */
+    bool                    query_name_batch;   /*<< true if the hub answers "QueryNameBatch" */
 
 #ifdef SECURITY_COMPATIBILITY
     bool                    is_old_config;      /*<< true if this transport for old-configured service */
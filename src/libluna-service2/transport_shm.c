@@ -32,20 +32,36 @@
 
 #define SHM_MODE      0666
 
-#define FENCE_VAL       0xdeadbeef
+/* Layout 1 kept the serial behind a process-shared mutex and used 0xdeadbeef
+ * for its fences. The fence value changes with the layout, so that libraries
+ * of either version find the region of the other invalid instead of misusing
+ * it: they keep working, only without monitor serials. */
+#define SHM_LAYOUT_VERSION  2
+#define FENCE_VAL           0x5e71a102
+
+#define SHM_CACHE_LINE_SIZE 64
 
 /** @cond INTERNAL */
 
+/* The serial is the only field written to, it gets a cache line of its own */
 struct _LSTransportShmData
 {
     uint32_t front_fence;
-    pthread_mutex_t lock;
+    uint32_t version;
+    char pad1[SHM_CACHE_LINE_SIZE - 2 * sizeof(uint32_t)];
     _LSTransportMonitorSerial serial;
+    char pad2[SHM_CACHE_LINE_SIZE - sizeof(_LSTransportMonitorSerial)];
     uint32_t back_fence;
 };
 
 typedef struct _LSTransportShmData _LSTransportShmData;
 
+/* The serial is incremented by several processes at once. Unless the atomic
+ * is lock-free, the compiler calls libatomic, whose locks are private to the
+ * process, and serials stop being unique. */
+_Static_assert(__atomic_always_lock_free(sizeof(_LSTransportMonitorSerial), 0),
+               "monitor serial must be lock-free to be shared between processes");
+
 struct _LSTransportShm
 {
     _LSTransportShmData* data;
@@ -105,15 +121,20 @@ _LSTransportShmInitOnce(LSError *lserror)
         fchmod(fd, SHM_MODE);
     }
 
-    if (shm_needs_init)
+    /* A region created by an older library may be smaller. Growing it
+     * doesn't bother the older library, and makes the mapping below safe. */
+    struct stat st;
+    ret = fstat(fd, &st);
+
+    if (ret == 0 && st.st_size < (off_t) sizeof(_LSTransportShmData))
     {
         ret = ftruncate(fd, sizeof(_LSTransportShmData));
+    }
 
-        if (ret == -1)
-        {
-            _LSErrorSetFromErrno(lserror, MSGID_LS_SHARED_MEMORY_ERR, errno);
-            goto error;
-        }
+    if (ret == -1)
+    {
+        _LSErrorSetFromErrno(lserror, MSGID_LS_SHARED_MEMORY_ERR, errno);
+        goto error;
     }
 
     map = mmap(NULL, sizeof(_LSTransportShmData), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
@@ -136,20 +157,18 @@ _LSTransportShmInitOnce(LSError *lserror)
 
     if (shm_needs_init)
     {
-        pthread_mutexattr_t attr;
-
-        /* mark mutex as being shared by multiple processes */
-        pthread_mutexattr_init(&attr);
-        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
-
-        if (pthread_mutex_init(&map->lock, &attr))
-        {
-            LOG_LS_ERROR(MSGID_LS_MUTEX_ERR, 0, "Could not initialize mutex.");
-            goto error;
-        }
         map->serial = MONITOR_SERIAL_INVALID;
-        map->front_fence = FENCE_VAL;
+        map->version = SHM_LAYOUT_VERSION;
         map->back_fence = FENCE_VAL;
+        g_atomic_int_set((gint *) &map->front_fence, FENCE_VAL);
+    }
+    else if (map->front_fence != 0 &&
+             (map->front_fence != FENCE_VAL || map->version != SHM_LAYOUT_VERSION))
+    {
+        LOG_LS_WARNING(MSGID_LS_SHARED_MEMORY_ERR, 2,
+                       PMLOGKFV("FENCE", "%#x", map->front_fence),
+                       PMLOGKFV("VERSION", "%u", map->version),
+                       "Monitor shared memory has another layout, messages won't have monitor serials");
     }
 
     /* success, so save the resulting mappping */
@@ -202,20 +221,21 @@ _LSTransportShmGetSerial(_LSTransportShm* shm)
 {
     LS_ASSERT(shm != NULL);
 
+    _LSTransportShmData *data = shm->data;
     _LSTransportMonitorSerial ret = MONITOR_SERIAL_INVALID;
 
-    /* Make sure a rogue process didn't mess with the shared mem */
-    if (shm->data->front_fence == FENCE_VAL &&
-        shm->data->back_fence == FENCE_VAL)
+    /* Make sure a rogue process (or a library with another layout) didn't
+     * mess with the shared mem */
+    if (data->front_fence == FENCE_VAL &&
+        data->back_fence == FENCE_VAL &&
+        data->version == SHM_LAYOUT_VERSION)
     {
-        pthread_mutex_lock(&shm->data->lock);
-        ret = ++shm->data->serial;
-
-        if (unlikely(ret == MONITOR_SERIAL_INVALID))
+        /* glib has no 64-bit atomic add on 32-bit targets, the builtin is
+         * lock-free there too (see the assertion above) */
+        do
         {
-            ret++;
-        }
-        pthread_mutex_unlock(&shm->data->lock);
+            ret = __atomic_add_fetch(&data->serial, 1, __ATOMIC_RELAXED);
+        } while (unlikely(ret == MONITOR_SERIAL_INVALID));
     }
 
     return ret;
@@ -22,6 +22,10 @@
 #include <stdint.h>
 #include "error.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /** @cond INTERNAL */
 
 typedef struct _LSTransportShm _LSTransportShm;
@@ -36,4 +40,8 @@ void _LSTransportShmDeinit(_LSTransportShm** shm);
 
 /** @endcond */
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif  /* _TRANSPORT_SHM_H */
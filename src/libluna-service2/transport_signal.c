@@ -38,6 +38,7 @@
  * @param  reg          IN  true to register, false to unregister
  * @param  category     IN  category (required)
  * @param  method       IN  method (optional, NULL means none)
+ * @param  coalesce     IN  true if only the latest undelivered signal matters
  * @param  token        OUT message token
  * @param  lserror      OUT set on error
  *
@@ -49,7 +50,8 @@ bool
 _LSTransportSignalRegistration(_LSTransport *transport,
                                bool is_public_bus,
                                bool reg, const char *category,
-                               const char *method, LSMessageToken *token, LSError *lserror)
+                               const char *method, bool coalesce,
+                               LSMessageToken *token, LSError *lserror)
 {
     /*
      * format:
@@ -73,6 +75,8 @@ _LSTransportSignalRegistration(_LSTransport *transport,
     {
         _LSTransportMessageSetType(message, _LSTransportMessageTypeSignalUnregister);
     }
+    /* the hub has to drop the same kind of registration it added */
+    _LSTransportMessageSetCoalesced(message, coalesce);
 
     char *message_body = _LSTransportMessageGetBody(message);
 
@@ -111,6 +115,7 @@ _LSTransportSignalRegistration(_LSTransport *transport,
  * @param  transport    IN  transport
  * @param  category     IN  category
  * @param  method       IN  method (optional, NULL means none)
+ * @param  coalesce     IN  true to have only the latest undelivered signal queued
  * @param  is_public_bus
  * @param  token        OUT message token
  * @param  lserror      OUT set on error
@@ -121,10 +126,10 @@ _LSTransportSignalRegistration(_LSTransport *transport,
  */
 bool
 LSTransportRegisterSignal(_LSTransport *transport, const char *category, const char *method,
-                          bool is_public_bus,
+                          bool coalesce, bool is_public_bus,
                            LSMessageToken *token, LSError *lserror)
 {
-    return _LSTransportSignalRegistration(transport, is_public_bus, true, category, method, token, lserror);
+    return _LSTransportSignalRegistration(transport, is_public_bus, true, category, method, coalesce, token, lserror);
 }
 
 /**
@@ -135,6 +140,7 @@ LSTransportRegisterSignal(_LSTransport *transport, const char *category, const c
  * @param  transport    IN  transport
  * @param  category     IN  category
  * @param  method       IN  method (optional, NULL means none)
+ * @param  coalesce     IN  as passed to @ref LSTransportRegisterSignal
  * @param  is_public_bus
  * @param  token        OUT message token
  * @param  lserror      OUT set on error
@@ -145,10 +151,10 @@ LSTransportRegisterSignal(_LSTransport *transport, const char *category, const c
  */
 bool
 LSTransportUnregisterSignal(_LSTransport *transport, const char *category, const char *method,
-                            bool is_public_bus,
+                            bool coalesce, bool is_public_bus,
                            LSMessageToken *token, LSError *lserror)
 {
-    return _LSTransportSignalRegistration(transport, is_public_bus, false, category, method, token, lserror);
+    return _LSTransportSignalRegistration(transport, is_public_bus, false, category, method, coalesce, token, lserror);
 }
 
 /**
@@ -168,7 +174,7 @@ LSTransportUnregisterSignal(_LSTransport *transport, const char *category, const
 bool
 LSTransportRegisterSignalServiceStatus(_LSTransport *transport, const char *service_name, bool is_public_bus, LSMessageToken *token, LSError *lserror)
 {
-    return _LSTransportSignalRegistration(transport, is_public_bus, true, SERVICE_STATUS_CATEGORY, service_name, token, lserror);
+    return _LSTransportSignalRegistration(transport, is_public_bus, true, SERVICE_STATUS_CATEGORY, service_name, false, token, lserror);
 }
 
 /**
@@ -188,7 +194,7 @@ LSTransportRegisterSignalServiceStatus(_LSTransport *transport, const char *serv
 bool
 LSTransportUnregisterSignalServiceStatus(_LSTransport *transport, const char *service_name, bool is_public_bus, LSMessageToken *token, LSError *lserror)
 {
-    return _LSTransportSignalRegistration(transport, is_public_bus, false, SERVICE_STATUS_CATEGORY, service_name, token, lserror);
+    return _LSTransportSignalRegistration(transport, is_public_bus, false, SERVICE_STATUS_CATEGORY, service_name, false, token, lserror);
 }
 
 /**
@@ -241,6 +247,8 @@ LSTransportMessageSignalNewRef(const char *category, const char *method, const c
  * @param  method       IN  method (optional, NULL means none)
  * @param  payload      IN  payload
  * @param  is_public_bus  IN
+ * @param  coalesce     IN  true if the signal carries the latest value of a state,
+ *                          so that a newer instance may replace a queued one
  * @param  lserror      OUT set on error
  *
  * @retval  true on success
@@ -248,11 +256,12 @@ LSTransportMessageSignalNewRef(const char *category, const char *method, const c
  *******************************************************************************
  */
 bool
-LSTransportSendSignal(_LSTransport *transport, const char *category, const char *method, const char *payload, bool is_public_bus, LSError *lserror)
+LSTransportSendSignal(_LSTransport *transport, const char *category, const char *method, const char *payload, bool is_public_bus, bool coalesce, LSError *lserror)
 {
     bool ret = true;
 
     _LSTransportMessage *message = LSTransportMessageSignalNewRef(category, method, payload, is_public_bus);
+    _LSTransportMessageSetCoalesced(message, coalesce);
 
     LS_ASSERT(transport->hub != NULL);
 
@@ -29,9 +29,9 @@
 typedef struct LSTransport _LSTransport;
 typedef struct LSTransportMessage _LSTransportMessage;
 
-bool LSTransportRegisterSignal(_LSTransport *transport, const char *category, const char *method, bool is_public_bus, LSMessageToken *token, LSError *lserror);
-bool LSTransportUnregisterSignal(_LSTransport *transport, const char *category, const char *method, bool is_public_bus, LSMessageToken *token, LSError *lserror);
-bool LSTransportSendSignal(_LSTransport *transport, const char *category, const char *method, const char *payload, bool is_public_bus, LSError *lserror);
+bool LSTransportRegisterSignal(_LSTransport *transport, const char *category, const char *method, bool coalesce, bool is_public_bus, LSMessageToken *token, LSError *lserror);
+bool LSTransportUnregisterSignal(_LSTransport *transport, const char *category, const char *method, bool coalesce, bool is_public_bus, LSMessageToken *token, LSError *lserror);
+bool LSTransportSendSignal(_LSTransport *transport, const char *category, const char *method, const char *payload, bool is_public_bus, bool coalesce, LSError *lserror);
 
 bool LSTransportRegisterSignalServiceStatus(_LSTransport *transport, const char *service_name, bool is_public_bus, LSMessageToken *token, LSError *lserror);
 bool LSTransportUnregisterSignalServiceStatus(_LSTransport *transport, const char *service_name, bool is_public_bus, LSMessageToken *token, LSError *lserror);
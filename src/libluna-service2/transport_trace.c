@@ -0,0 +1,791 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock.h"
+#include "log.h"
+#include "transport_priv.h"
+#include "transport_trace.h"
+
+/**
+ * @cond INTERNAL
+ * @defgroup LunaServiceTransportTrace Shared memory tracing
+ * @ingroup LunaServiceTransport
+ *
+ * Messages for a tracing monitor, without the message copies and the
+ * monitor connections.
+ *
+ * A tracing monitor asks the hub like any monitor (see
+ * @ref LSTransportSendMessageMonitorRequestTraced), and the hub, once it has
+ * checked that the monitor is allowed to, tells the processes that can trace
+ * to. Those append a compact record of the messages they send and receive to
+ * a ring of their own in shared memory, readable by their user only, until
+ * the hub says the monitor is gone; then they remove their rings (and at
+ * exit, the monitor removing those of processes that crashed). The monitor
+ * reads the rings. When a ring is full, records are dropped: the process
+ * never waits for the monitor.
+ *
+ * @{
+ */
+
+#define TRACE_RING_SHM_PREFIX   "ls2.trace."
+#define TRACE_SHM_DIR           "/dev/shm"
+
+#define TRACE_RING_MODE         0600
+
+#define TRACE_RESCAN_INTERVAL   G_USEC_PER_SEC
+
+/** A ring read by the monitor */
+typedef struct LSTransportTraceSource {
+    int32_t pid;
+    _LSTransportTraceRing *ring;
+    size_t size;
+    GHashTable *senders;        /**< unique name -> _LSTransportClient, sender of the records */
+    gint dropped;               /**< dropped count of the ring seen last */
+} _LSTransportTraceSource;
+
+struct LSTransportTraceReader {
+    _LSTransport *transport;
+    GHashTable *sources;        /**< pid -> _LSTransportTraceSource */
+    gint64 scanned;             /**< when the rings were looked for last */
+    unsigned long dropped;
+    _LSTransportTraceRecord *record;
+};
+
+static GMutex trace_lock;
+static _LSTransportTraceRing *trace_ring = NULL;   /**< set under the lock, read atomically */
+static char *trace_ring_name = NULL;
+static pid_t trace_ring_pid = 0;                  /**< process the ring is of (not a forked child) */
+static bool trace_ring_failed = false;
+static int trace_users = 0;                       /**< transports tracing (under the lock) */
+static gint trace_writers = 0;                    /**< appends that may be using the ring */
+
+/* not the geometry in the ring header: the process writing to it could change that under the monitor */
+#define TRACE_RECORD_AT(ring, pos) \
+    ((_LSTransportTraceRecord *) ((ring)->records + ((pos) & (TRACE_RING_SLOTS - 1)) * TRACE_RECORD_SIZE))
+
+static void*
+_LSTransportTraceMap(int fd, size_t size)
+{
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return map == MAP_FAILED ? NULL : map;
+}
+
+/**
+ *******************************************************************************
+ * @brief Check if a monitor traces the messages, as the hub said.
+ *
+ * @param  transport    IN  transport
+ *
+ * @retval true if messages should be passed to @ref _LSTransportTraceMessage
+ *******************************************************************************
+ */
+bool
+_LSTransportTraceEnabled(_LSTransport *transport)
+{
+    return g_atomic_int_get(&transport->trace) != 0;
+}
+
+/* Drop the name of the ring, for a process that exits without a word */
+static void
+_LSTransportTraceAtExit(void)
+{
+    /* the ring of the parent is no business of a forked child */
+    if (g_atomic_pointer_get(&trace_ring) && trace_ring_pid == getpid())
+    {
+        shm_unlink(trace_ring_name);
+    }
+}
+
+/* @attention must be called with the lock held */
+static void
+_LSTransportTraceRingRelease(void)
+{
+    _LSTransportTraceRing *ring = trace_ring;
+
+    trace_ring_failed = false;
+    if (!ring)
+        return;
+
+    g_atomic_pointer_set(&trace_ring, NULL);
+
+    /* appends that got the ring before it was taken away finish first */
+    while (g_atomic_int_get(&trace_writers) > 0)
+    {
+        g_thread_yield();
+    }
+
+    munmap(ring, _LSTransportTraceRingSize());
+    if (trace_ring_pid == getpid())
+    {
+        shm_unlink(trace_ring_name);
+    }
+}
+
+/**
+ *******************************************************************************
+ * @brief Start or stop tracing for a transport, as the hub says (and stop when
+ * the transport goes).
+ *
+ * The ring of the process is unmapped and unlinked once no transport traces,
+ * so that it doesn't pin its memory in between monitors.
+ *
+ * @param  transport    IN  transport
+ * @param  enabled      IN  whether a monitor reads the ring
+ *******************************************************************************
+ */
+void
+_LSTransportTraceSetEnabled(_LSTransport *transport, bool enabled)
+{
+    g_mutex_lock(&trace_lock);
+    if ((g_atomic_int_get(&transport->trace) != 0) != enabled)
+    {
+        g_atomic_int_set(&transport->trace, enabled);
+        trace_users += enabled ? 1 : -1;
+
+        if (trace_users == 0)
+        {
+            _LSTransportTraceRingRelease();
+        }
+    }
+    g_mutex_unlock(&trace_lock);
+}
+
+/**
+ *******************************************************************************
+ * @brief Size of a ring in bytes.
+ *******************************************************************************
+ */
+size_t
+_LSTransportTraceRingSize(void)
+{
+    return sizeof(_LSTransportTraceRing) + (size_t) TRACE_RING_SLOTS * TRACE_RECORD_SIZE;
+}
+
+/**
+ *******************************************************************************
+ * @brief Initialize an empty ring of @ref _LSTransportTraceRingSize() zeroed
+ * bytes.
+ *
+ * @param  ring     IN  ring
+ * @param  pid      IN  process appending to the ring
+ *******************************************************************************
+ */
+void
+_LSTransportTraceRingInit(_LSTransportTraceRing *ring, int32_t pid)
+{
+    guint pos;
+
+    ring->version = TRACE_VERSION;
+    ring->slots = TRACE_RING_SLOTS;
+    ring->record_size = TRACE_RECORD_SIZE;
+    ring->pid = pid;
+
+    for (pos = 0; pos < ring->slots; pos++)
+    {
+        TRACE_RECORD_AT(ring, pos)->seq = pos;
+    }
+
+    g_atomic_int_set((gint *) &ring->magic, TRACE_MAGIC);
+}
+
+static bool
+_LSTransportTraceRingValid(const _LSTransportTraceRing *ring, size_t size)
+{
+    return size >= _LSTransportTraceRingSize() &&
+           g_atomic_int_get((gint *) &ring->magic) == TRACE_MAGIC &&
+           ring->version == TRACE_VERSION &&
+           ring->record_size == TRACE_RECORD_SIZE &&
+           ring->slots == TRACE_RING_SLOTS;
+}
+
+static char*
+_LSTransportTraceAppendName(char *dest, const char *name)
+{
+    size_t len = strlen_safe(name) + 1;
+
+    memcpy(dest, len > 1 ? name : "", len);
+    return dest + len;
+}
+
+/**
+ *******************************************************************************
+ * @brief Append the record of a message to a ring.
+ *
+ * The payload is cut to fit the record. Lock-free, safe from any thread.
+ *
+ * @param  ring                 IN  ring
+ * @param  message              IN  message
+ * @param  sender_service_name  IN  names of the sender
+ * @param  sender_unique_name   IN
+ * @param  dest_service_name    IN  names of the destination
+ * @param  dest_unique_name     IN
+ * @param  message_data         IN  serial, type and timestamp
+ *
+ * @retval  true if appended
+ * @retval  false if dropped (full ring)
+ *******************************************************************************
+ */
+bool
+_LSTransportTraceRingAppend(_LSTransportTraceRing *ring, _LSTransportMessage *message,
+                            const char *sender_service_name, const char *sender_unique_name,
+                            const char *dest_service_name, const char *dest_unique_name,
+                            const _LSMonitorMessageData *message_data)
+{
+    const char *body = _LSTransportMessageGetBody(message);
+    unsigned long body_size = _LSTransportMessageGetBodySize(message);
+
+    /* only the payload is cut: the body is kept apart from it */
+    const char *payload = _LSTransportMessageIsMonitorType(message) ? _LSTransportMessageGetPayload(message) : NULL;
+    unsigned long prefix_size = payload ? payload - body : body_size;
+    unsigned long payload_size = payload ? strnlen(payload, body_size - prefix_size) : 0;
+
+    if (payload && prefix_size + payload_size == body_size)
+    {
+        /* not terminated, keep the body as is */
+        payload = NULL;
+        prefix_size = body_size;
+        payload_size = 0;
+    }
+    unsigned long suffix_size = payload ? body_size - prefix_size - payload_size - 1 : 0;
+
+    size_t names_size = strlen_safe(sender_service_name) + strlen_safe(sender_unique_name) +
+                        strlen_safe(dest_service_name) + strlen_safe(dest_unique_name) + 4;
+    size_t room = TRACE_RECORD_DATA_SIZE;
+
+    if (names_size + prefix_size + suffix_size + (payload ? 1 : 0) > room)
+    {
+        g_atomic_int_inc(&ring->dropped);
+        return false;
+    }
+
+    unsigned long payload_kept = payload
+                               ? MIN(payload_size, room - names_size - prefix_size - suffix_size - 1)
+                               : 0;
+
+    /* claim the slot of the next append, unless it wasn't read yet */
+    guint pos = (guint) g_atomic_int_get(&ring->head);
+    _LSTransportTraceRecord *record;
+
+    for (;;)
+    {
+        record = TRACE_RECORD_AT(ring, pos);
+        gint diff = (gint) ((guint) g_atomic_int_get(&record->seq) - pos);
+
+        if (diff == 0)
+        {
+            if (g_atomic_int_compare_and_exchange(&ring->head, (gint) pos, (gint) (pos + 1)))
+                break;
+        }
+        else if (diff < 0)
+        {
+            g_atomic_int_inc(&ring->dropped);
+            return false;
+        }
+        pos = (guint) g_atomic_int_get(&ring->head);
+    }
+
+    record->type = _LSTransportMessageGetType(message);
+    record->token = _LSTransportMessageGetToken(message);
+    record->message_data = *message_data;
+    record->is_public_bus = _LSTransportMessageGetHeader(message)->is_public_bus;
+    record->truncated = payload_kept < payload_size;
+    record->names_size = names_size;
+
+    char *dest = record->data;
+    dest = _LSTransportTraceAppendName(dest, sender_service_name);
+    dest = _LSTransportTraceAppendName(dest, sender_unique_name);
+    dest = _LSTransportTraceAppendName(dest, dest_service_name);
+    dest = _LSTransportTraceAppendName(dest, dest_unique_name);
+
+    memcpy(dest, body, prefix_size);
+    dest += prefix_size;
+    if (payload)
+    {
+        memcpy(dest, payload, payload_kept);
+        dest += payload_kept;
+        *dest++ = '\0';
+        memcpy(dest, payload + payload_size + 1, suffix_size);
+        dest += suffix_size;
+    }
+    record->body_size = dest - record->data - names_size;
+
+    /* publish */
+    g_atomic_int_set(&record->seq, (gint) (pos + 1));
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Take the oldest record out of a ring. Only the monitor reads.
+ *
+ * @param  ring     IN  ring
+ * @param  record   OUT record, of the record size of the ring
+ *
+ * @retval  true if a record was read
+ * @retval  false if there is none (yet)
+ *******************************************************************************
+ */
+bool
+_LSTransportTraceRingRead(_LSTransportTraceRing *ring, _LSTransportTraceRecord *record)
+{
+    guint pos = (guint) g_atomic_int_get(&ring->tail);
+    _LSTransportTraceRecord *slot = TRACE_RECORD_AT(ring, pos);
+
+    if ((guint) g_atomic_int_get(&slot->seq) != pos + 1)
+        return false;
+
+    memcpy(record, slot, TRACE_RECORD_SIZE);
+
+    /* free for the append a lap later */
+    g_atomic_int_set(&slot->seq, (gint) (pos + TRACE_RING_SLOTS));
+    g_atomic_int_set(&ring->tail, (gint) (pos + 1));
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Check a record read from a ring before using it.
+ *
+ * The ring is written by another process: the sizes of a record are to be
+ * within it, and its names NUL-terminated.
+ *
+ * @param  record   IN  record, of @ref TRACE_RECORD_SIZE bytes
+ *
+ * @retval  true if the record can be used
+ *******************************************************************************
+ */
+bool
+_LSTransportTraceRecordValid(const _LSTransportTraceRecord *record)
+{
+    const char *name = record->data;
+    const char *names_end = record->data + record->names_size;
+    int index;
+
+    if ((size_t) record->names_size + record->body_size > TRACE_RECORD_DATA_SIZE)
+        return false;
+
+    for (index = 0; index < 4; index++)
+    {
+        const char *nul = memchr(name, '\0', names_end - name);
+        if (!nul)
+            return false;
+        name = nul + 1;
+    }
+    return name == names_end;
+}
+
+/**
+ *******************************************************************************
+ * @brief Get one of the names of a record.
+ *
+ * @param  record   IN  record checked by @ref _LSTransportTraceRecordValid
+ * @param  index    IN  0 - sender service name, 1 - sender unique name,
+ *                      2 - destination service name, 3 - destination unique name
+ *
+ * @retval name ("" if none)
+ *******************************************************************************
+ */
+const char*
+_LSTransportTraceRecordGetName(const _LSTransportTraceRecord *record, int index)
+{
+    const char *name = record->data;
+
+    LS_ASSERT(index >= 0 && index < 4);
+
+    while (index-- > 0)
+    {
+        name += strlen(name) + 1;
+    }
+    return name;
+}
+
+/**
+ *******************************************************************************
+ * @brief Build the message the monitor would get over its socket for a record.
+ *
+ * @param  record   IN  record checked by @ref _LSTransportTraceRecordValid
+ * @param  sender   IN  client with the names of the sender
+ *
+ * @retval message with ref count of 1
+ *******************************************************************************
+ */
+_LSTransportMessage*
+_LSTransportTraceRecordToMessage(const _LSTransportTraceRecord *record, _LSTransportClient *sender)
+{
+    _LSTransportMessage *message =
+        _LSTransportMessageNewMonitorRef(record->type, record->token, record->is_public_bus,
+                                         record->data + record->names_size, record->body_size,
+                                         _LSTransportTraceRecordGetName(record, 2),
+                                         _LSTransportTraceRecordGetName(record, 3),
+                                         &record->message_data);
+    _LSTransportMessageSetClient(message, sender);
+
+    return message;
+}
+
+/* @attention must be called with the lock held */
+static _LSTransportTraceRing*
+_LSTransportTraceRingCreate(LSError *lserror)
+{
+    char *name = g_strdup_printf("/" TRACE_RING_SHM_PREFIX "%d", (int) getpid());
+    size_t size = _LSTransportTraceRingSize();
+    _LSTransportTraceRing *ring = NULL;
+
+    /* a ring left behind by a process that had the same pid */
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, TRACE_RING_MODE);
+    if (fd == -1)
+    {
+        _LSErrorSetFromErrno(lserror, MSGID_LS_SHARED_MEMORY_ERR, errno);
+        goto exit;
+    }
+
+    if (ftruncate(fd, size) == -1 || !(ring = _LSTransportTraceMap(fd, size)))
+    {
+        _LSErrorSetFromErrno(lserror, MSGID_LS_SHARED_MEMORY_ERR, errno);
+        shm_unlink(name);
+        goto exit;
+    }
+
+    _LSTransportTraceRingInit(ring, getpid());
+
+    static bool at_exit_set = false;
+    if (!at_exit_set)
+    {
+        atexit(_LSTransportTraceAtExit);
+        at_exit_set = true;
+    }
+
+    g_free(trace_ring_name);
+    trace_ring_name = name;
+    trace_ring_pid = getpid();
+    name = NULL;
+
+exit:
+    if (fd != -1) close(fd);
+    g_free(name);
+    return ring;
+}
+
+/* Get the ring, created the first time (while a transport traces) */
+static bool
+_LSTransportTraceRingEnsure(void)
+{
+    g_mutex_lock(&trace_lock);
+    if (!trace_ring && !trace_ring_failed && trace_users > 0)
+    {
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        _LSTransportTraceRing *ring = _LSTransportTraceRingCreate(&lserror);
+        if (ring)
+        {
+            g_atomic_pointer_set(&trace_ring, ring);
+        }
+        else
+        {
+            /* don't try on every message */
+            trace_ring_failed = true;
+            LOG_LSERROR(MSGID_LS_SHARED_MEMORY_ERR, &lserror);
+            LSErrorFree(&lserror);
+        }
+    }
+    bool ret = trace_ring != NULL;
+    g_mutex_unlock(&trace_lock);
+
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Append the record of a message to the ring of the process (created
+ * the first time, and again after tracing was switched off and on).
+ *
+ * @param  message      IN  message
+ * @param  client       IN  client the message is sent to or was received from
+ * @param  type         IN  sent or received
+ * @param  timestamp    IN  when (NULL for now)
+ *******************************************************************************
+ */
+void
+_LSTransportTraceMessage(_LSTransportMessage *message, _LSTransportClient *client,
+                         _LSMonitorMessageType type, const struct timespec *timestamp)
+{
+    if (!g_atomic_pointer_get(&trace_ring) && !_LSTransportTraceRingEnsure())
+        return;
+
+    _LSTransport *transport = client->transport;
+    _LSMonitorMessageData message_data;
+
+    message_data.serial = _LSTransportShmGetSerial(transport->shm);
+    message_data.type = type;
+    if (timestamp)
+    {
+        message_data.timestamp = *timestamp;
+    }
+    else
+    {
+        ClockGetTime(&message_data.timestamp);
+    }
+
+    /* counted before the ring is looked at, see _LSTransportTraceRingRelease() */
+    g_atomic_int_inc(&trace_writers);
+    _LSTransportTraceRing *ring = g_atomic_pointer_get(&trace_ring);
+    if (ring)
+    {
+        (void) _LSTransportTraceRingAppend(ring, message, transport->service_name, transport->unique_name,
+                                           client->service_name, client->unique_name, &message_data);
+    }
+    g_atomic_int_add(&trace_writers, -1);
+}
+
+static void
+_LSTransportTraceSourceFree(_LSTransportTraceSource *source)
+{
+    g_hash_table_unref(source->senders);
+    munmap(source->ring, source->size);
+    g_slice_free(_LSTransportTraceSource, source);
+}
+
+static _LSTransportTraceSource*
+_LSTransportTraceSourceOpen(const char *name, int32_t pid)
+{
+    char *path = g_strconcat("/", name, NULL);
+    _LSTransportTraceSource *source = NULL;
+    _LSTransportTraceRing *ring = NULL;
+    struct stat st;
+
+    int fd = shm_open(path, O_RDWR, 0);
+    g_free(path);
+    if (fd == -1)
+        return NULL;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        ring = _LSTransportTraceMap(fd, st.st_size);
+    }
+    close(fd);
+
+    if (!ring)
+        return NULL;
+
+    /* still being set up, or not a ring this version understands */
+    if (!_LSTransportTraceRingValid(ring, st.st_size) || ring->pid != pid)
+    {
+        munmap(ring, st.st_size);
+        return NULL;
+    }
+
+    source = g_slice_new0(_LSTransportTraceSource);
+    source->pid = pid;
+    source->ring = ring;
+    source->size = st.st_size;
+    source->senders = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify) _LSTransportClientUnref);
+    source->dropped = 0;
+    return source;
+}
+
+static void
+_LSTransportTraceReaderScan(_LSTransportTraceReader *reader)
+{
+    GDir *dir = g_dir_open(TRACE_SHM_DIR, 0, NULL);
+    const char *name;
+
+    if (!dir)
+        return;
+
+    while ((name = g_dir_read_name(dir)))
+    {
+        if (!g_str_has_prefix(name, TRACE_RING_SHM_PREFIX))
+            continue;
+
+        char *end = NULL;
+        long pid = strtol(name + strlen(TRACE_RING_SHM_PREFIX), &end, 10);
+        if (!end || *end != '\0' || pid <= 0 || pid == getpid())
+            continue;
+
+        if (g_hash_table_contains(reader->sources, GINT_TO_POINTER(pid)))
+            continue;
+
+        _LSTransportTraceSource *source = _LSTransportTraceSourceOpen(name, pid);
+        if (source)
+        {
+            g_hash_table_insert(reader->sources, GINT_TO_POINTER(pid), source);
+        }
+    }
+    g_dir_close(dir);
+}
+
+/**
+ *******************************************************************************
+ * @brief Set up reading the rings of the processes.
+ *
+ * The processes only trace once the hub tells them to, after the monitor
+ * sent @ref LSTransportSendMessageMonitorRequestTraced.
+ *
+ * @param  transport    IN  transport of the monitor (for the sender clients)
+ * @param  lserror      OUT set on error
+ *
+ * @retval  reader on success
+ * @retval  NULL on failure
+ *******************************************************************************
+ */
+_LSTransportTraceReader*
+_LSTransportTraceReaderNew(_LSTransport *transport, LSError *lserror)
+{
+    if (!g_file_test(TRACE_SHM_DIR, G_FILE_TEST_IS_DIR))
+    {
+        _LSErrorSet(lserror, MSGID_LS_SHARED_MEMORY_ERR, -1,
+                    "No %s to find the trace rings in", TRACE_SHM_DIR);
+        return NULL;
+    }
+
+    _LSTransportTraceReader *reader = g_slice_new0(_LSTransportTraceReader);
+    reader->transport = transport;
+    reader->sources = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                            (GDestroyNotify) _LSTransportTraceSourceFree);
+    reader->record = g_malloc(TRACE_RECORD_SIZE);
+    return reader;
+}
+
+/**
+ *******************************************************************************
+ * @brief Stop reading the rings. The processes stop tracing when the hub sees
+ * the monitor go.
+ *
+ * @param  reader   IN  reader
+ *******************************************************************************
+ */
+void
+_LSTransportTraceReaderFree(_LSTransportTraceReader *reader)
+{
+    g_hash_table_unref(reader->sources);
+    g_free(reader->record);
+    g_slice_free(_LSTransportTraceReader, reader);
+}
+
+static _LSTransportClient*
+_LSTransportTraceSourceGetSender(_LSTransportTraceReader *reader, _LSTransportTraceSource *source,
+                                 const _LSTransportTraceRecord *record)
+{
+    const char *service_name = _LSTransportTraceRecordGetName(record, 0);
+    const char *unique_name = _LSTransportTraceRecordGetName(record, 1);
+
+    _LSTransportClient *sender = g_hash_table_lookup(source->senders, unique_name);
+    if (!sender)
+    {
+        sender = _LSTransportClientNewRef(reader->transport, -1,
+                                          *service_name ? service_name : NULL, unique_name, NULL);
+        if (!sender)
+            return NULL;
+        g_hash_table_insert(source->senders, g_strdup(unique_name), sender);
+    }
+    return sender;
+}
+
+/**
+ *******************************************************************************
+ * @brief Read the records appended to the rings since the last call.
+ *
+ * Looks for new rings now and then, and lets go of the rings of the
+ * processes that are gone once they're read.
+ *
+ * @param  reader   IN  reader
+ * @param  handler  IN  called with the message of every record
+ * @param  context  IN  passed to @p handler
+ *
+ * @retval number of messages read
+ *******************************************************************************
+ */
+int
+_LSTransportTraceReaderRead(_LSTransportTraceReader *reader, LSTransportTraceHandler handler, void *context)
+{
+    gint64 now = g_get_monotonic_time();
+    bool rescan = now - reader->scanned >= TRACE_RESCAN_INTERVAL;
+    GHashTableIter iter;
+    _LSTransportTraceSource *source;
+    int count = 0;
+
+    if (rescan)
+    {
+        reader->scanned = now;
+        _LSTransportTraceReaderScan(reader);
+    }
+
+    g_hash_table_iter_init(&iter, reader->sources);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *) &source))
+    {
+        while (_LSTransportTraceRingRead(source->ring, reader->record))
+        {
+            if (!_LSTransportTraceRecordValid(reader->record))
+            {
+                reader->dropped++;
+                continue;
+            }
+
+            _LSTransportClient *sender = _LSTransportTraceSourceGetSender(reader, source, reader->record);
+            if (!sender)
+                continue;
+
+            _LSTransportMessage *message = _LSTransportTraceRecordToMessage(reader->record, sender);
+            handler(message, context);
+            _LSTransportMessageUnref(message);
+            count++;
+        }
+
+        gint dropped = g_atomic_int_get(&source->ring->dropped);
+        reader->dropped += (guint) (dropped - source->dropped);
+        source->dropped = dropped;
+
+        if (rescan && kill(source->pid, 0) == -1 && errno == ESRCH)
+        {
+            char *name = g_strdup_printf("/" TRACE_RING_SHM_PREFIX "%d", (int) source->pid);
+            shm_unlink(name);
+            g_free(name);
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    return count;
+}
+
+/**
+ *******************************************************************************
+ * @brief Get the number of records the processes dropped since the reader
+ * started, because their rings were full, and of the malformed records skipped.
+ *******************************************************************************
+ */
+unsigned long
+_LSTransportTraceReaderGetDropped(_LSTransportTraceReader *reader)
+{
+    return reader->dropped;
+}
+
+/** @} END OF LunaServiceTransportTrace */
+/** @endcond */
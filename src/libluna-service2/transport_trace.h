@@ -0,0 +1,116 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef _TRANSPORT_TRACE_H_
+#define _TRANSPORT_TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+
+#include "error.h"
+#include "transport_message.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @cond INTERNAL */
+
+typedef struct LSTransport _LSTransport;
+
+#define TRACE_MAGIC             0x4c535452  /**< "LSTR" */
+#define TRACE_VERSION           1
+
+#define TRACE_RING_SLOTS        1024        /**< records in a ring, power of 2 */
+#define TRACE_RECORD_SIZE       1024        /**< bytes of a record */
+
+/** Trace record: what the monitor needs to print a message */
+typedef struct LSTransportTraceRecord {
+    gint seq;                       /**< slot sequence, see @ref LSTransportTraceRing */
+    uint32_t type;                  /**< @ref _LSTransportMessageType */
+    LSMessageToken token;
+    _LSMonitorMessageData message_data;
+    uint32_t body_size;             /**< bytes of the message body in @ref data */
+    uint16_t names_size;            /**< bytes of the names in @ref data */
+    uint8_t is_public_bus;
+    uint8_t truncated;              /**< the payload was cut to fit */
+    char data[];                    /**< sender service name, sender unique name,
+                                         destination service name, destination
+                                         unique name (all NUL-terminated),
+                                         then the message body */
+} _LSTransportTraceRecord;
+
+#define TRACE_RECORD_DATA_SIZE  (TRACE_RECORD_SIZE - sizeof(_LSTransportTraceRecord))
+
+/**
+ * Ring of trace records of a process, in shared memory.
+ *
+ * Any number of threads append, a single monitor reads. A slot is free for
+ * the append number n when its seq is n, holds the record n when its seq is
+ * n + 1, and is free again for the append n + TRACE_RING_SLOTS once read.
+ * Appending to a full ring drops the record.
+ */
+typedef struct LSTransportTraceRing {
+    uint32_t magic;                 /**< set last, once the ring is ready */
+    uint32_t version;
+    uint32_t slots;
+    uint32_t record_size;
+    int32_t pid;                    /**< process writing to the ring */
+    gint head;                      /**< next append */
+    gint tail;                      /**< next read (monitor only) */
+    gint dropped;                   /**< records that didn't fit */
+    char records[];
+} _LSTransportTraceRing;
+
+/** Called for every message read from the rings */
+typedef void (*LSTransportTraceHandler)(_LSTransportMessage *message, void *context);
+
+typedef struct LSTransportTraceReader _LSTransportTraceReader;
+
+/* Process side */
+bool _LSTransportTraceEnabled(_LSTransport *transport);
+void _LSTransportTraceSetEnabled(_LSTransport *transport, bool enabled);
+void _LSTransportTraceMessage(_LSTransportMessage *message, _LSTransportClient *client,
+                              _LSMonitorMessageType type, const struct timespec *timestamp);
+
+/* Monitor side */
+_LSTransportTraceReader* _LSTransportTraceReaderNew(_LSTransport *transport, LSError *lserror);
+void _LSTransportTraceReaderFree(_LSTransportTraceReader *reader);
+int _LSTransportTraceReaderRead(_LSTransportTraceReader *reader, LSTransportTraceHandler handler, void *context);
+unsigned long _LSTransportTraceReaderGetDropped(_LSTransportTraceReader *reader);
+
+/* The ring itself */
+size_t _LSTransportTraceRingSize(void);
+void _LSTransportTraceRingInit(_LSTransportTraceRing *ring, int32_t pid);
+bool _LSTransportTraceRingAppend(_LSTransportTraceRing *ring, _LSTransportMessage *message,
+                                 const char *sender_service_name, const char *sender_unique_name,
+                                 const char *dest_service_name, const char *dest_unique_name,
+                                 const _LSMonitorMessageData *message_data);
+bool _LSTransportTraceRingRead(_LSTransportTraceRing *ring, _LSTransportTraceRecord *record);
+bool _LSTransportTraceRecordValid(const _LSTransportTraceRecord *record);
+_LSTransportMessage* _LSTransportTraceRecordToMessage(const _LSTransportTraceRecord *record,
+                                                      _LSTransportClient *sender);
+const char* _LSTransportTraceRecordGetName(const _LSTransportTraceRecord *record, int index);
+
+/** @endcond */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TRANSPORT_TRACE_H_
@@ -67,6 +67,13 @@ do {                                                        \
     pthread_mutex_unlock(mutex);                            \
 } while (0)
 
+/* evaluates to true if the mutex was taken */
+#define TRYLOCK(name, mutex)                                \
+({                                                          \
+    LOG_LS_TRACE("%s: TRYLOCK %s\n", __func__, name);       \
+    pthread_mutex_trylock(mutex) == 0;                      \
+})
+
 
 #define TRANSPORT_LOCK(mutex)                               \
 do {                                                        \
@@ -108,6 +115,9 @@ do {                                                        \
     UNLOCK("Outgoing", mutex);                              \
 } while (0)
 
+#define OUTGOING_TRYLOCK(mutex)                             \
+    TRYLOCK("Outgoing", mutex)
+
 #define SEND_WATCH_LOCK(mutex)                              \
 do {                                                        \
     LOCK("Send Watch", mutex);                              \
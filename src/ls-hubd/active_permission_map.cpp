@@ -67,6 +67,20 @@ LSHubActivePermissionMapGet()
     return active_permission_map.get();
 }
 
+static unsigned active_permission_map_generation = 0;
+
+/// @brief Get generation of the active permission map
+///
+/// Anything computed from active permissions (e.g., cached ACG decisions)
+/// is valid as long as the generation stays the same.
+///
+/// @return Generation, changes whenever permissions are added or removed
+unsigned
+LSHubActivePermissionMapGeneration()
+{
+    return active_permission_map_generation;
+}
+
 /// @brief Lookup service permissions from the active permission map
 ///
 /// @param[in] active_service_id  Identification of the service (unique name)
@@ -117,6 +131,7 @@ LSHubActivePermissionMapAddRef(LSHubPermission *perm, const char *active_service
         // Ref and add permissions for active service
         LSHubPermissionRef(perm);
         g_hash_table_insert(LSHubActivePermissionMapGet(), g_strdup(active_service_id), perm);
+        ++active_permission_map_generation;
     }
 
     return true;
@@ -132,7 +147,11 @@ LSHubActivePermissionMapUnref(const char *active_service_id)
     if (!active_service_id)
         return false;
 
-    return g_hash_table_remove(LSHubActivePermissionMapGet(), active_service_id);
+    if (!g_hash_table_remove(LSHubActivePermissionMapGet(), active_service_id))
+        return false;
+
+    ++active_permission_map_generation;
+    return true;
 }
 
 /// @brief Create an entry in the active permission map for a new client
@@ -46,4 +46,8 @@ LSHubActivePermissionMapClientAdd(const _LSTransportClient *client, const char *
 bool
 LSHubActivePermissionMapClientRemove(const _LSTransportClient *client, LSError *lserror);
 
+/* generation of the map contents, changes whenever permissions are added or removed */
+unsigned
+LSHubActivePermissionMapGeneration();
+
 #endif //_ACTIVE_PERMISSION_MAP_H_
@@ -1,4 +1,4 @@
-// Copyright (c) 2014-2018 LG Electronics, Inc.
+// Copyright (c) 2014-2021 LG Electronics, Inc.
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -50,6 +50,7 @@ void
 _LSTransportClientMapFree(_LSTransportClientMap *map)
 {
     g_hash_table_unref(map->map);
+    if (map->coalesce_map) g_hash_table_unref(map->coalesce_map);
 
 #ifdef MEMCHECK
     memset(map, 0xFF, sizeof(_LSTransportClientMap));
@@ -65,10 +66,24 @@ _LSTransportClientMapFree(_LSTransportClientMap *map)
  *
  * @param  map      IN  map
  * @param  client   IN  client
+ * @param  coalesce IN  true if the client wants only the latest undelivered
+ *                      instance of a signal queued
  ********************************************************************************/
 void
-_LSTransportClientMapAddRefClient(_LSTransportClientMap *map, _LSTransportClient *client)
+_LSTransportClientMapAddRefClient(_LSTransportClientMap *map, _LSTransportClient *client, bool coalesce)
 {
+    if (coalesce)
+    {
+        if (!map->coalesce_map)
+        {
+            map->coalesce_map = g_hash_table_new(g_direct_hash, g_direct_equal);
+        }
+
+        /* the client itself is held by the ref in map->map */
+        gint coalesce_refs = GPOINTER_TO_INT(g_hash_table_lookup(map->coalesce_map, client));
+        g_hash_table_replace(map->coalesce_map, client, GINT_TO_POINTER(coalesce_refs + 1));
+    }
+
     gpointer value = g_hash_table_lookup(map->map, client);
 
     if (value == NULL)
@@ -93,17 +108,32 @@ _LSTransportClientMapAddRefClient(_LSTransportClientMap *map, _LSTransportClient
  *
  * @param  map      IN  map
  * @param  client   IN  client
+ * @param  coalesce IN  as passed to @ref _LSTransportClientMapAddRefClient
  *
  * @retval  true if client was found in map
  * @retval  false if client was not found in map
  ********************************************************************************/
 bool
-_LSTransportClientMapUnrefClient(_LSTransportClientMap *map, _LSTransportClient *client)
+_LSTransportClientMapUnrefClient(_LSTransportClientMap *map, _LSTransportClient *client, bool coalesce)
 {
     gpointer value = g_hash_table_lookup(map->map, client);
 
     if (value)
     {
+        if (coalesce && map->coalesce_map)
+        {
+            gint coalesce_refs = GPOINTER_TO_INT(g_hash_table_lookup(map->coalesce_map, client)) - 1;
+
+            if (coalesce_refs > 0)
+            {
+                g_hash_table_replace(map->coalesce_map, client, GINT_TO_POINTER(coalesce_refs));
+            }
+            else
+            {
+                g_hash_table_remove(map->coalesce_map, client);
+            }
+        }
+
         gint new_value = GPOINTER_TO_INT(value) - 1;
 
         if (new_value == 0)
@@ -138,6 +168,7 @@ _LSTransportClientMapRemove(_LSTransportClientMap *map, _LSTransportClient *clie
 
     if (value)
     {
+        if (map->coalesce_map) g_hash_table_remove(map->coalesce_map, client);
         g_hash_table_remove(map->map, client);
         _LSTransportClientUnref(client);
         return true;
@@ -168,16 +199,32 @@ _LSTransportClientMapIsEmpty(_LSTransportClientMap *map)
 
 /**
  ********************************************************************************
- * @brief Call the specified function for each item in the map.
+ * @brief Check whether any registration of the client in the map asked for
+ * latest-value delivery.
  *
  * @param  map      IN  map
- * @param  func     IN  callback
- * @param  message  IN  message to pass as data to callback
+ * @param  client   IN  client
+ *
+ * @retval  true if only the latest undelivered signal should be queued
+ ********************************************************************************/
+bool
+_LSTransportClientMapIsCoalesced(_LSTransportClientMap *map, _LSTransportClient *client)
+{
+    return map->coalesce_map && g_hash_table_contains(map->coalesce_map, client);
+}
+
+/**
+ ********************************************************************************
+ * @brief Call the specified function for each item in the map.
+ *
+ * @param  map          IN  map
+ * @param  func         IN  callback
+ * @param  user_data    IN  data to pass to callback
  ********************************************************************************/
 void
-_LSTransportClientMapForEach(_LSTransportClientMap *map, GHFunc func, _LSTransportMessage *message)
+_LSTransportClientMapForEach(_LSTransportClientMap *map, GHFunc func, gpointer user_data)
 {
-    g_hash_table_foreach(map->map, func, message);
+    g_hash_table_foreach(map->map, func, user_data);
 }
 
 /// @} END OF GROUP LunaServiceHub
@@ -1,4 +1,4 @@
-// Copyright (c) 2014-2018 LG Electronics, Inc.
+// Copyright (c) 2014-2021 LG Electronics, Inc.
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -32,6 +32,8 @@ typedef struct LSTransportMessage _LSTransportMessage;
 /// @brief Map of transport clients
 typedef struct _LSTransportClientMap {
     GHashTable *map;
+    GHashTable *coalesce_map;   /**< clients with latest-value registrations to their
+                                     ref count (NULL until there is one) */
 } _LSTransportClientMap;
 
 _LSTransportClientMap*
@@ -41,10 +43,10 @@ void
 _LSTransportClientMapFree(_LSTransportClientMap *map);
 
 void
-_LSTransportClientMapAddRefClient(_LSTransportClientMap *map, _LSTransportClient *client);
+_LSTransportClientMapAddRefClient(_LSTransportClientMap *map, _LSTransportClient *client, bool coalesce);
 
 bool
-_LSTransportClientMapUnrefClient(_LSTransportClientMap *map, _LSTransportClient *client);
+_LSTransportClientMapUnrefClient(_LSTransportClientMap *map, _LSTransportClient *client, bool coalesce);
 
 bool
 _LSTransportClientMapRemove(_LSTransportClientMap *map, _LSTransportClient *client);
@@ -52,8 +54,11 @@ _LSTransportClientMapRemove(_LSTransportClientMap *map, _LSTransportClient *clie
 bool
 _LSTransportClientMapIsEmpty(_LSTransportClientMap *map);
 
+bool
+_LSTransportClientMapIsCoalesced(_LSTransportClientMap *map, _LSTransportClient *client);
+
 void
-_LSTransportClientMapForEach(_LSTransportClientMap *map, GHFunc func, _LSTransportMessage *message);
+_LSTransportClientMapForEach(_LSTransportClientMap *map, GHFunc func, gpointer user_data);
 
 /// @} END OF GROUP LunaServiceHub
 /// @endcond
@@ -39,8 +39,10 @@
 #include "hub.hpp"
 #include "conf.hpp"
 #include "security.hpp"
+#include "security_cache.hpp"
 #include "watchdog.hpp"
 #include "file_parser.hpp"
+#include "transport.h"
 #include "transport_utils.h"
 
 #define PIPE_READ_END   0
@@ -112,6 +114,10 @@ _ConfigKeyProcessDynamicServiceExecPrefix(char *value, const char **conf_var, LS
 static bool
 _ConfigKeyProcessWatchdogFailureMode(char *mode_str, LSHubWatchdogFailureMode *conf_var, LSError *lserror);
 static bool
+_ConfigKeySetQueueSize(const int *value, unsigned long *conf_var, LSError *lserror);
+static bool
+_ConfigKeyProcessQueuePolicy(char *policy_str, _LSTransportQueuePolicy *conf_var, LSError *lserror);
+static bool
 _ConfigParseFile(const char *path, const _ConfigDOM *dom, LSError *lserror);
 
 static bool ProcessVolatileDirectories(const char **dirs, void* ctx, LSError *lserror);
@@ -135,6 +141,13 @@ void _ConfigFreeSettings(void);
  * ExecPrefix=/path/to/some/bin
  * LaunchTimeout=time_ms
  *
+ * [Queues]
+ * OutgoingHighWaterBytes=bytes (0 - unlimited)
+ * OutgoingHighWaterMessages=number (0 - unlimited)
+ * OutgoingPolicy=drop-signals (or disconnect or push-back)
+ * IncomingHighWaterBytes=bytes (0 - unlimited)
+ * IncomingHighWaterMessages=number (0 - unlimited)
+ *
  * [Security]
  * Enabled=bool
  * ContainersDirectories=/path/to/containers/dir;/another/path/to/some/dir
@@ -142,6 +155,8 @@ void _ConfigFreeSettings(void);
  * ManifestsVolatileDirectories=/path/to/volatile/manifests/dir
  * GroupsDeclaration=/path/to/groups.json
  * JsServiceExePath=js
+ * CacheFile=/path/to/security.cache
+ * ParserThreads=number (0 - one per CPU)
  * AllowNullOutboundByDefault=bool
  */
 static _ConfigDOM _ConfigCreateDOM(SecurityData *security_data)
@@ -208,6 +223,42 @@ static _ConfigDOM _ConfigCreateDOM(SecurityData *security_data)
                     { NULL }
                 }
             },
+            {
+                .group_name = "Queues",
+                .keys = {
+                    {
+                        .key = "OutgoingHighWaterBytes",
+                        .get_value = _ConfigKeyGetInt,
+                        .user_cb = (_ConfigKeyUser*)_ConfigKeySetQueueSize,
+                        .user_ctxt = &_ls_outgoing_hwm_bytes,
+                    },
+                    {
+                        .key = "OutgoingHighWaterMessages",
+                        .get_value = _ConfigKeyGetInt,
+                        .user_cb = (_ConfigKeyUser*)_ConfigKeySetQueueSize,
+                        .user_ctxt = &_ls_outgoing_hwm_messages,
+                    },
+                    {
+                        .key = "OutgoingPolicy",
+                        .get_value = _ConfigKeyGetString,
+                        .user_cb = (_ConfigKeyUser*)_ConfigKeyProcessQueuePolicy,
+                        .user_ctxt = &_ls_outgoing_hwm_policy,
+                    },
+                    {
+                        .key = "IncomingHighWaterBytes",
+                        .get_value = _ConfigKeyGetInt,
+                        .user_cb = (_ConfigKeyUser*)_ConfigKeySetQueueSize,
+                        .user_ctxt = &_ls_incoming_hwm_bytes,
+                    },
+                    {
+                        .key = "IncomingHighWaterMessages",
+                        .get_value = _ConfigKeyGetInt,
+                        .user_cb = (_ConfigKeyUser*)_ConfigKeySetQueueSize,
+                        .user_ctxt = &_ls_incoming_hwm_messages,
+                    },
+                    { NULL }
+                }
+            },
             {
                 .group_name = "Security",
                 .keys = {
@@ -229,6 +280,18 @@ static _ConfigDOM _ConfigCreateDOM(SecurityData *security_data)
                         .user_cb = (_ConfigKeyUser*) _ConfigKeySetString,
                         .user_ctxt = &g_conf_triton_service_exe_path,
                     },
+                    {
+                        .key = "CacheFile",
+                        .get_value = _ConfigKeyGetString,
+                        .user_cb = (_ConfigKeyUser*) _ConfigKeySetString,
+                        .user_ctxt = &g_conf_security_cache_file,
+                    },
+                    {
+                        .key = "ParserThreads",
+                        .get_value = _ConfigKeyGetInt,
+                        .user_cb = (_ConfigKeyUser*)_ConfigKeySetInt,
+                        .user_ctxt = &g_conf_security_parser_threads,
+                    },
                     {
                         .key = "AllowNullOutboundByDefault",
                         .get_value = _ConfigKeyGetBool,
@@ -296,6 +359,8 @@ bool g_conf_allow_null_outbound_by_default = false; /**< whether to allow connec
 char *g_conf_pid_dir = NULL;                    /**< PID file directory */
 char *g_conf_devmode_certificate = NULL;        /**< path to devmode_certificate.json */
 char *g_conf_default_devmode_certificate = NULL;  /**< path to default devmode_certificate.json */
+char *g_conf_security_cache_file = NULL;        /**< path to the cache of parsed manifests */
+int g_conf_security_parser_threads = 0;         /**< number of threads parsing manifests, 0 - one per CPU */
 
 /* static -- local to this file */
 static char *config_file_path = NULL;                /**< full path to config file */
@@ -308,7 +373,11 @@ namespace
     enum class ParseTask {idle, parse, quit};
     std::atomic<ParseTask> config_parser_state(ParseTask::idle);
 
+    std::mutex config_parse_mutex;
     std::condition_variable config_parse_condition;
+
+    /// Security data replaced by the mainloop, to be released by the parser thread
+    std::vector<std::unique_ptr<SecurityData>> config_retired_security_data;
 }
 
 #ifdef HAVE_SYS_INOTIFY_H
@@ -806,6 +875,11 @@ _ConfigFreeSettings(void)
     {
         g_free(g_conf_default_devmode_certificate), g_conf_default_devmode_certificate = nullptr;
     }
+
+    if (g_conf_security_cache_file)
+    {
+        g_free(g_conf_security_cache_file), g_conf_security_cache_file = nullptr;
+    }
 }
 
 static bool
@@ -848,6 +922,64 @@ _ConfigKeyProcessWatchdogFailureMode(char *mode_str, LSHubWatchdogFailureMode *c
     return true;
 }
 
+/**
+ *******************************************************************************
+ * @brief Set a queue high-water mark.
+ *
+ * @param  value        IN  value from the config file
+ * @param  conf_var     OUT high-water mark, 0 - unlimited
+ * @param  lserror      OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false if @p value is negative
+ *******************************************************************************
+ */
+static bool
+_ConfigKeySetQueueSize(const int *value, unsigned long *conf_var, LSError *lserror)
+{
+    LS_ASSERT(value != NULL);
+    LS_ASSERT(conf_var != NULL);
+
+    if (*value < 0)
+    {
+        _LSErrorSet(lserror, MSGID_LSHUB_KEYFILE_ERR, -1, "Negative queue high-water mark: %d", *value);
+        return false;
+    }
+
+    *conf_var = *value;
+    return true;
+}
+
+/**
+ *******************************************************************************
+ * @brief Process the outgoing queue policy string.
+ *
+ * @param  policy_str   IN  policy string
+ * @param  conf_var     OUT policy
+ * @param  lserror      OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false if the policy is unknown
+ *******************************************************************************
+ */
+static bool
+_ConfigKeyProcessQueuePolicy(char *policy_str, _LSTransportQueuePolicy *conf_var, LSError *lserror)
+{
+    LS_ASSERT(policy_str != NULL);
+    LS_ASSERT(conf_var != NULL);
+
+    bool ret = _LSTransportQueuePolicyFromString(policy_str, conf_var);
+    if (!ret)
+    {
+        _LSErrorSet(lserror, MSGID_LSHUB_KEYFILE_ERR, -1, "Unknown outgoing queue policy: \"%s\"", policy_str);
+    }
+
+    /* we don't need to save the string */
+    g_free(policy_str);
+
+    return ret;
+}
+
 /**
  *******************************************************************************
  * @brief Parse the keys in a "keyfile", calling the user callback as
@@ -977,14 +1109,18 @@ _ConfigUpdateSecuritySettings()
         for (const auto &cur_dir : sec_data->GetNonVolatileDirs())
             ProcessDirectory(cur_dir.c_str(), &collector, lserror.get());
 
+        std::unique_ptr<SecurityCache> cache;
+        if (g_conf_security_cache_file && g_conf_security_cache_file[0])
+            cache.reset(new SecurityCache(g_conf_security_cache_file));
+
         // add manifests from non volatile partition
-        for (const auto &f : collector.Files())
+        sec_data->AddManifests(collector.Files(), std::string(), cache.get(),
+                               g_conf_security_parser_threads > 0 ? g_conf_security_parser_threads : 0);
+
+        LS::Error cache_error;
+        if (cache && !cache->Save(cache_error.get()))
         {
-            LS::Error lserror;
-            if (!sec_data->AddManifest(f, std::string(), lserror))
-            {
-                LOG_LSERROR(MSGID_LSHUB_MANIFEST_FILE_ERROR, lserror);
-            }
+            LOG_LSERROR(MSGID_LSHUB_SECURITY_CACHE_ERR, cache_error.get());
         }
 
         // add manifests from volatile directories
@@ -1011,20 +1147,32 @@ ConfigGetParserThread()
         int res = pthread_sigmask(SIG_BLOCK, &set, NULL);
         LS_ASSERT(res == 0);
 
-        std::mutex mut;
-        std::unique_lock<std::mutex> lock(mut);
+        std::unique_lock<std::mutex> lock(config_parse_mutex);
         while (true)
         {
-            while (config_parser_state == ParseTask::idle)
+            while (config_parser_state == ParseTask::idle && config_retired_security_data.empty())
             {
                 config_parse_condition.wait(lock);
             }
 
+            if (!config_retired_security_data.empty())
+            {
+                std::vector<std::unique_ptr<SecurityData>> retired;
+                retired.swap(config_retired_security_data);
+
+                lock.unlock();
+                retired.clear();
+                lock.lock();
+                continue;
+            }
+
             if (config_parser_state == ParseTask::quit) break;
 
             config_parser_state = ParseTask::idle;
 
+            lock.unlock();
             _ConfigUpdateSecuritySettings();
+            lock.lock();
         }
     });
 
@@ -1043,7 +1191,10 @@ ConfigUpdateSecurity(bool async)
 
     if (async)
     {
-        config_parser_state = ParseTask::parse;
+        {
+            std::lock_guard<std::mutex> lock(config_parse_mutex);
+            config_parser_state = ParseTask::parse;
+        }
         config_parse_condition.notify_all();
     }
     else
@@ -1052,10 +1203,31 @@ ConfigUpdateSecurity(bool async)
     }
 }
 
+/**
+ *******************************************************************************
+ * @brief Release security data, which isn't in use any more, on the parser
+ * thread.
+ *
+ * @param  security_data  IN  replaced security data
+ *******************************************************************************
+ */
+void
+ConfigRetireSecurityData(std::unique_ptr<SecurityData> security_data)
+{
+    {
+        std::lock_guard<std::mutex> lock(config_parse_mutex);
+        config_retired_security_data.push_back(std::move(security_data));
+    }
+    config_parse_condition.notify_all();
+}
+
 static void
 _ConfigExitParserThread()
 {
-    config_parser_state = ParseTask::quit;
+    {
+        std::lock_guard<std::mutex> lock(config_parse_mutex);
+        config_parser_state = ParseTask::quit;
+    }
     config_parse_condition.notify_all();
 }
 
@@ -20,6 +20,7 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#include <memory>
 #include <thread>
 
 #include "watchdog.hpp"
@@ -31,9 +32,12 @@
 struct LSError;
 typedef struct LSError LSError;
 
+class SecurityData;
+
 void ConfigSetFilePath(const char *path);
 std::thread &ConfigGetParserThread();
 void ConfigUpdateSecurity(bool async);
+void ConfigRetireSecurityData(std::unique_ptr<SecurityData> security_data);
 bool ConfigSetupInotify(LSError *lserror);
 void ConfigSetDefaults(void);
 void ConfigCleanup();
@@ -51,6 +55,8 @@ extern bool g_conf_allow_null_outbound_by_default;
 extern char *g_conf_pid_dir;
 extern char *g_conf_devmode_certificate;
 extern char *g_conf_default_devmode_certificate;
+extern char *g_conf_security_cache_file;
+extern int g_conf_security_parser_threads;
 
 #ifdef SECURITY_COMPATIBILITY
 
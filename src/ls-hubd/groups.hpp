@@ -31,7 +31,7 @@ typedef GSList _LSHubTrustLevels;
 // struct representing groups
 struct LSHubGroups {
     int ref;                    // ref count
-    char **groups_name;         // names of groups provided
+    char **groups_name;         // names of groups provided, NULL terminated
     int num_groups;             // number of groups
     bool access;                // public true or false
     TrustMap trustLevel;
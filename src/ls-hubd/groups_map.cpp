@@ -17,7 +17,9 @@
 #include "groups_map.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <sstream>
+#include <unordered_map>
 
 #include "error.h"
 
@@ -61,9 +63,55 @@ bool GroupsMap::Data::IsEmpty() const
            // provided_terminal.empty();
 }
 
+/// @brief Get bit number of a group in GroupsBitset
+///
+/// Bit sets are built in the hub main loop only.
+///
+/// @param[in] group Interned group name
+/// @return Bit number, assigned on first request
+static size_t
+GroupBit(const char *group)
+{
+    static std::unordered_map<const char *, size_t> bits;
+
+    auto it = bits.emplace(group, bits.size()).first;
+    return it->second;
+}
+
+GroupsBitset::GroupsBitset(const Groups &groups)
+{
+    for (const char *group : groups)
+    {
+        size_t bit = GroupBit(group);
+        if (_words.size() <= bit / 64)
+            _words.resize(bit / 64 + 1);
+        _words[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+}
+
+bool GroupsBitset::Intersects(const GroupsBitset &other) const
+{
+    size_t size = std::min(_words.size(), other._words.size());
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (_words[i] & other._words[i])
+            return true;
+    }
+    return false;
+}
+
 GroupsMap::GroupsMap()
-    : _groups(Trie<Data>::PtrT(new Trie<Data>))
+    : _groups(RadixTrie<Data>::PtrT(new RadixTrie<Data>))
 {
+    Touch();
+}
+
+void GroupsMap::Touch()
+{
+    // Maps are filled in a worker thread while the hub uses the current one
+    static std::atomic<uint64_t> generations{0};
+
+    _generation = ++generations;
 }
 
 void GroupsMap::AddProvidedTrustLevel(const char *service_name, const TrustMap &map) {
@@ -103,7 +151,7 @@ void GroupsMap::RemoveProvidedTrustLevel(const char *service_name,
     LS_ASSERT(service_name != nullptr);
     LS_ASSERT(group != nullptr);
     LS_ASSERT(trust != nullptr);
-    auto *node = _groups->Get(service_name);
+    const auto *node = _groups->Find(service_name);
     if (!node)
     {
         LOG_LS_DEBUG("ERRR %s : service_name [ %s ] not found in trie tree",__func__, service_name);
@@ -170,7 +218,7 @@ void GroupsMap::RemoveRequiredTrustLevel(const char *service_name,
     LS_ASSERT(service_name != nullptr);
     LS_ASSERT(group != nullptr);
     LS_ASSERT(trust != nullptr);
-    auto *node = _groups->Get(service_name);
+    const auto *node = _groups->Find(service_name);
     if (!node)
     {
         LOG_LS_DEBUG("ERRR %s : service_name [ %s ] not found in trie tree",__func__, service_name);
@@ -207,6 +255,8 @@ void GroupsMap::AddProvided(const char *service_name, const char *category_name,
     const char *category_pattern = category_only ? category_only : "/";
     auto& container = is_pattern(service_name) ? node->provided_pattern : node->provided_terminal;
     container[category_pattern].push_back(g_intern_string(group_name));
+
+    Touch();
 }
 
 /// @brief Remove provided ACG from the security data
@@ -234,6 +284,8 @@ void GroupsMap::RemoveProvided(const char *service_name, const char *category_na
     };
 
     _groups->Remove(service_name, action);
+
+    Touch();
 }
 
 /// @brief Add group name to the set of required
@@ -249,6 +301,8 @@ void GroupsMap::AddRequired(const char *service_name, const char *group_name)
 
     auto &container = is_pattern(service_name) ? node->required_pattern : node->required_terminal;
     container.push_back(g_intern_string(group_name));
+
+    Touch();
 }
 
 /// @brief Remove group name from the set of required
@@ -270,6 +324,8 @@ void GroupsMap::RemoveRequired(const char *service_name, const char *group_name)
     };
 
     _groups->Remove(service_name, action);
+
+    Touch();
 }
 
 /// @brief Get set of required trusts for a service
@@ -18,9 +18,11 @@
 #define _GROUPS_MAP_HPP_
 
 #include <memory>
+#include <vector>
+#include <cstdint>
 
 #include "permission.hpp"
-#include "trie.hpp"
+#include "radix_trie.hpp"
 
 /// @cond INTERNAL
 /// @addtogroup LunaServiceHubSecurity
@@ -34,11 +36,32 @@
 
 #endif //SECURITY_COMPATIBILITY
 
+/// Set of groups as a bit set
+///
+/// Every interned group name gets its own bit the first time it's seen,
+/// thus intersection of two sets is a word-wise AND.
+class GroupsBitset
+{
+public:
+    GroupsBitset() = default;
+    explicit GroupsBitset(const Groups &groups);
+
+    bool Empty() const { return _words.empty(); }
+    bool Intersects(const GroupsBitset &other) const;
+
+private:
+    std::vector<uint64_t> _words;
+};
+
 class GroupsMap
 {
 public:
     GroupsMap();
 
+    /// Generation of the map contents, changes with every modification of
+    /// provided or required groups. Different maps never share a generation.
+    uint64_t Generation() const { return _generation; }
+
     void AddProvided(const char *service_name, const char *category_name, const char *group_name);
     void RemoveProvided(const char *service_name, const char *category_name, const char *group_name);
 
@@ -92,7 +115,10 @@ private:
         bool IsEmpty() const;
     };
 
-    Trie<Data>::PtrT _groups;
+    RadixTrie<Data>::PtrT _groups;
+    uint64_t _generation;
+
+    void Touch();
 };
 
 /// @} END OF GROUP LunaServiceHubSecurity
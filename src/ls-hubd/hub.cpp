@@ -16,6 +16,7 @@
 
 #include "hub.hpp"
 #include <string>
+#include <vector>
 #include <sstream>
 #include <cinttypes>
 #include <cstring>
@@ -43,6 +44,7 @@
 #include "service_permissions.hpp"
 #include "permissions_map.hpp"
 #include "timersource.h"
+#include "transport_monitor_filter.h"
 #include "client_id.hpp"
 #include "client_map.hpp"
 #include "signal_map.hpp"
@@ -83,7 +85,6 @@ void DumpToFile(std::ostream& out, Arg&& arg, Args&&... args)
 /** hub pid file */
 #define HUB_LOCK_FILENAME        "ls-hubd.pid"
 
-#define MESSAGE_TIMEOUT_GRANULARITY_MS 100  /**< glib timer granularity for message timeouts */
 
 /** log context names. last two are configured in /etc/pmlog.d/ls-hub.conf */
 #define HUB_LOG_CONTEXT          "ls-hubd"
@@ -128,9 +129,14 @@ static GSList *waiting_for_service = NULL;      /**< list of messages waiting fo
  */
 static GHashTable *dynamic_service_states = NULL;
 
+static std::string monitor_filter;              /**< messages the monitor wants, empty for all */
+static bool monitor_trace = false;              /**< the monitor reads the trace rings of the
+                                                     clients that can trace */
+
 /************************************************************************/
 static bool _LSHubRemoveClientSignals(_LSTransportClient *client);
-static void _LSHubSendSignal(_LSTransportClient *client, void *dummy, _LSTransportMessage *message);
+struct _LSHubSignalFanOut;
+static void _LSHubSendSignal(_LSTransportClient *client, void *dummy, _LSHubSignalFanOut *fan_out);
 static void _LSHubHandleSignal(_LSTransportMessage *message, bool generated_by_hub);
 static void _LSHubSignalRegisterAllServicesItem(gpointer key, gpointer value, gpointer user_data);
 static gchar * _LSHubSignalRegisterAllServices(GHashTable *table);
@@ -805,9 +811,17 @@ _LSHubHandleDisconnect(_LSTransportClient *client, _LSTransportDisconnectType ty
     if (id->is_monitor)
     {
         LOG_LS_DEBUG("%s: monitor disconnected\n", __func__);
-        id->is_monitor = false;
         _LSHubClientIdLocalUnref(monitor);
         monitor = NULL;
+        monitor_filter.clear();
+
+        if (monitor_trace)
+        {
+            /* the tracing clients aren't connected to the monitor to see it go */
+            g_hash_table_foreach(connected_clients.by_fd, (GHFunc)_LSHubSendMonitorMessage, NULL);
+            monitor_trace = false;
+        }
+        id->is_monitor = false;
     }
 
     /* remove from connected list */
@@ -1083,6 +1097,14 @@ _LSHubHandleRequestName(_LSTransportMessage *message)
     _LSTransportMessageIterNext(&iter);
     _LSTransportMessageGetString(&iter, &app_id);
 
+    /* the features it has, known before the monitor status is sent (older clients don't say) */
+    int32_t features = 0;
+    _LSTransportMessageIterNext(&iter);
+    if (_LSTransportMessageGetInt32(&iter, &features))
+    {
+        client->features = features;
+    }
+
     LOG_LS_DEBUG("%s: service_name: \"%s\" app_id: \"%s\"\n", __func__, service_name, app_id);
 
     // If peer specified application Id do checking if it is an application container
@@ -1480,6 +1502,71 @@ _LSHubSendQueryProxyNameReplyMessage(_LSTransportClient *client, const _LSTransp
     return false;
 }
 
+/**
+ *******************************************************************************
+ * @brief Append the fields of a reply to a "QueryName" message, shared by
+ * "QueryNameReply" and the entries of "QueryNameBatchReply".
+ *
+ * @retval  true on success
+ * @retval  false on OOM
+ *******************************************************************************
+ */
+static bool
+_LSHubAppendQueryNameReply(_LSTransportMessageIter *iter, _LSTransportClient *client,
+                           const _LSTransportClient *source_client, long err_code,
+                           const char *service_name, const char *unique_name, const char *app_id,
+                           bool is_dynamic, int fd, _LSTransportClientPermissions client_permissions)
+{
+    if (!_LSTransportMessageAppendInt32(iter, err_code) ||
+        !_LSTransportMessageAppendString(iter, service_name) ||
+        !_LSTransportMessageAppendString(iter, unique_name) ||
+        !_LSTransportMessageAppendInt32(iter, is_dynamic))
+    {
+        return false;
+    }
+
+    std::string groups = source_client ? _LSHubGetRequiredGroups(source_client) : "";
+    std::string trusts = source_client ? _LSHubGetRequiredTrusts(source_client) : "";
+
+    const char *exe_path = NULL;
+
+    if ((err_code == LS_TRANSPORT_QUERY_NAME_SUCCESS) &&
+        (LSHubClientGetPrivileged(client) || LSHubClientGetProxy(client))) {
+        exe_path = _LSTransportCredGetExePath(_LSTransportClientGetCred(source_client));
+    }
+
+    //TBD: Below line is crashing :(
+    //std::string required_trust_as_string = source_client ? _LSHubGetRequiredTrustLevelAsString(source_client) : std::string("dev");
+
+    LOG_LS_DEBUG("%s : trusts : %s", __func__, trusts.c_str());
+    //LOG_LS_DEBUG("%s : required_trust_as_string : %s", __func__, required_trust_as_string.c_str());
+    // TBD: We need  to add trust level here the client has
+    if (err_code == LS_TRANSPORT_QUERY_NAME_SUCCESS &&
+        (!_LSTransportMessageAppendString(iter, app_id) ||
+         !_LSTransportMessageAppendString(iter, groups.c_str()) ||
+         !_LSTransportMessageAppendInt32(iter, client_permissions) ||
+         !_LSTransportMessageAppendString(iter, trusts.c_str()) ||
+         !_LSTransportMessageAppendString(iter, trusts.c_str()) ||
+         !_LSTransportMessageAppendString(iter, exe_path) ||
+         !_LSTransportMessageAppendInt32(iter, _LSTransportClientGetFeatures(source_client))))
+    {
+        return false;
+    }
+
+    if (err_code != LS_TRANSPORT_QUERY_NAME_SUCCESS)
+    {
+         LOG_LS_WARNING(MSGID_LSHUB_NO_SERVICE, 0, "%s: Failed Connecting to Service err_code: %ld, service_name: \"%s\", unique_name: \"%s\", %s, fd %d\n",
+                        __func__, err_code, service_name, unique_name,
+                        is_dynamic ? "dynamic" : "static", fd);
+    }
+
+    LOG_LS_DEBUG("%s: err_code: %ld, service_name: \"%s\", unique_name: \"%s\", %s, fd %d, groups: \"%s\", exe_path: \"%s\"\n",
+                 __func__, err_code, service_name, unique_name,
+                 is_dynamic ? "dynamic" : "static", fd, groups.c_str(), exe_path);
+
+    return true;
+}
+
 static bool
 _LSHubSendQueryNameReplyMessage(_LSTransportClient *client, const _LSTransportClient *source_client,
                                 bool is_public_bus, long err_code, const char *service_name,
@@ -1500,70 +1587,187 @@ _LSHubSendQueryNameReplyMessage(_LSTransportClient *client, const _LSTransportCl
         _LSTransportMessageIter iter;
         _LSTransportMessageIterInit(reply_message, &iter);
 
-        if (!_LSTransportMessageAppendInt32(&iter, err_code) ||
-            !_LSTransportMessageAppendString(&iter, service_name) ||
-            !_LSTransportMessageAppendString(&iter, unique_name) ||
-            !_LSTransportMessageAppendInt32(&iter, is_dynamic))
+        if (!_LSHubAppendQueryNameReply(&iter, client, source_client, err_code, service_name,
+                                        unique_name, app_id, is_dynamic, fd, client_permissions) ||
+            (err_code == LS_TRANSPORT_QUERY_NAME_SUCCESS && !_LSTransportMessageAppendInvalid(&iter)))
         {
             _LSErrorSetOOM(lserror);
             break;
         }
 
-        std::string groups = source_client ? _LSHubGetRequiredGroups(source_client) : "";
-        std::string trusts = source_client ? _LSHubGetRequiredTrusts(source_client) : "";
-
-        const char *exe_path = NULL;
+        // Set the connection fd on the message (-1 on error)
+        _LSTransportMessageSetFd(reply_message, fd);
 
-        if ((err_code == LS_TRANSPORT_QUERY_NAME_SUCCESS) &&
-            (LSHubClientGetPrivileged(client) || LSHubClientGetProxy(client))) {
-            exe_path = _LSTransportCredGetExePath(_LSTransportClientGetCred(source_client));
+        if (!_LSTransportSendMessage(reply_message, client, NULL, lserror))
+        {
+            break;
         }
 
-        //TBD: Below line is crashing :(
-        //std::string required_trust_as_string = source_client ? _LSHubGetRequiredTrustLevelAsString(source_client) : std::string("dev");
+        _LSTransportMessageUnref(reply_message);
+        return true;
 
-        LOG_LS_DEBUG("%s : trusts : %s", __func__, trusts.c_str());
-        //LOG_LS_DEBUG("%s : required_trust_as_string : %s", __func__, required_trust_as_string.c_str());
-        // TBD: We need  to add trust level here the client has
-        if (err_code == LS_TRANSPORT_QUERY_NAME_SUCCESS &&
-            (!_LSTransportMessageAppendString(&iter, app_id) ||
-             !_LSTransportMessageAppendString(&iter, groups.c_str()) ||
-             !_LSTransportMessageAppendInt32(&iter, client_permissions) ||
-             !_LSTransportMessageAppendString(&iter, trusts.c_str()) ||
-             !_LSTransportMessageAppendString(&iter, trusts.c_str()) ||
-             !_LSTransportMessageAppendString(&iter, exe_path) ||
-             !_LSTransportMessageAppendInvalid(&iter)))
-        {
-            _LSErrorSetOOM(lserror);
+    } while (false);
+
+    if (reply_message) _LSTransportMessageUnref(reply_message);
+    return false;
+}
+
+/** Replies to a "QueryNameBatch" message that could be answered right away */
+typedef struct _QueryNameBatch {
+    _LSTransportClient *client;     /**< client that sent the batch */
+    bool is_public_bus;
+    _LSTransportMessage *entries;   /**< entries being collected with their fds, NULL if none */
+    _LSTransportMessageIter iter;   /**< end of @ref entries */
+    std::vector<std::string> names; /**< service names of @ref entries */
+} _QueryNameBatch;
+
+/**
+ *******************************************************************************
+ * @brief Send the entries collected for a "QueryNameBatch" message.
+ *
+ * The reply starts with the number of fds and entries and the service names
+ * of the entries, which are only known now, so the entries are copied after
+ * them. The client can then fail the services of the entries it can't read.
+ *
+ * @param  batch    IN  batch
+ * @param  lserror  OUT set on error
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_LSHubFlushQueryNameBatch(_QueryNameBatch *batch, LSError *lserror)
+{
+    if (!batch->entries)
+        return true;
+
+    bool ret = false;
+    unsigned int fd_count = _LSTransportMessageGetFdCount(batch->entries);
+
+    _LSTransportMessage *reply = _LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE);
+    do
+    {
+        if (!reply || !_LSTransportMessageAppendInvalid(&batch->iter))
+            break;
+
+        reply->raw->header.is_public_bus = batch->is_public_bus;
+        _LSTransportMessageSetType(reply, _LSTransportMessageTypeQueryNameBatchReply);
+
+        _LSTransportMessageIter iter;
+        _LSTransportMessageIterInit(reply, &iter);
+
+        if (!_LSTransportMessageAppendInt32(&iter, fd_count) ||
+            !_LSTransportMessageAppendInt32(&iter, static_cast<int32_t>(batch->names.size())))
             break;
+
+        bool ok = true;
+        for (const auto &name : batch->names)
+        {
+            if (!(ok = _LSTransportMessageAppendString(&iter, name.c_str())))
+                break;
         }
 
-        if (err_code != LS_TRANSPORT_QUERY_NAME_SUCCESS)
+        _LSTransportMessageIter entry_iter;
+        _LSTransportMessageIterInit(batch->entries, &entry_iter);
+        for (; ok && _LSTransportMessageIterHasNext(&entry_iter); _LSTransportMessageIterNext(&entry_iter))
         {
-             LOG_LS_WARNING(MSGID_LSHUB_NO_SERVICE, 0, "%s: Failed Connecting to Service err_code: %ld, service_name: \"%s\", unique_name: \"%s\", %s, fd %d\n",
-                            __func__, err_code, service_name, unique_name,
-                            is_dynamic ? "dynamic" : "static", fd);
+            int32_t value;
+            const char *str;
+            if (_LSTransportMessageGetInt32(&entry_iter, &value))
+                ok = _LSTransportMessageAppendInt32(&iter, value);
+            else if (_LSTransportMessageGetString(&entry_iter, &str))
+                ok = _LSTransportMessageAppendString(&iter, str);
+            else
+                ok = false;
         }
 
-        LOG_LS_DEBUG("%s: err_code: %ld, service_name: \"%s\", unique_name: \"%s\", %s, fd %d, groups: \"%s\", exe_path: \"%s\"\n",
-                     __func__, err_code, service_name, unique_name,
-                     is_dynamic ? "dynamic" : "static", fd, groups.c_str(), exe_path);
+        if (!ok || !_LSTransportMessageAppendInvalid(&iter))
+            break;
 
-        // Set the connection fd on the message (-1 on error)
-        _LSTransportMessageSetFd(reply_message, fd);
+        for (unsigned int i = 0; i < fd_count; i++)
+        {
+            _LSTransportMessageAddFd(reply, _LSTransportMessageStealFd(batch->entries, i));
+        }
 
-        if (!_LSTransportSendMessage(reply_message, client, NULL, lserror))
+        ret = true;
+    } while (false);
+
+    if (ret)
+    {
+        ret = _LSTransportSendMessage(reply, batch->client, NULL, lserror);
+    }
+    else
+    {
+        _LSErrorSetOOM(lserror);
+    }
+
+    if (reply) _LSTransportMessageUnref(reply);
+    _LSTransportMessageUnref(batch->entries);
+    batch->entries = NULL;
+    batch->names.clear();
+    return ret;
+}
+
+/**
+ *******************************************************************************
+ * @brief Add the reply for one service to a "QueryNameBatchReply".
+ *
+ * The reply is sent as soon as it carries as many fds as the client accepts
+ * at once.
+ *
+ * @param  batch    IN  batch
+ * @param  fd       IN  connection fd for the client, owned by the batch now
+ *                      (-1 on error)
+ *
+ * @retval  true on success
+ * @retval  false on failure
+ *******************************************************************************
+ */
+static bool
+_LSHubAddQueryNameBatchReply(_QueryNameBatch *batch, const _LSTransportClient *source_client,
+                             long err_code, const char *service_name, const char *unique_name,
+                             const char *app_id, bool is_dynamic, int fd,
+                             _LSTransportClientPermissions client_permissions, LSError *lserror)
+{
+    if (!batch->entries)
+    {
+        batch->entries = _LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE);
+        if (!batch->entries)
         {
-            break;
+            if (fd != -1) close(fd);
+            _LSErrorSetOOM(lserror);
+            return false;
         }
 
-        _LSTransportMessageUnref(reply_message);
-        return true;
+        _LSTransportMessageIterInit(batch->entries, &batch->iter);
+    }
 
-    } while (false);
+    if (!_LSHubAppendQueryNameReply(&batch->iter, batch->client, source_client, err_code,
+                                    service_name, unique_name, app_id, is_dynamic, fd,
+                                    client_permissions))
+    {
+        if (fd != -1) close(fd);
+        _LSErrorSetOOM(lserror);
+        return false;
+    }
+    batch->names.push_back(service_name);
 
-    if (reply_message) _LSTransportMessageUnref(reply_message);
-    return false;
+    // Only successful entries carry a connection
+    if (err_code == LS_TRANSPORT_QUERY_NAME_SUCCESS)
+    {
+        _LSTransportMessageAddFd(batch->entries, fd);
+    }
+    else if (fd != -1)
+    {
+        close(fd);
+    }
+
+    if (_LSTransportMessageGetFdCount(batch->entries) == LS_TRANSPORT_QUERY_NAME_BATCH_MAX)
+    {
+        return _LSHubFlushQueryNameBatch(batch, lserror);
+    }
+    return true;
 }
 
 static bool
@@ -1641,6 +1845,8 @@ _LSHubSendQueryProxyNameReply(_ClientId *id, const char *origin_exe,
  * @param  is_dynamic    IN     true if the service is dynamic
  * @param  is_redirected IN     true if the client call the service by old service name
  * @param  lserror       OUT    set on error
+ * @param  batch         IN     batch to add the reply to the client to, NULL to
+ *                              send it right away
  *
  * @retval  true on success
  * @retval  false on failure
@@ -1650,7 +1856,8 @@ _LSHubSendQueryProxyNameReply(_ClientId *id, const char *origin_exe,
 static bool
 _LSHubSendQueryNameReply(_ClientId *id, const _LSTransportMessage *message, long err_code,
                          const char *service_name, const char *unique_name,
-                         bool is_dynamic, bool is_redirected, LSError *lserror)
+                         bool is_dynamic, bool is_redirected, LSError *lserror,
+                         _QueryNameBatch *batch = nullptr)
 {
     LS_ASSERT(message != NULL);
     LS_ASSERT(service_name != NULL);
@@ -1714,13 +1921,25 @@ _LSHubSendQueryNameReply(_ClientId *id, const _LSTransportMessage *message, long
         }
     }
 
-    if (!_LSHubSendQueryNameReplyMessage(client, id ? id->client : nullptr,
-                                         message->raw->header.is_public_bus,
-                                         err_code, service_name, unique_name,
-                                         id ? _LSTransportClientGetApplicationId(id->client) : nullptr,
-                                         is_dynamic, socket_vector[0],
-                                         allow_reverse_calls ? _LSClientAllowBoth : _LSClientAllowOutbound,
-                                         lserror))
+    if (batch)
+    {
+        if (!_LSHubAddQueryNameBatchReply(batch, id ? id->client : nullptr,
+                                          err_code, service_name, unique_name,
+                                          id ? _LSTransportClientGetApplicationId(id->client) : nullptr,
+                                          is_dynamic, socket_vector[0],
+                                          allow_reverse_calls ? _LSClientAllowBoth : _LSClientAllowOutbound,
+                                          lserror))
+        {
+            ret = false;
+        }
+    }
+    else if (!_LSHubSendQueryNameReplyMessage(client, id ? id->client : nullptr,
+                                              message->raw->header.is_public_bus,
+                                              err_code, service_name, unique_name,
+                                              id ? _LSTransportClientGetApplicationId(id->client) : nullptr,
+                                              is_dynamic, socket_vector[0],
+                                              allow_reverse_calls ? _LSClientAllowBoth : _LSClientAllowOutbound,
+                                              lserror))
     {
         ret = false;
     }
@@ -2102,10 +2321,9 @@ _LSHubAddMessageTimeout(_LSTransportMessage *message, int timeout_ms, GSourceFun
 {
     _LSTransportMessageRef(message);
 
-    GTimerSource *source = g_timer_source_new (timeout_ms, MESSAGE_TIMEOUT_GRANULARITY_MS);
-
-    g_source_set_callback ((GSource*)source, callback, message, NULL);
-    guint timeout_id = g_source_attach ((GSource*)source, NULL);
+    /* thousands of clients may wait for a service at once: keep their
+     * timeouts on the timer wheel instead of a source each */
+    guint timeout_id = _LSTimerWheelAdd(NULL, timeout_ms, callback, message, NULL);
 
     _LSTransportMessageSetTimeoutId(message, timeout_id);
 }
@@ -2120,13 +2338,12 @@ _LSHubAddMessageTimeout(_LSTransportMessage *message, int timeout_ms, GSourceFun
 static void
 _LSHubRemoveMessageTimeout(_LSTransportMessage *message)
 {
-    /* remove timeout source from mainloop */
-    GSource *timeout_source = g_main_context_find_source_by_id(NULL, _LSTransportMessageGetTimeoutId(message));
+    /* remove timeout from the timer wheel */
+    guint timeout_id = _LSTransportMessageGetTimeoutId(message);
 
-    if (timeout_source)
+    if (timeout_id)
     {
-        g_source_destroy(timeout_source);
-        g_source_unref(timeout_source);
+        _LSTimerWheelRemove(timeout_id);
     }
 
     /* clear timeout id */
@@ -2154,12 +2371,16 @@ _LSHubAddQueryNameMessageTimeout(_LSTransportMessage *message)
  *******************************************************************************
  * @brief Cleanup outgoing queue from messages with invalid (closed) sockets.
  *
- * @param queue outgoing queue
+ * @param outgoing outgoing queue
  *******************************************************************************
  */
 static void
-_LSHubCleanupOutgoingQueue(GQueue *queue)
+_LSHubCleanupOutgoingQueue(_LSTransportOutgoing *outgoing)
 {
+    OUTGOING_LOCK(&outgoing->lock);
+    _LSTransportOutgoingCollect(outgoing);
+
+    GQueue *queue = outgoing->queue;
     int len = g_queue_get_length(queue);
     while (--len >= 0)
     {
@@ -2174,12 +2395,15 @@ _LSHubCleanupOutgoingQueue(GQueue *queue)
             // side has closed the socket).
             if (write(fd, NULL, 0) == -1 && EPIPE == errno)
             {
+                _LSTransportOutgoingUnaccount(outgoing, message);
                 _LSTransportMessageFree(message);
                 continue;
             }
         }
         g_queue_push_tail(queue, message);
     }
+
+    OUTGOING_UNLOCK(&outgoing->lock);
 }
 
 static void
@@ -2280,10 +2504,8 @@ _LSHubHandleQueryProxyName(_LSTransportMessage *message) {
     // socket buffer is full, and service is freezing for a long period of time.
     // To increase chances for new clients to connect, we may cleanup an outgoing
     // queue from messages with invalid socket fds.
-    if (dest_client &&
-        dest_client->outgoing->queue &&
-        !g_queue_is_empty(dest_client->outgoing->queue)) {
-        _LSHubCleanupOutgoingQueue(dest_client->outgoing->queue);
+    if (dest_client) {
+        _LSHubCleanupOutgoingQueue(dest_client->outgoing);
     }
 
     // We know the service exists, so now we check to see if we have
@@ -2393,13 +2615,16 @@ _LSHubHandleQueryProxyName(_LSTransportMessage *message) {
 
 /**
  *******************************************************************************
- * @brief Process a "QueryName" message.
+ * @brief Look up the service of a "QueryName" message and reply to it.
  *
  * @param  message  IN  query name message
+ * @param  batch    IN  batch to add the reply to, NULL to send it right away;
+ *                      a service that isn't up yet is always answered later
+ *                      with a single "QueryNameReply"
  *******************************************************************************
  */
 static void
-_LSHubHandleQueryName(_LSTransportMessage *message)
+_LSHubQueryName(_LSTransportMessage *message, _QueryNameBatch *batch)
 {
     LOG_LS_DEBUG("%s\n", __func__);
 
@@ -2456,7 +2681,7 @@ _LSHubHandleQueryName(_LSTransportMessage *message)
                                       requested_service_name,
                                       NULL,
                                       false, false,
-                                      &lserror))
+                                      &lserror, batch))
         {
             LOG_LSERROR(MSGID_LSHUB_SENDMSG_ERROR, &lserror);
             LSErrorFree(&lserror);
@@ -2476,11 +2701,9 @@ _LSHubHandleQueryName(_LSTransportMessage *message)
     // socket buffer is full, and service is freezing for a long period of time.
     // To increase chances for new clients to connect, we may cleanup an outgoing
     // queue from messages with invalid socket fds.
-    if (dest_client &&
-        dest_client->outgoing->queue &&
-        !g_queue_is_empty(dest_client->outgoing->queue))
+    if (dest_client)
     {
-        _LSHubCleanupOutgoingQueue(dest_client->outgoing->queue);
+        _LSHubCleanupOutgoingQueue(dest_client->outgoing);
     }
 
     // We know the service exists, so now we check to see if we have
@@ -2499,7 +2722,7 @@ _LSHubHandleQueryName(_LSTransportMessage *message)
                                       requested_service_name,
                                       NULL,
                                       false, false,
-                                      &lserror))
+                                      &lserror, batch))
         {
             LOG_LSERROR(MSGID_LSHUB_SENDMSG_ERROR, &lserror);
             LSErrorFree(&lserror);
@@ -2535,7 +2758,7 @@ _LSHubHandleQueryName(_LSTransportMessage *message)
                                                   requested_service_name,
                                                   NULL,
                                                   false, false,
-                                                  &lserror))
+                                                  &lserror, batch))
                     {
                         LOG_LSERROR(MSGID_LSHUB_SENDMSG_ERROR, &lserror);
                         LSErrorFree(&lserror);
@@ -2571,7 +2794,7 @@ _LSHubHandleQueryName(_LSTransportMessage *message)
                                   unique_name,
                                   service_is_dynamic,
                                   requested_service_name != destination_service_name,
-                                  &lserror))
+                                  &lserror, batch))
     {
         LOG_LSERROR(MSGID_LSHUB_SENDMSG_ERROR, &lserror);
         LSErrorFree(&lserror);
@@ -2588,39 +2811,147 @@ _LSHubHandleQueryName(_LSTransportMessage *message)
     }
 }
 
+/**
+ *******************************************************************************
+ * @brief Process a "QueryName" message.
+ *
+ * @param  message  IN  query name message
+ *******************************************************************************
+ */
+static void
+_LSHubHandleQueryName(_LSTransportMessage *message)
+{
+    _LSHubQueryName(message, nullptr);
+}
+
+/**
+ *******************************************************************************
+ * @brief Process a "QueryNameBatch" message.
+ *
+ * Every service is looked up as if the client queried it alone. The replies
+ * the hub can give right away are sent together in "QueryNameBatchReply"
+ * messages.
+ *
+ * @param  message  IN  query name batch message
+ *******************************************************************************
+ */
+static void
+_LSHubHandleQueryNameBatch(_LSTransportMessage *message)
+{
+    LOG_LS_DEBUG("%s\n", __func__);
+
+    LSError lserror;
+    LSErrorInit(&lserror);
+
+    _LSTransportClient *client = _LSTransportMessageGetClient(message);
+
+    _LSTransportMessageIter iter;
+    _LSTransportMessageIterInit(message, &iter);
+
+    const char *app_id = nullptr;
+    int32_t count = 0;
+    if (!_LSTransportMessageGetString(&iter, &app_id) ||
+        !_LSTransportMessageGetInt32(_LSTransportMessageIterNext(&iter), &count) ||
+        count < 0 || count > LS_TRANSPORT_QUERY_NAME_BATCH_MAX)
+    {
+        LOG_LS_ERROR(MSGID_LSHUB_BAD_PARAMS, 0, "%s: malformed message", __func__);
+        return;
+    }
+
+    _QueryNameBatch batch = {};
+    batch.client = client;
+    batch.is_public_bus = message->raw->header.is_public_bus;
+
+    for (; count > 0; --count)
+    {
+        const char *service_name = nullptr;
+        if (!_LSTransportMessageGetString(_LSTransportMessageIterNext(&iter), &service_name) ||
+            !service_name)
+        {
+            LOG_LS_ERROR(MSGID_LSHUB_BAD_PARAMS, 0, "%s: malformed message", __func__);
+            break;
+        }
+
+        // The lookup may have to wait for the service and keep the message,
+        // so each service gets its own "QueryName".
+        _LSTransportMessage *query = _LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE);
+        if (!query)
+        {
+            LOG_LS_ERROR(MSGID_LSHUB_OOM_ERR, 0, "%s: OOM", __func__);
+            break;
+        }
+
+        query->raw->header.is_public_bus = message->raw->header.is_public_bus;
+        _LSTransportMessageSetType(query, _LSTransportMessageTypeQueryName);
+        _LSTransportMessageSetClient(query, client);
+
+        _LSTransportMessageIter query_iter;
+        _LSTransportMessageIterInit(query, &query_iter);
+        if (_LSTransportMessageAppendString(&query_iter, service_name) &&
+            _LSTransportMessageAppendString(&query_iter, app_id) &&
+            _LSTransportMessageAppendInvalid(&query_iter))
+        {
+            _LSHubQueryName(query, &batch);
+        }
+        else
+        {
+            LOG_LS_ERROR(MSGID_LSHUB_OOM_ERR, 0, "%s: OOM", __func__);
+        }
+
+        _LSTransportMessageUnref(query);
+    }
+
+    if (!_LSHubFlushQueryNameBatch(&batch, &lserror))
+    {
+        LOG_LSERROR(MSGID_LSHUB_SENDMSG_ERROR, &lserror);
+        LSErrorFree(&lserror);
+    }
+}
+
+/// @brief Signal being forwarded to the clients of one registration map
+struct _LSHubSignalFanOut {
+    _LSTransportMessage *message;       ///< signal to forward
+    _LSTransportClientMap *client_map;  ///< registrations it matched
+};
+
 /**
  *******************************************************************************
  * @brief Send a signal message to a client.
  *
  * @param  client   IN  client to which signal should be sent
  * @param  dummy    IN  unused
- * @param  message  IN  message to forward as the signal
+ * @param  fan_out  IN  message to forward as the signal and the registrations
+ *                      it matched
  *******************************************************************************
  */
 static void
-_LSHubSendSignal(_LSTransportClient *client, void *dummy, _LSTransportMessage *message)
+_LSHubSendSignal(_LSTransportClient *client, void *dummy, _LSHubSignalFanOut *fan_out)
 {
     LSError lserror;
     LSErrorInit(&lserror);
     LSMessageToken token;
 
-    /* Need to make a copy of the message, since this function gets called
-     * multiple times with the same message.
-     *
-     * TODO: It would be nice to avoid the message copies for performance,
-     * but we need to have independent message transmit counts since the
-     * message is sent to different clients
+    /* This function gets called multiple times with the same message, and
+     * every client needs independent token and message transmit count.
+     * The body is shared between the clients, not copied.
      */
 
-    _LSTransportMessage *msg_copy = _LSTransportMessageCopyNewRef(message);
+    _LSTransportMessage *msg_share = _LSTransportMessageShareNewRef(fan_out->message);
 
-    if (!_LSTransportSendMessage(msg_copy, client, &token, &lserror))
+    /* the sender may have declared the signal latest-value already, else the
+     * subscriber may have asked for it */
+    if (_LSTransportClientMapIsCoalesced(fan_out->client_map, client))
+    {
+        _LSTransportMessageSetCoalesced(msg_share, true);
+    }
+
+    if (!_LSTransportSendMessage(msg_share, client, &token, &lserror))
     {
         LOG_LSERROR(MSGID_LSHUB_SENDMSG_ERROR, &lserror);
         LSErrorFree(&lserror);
     }
 
-    _LSTransportMessageUnref(msg_copy);
+    _LSTransportMessageUnref(msg_share);
 }
 
 /**
@@ -2681,13 +3012,14 @@ _LSHubRemoveClientSignals(_LSTransportClient *client)
  * @param  map      IN  signal's "method_map" or "category_map"
  * @param  path     IN  signal to unregister for
  * @param  client   In  client
+ * @param  coalesce IN  true if the registration asked for latest-value delivery
  *
  * @retval  true if signal registration was removed
  * @retval  false otherwise
  *******************************************************************************
  */
 static bool
-_LSHubRemoveSignal(GHashTable *map, const char *path, _LSTransportClient *client)
+_LSHubRemoveSignal(GHashTable *map, const char *path, _LSTransportClient *client, bool coalesce)
 {
     bool ret = false;
 
@@ -2695,7 +3027,7 @@ _LSHubRemoveSignal(GHashTable *map, const char *path, _LSTransportClient *client
 
     if (client_map)
     {
-        ret = _LSTransportClientMapUnrefClient(client_map, client);
+        ret = _LSTransportClientMapUnrefClient(client_map, client, coalesce);
 
         if (_LSTransportClientMapIsEmpty(client_map))
         {
@@ -2724,6 +3056,7 @@ _LSHubHandleSignalUnregister(_LSTransportMessage *message)
     const char *category = _LSTransportMessageGetCategory(message);
     const char *method = _LSTransportMessageGetMethod(message);
     _LSTransportClient *client = _LSTransportMessageGetClient(message);
+    bool coalesce = _LSTransportMessageIsCoalesced(message);
 
     LOG_LS_DEBUG("%s: category: \"%s\", method: \"%s\", client: %p\n", __func__, category, method, client);
 
@@ -2734,7 +3067,7 @@ _LSHubHandleSignalUnregister(_LSTransportMessage *message)
     {
         char *full_path = g_strdup_printf("%s/%s", category, method);
 
-        if (!_LSHubRemoveSignal(signal_map->method_map, full_path, client))
+        if (!_LSHubRemoveSignal(signal_map->method_map, full_path, client, coalesce))
         {
             G_GNUC_UNUSED const _LSTransportCred *cred = _LSTransportClientGetCred(client);
             LOG_LS_ERROR(MSGID_LSHUB_SIGNAL_ERR, 3,
@@ -2749,7 +3082,7 @@ _LSHubHandleSignalUnregister(_LSTransportMessage *message)
     else
     {
         /* remove from category hash */
-        if (!_LSHubRemoveSignal(signal_map->category_map, category, client))
+        if (!_LSHubRemoveSignal(signal_map->category_map, category, client, coalesce))
         {
             G_GNUC_UNUSED const _LSTransportCred *cred = _LSTransportClientGetCred(client);
             LOG_LS_ERROR(MSGID_LSHUB_SIGNAL_ERR, 3,
@@ -2771,13 +3104,15 @@ _LSHubHandleSignalUnregister(_LSTransportMessage *message)
  * @param  map      IN  signal's "method_map" or "category_map"
  * @param  path     IN  signal to register for
  * @param  client   In  client
+ * @param  coalesce IN  true if the client wants only the latest undelivered
+ *                      instance of the signal queued
  *
  * @retval  true if signal registration was added
  * @retval  false otherwise
  *******************************************************************************
  */
 static bool
-_LSHubAddSignal(GHashTable *map, const char *path, _LSTransportClient *client)
+_LSHubAddSignal(GHashTable *map, const char *path, _LSTransportClient *client, bool coalesce)
 {
     LS_ASSERT(map != NULL);
     LS_ASSERT(path != NULL);
@@ -2794,7 +3129,7 @@ _LSHubAddSignal(GHashTable *map, const char *path, _LSTransportClient *client)
         g_hash_table_replace(map, (gpointer)path_copy, client_map);
     }
 
-    _LSTransportClientMapAddRefClient(client_map, client);
+    _LSTransportClientMapAddRefClient(client_map, client, coalesce);
 
     return true;
 }
@@ -2908,11 +3243,11 @@ _LSHubHandleSignalRegister(_LSTransportMessage* message)
     {
         /* method is optional for registration */
         std::string path = std::string(category) + "/" + method;
-        _LSHubAddSignal(signal_map->method_map, path.c_str(), client);
+        _LSHubAddSignal(signal_map->method_map, path.c_str(), client, _LSTransportMessageIsCoalesced(message));
     }
     else
     {
-        _LSHubAddSignal(signal_map->category_map, category, client);
+        _LSHubAddSignal(signal_map->category_map, category, client, _LSTransportMessageIsCoalesced(message));
     }
 
     /* FIXME: we need to create a new "signal reply" function, so that we can
@@ -2973,7 +3308,8 @@ _LSHubHandleSignal(_LSTransportMessage *message, bool generated_by_hub)
 
     if (category_client_map)
     {
-        _LSTransportClientMapForEach(category_client_map, (GHFunc)_LSHubSendSignal, message);
+        _LSHubSignalFanOut fan_out = { message, category_client_map };
+        _LSTransportClientMapForEach(category_client_map, (GHFunc)_LSHubSendSignal, &fan_out);
     }
 
     /* look up all clients that handle this category/method */
@@ -2982,7 +3318,8 @@ _LSHubHandleSignal(_LSTransportMessage *message, bool generated_by_hub)
             static_cast<_LSTransportClientMap *>(g_hash_table_lookup(signal_map->method_map, category_method.c_str()));
     if (method_client_map)
     {
-        _LSTransportClientMapForEach(method_client_map, (GHFunc)_LSHubSendSignal, message);
+        _LSHubSignalFanOut fan_out = { message, method_client_map };
+        _LSTransportClientMapForEach(method_client_map, (GHFunc)_LSHubSendSignal, &fan_out);
     }
 }
 
@@ -3011,11 +3348,12 @@ _SendMonitorAcceptClient(const _ClientId *monitor_id, const _ClientId *id, int f
 
 /**
  *******************************************************************************
- * @brief Send a message to client telling it to connect to the monitor.
+ * @brief Send a message to client telling it to connect to the monitor (or to
+ * trace for it, see @ref _LSTransportFeatureTrace), or that there is none.
  *
  * @param  ignored_fd   IN  don't use this
  * @param  id           IN  client id
- * @param  monitor_id   IN  monitor's client id
+ * @param  monitor_id   IN  monitor's client id, NULL if none
  *******************************************************************************
  */
 static void
@@ -3033,6 +3371,7 @@ _LSHubSendMonitorMessage(int ignored_fd, _ClientId *id, _ClientId *monitor_id)
     LOG_LS_DEBUG("%s: client: %p\n", __func__, id->client);
 
     bool monitor_is_connected = true;
+    bool traced = false;
     _LSTransportMessageIter iter;
 
     const char *unique_name = nullptr;
@@ -3043,6 +3382,11 @@ _LSHubSendMonitorMessage(int ignored_fd, _ClientId *id, _ClientId *monitor_id)
     {
         monitor_is_connected = false;
     }
+    else if (monitor_trace)
+    {
+        /* clients that can't trace get their connection to the monitor */
+        traced = _LSTransportClientGetFeatures(id->client) & _LSTransportFeatureTrace;
+    }
 
     /* get the unique name for the client and add send it as part of the message */
     auto monitor_message = mk_ptr(_LSTransportMessageNewRef(LS_TRANSPORT_MESSAGE_DEFAULT_PAYLOAD_SIZE),
@@ -3053,13 +3397,31 @@ _LSHubSendMonitorMessage(int ignored_fd, _ClientId *id, _ClientId *monitor_id)
                                                     :  _LSTransportMessageTypeMonitorNotConnected);
 
     _LSTransportMessageIterInit(monitor_message.get(), &iter);
-    if (!_LSTransportMessageAppendString(&iter, unique_name) || !_LSTransportMessageAppendInvalid(&iter))
+    if (!_LSTransportMessageAppendString(&iter, unique_name))
+    {
+        return;
+    }
+
+    /* older clients stop at the name */
+    if (monitor_is_connected && (traced || !monitor_filter.empty()) &&
+        !_LSTransportMessageAppendString(&iter, monitor_filter.c_str()))
+    {
+        return;
+    }
+
+    /* and only clients that can trace are told to */
+    if (traced && !_LSTransportMessageAppendInt32(&iter, 1))
+    {
+        return;
+    }
+
+    if (!_LSTransportMessageAppendInvalid(&iter))
     {
         return;
     }
 
     /* set up the connection to the monitor if it exists and we're local */
-    if (monitor_is_connected)
+    if (monitor_is_connected && !traced)
     {
         int socket_vector[2] = { -1, -1 };
         if (-1 == socketpair(AF_UNIX, SOCK_STREAM, 0, socket_vector))
@@ -3141,6 +3503,45 @@ _LSHubHandleMonitorRequest(_LSTransportMessage *message)
         return;
     }
 
+    /* the messages it wants, if it says (older monitors don't) */
+    _LSTransportMessageIter iter;
+    const char *filter = nullptr;
+    _LSTransportMessageIterInit(message, &iter);
+    if (_LSTransportMessageGetString(&iter, &filter) && filter && *filter)
+    {
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        _LSTransportMonitorFilter *parsed = _LSTransportMonitorFilterNew(filter, &lserror);
+        if (!parsed)
+        {
+            /* tell the monitor why nothing is coming */
+            LOG_LSERROR(MSGID_LSHUB_BAD_PARAMS, &lserror);
+            std::string reason = std::string("Invalid monitor filter: ") + lserror.message;
+            LSErrorFree(&lserror);
+
+            if (!_LSTransportSendReplyString(message, _LSTransportMessageTypeError, reason.c_str(), &lserror))
+            {
+                LOG_LSERROR(MSGID_LSHUB_SENDMSG_ERROR, &lserror);
+                LSErrorFree(&lserror);
+            }
+            return;
+        }
+        _LSTransportMonitorFilterUnref(parsed);
+        monitor_filter = filter;
+    }
+    else
+    {
+        monitor_filter.clear();
+    }
+
+    /* whether it reads the clients' trace rings rather than get copies
+     * (only ever allowed to the monitor checked above) */
+    int32_t trace = 0;
+    _LSTransportMessageIterNext(&iter);
+    _LSTransportMessageGetInt32(&iter, &trace);
+    monitor_trace = trace != 0;
+
     /* mark this client as the monitor */
     id->is_monitor = true;
     _LSHubClientIdLocalRef(id);
@@ -3772,6 +4173,10 @@ _LSHubHandleMessage(_LSTransportMessage* message, void *context)
         _LSHubHandleQueryName(message);
         break;
 
+    case _LSTransportMessageTypeQueryNameBatch:
+        _LSHubHandleQueryNameBatch(message);
+        break;
+
     case _LSTransportMessageTypeQueryProxyName:
         _LSHubHandleQueryProxyName(message);
         break;
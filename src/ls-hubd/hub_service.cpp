@@ -113,6 +113,7 @@ HubService::HubService()
         {"removeManifestsDir", &HubService::RemoveManifestsDir},
         {"getServiceAPIVersions", &HubService::GetServiceApiVersions},
         {"queryServicePermissions", &HubService::QueryServicePermissions},
+        {"getQueues", &HubService::GetQueues},
     }
 {
 }
@@ -483,3 +484,17 @@ std::string HubService::QueryServicePermissions(_LSTransportMessage *message, co
 
     return RespondServicePermissions(provided, required);
 }
+
+std::string HubService::GetQueues(_LSTransportMessage *message, const char *payload)
+{
+    (void)payload;
+
+    _LSTransport *transport = _LSTransportClientGetTransport(_LSTransportMessageGetClient(message));
+
+    jvalue_ref queues = LSTransportGetQueues(transport);
+    jobject_put(queues, J_CSTR_TO_JVAL("returnValue"), jboolean_create(true));
+    std::string reply = jvalue_tostring_simple(queues);
+    j_release(&queues);
+
+    return reply;
+}
@@ -49,6 +49,7 @@ private:
     std::string RemoveManifestsDir(_LSTransportMessage *message, const char *payload);
     std::string GetServiceApiVersions(_LSTransportMessage *message, const char *payload);
     std::string QueryServicePermissions(_LSTransportMessage *message, const char *payload);
+    std::string GetQueues(_LSTransportMessage *message, const char *payload);
 
 private:
     std::unordered_map<std::string, method_t> _methods_map;
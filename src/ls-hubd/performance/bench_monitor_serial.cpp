@@ -0,0 +1,174 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "transport_shm.h"
+
+// Every process takes serials for that long, all at the same time
+constexpr auto RUN_TIME = std::chrono::milliseconds{1000};
+
+// Shared by the processes of a run
+struct Shared
+{
+    pthread_mutex_t lock;           // the serial as it used to be taken
+    uint64_t serial;
+    volatile int start;
+    uint64_t taken[64];             // serials taken by each process
+    bool in_order[64];              // every serial bigger than the previous one
+};
+
+uint64_t MutexSerial(Shared *shared, _LSTransportShm *)
+{
+    pthread_mutex_lock(&shared->lock);
+    uint64_t serial = ++shared->serial;
+    pthread_mutex_unlock(&shared->lock);
+    return serial;
+}
+
+uint64_t AtomicSerial(Shared *, _LSTransportShm *shm)
+{
+    return _LSTransportShmGetSerial(shm);
+}
+
+typedef std::function<uint64_t(Shared *, _LSTransportShm *)> SerialFunc;
+
+void TakeSerials(Shared *shared, size_t index, const SerialFunc &take)
+{
+    _LSTransportShm *shm = nullptr;
+    LSError lserror;
+    LSErrorInit(&lserror);
+    if (!_LSTransportShmInit(&shm, &lserror))
+        _exit(EXIT_FAILURE);
+
+    while (!shared->start)
+        ;
+
+    auto stop = std::chrono::steady_clock::now() + RUN_TIME;
+    uint64_t taken = 0;
+    uint64_t last = 0;
+    bool in_order = true;
+
+    do
+    {
+        // check the clock now and then only
+        for (int i = 0; i < 1000; ++i)
+        {
+            uint64_t serial = take(shared, shm);
+            in_order = in_order && serial > last;
+            last = serial;
+        }
+        taken += 1000;
+    } while (std::chrono::steady_clock::now() < stop);
+
+    shared->taken[index] = taken;
+    shared->in_order[index] = in_order;
+    _LSTransportShmDeinit(&shm);
+}
+
+// Millions of serials a second taken by the processes together
+double Measure(size_t processes, const SerialFunc &take)
+{
+    void *map = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return 0;
+    Shared *shared = new (map) Shared();
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&shared->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    std::vector<pid_t> pids;
+    for (size_t i = 0; i < processes; ++i)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            TakeSerials(shared, i, take);
+            _exit(EXIT_SUCCESS);
+        }
+        pids.push_back(pid);
+    }
+
+    shared->start = 1;
+    bool ok = true;
+    for (pid_t pid : pids)
+    {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    }
+
+    uint64_t taken = 0;
+    for (size_t i = 0; i < processes; ++i)
+    {
+        taken += shared->taken[i];
+        ok = ok && shared->in_order[i];
+    }
+
+    pthread_mutex_destroy(&shared->lock);
+    munmap(map, sizeof(Shared));
+
+    if (!ok)
+    {
+        std::cerr << "Serials out of order or a process failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return taken / std::chrono::duration<double, std::micro>(RUN_TIME).count();
+}
+
+void Measure(size_t processes)
+{
+    std::cout << '|' << std::setw(15) << processes
+              << '|' << std::setw(15) << Measure(processes, MutexSerial)
+              << '|' << std::setw(15) << Measure(processes, AtomicSerial)
+              << '|' << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cout << std::left << std::setfill(' ') << std::setprecision(3);
+    std::cout << std::string(49, '*') << std::endl;
+    std::cout << '|' << std::setw(15) << "Processes"
+              << '|' << std::setw(15) << "Shared mutex"
+              << '|' << std::setw(15) << "Atomic add"
+              << '|' << std::endl;
+    std::cout << '|' << std::setw(15) << ""
+              << '|' << std::setw(15) << "M serials/s"
+              << '|' << std::setw(15) << "M serials/s"
+              << '|' << std::endl;
+    std::cout << std::string(49, '*') << std::endl;
+
+    for (size_t processes : {1, 2, 4, 8, 16})
+        Measure(processes);
+
+    std::cout << std::string(49, '*') << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <luna-service2/lunaservice.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "benchmark_time.hpp"
+
+// Several threads push calls through one handle while its main loop runs on
+// yet another thread, the way a service with worker threads talks to the bus.
+constexpr size_t CALLS_PER_THREAD = 20000;
+constexpr size_t PAYLOAD_SIZE = 64;
+
+class LoopHandle : public LS::Handle
+{
+    std::shared_ptr<GMainLoop> loop;
+    std::thread loop_thread;
+
+public:
+    explicit LoopHandle(const char *name)
+        : LS::Handle(LS::registerService(name))
+        , loop(g_main_loop_new(nullptr, false), g_main_loop_unref)
+        , loop_thread([this]() { g_main_loop_run(loop.get()); })
+    {
+        attachToLoop(loop.get());
+
+        while (!g_main_loop_is_running(loop.get()))
+            usleep(1000);
+    }
+
+    ~LoopHandle()
+    {
+        g_main_loop_quit(loop.get());
+        loop_thread.join();
+    }
+};
+
+class Receiver
+{
+    LoopHandle handle;
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t received = 0;
+
+    static bool OnCall(LSHandle *sh, LSMessage *msg, void *ctx)
+    {
+        Receiver *self = static_cast<Receiver *>(ctx);
+        std::lock_guard<std::mutex> lock(self->mutex);
+        if (++self->received >= self->expected)
+            self->cv.notify_all();
+        return true;
+    }
+
+public:
+    size_t expected = 0;
+
+    Receiver()
+        : handle("com.webos.bench_mt_send")
+    {
+        static LSMethod methods[] = {{"call", OnCall}, {nullptr, nullptr}};
+        handle.registerCategory("/", methods, nullptr, nullptr);
+        handle.setCategoryData("/", this);
+    }
+
+    void Expect(size_t calls)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        received = 0;
+        expected = calls;
+    }
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return received >= expected; });
+    }
+};
+
+double Measure(LoopHandle &sender, Receiver &receiver, size_t threads)
+{
+    const std::string payload = "{\"data\":\"" + std::string(PAYLOAD_SIZE, '$') + "\"}";
+
+    receiver.Expect(threads * CALLS_PER_THREAD);
+
+    auto start = stop_watch::now();
+    std::vector<std::thread> producers;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        producers.emplace_back([&]() {
+            for (size_t i = 0; i < CALLS_PER_THREAD; ++i)
+            {
+                LS::Error error;
+                if (!LSCall(sender.get(), "luna://com.webos.bench_mt_send/call", payload.c_str(),
+                            nullptr, nullptr, nullptr, error.get()))
+                {
+                    error.print(stderr);
+                    std::abort();
+                }
+            }
+        });
+    }
+    for (auto &producer : producers)
+        producer.join();
+    receiver.Wait();
+
+    auto seconds = std::chrono::duration<double>(stop_watch::now() - start).count();
+    return threads * CALLS_PER_THREAD / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        Receiver receiver;
+        LoopHandle sender("com.webos.bench_mt_send_client");
+
+        std::cout << std::left << std::setfill(' ') << std::setprecision(3);
+        std::cout << std::string(33, '*') << std::endl;
+        std::cout << '|' << std::setw(15) << "Producers"
+                  << '|' << std::setw(15) << "calls/sec"
+                  << '|' << std::endl;
+        std::cout << std::string(33, '*') << std::endl;
+
+        for (size_t threads : {1, 2, 4, 8})
+        {
+            std::cout << '|' << std::setw(15) << threads
+                      << '|' << std::setw(15) << Measure(sender, receiver, threads)
+                      << '|' << std::endl;
+        }
+
+        std::cout << std::string(33, '*') << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
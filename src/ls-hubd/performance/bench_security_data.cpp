@@ -1,4 +1,4 @@
-// Copyright (c) 2017-2018 LG Electronics, Inc.
+// Copyright (c) 2017-2021 LG Electronics, Inc.
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -20,12 +20,17 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <numeric>
+#include <algorithm>
+#include <thread>
+#include <string>
+#include <unistd.h>
 
 #include <luna-service2/lunaservice.hpp>
 
 #define private public
 #include "../file_parser.hpp"
 #include "../security.hpp"
+#include "../security_cache.hpp"
 #include "../conf.hpp"
 #include "../role.hpp"
 #include "../patternqueue.hpp"
@@ -90,6 +95,56 @@ int main(int argc, char *argv[])
     auto maxrss2_kb = maxrss_kb();
     std::cout << "max memory usage: " << maxrss0_kb << " - (single pass) -> " << maxrss1_kb << " -(multi pass)-> " << maxrss2_kb << std::endl;
 
+    // Same, but with every manifest restored from the cache of parsed data
+    char cacheDir[] = "/tmp/bench_security_cache.XXXXXX";
+    if (!mkdtemp(cacheDir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string cachePath = std::string(cacheDir) + "/security.cache";
+    {
+        SecurityCache cache(cachePath);
+        SecurityData data;
+        for (const auto &f : filesBag.Files())
+        {
+            (void) data.AddManifest(f, std::string(), &cache, nullptr);
+        }
+        (void) cache.Save(nullptr);
+    }
+
+    auto buildCached = [&](size_t n) noexcept {
+        for (size_t i = 0; i < n; ++i)
+        {
+            SecurityCache cache(cachePath);
+            SecurityData data;
+            for (const auto &f : filesBag.Files())
+            {
+                (void) data.AddManifest(f, std::string(), &cache, nullptr);
+            }
+        }
+    };
+    report("build (cached)", benchmarkTime(buildCached, std::chrono::seconds{30}));
+
+    // Parsing with a pool of workers, e.g. over src/ls-hubd/test/data/*
+    unsigned maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned workers = 1; ; workers = std::min(workers * 2, maxWorkers))
+    {
+        auto buildParallel = [&](size_t n) noexcept {
+            for (size_t i = 0; i < n; ++i)
+            {
+                SecurityData data;
+                data.AddManifests(filesBag.Files(), std::string(), nullptr, workers);
+            }
+        };
+        std::string name = "build (" + std::to_string(workers) + " workers)";
+        report(name.c_str(), benchmarkTime(buildParallel, std::chrono::seconds{30}));
+        if (workers == maxWorkers)
+            break;
+    }
+    unlink(cachePath.c_str());
+    rmdir(cacheDir);
+
     SecurityData securityData;
     for (const auto &f : filesBag.Files())
     {
@@ -138,5 +193,39 @@ int main(int argc, char *argv[])
     };
 
     report("collect", benchmarkTime(collect, std::chrono::seconds{30}));
+
+    // Every caller checks a call to every destination per iteration
+    std::vector<std::string> callNames(serviceNames.begin(), serviceNames.end());
+    if (callNames.size() > 100) callNames.resize(100);
+    SecurityData::CurrentSecurityData() = std::move(securityData);
+
+    auto callAll = [&]() noexcept {
+        for (const auto &caller : callNames)
+        {
+            for (const auto &dest : callNames)
+            {
+                (void) LSHubIsCallAllowed(caller.c_str(), dest.c_str(), "/", "method");
+            }
+        }
+    };
+    auto isCallAllowed = [&](size_t n) noexcept {
+        for (size_t i = 0; i < n; ++i)
+        {
+            callAll();
+        }
+    };
+    // Groups change before every iteration, so that no cached decision is reused
+    auto isCallAllowedCold = [&](size_t n) noexcept {
+        for (size_t i = 0; i < n; ++i)
+        {
+            SecurityData::CurrentSecurityData().groups.AddRequired("bench.cold", "bench");
+            SecurityData::CurrentSecurityData().groups.RemoveRequired("bench.cold", "bench");
+            callAll();
+        }
+    };
+
+    std::cout << "isCallAllowed: " << callNames.size() * callNames.size() << " calls per iteration" << std::endl;
+    report("isCallAllowed (cached)", benchmarkTime(isCallAllowed, std::chrono::seconds{30}));
+    report("isCallAllowed (after security change)", benchmarkTime(isCallAllowedCold, std::chrono::seconds{30}));
     return 0;
 }
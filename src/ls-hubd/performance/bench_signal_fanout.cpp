@@ -0,0 +1,146 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <malloc.h>
+
+#include "transport_priv.h"
+
+#include "benchmark_time.hpp"
+
+// One large signal delivered to every subscriber. The subscribers don't read
+// their sockets meanwhile, so every per-destination message stays queued.
+constexpr size_t PAYLOAD_SIZE = 64 * 1024;
+
+long VmRSSKiB()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return std::stol(line.substr(6));
+    }
+    return 0;
+}
+
+_LSTransportMessage *MakeSignal()
+{
+    std::string payload(PAYLOAD_SIZE, '$');
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(PAYLOAD_SIZE);
+    _LSTransportMessageSetType(message, _LSTransportMessageTypeSignal);
+    _LSTransportMessageSetBody(message, payload.data(), PAYLOAD_SIZE);
+    return message;
+}
+
+// What the hub does per subscriber: a message of its own, stamped with the
+// token of the destination, queued until the socket can take it
+using FanOut = std::function<_LSTransportMessage *(_LSTransportMessage *)>;
+
+void Queue(std::vector<GQueue> &queues, _LSTransportMessage *signal, const FanOut &fan_out)
+{
+    for (size_t i = 0; i < queues.size(); ++i)
+    {
+        _LSTransportMessage *message = fan_out(signal);
+        _LSTransportMessageSetToken(message, i + 1);
+        g_queue_push_tail(&queues[i], message);
+    }
+}
+
+void Release(std::vector<GQueue> &queues)
+{
+    for (auto &queue : queues)
+    {
+        while (!g_queue_is_empty(&queue))
+            _LSTransportMessageUnref(static_cast<_LSTransportMessage *>(g_queue_pop_head(&queue)));
+    }
+    malloc_trim(0);
+}
+
+void Measure(size_t subscribers, const FanOut &fan_out, long &rss_kib, double &rate)
+{
+    std::vector<GQueue> queues(subscribers);
+    for (auto &queue : queues)
+        g_queue_init(&queue);
+
+    _LSTransportMessage *signal = MakeSignal();
+
+    long before = VmRSSKiB();
+    Queue(queues, signal, fan_out);
+    rss_kib = VmRSSKiB() - before;
+    Release(queues);
+
+    auto run = [&](size_t n) noexcept {
+        for (size_t i = 0; i < n; ++i)
+        {
+            Queue(queues, signal, fan_out);
+            Release(queues);
+        }
+    };
+
+    auto ms = benchmarkTime(run, std::chrono::seconds{2});
+    auto total = std::accumulate(ms.begin(), ms.end(), MeasuredTime::zero());
+    rate = total.cycles / std::chrono::duration<double>(total.cpuTime).count();
+
+    _LSTransportMessageUnref(signal);
+}
+
+int main(int argc, char *argv[])
+{
+    std::cout << std::left << std::setfill(' ') << std::setprecision(3);
+    std::cout << std::string(81, '*') << std::endl;
+    std::cout << '|' << std::setw(15) << "Subscribers"
+              << '|' << std::setw(15) << "Copy"
+              << '|' << std::setw(15) << "Copy"
+              << '|' << std::setw(15) << "Share"
+              << '|' << std::setw(15) << "Share"
+              << '|' << std::endl;
+    std::cout << '|' << std::setw(15) << "64KB signal"
+              << '|' << std::setw(15) << "RSS KiB"
+              << '|' << std::setw(15) << "sig/cpu sec"
+              << '|' << std::setw(15) << "RSS KiB"
+              << '|' << std::setw(15) << "sig/cpu sec"
+              << '|' << std::endl;
+    std::cout << std::string(81, '*') << std::endl;
+
+    for (size_t subscribers : {8, 32, 128, 512})
+    {
+        long copy_rss, share_rss;
+        double copy_rate, share_rate;
+
+        Measure(subscribers, _LSTransportMessageCopyNewRef, copy_rss, copy_rate);
+        Measure(subscribers, _LSTransportMessageShareNewRef, share_rss, share_rate);
+
+        std::cout << '|' << std::setw(15) << subscribers
+                  << '|' << std::setw(15) << copy_rss
+                  << '|' << std::setw(15) << copy_rate
+                  << '|' << std::setw(15) << share_rss
+                  << '|' << std::setw(15) << share_rate
+                  << '|' << std::endl;
+    }
+
+    std::cout << std::string(81, '*') << std::endl;
+
+    return 0;
+}
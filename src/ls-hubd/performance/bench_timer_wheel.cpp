@@ -0,0 +1,128 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "timersource.h"
+
+#include "benchmark_time.hpp"
+
+// Pending call timeouts far in the future, as with many outstanding calls:
+// nothing fires, every main loop iteration only has to find out when to wake.
+constexpr guint PENDING_TIMEOUT_MS = 60000;
+
+gboolean OnTimeout(gpointer)
+{
+    return G_SOURCE_REMOVE;
+}
+
+// CPU time of a main loop iteration with the given timeouts pending
+double IterationCost(GMainContext *context)
+{
+    auto iterate = [context](size_t n) noexcept {
+        for (size_t i = 0; i < n; ++i)
+            g_main_context_iteration(context, FALSE);
+    };
+
+    auto ms = benchmarkTime(iterate, std::chrono::seconds{2});
+    auto total = std::accumulate(ms.begin(), ms.end(), MeasuredTime::zero());
+    return std::chrono::duration<double, std::micro>(total.cpuTime).count() / total.cycles;
+}
+
+// One GSource per timeout, as callmap and the hub used to do
+double MeasureSources(size_t pending)
+{
+    GMainContext *context = g_main_context_new();
+    std::vector<GSource *> sources;
+
+    for (size_t i = 0; i < pending; ++i)
+    {
+        GSource *source = g_timeout_source_new(PENDING_TIMEOUT_MS);
+        g_source_set_callback(source, OnTimeout, nullptr, nullptr);
+        g_source_attach(source, context);
+        sources.push_back(source);
+    }
+
+    double cost = IterationCost(context);
+
+    for (GSource *source : sources)
+    {
+        g_source_destroy(source);
+        g_source_unref(source);
+    }
+    g_main_context_unref(context);
+
+    return cost;
+}
+
+// All timeouts on the timer wheel of the context
+double MeasureWheel(size_t pending)
+{
+    GMainContext *context = g_main_context_new();
+    std::vector<guint> ids;
+
+    for (size_t i = 0; i < pending; ++i)
+        ids.push_back(_LSTimerWheelAdd(context, PENDING_TIMEOUT_MS, OnTimeout, nullptr, nullptr));
+
+    double cost = IterationCost(context);
+
+    for (guint id : ids)
+        _LSTimerWheelRemove(id);
+    g_main_context_iteration(context, FALSE);
+    g_main_context_unref(context);
+
+    return cost;
+}
+
+void Measure(size_t pending)
+{
+    std::cout << '|' << std::setw(15) << pending
+              << '|' << std::setw(15) << MeasureSources(pending)
+              << '|' << std::setw(15) << MeasureWheel(pending)
+              << '|' << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::cout << std::left << std::setfill(' ') << std::setprecision(3);
+    std::cout << std::string(49, '*') << std::endl;
+    std::cout << '|' << std::setw(15) << "Pending"
+              << '|' << std::setw(15) << "GSource each"
+              << '|' << std::setw(15) << "Timer wheel"
+              << '|' << std::endl;
+    std::cout << '|' << std::setw(15) << "timeouts"
+              << '|' << std::setw(15) << "us/iteration"
+              << '|' << std::setw(15) << "us/iteration"
+              << '|' << std::endl;
+    std::cout << std::string(49, '*') << std::endl;
+
+    Measure(10);
+    Measure(100);
+    Measure(1000);
+    Measure(10000);
+    Measure(50000);
+
+    std::cout << std::string(49, '*') << std::endl;
+
+    return 0;
+}
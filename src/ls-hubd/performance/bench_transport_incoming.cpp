@@ -0,0 +1,193 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "transport_priv.h"
+
+#include "benchmark_time.hpp"
+
+// Burst of small replies a busy client gets per mainloop wakeup. The burst is
+// written in chunks, so that the writer never blocks on the socket buffer.
+constexpr size_t BURST_MESSAGES = 10000;
+constexpr size_t CHUNK_BYTES = 32 * 1024;
+
+std::vector<char> MakeChunk(size_t payload_size, size_t chunk_messages)
+{
+    std::vector<char> chunk;
+    std::string payload(payload_size, '$');
+
+    for (size_t i = 0; i < chunk_messages; ++i)
+    {
+        _LSTransportMessage *message = _LSTransportMessageNewRef(payload_size);
+        _LSTransportMessageSetType(message, _LSTransportMessageTypeReply);
+        _LSTransportMessageSetToken(message, i + 1);
+        _LSTransportMessageSetBody(message, payload.data(), payload_size);
+
+        const char *raw = reinterpret_cast<const char *>(message->raw);
+        chunk.insert(chunk.end(), raw, raw + sizeof(_LSTransportHeader) + payload_size);
+
+        _LSTransportMessageUnref(message);
+    }
+
+    return chunk;
+}
+
+void WriteAll(int fd, const std::vector<char> &data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t ret = write(fd, data.data() + written, data.size() - written);
+        assert(ret > 0);
+        written += ret;
+    }
+}
+
+// The receive path before staging buffer: recv() for the header, then recv()
+// for the body of every message
+size_t LegacyReceive(int fd, size_t &syscalls)
+{
+    size_t messages = 0;
+
+    for (;;)
+    {
+        _LSTransportHeader header;
+        ssize_t ret = recv(fd, &header, sizeof(header), MSG_DONTWAIT);
+        ++syscalls;
+        if (ret <= 0)
+            break;
+        assert(ret == sizeof(header));
+
+        _LSTransportMessage *message = _LSTransportMessageNewRef(header.len);
+        _LSTransportMessageSetHeader(message, &header);
+        ret = recv(fd, message->raw->data, header.len, MSG_DONTWAIT);
+        ++syscalls;
+        assert(ret == ssize_t(header.len));
+        _LSTransportMessageUnref(message);
+
+        ++messages;
+    }
+
+    return messages;
+}
+
+size_t StagingReceive(_LSTransportClient *client)
+{
+    _LSTransportIncoming *incoming = client->incoming;
+
+    (void) _LSTransportIncomingReceive(incoming, client->channel.fd, client);
+
+    size_t messages = g_queue_get_length(incoming->complete_messages);
+    while (!g_queue_is_empty(incoming->complete_messages))
+    {
+        _LSTransportMessageUnref(static_cast<_LSTransportMessage *>(g_queue_pop_head(incoming->complete_messages)));
+    }
+
+    return messages;
+}
+
+void Measure(size_t payload_size)
+{
+    int sv[2];
+    int result = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    (void) result;
+    assert(result == 0);
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+
+    _LSTransport transport;
+    memset(&transport, 0, sizeof(transport));
+    _LSTransportClient *client = _LSTransportClientNewRef(&transport, sv[1], "com.webos.bench", "bench", nullptr);
+
+    const size_t chunk_messages = CHUNK_BYTES / (sizeof(_LSTransportHeader) + payload_size);
+    const size_t chunks_per_burst = (BURST_MESSAGES + chunk_messages - 1) / chunk_messages;
+    auto chunk = MakeChunk(payload_size, chunk_messages);
+
+    size_t legacy_syscalls = 0;
+    size_t legacy_messages = 0;
+    auto legacy = [&](size_t n) noexcept {
+        for (size_t i = 0; i < n * chunks_per_burst; ++i)
+        {
+            WriteAll(sv[0], chunk);
+            legacy_messages += LegacyReceive(sv[1], legacy_syscalls);
+        }
+    };
+
+    size_t staging_messages = 0;
+    auto staging = [&](size_t n) noexcept {
+        for (size_t i = 0; i < n * chunks_per_burst; ++i)
+        {
+            WriteAll(sv[0], chunk);
+            staging_messages += StagingReceive(client);
+        }
+    };
+
+    auto rate = [&](const std::vector<MeasuredTime> &ms) {
+        auto total = std::accumulate(ms.begin(), ms.end(), MeasuredTime::zero());
+        return total.cycles * chunks_per_burst * chunk_messages / std::chrono::duration<double>(total.time).count();
+    };
+
+    auto legacy_rate = rate(benchmarkTime(legacy, std::chrono::seconds{3}));
+    auto staging_rate = rate(benchmarkTime(staging, std::chrono::seconds{3}));
+
+    std::cout << '|' << std::setw(15) << payload_size
+              << '|' << std::setw(15) << double(legacy_syscalls) / legacy_messages
+              << '|' << std::setw(15) << legacy_rate
+              << '|' << std::setw(15) << double(client->incoming->rx_syscalls) / staging_messages
+              << '|' << std::setw(15) << staging_rate
+              << '|' << std::endl;
+
+    _LSTransportClientUnref(client);
+    close(sv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+    std::cout << std::left << std::setfill(' ') << std::setprecision(3);
+    std::cout << std::string(81, '*') << std::endl;
+    std::cout << '|' << std::setw(15) << "Payload size"
+              << '|' << std::setw(15) << "Legacy"
+              << '|' << std::setw(15) << "Legacy"
+              << '|' << std::setw(15) << "Staging"
+              << '|' << std::setw(15) << "Staging"
+              << '|' << std::endl;
+    std::cout << '|' << std::setw(15) << "bytes"
+              << '|' << std::setw(15) << "syscalls/mes"
+              << '|' << std::setw(15) << "mes/sec"
+              << '|' << std::setw(15) << "syscalls/mes"
+              << '|' << std::setw(15) << "mes/sec"
+              << '|' << std::endl;
+    std::cout << std::string(81, '*') << std::endl;
+
+    Measure(16);
+    Measure(64);
+    Measure(256);
+    Measure(1024);
+
+    std::cout << std::string(81, '*') << std::endl;
+
+    return 0;
+}
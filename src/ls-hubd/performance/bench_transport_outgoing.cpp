@@ -0,0 +1,186 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "transport_priv.h"
+
+#include "benchmark_time.hpp"
+
+// Backlog of signals queued for a client that doesn't keep up with them.
+// The consumer reads a small chunk per wakeup, so the sender keeps hitting
+// a full socket and resumes from the queue.
+constexpr size_t BACKLOG_MESSAGES = 2000;
+constexpr size_t CONSUMER_CHUNK = 4096;
+constexpr int SOCKET_BUFFER = 16 * 1024;
+
+void QueueBacklog(_LSTransportClient *client, size_t payload_size)
+{
+    std::string payload(payload_size, '$');
+
+    for (size_t i = 0; i < BACKLOG_MESSAGES; ++i)
+    {
+        _LSTransportMessage *message = _LSTransportMessageNewRef(payload_size);
+        _LSTransportMessageSetType(message, _LSTransportMessageTypeSignal);
+        _LSTransportMessageSetToken(message, i + 1);
+        _LSTransportMessageSetBody(message, payload.data(), payload_size);
+        message->tx_bytes_remaining = sizeof(_LSTransportHeader) + payload_size;
+
+        g_queue_push_tail(client->outgoing->queue, message);
+    }
+}
+
+// The drain loop before batching: one send() per queued message
+bool LegacySendClient(_LSTransportClient *client, size_t &syscalls)
+{
+    GQueue *queue = client->outgoing->queue;
+
+    while (!g_queue_is_empty(queue))
+    {
+        _LSTransportMessage *message = static_cast<_LSTransportMessage *>(g_queue_peek_head(queue));
+        const char *end = reinterpret_cast<const char *>(message->raw) + sizeof(_LSTransportHeader) + message->raw->header.len;
+
+        ssize_t ret = send(client->channel.fd, end - message->tx_bytes_remaining, message->tx_bytes_remaining, MSG_DONTWAIT);
+        ++syscalls;
+        if (ret < 0)
+        {
+            assert(errno == EAGAIN);
+            return true;
+        }
+
+        message->tx_bytes_remaining -= ret;
+        if (message->tx_bytes_remaining)
+            return true;
+
+        _LSTransportMessageUnref(static_cast<_LSTransportMessage *>(g_queue_pop_head(queue)));
+    }
+
+    return false;
+}
+
+size_t ConsumeChunk(int fd)
+{
+    char buf[CONSUMER_CHUNK];
+    ssize_t ret = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    return ret > 0 ? ret : 0;
+}
+
+void DrainRest(int fd)
+{
+    while (ConsumeChunk(fd));
+}
+
+void Measure(size_t payload_size)
+{
+    int sv[2];
+    int result = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    (void) result;
+    assert(result == 0);
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+    setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &SOCKET_BUFFER, sizeof(SOCKET_BUFFER));
+    setsockopt(sv[0], SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER, sizeof(SOCKET_BUFFER));
+
+    _LSTransport transport;
+    memset(&transport, 0, sizeof(transport));
+    _LSTransportClient *client = _LSTransportClientNewRef(&transport, sv[1], "com.webos.bench", "bench", nullptr);
+
+    size_t legacy_syscalls = 0;
+    size_t legacy_messages = 0;
+    auto legacy = [&](size_t n) noexcept {
+        for (size_t i = 0; i < n; ++i)
+        {
+            QueueBacklog(client, payload_size);
+            while (LegacySendClient(client, legacy_syscalls))
+                ConsumeChunk(sv[0]);
+            DrainRest(sv[0]);
+            legacy_messages += BACKLOG_MESSAGES;
+        }
+    };
+
+    size_t batched_wakeups = 0;
+    size_t batched_messages = 0;
+    auto batched = [&](size_t n) noexcept {
+        for (size_t i = 0; i < n; ++i)
+        {
+            QueueBacklog(client, payload_size);
+            while (_LSTransportSendClient(nullptr, G_IO_OUT, client))
+            {
+                ++batched_wakeups;
+                ConsumeChunk(sv[0]);
+            }
+            DrainRest(sv[0]);
+            batched_messages += BACKLOG_MESSAGES;
+        }
+    };
+
+    auto rate = [](const std::vector<MeasuredTime> &ms) {
+        auto total = std::accumulate(ms.begin(), ms.end(), MeasuredTime::zero());
+        return total.cycles * BACKLOG_MESSAGES / std::chrono::duration<double>(total.cpuTime).count();
+    };
+
+    auto legacy_rate = rate(benchmarkTime(legacy, std::chrono::seconds{3}));
+    auto batched_rate = rate(benchmarkTime(batched, std::chrono::seconds{3}));
+
+    std::cout << '|' << std::setw(15) << payload_size
+              << '|' << std::setw(15) << double(legacy_syscalls) / legacy_messages
+              << '|' << std::setw(15) << legacy_rate
+              << '|' << std::setw(15) << double(batched_wakeups) / batched_messages
+              << '|' << std::setw(15) << batched_rate
+              << '|' << std::endl;
+
+    _LSTransportClientUnref(client);
+    close(sv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+    std::cout << std::left << std::setfill(' ') << std::setprecision(3);
+    std::cout << std::string(81, '*') << std::endl;
+    std::cout << '|' << std::setw(15) << "Payload size"
+              << '|' << std::setw(15) << "Legacy"
+              << '|' << std::setw(15) << "Legacy"
+              << '|' << std::setw(15) << "Batched"
+              << '|' << std::setw(15) << "Batched"
+              << '|' << std::endl;
+    std::cout << '|' << std::setw(15) << "bytes"
+              << '|' << std::setw(15) << "sends/mes"
+              << '|' << std::setw(15) << "mes/cpu sec"
+              << '|' << std::setw(15) << "wakeups/mes"
+              << '|' << std::setw(15) << "mes/cpu sec"
+              << '|' << std::endl;
+    std::cout << std::string(81, '*') << std::endl;
+
+    Measure(64);
+    Measure(256);
+    Measure(1024);
+    Measure(4096);
+
+    std::cout << std::string(81, '*') << std::endl;
+
+    return 0;
+}
@@ -1,4 +1,4 @@
-// Copyright (c) 2016-2018 LG Electronics, Inc.
+// Copyright (c) 2016-2021 LG Electronics, Inc.
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -199,6 +199,41 @@ void TestMethodReplySize()
     std::cout << std::endl;
 }
 
+void TestMessageChurn(const char *label)
+{
+    // Small calls and replies back to back, the way a busy service sees them.
+    const unsigned CALLS = 16384;
+    unsigned sample_step = CALLS / SAMPLE_COUNT;
+
+    LS::Handle &client = services[1];
+
+    for (unsigned i = 0; i != CALLS; ++i)
+    {
+        auto call = client.callOneReply("luna://com.webos.service0/test/method0", R"({"churn": true})");
+        call.get();
+
+        if (0 == i % sample_step)
+        {
+            usleep(10000);
+            std::cout << label << " " << i << " " << GetStatm() << std::endl;
+        }
+    }
+
+    std::cout << std::endl;
+}
+
+void TestMessagePool()
+{
+    TestMessageChurn("Lib::MessageChurn");
+
+    // Same traffic with the message pools presized for it
+    services[0].reserveMessagePool(256, 1024);
+    services[1].reserveMessagePool(256, 1024);
+    TestMessageChurn("Lib::MessageChurnReserved");
+    services[0].reserveMessagePool(256, 0);
+    services[1].reserveMessagePool(256, 0);
+}
+
 bool OnTestSubscription(LSHandle *lsh, LSMessage *message, void *ctxt)
 {
     LS::Message request{message};
@@ -267,6 +302,7 @@ int main()
     TestServiceRegistration(SERVICES_TO_REGISTER);
     TestMethodRegistration(METHODS_TO_REGISTER);
     TestMethodCall();
+    TestMessagePool();
     TestSubscription();
     TestMethodCallPayloadSize();
     TestMethodReplySize();
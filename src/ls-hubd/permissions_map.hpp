@@ -22,7 +22,7 @@
 #include "pattern.hpp"
 #include "permission.hpp"
 #include "service_permissions.hpp"
-#include "trie.hpp"
+#include "radix_trie.hpp"
 
 class PermissionsMap
 {
@@ -55,7 +55,7 @@ private:
         WildcardData(): perms(nullptr, LSHubServicePermissionsUnref) {}
     };
 
-    Trie<WildcardData> _wildcard_permissions;
+    RadixTrie<WildcardData> _wildcard_permissions;
 };
 
 #endif //_PERMISSIONS_MAP_HPP_
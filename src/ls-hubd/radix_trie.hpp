@@ -0,0 +1,437 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+// Path-compressed prefix tree. Every edge carries a run of characters, so that
+// a service name like "com.webos.service.foo" takes a node per branching point
+// instead of a node per character.
+//
+// Nodes live in fixed-size chunks of contiguous storage (so their addresses
+// stay stable) and refer to each other by index; edge labels are slices of
+// a single string. Nodes of removed keys are recycled, and an empty node left
+// with a single child is merged into it, so that the trie stays as compact as
+// if the remaining keys had been added anew. The label characters of removed
+// and merged nodes are reclaimed once they make up half of the string.
+//
+// A key that ends in the middle of an edge is a prefix of stored keys, but has
+// no node of its own. Lookups report an empty node for it (as a trie branching
+// on every character would for its intermediate nodes); only Get(), which
+// hands out a node to be modified, creates the node by splitting the edge.
+
+template <typename T>
+class RadixTrie
+{
+public:
+    struct Node : T
+    {
+        Node() = default;
+
+    private:
+        friend class RadixTrie<T>;
+
+        uint32_t label = 0;         // offset of the edge label in _labels
+        uint32_t label_size = 0;
+        uint32_t first_child = 0;   // node index, 0 if none (root is never a child)
+        uint32_t next_sibling = 0;
+        char first = 0;             // first character of the label for quick branching
+    };
+
+    using PtrT = std::unique_ptr<RadixTrie<T>>;
+
+    RadixTrie() { _Alloc(); }
+    RadixTrie(const RadixTrie<T> &) = delete;
+    RadixTrie& operator=(const RadixTrie<T> &) = delete;
+    RadixTrie(RadixTrie<T> &&other) = default;
+    RadixTrie& operator=(RadixTrie<T> &&other) = default;
+
+    // Ensure the key can be stored in the trie, and return the leaf node for
+    // the key.
+    Node* Add(const char *key)
+    {
+        uint32_t node = 0;
+
+        while (!_IsCharTerminal(*key))
+        {
+            uint32_t child = _Child(node, *key);
+            if (!child)
+                return &_nodes[_NewChild(node, key, _KeySize(key))];
+
+            size_t matched = _Match(child, key);
+            if (matched < _nodes[child].label_size)
+                child = _Split(node, child, matched);
+
+            node = child;
+            key += matched;
+        }
+
+        return &_nodes[node];
+    }
+
+    // Find the leaf node for the key or nullptr.
+    const Node* Find(const char *key) const
+    {
+        return Search(key, [](const T &) {});
+    }
+
+    // Find the leaf node for the key or nullptr.
+    Node* Get(const char *key)
+    {
+        uint32_t node = 0;
+
+        while (!_IsCharTerminal(*key))
+        {
+            uint32_t child = _Child(node, *key);
+            if (!child)
+                return nullptr;
+
+            size_t matched = _Match(child, key);
+            if (matched < _nodes[child].label_size)
+            {
+                if (!_IsCharTerminal(key[matched]))
+                    return nullptr;
+                child = _Split(node, child, matched);
+            }
+
+            node = child;
+            key += matched;
+        }
+
+        return &_nodes[node];
+    }
+
+    // Search for the given key, executing func along the descent.
+    template <typename Func>
+    const Node* Search(const char *key, Func func) const
+    {
+        uint32_t node = 0;
+
+        while (true)
+        {
+            func(_nodes[node]);
+
+            if (_IsCharTerminal(*key))
+                return &_nodes[node];
+
+            uint32_t child = _Child(node, *key);
+            if (!child)
+                return nullptr;
+
+            size_t matched = _Match(child, key);
+            if (matched < _nodes[child].label_size)
+                return _IsCharTerminal(key[matched]) ? &_EmptyNode() : nullptr;
+
+            node = child;
+            key += matched;
+        }
+    }
+
+    // Execute func on the given leaf node. Remove empty nodes on the way back
+    // to the root, and merge the first remaining one into its child if it's
+    // empty and has only one.
+    template <typename Func>
+    void Remove(const char *key, const Func &func)
+    {
+        std::vector<uint32_t> path{0};
+
+        while (!_IsCharTerminal(*key))
+        {
+            uint32_t node = path.back();
+            uint32_t child = _Child(node, *key);
+            if (!child)
+                return;
+
+            size_t matched = _Match(child, key);
+            if (matched < _nodes[child].label_size)
+            {
+                if (!_IsCharTerminal(key[matched]))
+                    return;
+
+                // The key has no node, func gets an empty one as from Search()
+                T empty;
+                func(key + matched, empty);
+                return;
+            }
+
+            path.push_back(child);
+            key += matched;
+        }
+
+        func(key, static_cast<T &>(_nodes[path.back()]));
+
+        size_t i = path.size() - 1;
+        for (; i > 0; --i)
+        {
+            Node &node = _nodes[path[i]];
+            if (!node.IsEmpty() || node.first_child)
+                break;
+
+            _Unlink(path[i - 1], path[i]);
+            _Free(path[i]);
+        }
+
+        if (i > 0)
+        {
+            Node &node = _nodes[path[i]];
+            if (node.IsEmpty() && node.first_child && !_nodes[node.first_child].next_sibling)
+                _Merge(path[i - 1], path[i]);
+        }
+
+        if (_label_garbage > _labels.size() / 2)
+            _CompactLabels();
+    }
+
+    // Remove all keys and release the memory.
+    void Clear()
+    {
+        _nodes.chunks.clear();
+        _nodes.size = 0;
+        _free.clear();
+        _labels.clear();
+        _labels.shrink_to_fit();
+        _label_garbage = 0;
+        _Alloc();
+    }
+
+    // Visit every node from top to bottom without any particular order between
+    // siblings.
+    template <typename Func>
+    void Visit(const Func &func) const
+    {
+        std::string prefix;
+        _Visit(0, prefix, func);
+    }
+
+private:
+    static constexpr uint32_t CHUNK_SHIFT = 6;
+    static constexpr uint32_t CHUNK_SIZE = 1 << CHUNK_SHIFT;
+
+    struct Nodes
+    {
+        std::vector<std::unique_ptr<Node[]>> chunks;
+        uint32_t size = 0;          // root is node 0
+
+        Node& operator[](uint32_t index) { return chunks[index >> CHUNK_SHIFT][index & (CHUNK_SIZE - 1)]; }
+        const Node& operator[](uint32_t index) const { return chunks[index >> CHUNK_SHIFT][index & (CHUNK_SIZE - 1)]; }
+    };
+
+    Nodes _nodes;
+    std::vector<uint32_t> _free;    // indices of removed nodes for reuse
+    std::string _labels;            // edge labels of all nodes
+    size_t _label_garbage = 0;      // characters of _labels no node refers to
+
+    inline static bool _IsCharTerminal(char ch)
+    {
+        return !ch || ch == '*';
+    }
+
+    static size_t _KeySize(const char *key)
+    {
+        size_t size = 0;
+        while (!_IsCharTerminal(key[size]))
+            ++size;
+        return size;
+    }
+
+    static const Node& _EmptyNode()
+    {
+        static const Node empty;
+        return empty;
+    }
+
+    // Find the subtree for a given character.
+    uint32_t _Child(uint32_t node, char ch) const
+    {
+        for (uint32_t child = _nodes[node].first_child; child; child = _nodes[child].next_sibling)
+        {
+            if (_nodes[child].first == ch)
+                return child;
+        }
+
+        return 0;
+    }
+
+    // Count characters of the child label matching the key (at least the first one).
+    size_t _Match(uint32_t child, const char *key) const
+    {
+        const Node &node = _nodes[child];
+        const char *label = _labels.data() + node.label;
+
+        size_t matched = 1;
+        while (matched < node.label_size && !_IsCharTerminal(key[matched]) && label[matched] == key[matched])
+            ++matched;
+        return matched;
+    }
+
+    uint32_t _Alloc()
+    {
+        if (_free.empty())
+        {
+            if (!(_nodes.size & (CHUNK_SIZE - 1)))
+                _nodes.chunks.emplace_back(new Node[CHUNK_SIZE]);
+            return _nodes.size++;
+        }
+
+        uint32_t index = _free.back();
+        _free.pop_back();
+        return index;
+    }
+
+    void _Free(uint32_t index)
+    {
+        Node *node = &_nodes[index];
+        _label_garbage += node->label_size;
+        node->~Node();
+        new (node) Node;
+        _free.push_back(index);
+    }
+
+    uint32_t _NewChild(uint32_t parent, const char *label, size_t size)
+    {
+        uint32_t index = _Alloc();
+        Node &node = _nodes[index];
+
+        node.label = _labels.size();
+        node.label_size = size;
+        node.first = label[0];
+        _labels.append(label, size);
+
+        node.next_sibling = _nodes[parent].first_child;
+        _nodes[parent].first_child = index;
+        return index;
+    }
+
+    // Cut the first size characters of the child label into a new node between
+    // the parent and the child. Return the new node.
+    uint32_t _Split(uint32_t parent, uint32_t child, size_t size)
+    {
+        uint32_t index = _Alloc();
+        Node &node = _nodes[index];
+        Node &lower = _nodes[child];
+
+        node.label = lower.label;
+        node.label_size = size;
+        node.first = lower.first;
+
+        lower.label += size;
+        lower.label_size -= size;
+        lower.first = _labels[lower.label];
+
+        _Replace(parent, child, index);
+        node.first_child = child;
+        lower.next_sibling = 0;
+        return index;
+    }
+
+    // Merge the empty node into its only child, which takes its place under
+    // the parent. The labels of a split edge are still adjacent and are simply
+    // joined; otherwise the joined label is appended anew.
+    void _Merge(uint32_t parent, uint32_t index)
+    {
+        Node &node = _nodes[index];
+        uint32_t child = node.first_child;
+        Node &lower = _nodes[child];
+        uint32_t size = node.label_size + lower.label_size;
+
+        if (node.label + node.label_size == lower.label)
+        {
+            lower.label = node.label;
+            node.label_size = 0;
+        }
+        else
+        {
+            std::string label(_labels, node.label, node.label_size);
+            label.append(_labels, lower.label, lower.label_size);
+            _label_garbage += lower.label_size;
+            lower.label = _labels.size();
+            _labels += label;
+        }
+
+        lower.label_size = size;
+        lower.first = node.first;
+        _Replace(parent, index, child);
+        _Free(index);
+    }
+
+    // Copy the labels of the nodes in the trie into a new string to get rid of
+    // the characters of removed and merged nodes.
+    void _CompactLabels()
+    {
+        std::string labels;
+        labels.reserve(_labels.size() - _label_garbage);
+
+        std::vector<uint32_t> stack{0};
+        while (!stack.empty())
+        {
+            uint32_t index = stack.back();
+            stack.pop_back();
+
+            for (uint32_t child = _nodes[index].first_child; child; child = _nodes[child].next_sibling)
+            {
+                Node &node = _nodes[child];
+                uint32_t label = labels.size();
+                labels.append(_labels, node.label, node.label_size);
+                node.label = label;
+                stack.push_back(child);
+            }
+        }
+
+        _labels.swap(labels);
+        _label_garbage = 0;
+    }
+
+    void _Replace(uint32_t parent, uint32_t child, uint32_t replacement)
+    {
+        uint32_t *link = &_nodes[parent].first_child;
+        while (*link != child)
+            link = &_nodes[*link].next_sibling;
+
+        _nodes[replacement].next_sibling = _nodes[child].next_sibling;
+        *link = replacement;
+    }
+
+    void _Unlink(uint32_t parent, uint32_t child)
+    {
+        uint32_t *link = &_nodes[parent].first_child;
+        while (*link != child)
+            link = &_nodes[*link].next_sibling;
+
+        *link = _nodes[child].next_sibling;
+    }
+
+    // Visit every node from top to bottom without any particular order between
+    // siblings. The prefix will be accumulated during the descent.
+    template <typename Func>
+    void _Visit(uint32_t index, std::string &prefix, const Func &func) const
+    {
+        const Node &node = _nodes[index];
+
+        func(prefix, static_cast<const T &>(node));
+        for (uint32_t child = node.first_child; child; child = _nodes[child].next_sibling)
+        {
+            const Node &next = _nodes[child];
+            prefix.append(_labels, next.label, next.label_size);
+            _Visit(child, prefix, func);
+            prefix.resize(prefix.size() - next.label_size);
+        }
+    }
+};
@@ -23,8 +23,11 @@
 #include <pbnjson.hpp>
 #include <luna-service2++/error.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <sstream>
+#include <thread>
 #include <unordered_map>
 
 #include "simple_pbnjson.h"
@@ -47,6 +50,7 @@
 #include "file_parser.hpp"
 #include "patternqueue.hpp"
 #include "permissions_map.hpp"
+#include "security_cache.hpp"
 #include "active_role_map.hpp"
 #include "service_permissions.hpp"
 #include "active_permission_map.hpp"
@@ -71,6 +75,7 @@
 #define TRITON_SERVICE_EXE_PATH     "js"    /**< special "path" for triton services */
 
 static inline bool _LSHubClientExePathMatches(const _LSTransportClient *client, const char *path);
+static void _LSHubCallAllowedCacheClear();
 
 /**
  *******************************************************************************
@@ -102,15 +107,21 @@ LSHubProxyAgentsGet()
 }
 
 /*
- * Security data, which is currently in use.
+ * Security data, which is currently in use. ApplyNewSecurity replaces it as
+ * a whole.
  */
-SecurityData &SecurityData::CurrentSecurityData()
+static std::unique_ptr<SecurityData> &CurrentSecurityDataPtr()
 {
-    static SecurityData data;
+    static std::unique_ptr<SecurityData> data(new SecurityData());
 
     return data;
 }
 
+SecurityData &SecurityData::CurrentSecurityData()
+{
+    return *CurrentSecurityDataPtr();
+}
+
 SecurityData::SecurityData()
 {
 }
@@ -125,7 +136,12 @@ int SecurityData::ApplyNewSecurity(void *sec_data)
 {
     std::unique_ptr<SecurityData> data(static_cast<SecurityData *>(sec_data));
 
-    CurrentSecurityData() = std::move(*data);
+    /* All readers run on the mainloop, thus nobody refers to the current data
+     * in between dispatches: publish the new data and hand the old one over to
+     * the config parser thread, so that tearing it down doesn't stall us. */
+    CurrentSecurityDataPtr().swap(data);
+    ConfigRetireSecurityData(std::move(data));
+    _LSHubCallAllowedCacheClear();
     for (const auto& it : external_manifests)
     {
         CurrentSecurityData().AddExternalManifest(it.first, it.second, true, nullptr);
@@ -923,21 +939,81 @@ bool LSHubIsClientAllowedToSubscribeSignal(_LSTransportClient *client, const cha
     return false;
 }
 
-bool
-LSHubIsCallAllowed(const char *service, const char *dest_service,
-                   const char *category, const char *method)
+/// Limit of cached decisions, callers may come up with arbitrary method names
+#define CALL_ALLOWED_CACHE_MAX_SIZE 4096
+
+/**
+ * @brief Cache of LSHubIsCallAllowed() decisions
+ *
+ * Decisions depend on the groups map of the current security data and on the
+ * active permissions of connected clients. Both are tracked by generation, and
+ * the cache is dropped as soon as either of them changes.
+ */
+struct CallAllowedCache
 {
-    LS_ASSERT(service);
-    LS_ASSERT(category);
+    /// Provided ACG patterns of a destination service with their group sets
+    typedef std::vector<std::pair<std::string, GroupsBitset>> ProvidedPatterns;
 
-    if (strcmp(service, dest_service) == 0)
+    uint64_t groups_generation = 0;
+    unsigned permissions_generation = 0;
+
+    /// Destination service name to its provided ACG
+    std::unordered_map<std::string, ProvidedPatterns> provided;
+    /// "caller\0destination\0category/method" to the decision
+    std::unordered_map<std::string, bool> decisions;
+
+    void Clear()
     {
-        return true;
+        provided.clear();
+        decisions.clear();
+    }
+
+    void Validate(uint64_t groups_gen, unsigned permissions_gen)
+    {
+        if (groups_gen != groups_generation || permissions_gen != permissions_generation)
+        {
+            Clear();
+            groups_generation = groups_gen;
+            permissions_generation = permissions_gen;
+        }
     }
 
-    Groups req;
-    const GroupsMap &gropus = SecurityData::CurrentSecurityData().groups;
-    CategoryMap prov_map = gropus.GetProvided(dest_service);
+    const ProvidedPatterns &GetProvided(const GroupsMap &groups, const char *dest_service)
+    {
+        auto it = provided.find(dest_service);
+        if (it == provided.end())
+        {
+            ProvidedPatterns patterns;
+            for (const auto &c : groups.GetProvided(dest_service))
+                patterns.emplace_back(c.first, GroupsBitset(c.second));
+
+            it = provided.emplace(dest_service, std::move(patterns)).first;
+        }
+        return it->second;
+    }
+};
+
+static CallAllowedCache &
+_LSHubCallAllowedCache()
+{
+    static CallAllowedCache cache;
+    return cache;
+}
+
+static void
+_LSHubCallAllowedCacheClear()
+{
+    _LSHubCallAllowedCache().Clear();
+}
+
+static bool
+_LSHubComputeCallAllowed(CallAllowedCache &cache, const GroupsMap &groups,
+                         const char *service, const char *dest_service,
+                         const char *category, const char *method,
+                         const std::string &req_method)
+{
+    GroupsBitset req;
+    const CallAllowedCache::ProvidedPatterns &prov_patterns = cache.GetProvided(groups, dest_service);
 
 #ifdef SECURITY_COMPATIBILITY
     _ClientId* id = AvailableMapLookup(service);
@@ -952,48 +1028,31 @@ LSHubIsCallAllowed(const char *service, const char *dest_service,
     LSHubPermission *permission = id ? LSHubActivePermissionMapLookup(id->client) : nullptr;
     if (permission)
     {
-        req = LSHubPermissionGetRequired(permission);
+        req = GroupsBitset(LSHubPermissionGetRequired(permission));
     }
     else
     {
 #endif
-        req = gropus.GetRequired(service);
+        req = GroupsBitset(groups.GetRequired(service));
 #ifdef SECURITY_COMPATIBILITY
     }
 
-    if (prov_map.empty() || req.empty()) // For old services
+    if (prov_patterns.empty() || req.Empty()) // For old services
     {
         return true;
     }
 #endif //SECURITY_COMPATIBILITY
 
-    std::string req_method(category);
-    //root path always ends with '/'
-    if (method)
-    {
-        if (req_method.back() != '/')
-            req_method.push_back('/');
-        req_method += method;
-    }
-
     // For each provided groups find groups for which requested method match to groups' method's pattern
-    for (const auto &it : prov_map)
+    for (const auto &it : prov_patterns)
     {
         const std::string &pattern = it.first;
         PatternMatchResult ret = globPatternMatch(pattern.c_str(), req_method.c_str());
         if (ret == PatternMatchResult::PATTERN_SAME || ret == PatternMatchResult::PATTERN_MATCH)
         {
-            // For matched provided groups find first intersection with required groups
-            const Groups &prov = it.second;
-            for (auto it_req = req.begin(); it_req != req.end(); ++it_req)
-            {
-                for (auto it_prov = prov.begin(); it_prov != prov.end(); ++it_prov)
-                {
-                    // If provided group equal to required group it means that method is allowed
-                    if (*it_prov == *it_req)
-                        return true;
-                }
-            }
+            // If matched provided groups intersect with required groups, the method is allowed
+            if (it.second.Intersects(req))
+                return true;
         }
     }
 
@@ -1001,6 +1060,56 @@ LSHubIsCallAllowed(const char *service, const char *dest_service,
     return false;
 }
 
+bool
+LSHubIsCallAllowed(const char *service, const char *dest_service,
+                   const char *category, const char *method)
+{
+    LS_ASSERT(service);
+    LS_ASSERT(category);
+
+    if (strcmp(service, dest_service) == 0)
+    {
+        return true;
+    }
+
+    const GroupsMap &groups = SecurityData::CurrentSecurityData().groups;
+    CallAllowedCache &cache = _LSHubCallAllowedCache();
+    cache.Validate(groups.Generation(), LSHubActivePermissionMapGeneration());
+
+    // Buffers are reused between calls to avoid allocations for cache hits
+    static std::string req_method;
+    static std::string key;
+
+    req_method.assign(category);
+    //root path always ends with '/'
+    if (method)
+    {
+        if (req_method.back() != '/')
+            req_method.push_back('/');
+        req_method += method;
+    }
+
+    key.assign(service);
+    key.push_back('\0');
+    key.append(dest_service);
+    key.push_back('\0');
+    key.append(req_method);
+
+    auto it = cache.decisions.find(key);
+    if (it != cache.decisions.end())
+    {
+        return it->second;
+    }
+
+    bool allowed = _LSHubComputeCallAllowed(cache, groups, service, dest_service, category, method, req_method);
+
+    if (cache.decisions.size() >= CALL_ALLOWED_CACHE_MAX_SIZE)
+        cache.Clear();
+    cache.decisions.emplace(key, allowed);
+
+    return allowed;
+}
+
 #ifndef UNIT_TESTS
 static
 #endif
@@ -1251,6 +1360,22 @@ SecurityData::LookupPermission(const _LSTransportClient *client, const char *ser
 
 bool SecurityData::AddManifest(const std::string &path, const std::string &prefix, LSError *error)
 {
+    return AddManifest(path, prefix, nullptr, error);
+}
+
+/// Parse the manifest, which path and prefix are given, with all the files it
+/// refers to. Touches nothing but the arguments, so that different manifests
+/// may be parsed concurrently.
+static bool ParseManifest(Manifest &manifest, ManifestData &data, SecurityCache *cache, LSError *error)
+{
+    const std::string &path = manifest.path;
+
+    if (cache && cache->Restore(manifest, data))
+    {
+        LOG_LS_DEBUG("%s: manifest restored from cache: \"%s\"", __func__, path.c_str());
+        return true;
+    }
+
     LOG_LS_DEBUG("%s: parsing manifest from file: \"%s\"", __func__, path.c_str());
 
     auto json = pbnjson::JDomParser::fromFile(path.c_str(), manifest_schema);
@@ -1262,10 +1387,21 @@ bool SecurityData::AddManifest(const std::string &path, const std::string &prefi
         return false;
     }
 
-    Manifest manifest(path, prefix);
     if (!manifest.parse(error))
         return false;
 
+    if (!ManifestData::ProcessManifest(json, manifest.prefix, data, error))
+        return false;
+
+    if (cache)
+        cache->Store(manifest, json, data);
+    return true;
+}
+
+bool SecurityData::AddManifest(const std::string &path, const std::string &prefix, SecurityCache *cache,
+                               LSError *error)
+{
+    Manifest manifest(path, prefix);
     if (_manifests.find(manifest) != _manifests.end())
     {
         LOG_LS_INFO(MSGID_LSHUB_MANIFEST_FILE_ERROR, 0, "Skipping already loaded manifest <%s>", path.c_str());
@@ -1273,9 +1409,78 @@ bool SecurityData::AddManifest(const std::string &path, const std::string &prefi
     }
 
     ManifestData data;
-    if (!ManifestData::ProcessManifest(json, prefix, data, error))
+    if (!ParseManifest(manifest, data, cache, error))
         return false;
 
+    InsertManifest(std::move(manifest), std::move(data));
+    return true;
+}
+
+void SecurityData::AddManifests(const std::vector<std::string> &paths, const std::string &prefix,
+                                SecurityCache *cache, unsigned workers)
+{
+    struct ParsedManifest
+    {
+        ParsedManifest(const std::string &path, const std::string &prefix)
+            : manifest(path, prefix), parsed(false)
+        {}
+
+        Manifest manifest;
+        ManifestData data;
+        LS::Error error;
+        bool parsed;
+    };
+
+    std::vector<ParsedManifest> manifests;
+    manifests.reserve(paths.size());
+    for (const auto &path : paths)
+        manifests.emplace_back(path, prefix);
+
+    if (workers == 0)
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min<size_t>(workers, manifests.size());
+
+    // Workers take manifests one by one, so that a single heavy manifest
+    // doesn't hold back a whole share of them
+    std::atomic<size_t> next(0);
+    auto parse = [&]()
+    {
+        for (size_t i = next++; i < manifests.size(); i = next++)
+        {
+            auto &m = manifests[i];
+            m.parsed = ParseManifest(m.manifest, m.data, cache, m.error.get());
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < workers; ++i)
+        threads.emplace_back(parse);
+    parse();
+    for (auto &thread : threads)
+        thread.join();
+
+    // Merge in the order of paths, the same as adding them one by one would
+    for (auto &m : manifests)
+    {
+        if (!m.parsed)
+        {
+            LOG_LSERROR(MSGID_LSHUB_MANIFEST_FILE_ERROR, m.error.get());
+            continue;
+        }
+
+        if (_manifests.find(m.manifest) != _manifests.end())
+        {
+            LOG_LS_INFO(MSGID_LSHUB_MANIFEST_FILE_ERROR, 0, "Skipping already loaded manifest <%s>",
+                        m.manifest.path.c_str());
+            continue;
+        }
+
+        InsertManifest(std::move(m.manifest), std::move(m.data));
+    }
+}
+
+void SecurityData::InsertManifest(Manifest &&manifest, ManifestData &&data)
+{
     const Manifest *ref = &(*_manifests.insert(std::move(manifest)).first);
 
     auto &priority = _manifests_priority[ref->id];
@@ -1284,7 +1489,7 @@ bool SecurityData::AddManifest(const std::string &path, const std::string &prefi
 
     if (ref != priority.top())
     {
-        return true;
+        return;
     }
 
     if (active)
@@ -1295,7 +1500,6 @@ bool SecurityData::AddManifest(const std::string &path, const std::string &prefi
     }
 
     LoadManifestData(std::move(data));
-    return true;
 }
 
 void SecurityData::RemoveManifest(const std::string &path)
@@ -22,6 +22,7 @@
 #include <string>
 #include <unordered_set>
 #include <unordered_map>
+#include <vector>
 
 #include <pbnjson.hpp>
 #include <luna-service2/lunaservice.h>
@@ -36,6 +37,7 @@
 
 struct LSHubRole;
 struct LSHubPermission;
+class SecurityCache;
 
 /** @cond INTERNAL */
 
@@ -69,6 +71,13 @@ public:
     SecurityData();
 
     bool AddManifest(const std::string &path, const std::string &prefix, LSError *error);
+    /// Add the manifest, take its data from the cache if it's up to date there
+    bool AddManifest(const std::string &path, const std::string &prefix, SecurityCache *cache, LSError *error);
+    /// Add the manifests parsing them with a pool of workers (0 - one per CPU).
+    /// The result is the same as of adding them one by one in the given order,
+    /// failures are logged.
+    void AddManifests(const std::vector<std::string> &paths, const std::string &prefix,
+                      SecurityCache *cache, unsigned workers);
     void RemoveManifest(const std::string &path);
 
     bool AddExternalManifest(const std::string &path, const std::string &prefix, bool from_memory, LSError *error);
@@ -107,6 +116,7 @@ private:
 #ifdef UNIT_TESTS
 public:
 #endif
+    void InsertManifest(Manifest &&manifest, ManifestData &&data);
     void LoadManifestData(ManifestData &&mdata);
     void UnloadManifestData(ManifestData &&mdata);
     SecurityData &operator=(SecurityData &&other) = default;
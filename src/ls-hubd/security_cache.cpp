@@ -0,0 +1,737 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "security_cache.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <glib.h>
+
+#include "log.h"
+#include "util.hpp"
+#include "conf.hpp"
+#include "groups.hpp"
+#include "pattern.hpp"
+#include "patternqueue.hpp"
+
+/// @cond INTERNAL
+/// @addtogroup LunaServiceHubSecurity
+/// @{
+
+namespace {
+
+const char CACHE_MAGIC[8] = {'L', 'S', 'H', 'U', 'B', 'S', 'C', '\0'};
+
+/// Bump whenever the record layout or the meaning of the parsed data changes
+const uint32_t CACHE_VERSION = 2;
+
+/// Null strings are distinguished from empty ones
+const uint32_t NULL_STRING = UINT32_MAX;
+
+const char *MANIFEST_FILE_KEYS[] = { "roleFiles", "roleFilesPub", "roleFilesPrv", "serviceFiles",
+                                     "clientPermissionFiles", "apiPermissionFiles", "groupsFiles" };
+
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t records;
+    uint64_t settings;      ///< hash of the hub settings parsed data depends on
+    uint64_t checksum;      ///< hash of everything past the header, catches damage only
+};
+
+/// The cache is as good as the files it's built from, so only the hub's own
+/// user (or root, for the directory) may be able to write it: the directory
+/// must not be writable by anybody else, and the file must be private.
+bool IsDirectoryTrusted(const char *dir)
+{
+    struct stat st;
+    return lstat(dir, &st) == 0 && S_ISDIR(st.st_mode) &&
+           (st.st_uid == 0 || st.st_uid == geteuid()) &&
+           !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+bool IsFileTrusted(const struct stat &st)
+{
+    return S_ISREG(st.st_mode) && st.st_uid == geteuid() && !(st.st_mode & (S_IRWXG | S_IRWXO));
+}
+
+uint64_t Hash(const char *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t HashSettings()
+{
+    // Parsers substitute the exec prefix into service files and skip roles of
+    // JS services
+    uint64_t hash = Hash(reinterpret_cast<const char *>(&CACHE_VERSION), sizeof(CACHE_VERSION));
+    for (const char *setting : {g_conf_dynamic_service_exec_prefix, g_conf_triton_service_exe_path})
+    {
+        const char *value = setting ? setting : "";
+        hash = Hash(value, strlen(value) + 1, hash);
+    }
+    return hash;
+}
+
+class Writer
+{
+public:
+    explicit Writer(std::string &buffer) : _buffer(buffer) {}
+
+    void U32(uint32_t value) { _buffer.append(reinterpret_cast<const char *>(&value), sizeof(value)); }
+    void U64(uint64_t value) { _buffer.append(reinterpret_cast<const char *>(&value), sizeof(value)); }
+
+    void Str(const std::string &value)
+    {
+        U32(value.size());
+        _buffer.append(value);
+    }
+
+    void Str(const char *value)
+    {
+        if (!value)
+            return U32(NULL_STRING);
+        U32(strlen(value));
+        _buffer.append(value);
+    }
+
+    template <typename Strings>
+    void Strs(const Strings &values)
+    {
+        U32(values.size());
+        for (const auto &value : values)
+            Str(value);
+    }
+
+    void Patterns(const _LSHubPatternQueue *queue)
+    {
+        U32(g_slist_length(queue->q));
+        for (GSList *it = queue->q; it; it = g_slist_next(it))
+            Str(static_cast<const _LSHubPatternSpec *>(it->data)->pattern_str);
+    }
+
+    template <typename Map>
+    void StrsMap(const Map &map)
+    {
+        U32(map.size());
+        for (const auto &item : map)
+        {
+            Str(item.first);
+            Strs(item.second);
+        }
+    }
+
+private:
+    std::string &_buffer;
+};
+
+/// Bounds-checked reader, once anything is out of bounds all the reads fail
+class Reader
+{
+public:
+    Reader(const char *begin, const char *end) : _cur(begin), _end(end), _ok(true) {}
+
+    bool Ok() const { return _ok; }
+
+    uint32_t U32() { uint32_t value = 0; Raw(&value, sizeof(value)); return value; }
+    uint64_t U64() { uint64_t value = 0; Raw(&value, sizeof(value)); return value; }
+
+    std::string Str()
+    {
+        const char *data = nullptr;
+        size_t size = Span(data);
+        return std::string(data ? data : "", size);
+    }
+
+    /// Nullable string, valid until the next call
+    const char *CStr()
+    {
+        const char *data = nullptr;
+        size_t size = Span(data);
+        if (!data)
+            return nullptr;
+        _tmp.assign(data, size);
+        return _tmp.c_str();
+    }
+
+    const char *Interned()
+    {
+        const char *value = CStr();
+        return value ? g_intern_string(value) : nullptr;
+    }
+
+    template <typename Strings>
+    void InternedStrs(Strings &values)
+    {
+        for (uint32_t n = Count(); n > 0 && _ok; --n)
+            values.push_back(Interned());
+    }
+
+    template <typename Map>
+    void InternedStrsMap(Map &map)
+    {
+        for (uint32_t n = Count(); n > 0 && _ok; --n)
+        {
+            std::string key = Str();
+            InternedStrs(map[key]);
+        }
+    }
+
+    /// Number of following items, each taking at least 4 bytes
+    uint32_t Count()
+    {
+        uint32_t n = U32();
+        if (n > size_t(_end - _cur) / sizeof(uint32_t))
+            _ok = false;
+        return _ok ? n : 0;
+    }
+
+private:
+    const char *_cur;
+    const char *_end;
+    bool _ok;
+    std::string _tmp;
+
+    void Raw(void *value, size_t size)
+    {
+        if (!_ok || size_t(_end - _cur) < size)
+        {
+            _ok = false;
+            return;
+        }
+        memcpy(value, _cur, size);
+        _cur += size;
+    }
+
+    size_t Span(const char *&data)
+    {
+        uint32_t size = U32();
+        if (size == NULL_STRING || !_ok)
+            return 0;
+        if (size_t(_end - _cur) < size)
+        {
+            _ok = false;
+            return 0;
+        }
+        data = _cur;
+        _cur += size;
+        return size;
+    }
+};
+
+void WriteSource(Writer &w, const std::string &path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        memset(&st, 0, sizeof(st));
+
+    w.Str(path);
+    w.U64(st.st_mtim.tv_sec);
+    w.U64(st.st_mtim.tv_nsec);
+    w.U64(st.st_size);
+    w.U64(st.st_ino);
+    w.U32(st.st_uid);
+    w.U32(st.st_gid);
+    w.U32(st.st_mode);
+}
+
+bool IsSourceUpToDate(Reader &r)
+{
+    std::string path = r.Str();
+    uint64_t mtime_sec = r.U64();
+    uint64_t mtime_nsec = r.U64();
+    uint64_t size = r.U64();
+    uint64_t ino = r.U64();
+    uint32_t uid = r.U32();
+    uint32_t gid = r.U32();
+    uint32_t mode = r.U32();
+
+    struct stat st;
+    return r.Ok() && stat(path.c_str(), &st) == 0 &&
+           uint64_t(st.st_mtim.tv_sec) == mtime_sec && uint64_t(st.st_mtim.tv_nsec) == mtime_nsec &&
+           uint64_t(st.st_size) == size && uint64_t(st.st_ino) == ino &&
+           st.st_uid == uid && st.st_gid == gid && st.st_mode == mode;
+}
+
+void WriteRole(Writer &w, const LSHubRole *role)
+{
+    w.Str(role->id);
+    w.U32(role->type);
+    w.U32(role->role_flags);
+    w.Patterns(role->allowed_names);
+    w.U32(role->flags.size());
+    for (const auto &item : role->flags)
+    {
+        w.Str(item.first);
+        w.U32(item.second);
+    }
+}
+
+/// Patterns are kept in the same order as in the queue serialized
+void ReadPatterns(Reader &r, _LSHubPatternQueue *queue)
+{
+    std::vector<std::string> patterns;
+    for (uint32_t n = r.Count(); n > 0 && r.Ok(); --n)
+        patterns.push_back(r.Str());
+
+    // Push to the queue prepends
+    for (auto it = patterns.rbegin(); it != patterns.rend(); ++it)
+    {
+        auto pattern = mk_ptr(_LSHubPatternSpecNewRef(it->c_str()), _LSHubPatternSpecUnref);
+        _LSHubPatternQueuePushTail(queue, pattern.get());
+    }
+}
+
+RolePtr ReadRole(Reader &r)
+{
+    std::string id = r.Str();
+    uint32_t type = r.U32();
+    uint32_t role_flags = r.U32();
+    if (!r.Ok())
+        return RolePtr(nullptr, LSHubRoleUnref);
+
+    RolePtr role(LSHubRoleNewRef(id, LSHubRoleType(type), role_flags), LSHubRoleUnref);
+    ReadPatterns(r, role->allowed_names);
+    for (uint32_t n = r.Count(); n > 0 && r.Ok(); --n)
+    {
+        std::string name = r.Str();
+        role->flags[name] = r.U32();
+    }
+    return role;
+}
+
+void WritePermission(Writer &w, const LSHubPermission *perm)
+{
+    w.Str(perm->service_name);
+    w.Str(perm->exe_path);
+    w.Patterns(perm->inbound);
+    w.Patterns(perm->outbound);
+    w.Strs(perm->requires);
+    w.StrsMap(perm->provides);
+    w.U32(perm->perm_flags);
+    w.Str(perm->version.stringify());
+    w.Str(perm->required_trust);
+    w.StrsMap(perm->trust_level_required);
+    w.StrsMap(perm->trust_level_provided);
+}
+
+PermissionPtr ReadPermission(Reader &r)
+{
+    std::string service_name = r.Str();
+    const char *exe_path = r.CStr();
+    if (!r.Ok())
+        return PermissionPtr(nullptr, LSHubPermissionUnref);
+
+    PermissionPtr perm(LSHubPermissionNewRef(service_name, exe_path), LSHubPermissionUnref);
+    ReadPatterns(r, perm->inbound);
+    ReadPatterns(r, perm->outbound);
+    r.InternedStrs(perm->requires);
+    r.InternedStrsMap(perm->provides);
+    perm->perm_flags = r.U32();
+    std::string version = r.Str();
+    if (r.Ok())
+        perm->version = pbnjson::JDomParser::fromString(version, pbnjson::JSchema::AllSchema());
+    if (const char *required_trust = r.CStr())
+        LSHubPermissionSetTrustString(perm.get(), required_trust);
+    r.InternedStrsMap(perm->trust_level_required);
+    r.InternedStrsMap(perm->trust_level_provided);
+    return perm;
+}
+
+void WriteService(Writer &w, const _Service *service)
+{
+    w.U32(service->num_services);
+    for (int i = 0; i < service->num_services; ++i)
+        w.Str(service->service_names[i]);
+    w.Str(service->exec_path);
+    w.U32(service->is_dynamic);
+    w.Str(service->service_file_name);
+}
+
+ServicePtr ReadService(Reader &r)
+{
+    std::vector<std::string> names;
+    for (uint32_t n = r.Count(); n > 0 && r.Ok(); --n)
+        names.push_back(r.Str());
+    std::string exec_path = r.Str();
+    bool is_dynamic = r.U32();
+    std::string service_file_name = r.Str();
+    if (!r.Ok())
+        return ServicePtr(nullptr, _ServiceUnref);
+
+    std::vector<const char *> c_names;
+    for (const auto &name : names)
+        c_names.push_back(name.c_str());
+
+    return ServicePtr(_ServiceNewRef(c_names.data(), c_names.size(), exec_path.c_str(), is_dynamic,
+                                     service_file_name.c_str()),
+                      _ServiceUnref);
+}
+
+void WriteGroups(Writer &w, const LSHubGroups *groups)
+{
+    w.U32(groups->num_groups);
+    for (int i = 0; i < groups->num_groups; ++i)
+        w.Str(groups->groups_name[i]);
+    w.U32(groups->access);
+    w.StrsMap(groups->trustLevel);
+}
+
+GroupsPtr ReadGroups(Reader &r)
+{
+    std::vector<std::string> names;
+    for (uint32_t n = r.Count(); n > 0 && r.Ok(); --n)
+        names.push_back(r.Str());
+    bool access = r.U32();
+    if (!r.Ok())
+        return GroupsPtr(nullptr, LSHubGroupsUnref);
+
+    GroupsPtr groups(LSHubGroupsNewRef(access), LSHubGroupsUnref);
+    groups->groups_name = g_new0(char *, names.size() + 1);
+    for (const auto &name : names)
+        groups->groups_name[groups->num_groups++] = g_strdup(name.c_str());
+    r.InternedStrsMap(groups->trustLevel);
+    return groups;
+}
+
+void WriteTrustMaps(Writer &w, const ServiceToTrustMap &map)
+{
+    w.U32(map.size());
+    for (const auto &item : map)
+    {
+        w.Str(item.first);
+        w.StrsMap(item.second);
+    }
+}
+
+void ReadTrustMaps(Reader &r, ServiceToTrustMap &map)
+{
+    for (uint32_t n = r.Count(); n > 0 && r.Ok(); --n)
+    {
+        std::string service = r.Str();
+        r.InternedStrsMap(map[service]);
+    }
+}
+
+void WriteManifestData(Writer &w, const ManifestData &data)
+{
+    w.U32(data.roles.size());
+    for (const auto &role : data.roles)
+        WriteRole(w, role.get());
+
+    w.U32(data.perms.size());
+    for (const auto &perm : data.perms)
+        WritePermission(w, perm.get());
+
+    w.U32(data.services.size());
+    for (const auto &service : data.services)
+        WriteService(w, service.get());
+
+    w.U32(data.groups.size());
+    for (const auto &groups : data.groups)
+        WriteGroups(w, groups.get());
+
+    w.StrsMap(data.requires);
+    w.StrsMap(data.provides);
+    WriteTrustMaps(w, data.trust_level_provided);
+    WriteTrustMaps(w, data.trust_level_required);
+    w.Str(data.trustLevel);
+}
+
+void ReadManifestData(Reader &r, ManifestData &data)
+{
+    for (uint32_t n = r.Count(); n > 0 && r.Ok(); --n)
+    {
+        RolePtr role = ReadRole(r);
+        if (role)
+            data.roles.push_back(std::move(role));
+    }
+
+    for (uint32_t n = r.Count(); n > 0 && r.Ok(); --n)
+    {
+        PermissionPtr perm = ReadPermission(r);
+        if (perm)
+            data.perms.push_back(std::move(perm));
+    }
+
+    for (uint32_t n = r.Count(); n > 0 && r.Ok(); --n)
+    {
+        ServicePtr service = ReadService(r);
+        if (service)
+            data.services.push_back(std::move(service));
+    }
+
+    for (uint32_t n = r.Count(); n > 0 && r.Ok(); --n)
+    {
+        GroupsPtr groups = ReadGroups(r);
+        if (groups)
+            data.groups.push_back(std::move(groups));
+    }
+
+    r.InternedStrsMap(data.requires);
+    r.InternedStrsMap(data.provides);
+    ReadTrustMaps(r, data.trust_level_provided);
+    ReadTrustMaps(r, data.trust_level_required);
+    data.trustLevel = r.Str();
+}
+
+} // namespace
+
+SecurityCache::SecurityCache(const std::string &path)
+    : _path(path)
+    , _image(nullptr)
+    , _image_size(0)
+    , _dirty(false)
+{
+    Map();
+}
+
+SecurityCache::~SecurityCache()
+{
+    if (_image)
+        munmap(const_cast<char *>(_image), _image_size);
+}
+
+void SecurityCache::Map()
+{
+    auto dir = mk_ptr(g_path_get_dirname(_path.c_str()), g_free);
+    if (!IsDirectoryTrusted(dir.get()))
+    {
+        LOG_LS_DEBUG("%s: ignoring cache \"%s\" out of a trusted directory", __func__, _path.c_str());
+        return;
+    }
+
+    int fd = open(_path.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !IsFileTrusted(st))
+    {
+        LOG_LS_DEBUG("%s: ignoring cache \"%s\" that isn't private", __func__, _path.c_str());
+    }
+    else if (size_t(st.st_size) >= sizeof(CacheHeader))
+    {
+        void *image = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (image != MAP_FAILED)
+        {
+            _image = static_cast<const char *>(image);
+            _image_size = st.st_size;
+        }
+    }
+    close(fd);
+
+    if (!_image)
+        return;
+
+    CacheHeader header;
+    memcpy(&header, _image, sizeof(header));
+
+    const char *begin = _image + sizeof(header);
+    const char *end = _image + _image_size;
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.settings != HashSettings() ||
+        header.checksum != Hash(begin, end - begin))
+    {
+        LOG_LS_DEBUG("%s: ignoring outdated or damaged cache \"%s\"", __func__, _path.c_str());
+        return;
+    }
+
+    // Every record is its size followed by the path of the manifest
+    const char *record = begin;
+    for (uint32_t n = 0; n < header.records; ++n)
+    {
+        Reader r(record, end);
+        uint32_t size = r.U32();
+        if (!r.Ok() || size_t(end - record) - sizeof(size) < size)
+            break;
+
+        record += sizeof(size);
+        std::string path = Reader(record, record + size).Str();
+        _index.emplace(std::move(path), std::make_pair(size_t(record - _image), size_t(size)));
+        record += size;
+    }
+}
+
+bool SecurityCache::Restore(Manifest &manifest, ManifestData &data)
+{
+    auto found = _index.find(manifest.path);
+    if (found == _index.end())
+        return false;
+
+    const char *record = _image + found->second.first;
+    Reader r(record, record + found->second.second);
+
+    std::string path = r.Str();
+    std::string prefix = r.Str();
+    std::string id = r.Str();
+    std::string version = r.Str();
+    if (!r.Ok() || prefix != manifest.prefix)
+        return false;
+
+    for (uint32_t n = r.Count(); n > 0; --n)
+    {
+        if (!IsSourceUpToDate(r))
+            return false;
+    }
+
+    ManifestData restored;
+    ReadManifestData(r, restored);
+    if (!r.Ok())
+        return false;
+
+    manifest.id = id;
+    manifest.version = SemanticVersion(version);
+    data = std::move(restored);
+
+    std::lock_guard<std::mutex> lock(_records_lock);
+    _records[manifest.path].assign(record, found->second.second);
+    return true;
+}
+
+void SecurityCache::Store(const Manifest &manifest, const pbnjson::JValue &json, const ManifestData &data)
+{
+    std::string record;
+    Writer w(record);
+
+    w.Str(manifest.path);
+    w.Str(manifest.prefix);
+    w.Str(manifest.id);
+    w.Str(manifest.version.asString());
+
+    std::vector<std::string> sources{manifest.path};
+    for (const char *key : MANIFEST_FILE_KEYS)
+    {
+        for (const auto &f : json[key].items())
+            sources.push_back(BuildFilename(manifest.prefix, f.asString()));
+    }
+    w.U32(sources.size());
+    for (const auto &source : sources)
+        WriteSource(w, source);
+
+    WriteManifestData(w, data);
+
+    std::lock_guard<std::mutex> lock(_records_lock);
+    _records[manifest.path] = std::move(record);
+    _dirty = true;
+}
+
+bool SecurityCache::Save(LSError *error)
+{
+    if (!_dirty && _records.size() == _index.size())
+        return true;
+
+    // Order records by path, so that same data gives the same file
+    std::map<std::string, const std::string *> ordered;
+    for (const auto &item : _records)
+        ordered.emplace(item.first, &item.second);
+
+    std::string image(sizeof(CacheHeader), '\0');
+    for (const auto &item : ordered)
+    {
+        Writer(image).U32(item.second->size());
+        image.append(*item.second);
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.records = ordered.size();
+    header.settings = HashSettings();
+    header.checksum = Hash(image.data() + sizeof(header), image.size() - sizeof(header));
+    memcpy(&image[0], &header, sizeof(header));
+
+    auto dir = mk_ptr(g_path_get_dirname(_path.c_str()), g_free);
+    if (g_mkdir_with_parents(dir.get(), 0700) != 0)
+    {
+        _LSErrorSet(error, MSGID_LSHUB_SECURITY_CACHE_ERR, errno, "Failed to create directory \"%s\": %s",
+                    dir.get(), g_strerror(errno));
+        return false;
+    }
+    if (!IsDirectoryTrusted(dir.get()))
+    {
+        _LSErrorSet(error, MSGID_LSHUB_SECURITY_CACHE_ERR, -1,
+                    "Refusing to write security cache into \"%s\": it's writable by others", dir.get());
+        return false;
+    }
+
+    // Write a private temporary file, and put it in place of the old one
+    std::string tmp_path = _path + ".XXXXXX";
+    int fd = g_mkstemp_full(&tmp_path[0], O_WRONLY | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        _LSErrorSet(error, MSGID_LSHUB_SECURITY_CACHE_ERR, errno, "Failed to create \"%s\": %s",
+                    tmp_path.c_str(), g_strerror(errno));
+        return false;
+    }
+
+    const char *data = image.data();
+    size_t size = image.size();
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0)
+            break;
+        data += written;
+        size -= written;
+    }
+
+    bool written = size == 0 && fsync(fd) == 0;
+    int saved_errno = errno;
+    if (close(fd) != 0 && written)
+    {
+        written = false;
+        saved_errno = errno;
+    }
+    if (written && rename(tmp_path.c_str(), _path.c_str()) != 0)
+    {
+        written = false;
+        saved_errno = errno;
+    }
+
+    if (!written)
+    {
+        unlink(tmp_path.c_str());
+        _LSErrorSet(error, MSGID_LSHUB_SECURITY_CACHE_ERR, saved_errno, "Failed to write security cache: %s",
+                    g_strerror(saved_errno));
+        return false;
+    }
+
+    _dirty = false;
+    return true;
+}
+
+/// @} END OF GROUP LunaServiceHubSecurity
+/// @endcond
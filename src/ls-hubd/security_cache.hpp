@@ -0,0 +1,88 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _SECURITY_CACHE_HPP_
+#define _SECURITY_CACHE_HPP_
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <pbnjson.hpp>
+
+#include "manifest.hpp"
+
+/// @cond INTERNAL
+/// @addtogroup LunaServiceHubSecurity
+/// @{
+
+/// Binary image of parsed manifests
+///
+/// Parsing and validating every manifest together with its role, service,
+/// API permission and groups files is what the hub spends its startup on.
+/// The cache keeps the outcome of that (ManifestData) for every manifest in
+/// a single file, which is mapped into memory next time. A record is only
+/// used if none of the files it was built from changed since (modification
+/// time, size, inode, owner and mode), otherwise the manifest is parsed as
+/// usual and the record gets replaced.
+///
+/// The cache stands in for the security files, so it's used only if nobody
+/// but the hub's user could have written it: the file is private to the hub's
+/// user, and its directory belongs to root or the hub's user and isn't
+/// writable by anybody else. The checksum of the image only catches damage.
+///
+/// Restore() and Store() may be called concurrently for different manifests.
+class SecurityCache
+{
+public:
+    /// Map the cache file. Missing, damaged or outdated file means empty cache.
+    explicit SecurityCache(const std::string &path);
+    ~SecurityCache();
+
+    SecurityCache(const SecurityCache &) = delete;
+    SecurityCache& operator=(const SecurityCache &) = delete;
+
+    /// Restore id, version and data of the manifest, which path and prefix are
+    /// given, if the record for it is up to date
+    bool Restore(Manifest &manifest, ManifestData &data);
+
+    /// Remember the manifest parsed from the json
+    void Store(const Manifest &manifest, const pbnjson::JValue &json, const ManifestData &data);
+
+    /// Write out records restored or stored so far, if anything changed
+    bool Save(LSError *error);
+
+private:
+    std::string _path;
+    const char *_image;
+    size_t _image_size;
+
+    /// Manifest path to offset and size of its record in the image
+    std::unordered_map<std::string, std::pair<size_t, size_t>> _index;
+    /// Manifest path to the record to save
+    std::unordered_map<std::string, std::string> _records;
+    bool _dirty;
+    std::mutex _records_lock;   ///< guards _records and _dirty
+
+    void Map();
+};
+
+/// @} END OF GROUP LunaServiceHubSecurity
+/// @endcond
+
+#endif //_SECURITY_CACHE_HPP_
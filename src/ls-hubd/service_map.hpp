@@ -21,7 +21,7 @@
 #include <unordered_map>
 
 #include "service.hpp"
-#include "trie.hpp"
+#include "radix_trie.hpp"
 
 class ServiceMap
 {
@@ -55,7 +55,7 @@ private:
         WildcardData() : service(nullptr, _ServiceUnref) {}
     };
 
-    Trie<WildcardData> _wildcard_services;
+    RadixTrie<WildcardData> _wildcard_services;
 };
 
 #endif //_SERVICE_MAP_HPP_
@@ -0,0 +1,106 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <gtest/gtest.h>
+#include "luna-service2/lunaservice.hpp"
+
+#include <signal.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "test_util.hpp"
+
+using namespace std::chrono;
+
+static bool Ping(LSHandle *sh, LSMessage *message, void *data)
+{
+    LSMessageRespond(message, "{}", nullptr);
+    return true;
+}
+
+static pid_t GetHubPid()
+{
+    std::string hub_pid_file = getenv("LS_HUB_CONF_ROOT");
+    hub_pid_file += "/run/ls-hubd.pid";
+    std::ifstream ifs(hub_pid_file.c_str());
+    pid_t hub_pid{-1};
+    ifs >> hub_pid;
+    return hub_pid;
+}
+
+TEST(TestSecurityReload, QueryNameDuringReload)
+{
+    const unsigned SAMPLES = 300;
+
+    pid_t hub_pid = GetHubPid();
+    ASSERT_LT(0, hub_pid);
+
+    MainLoopT mainloop;
+
+    auto service = LS::registerService("com.webos.reload.service");
+    static LSMethod methods[] =
+    {
+        { "ping", Ping, LUNA_METHOD_FLAGS_NONE },
+        { nullptr }
+    };
+    service.registerCategory("/", methods, nullptr, nullptr);
+    service.attachToLoop(mainloop.get());
+
+    // Keep the hub reparsing its configuration all the time
+    std::atomic<bool> done{false};
+    unsigned reloads = 0;
+    std::thread reloader([&]()
+    {
+        while (!done)
+        {
+            kill(hub_pid, SIGHUP);
+            ++reloads;
+            std::this_thread::sleep_for(milliseconds{5});
+        }
+    });
+
+    std::vector<microseconds> latencies;
+    unsigned failures = 0;
+    for (unsigned i = 0; i < SAMPLES; ++i)
+    {
+        // Every new client makes the hub check and resolve the service name again
+        auto client = LS::registerService(("com.webos.reload.client" + std::to_string(i)).c_str());
+        client.attachToLoop(mainloop.get());
+
+        auto start = steady_clock::now();
+        auto reply = client.callOneReply("luna://com.webos.reload.service/ping", "{}").get(5000);
+        latencies.push_back(duration_cast<microseconds>(steady_clock::now() - start));
+
+        if (!reply || reply.isHubError())
+            ++failures;
+    }
+
+    done = true;
+    reloader.join();
+
+    EXPECT_EQ(0u, failures);
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "QueryName during " << reloads << " reloads:"
+              << " median " << latencies[latencies.size() / 2].count() << " us,"
+              << " 99% " << latencies[latencies.size() * 99 / 100].count() << " us,"
+              << " worst " << latencies.back().count() << " us" << std::endl;
+}
@@ -92,6 +92,51 @@ TEST_F(GroupParser, GroupManageTest)
                   }));
 }
 
+TEST_F(GroupParser, CallAllowedCacheTest)
+{
+    SecurityData sdata;
+    fillGroupTree(sdata);
+    sdata.groups.AddRequired("com.webos.app", "contacts");
+    SecurityData::CurrentSecurityData() = std::move(sdata);
+
+    // Repeated checks are served from the cache with the same result
+    for (int i = 0; i < 2; ++i)
+    {
+        EXPECT_TRUE(LSHubIsCallAllowed("com.webos.app", "com.webos.contacts", "/", "query"));
+        EXPECT_FALSE(LSHubIsCallAllowed("com.webos.app", "com.webos.umediaserver", "/", "play"));
+    }
+
+    // Groups modified in place
+    SecurityData::CurrentSecurityData().groups.AddRequired("com.webos.app", "media");
+    EXPECT_TRUE(LSHubIsCallAllowed("com.webos.app", "com.webos.umediaserver", "/", "play"));
+
+    SecurityData::CurrentSecurityData().groups.RemoveRequired("com.webos.app", "contacts");
+    EXPECT_FALSE(LSHubIsCallAllowed("com.webos.app", "com.webos.contacts", "/", "query"));
+
+    // Whole security data replaced
+    sdata = SecurityData();
+    fillGroupTree(sdata);
+    sdata.groups.AddRequired("com.webos.app", "public");
+    SecurityData::CurrentSecurityData() = std::move(sdata);
+
+    EXPECT_FALSE(LSHubIsCallAllowed("com.webos.app", "com.webos.umediaserver", "/", "play"));
+    EXPECT_TRUE(LSHubIsCallAllowed("com.webos.app", "com.webos.contacts", "/public", "query"));
+}
+
+TEST(GroupsBitset, Intersects)
+{
+    const char *a = g_intern_string("bitset.a");
+    const char *b = g_intern_string("bitset.b");
+    const char *c = g_intern_string("bitset.c");
+
+    EXPECT_TRUE(GroupsBitset().Empty());
+    EXPECT_FALSE(GroupsBitset(Groups{a}).Empty());
+
+    EXPECT_TRUE(GroupsBitset(Groups{a, b}).Intersects(GroupsBitset(Groups{b, c})));
+    EXPECT_FALSE(GroupsBitset(Groups{a}).Intersects(GroupsBitset(Groups{b, c})));
+    EXPECT_FALSE(GroupsBitset(Groups{a}).Intersects(GroupsBitset()));
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -1,4 +1,4 @@
-// Copyright (c) 2015-2019 LG Electronics, Inc.
+// Copyright (c) 2015-2021 LG Electronics, Inc.
 //
 // Licensed under the Apache License, Version 2.0 (the "License");
 // you may not use this file except in compliance with the License.
@@ -16,6 +16,10 @@
 
 #include <gtest/gtest.h>
 
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <pbnjson.hpp>
 #include <luna-service2++/error.hpp>
 
@@ -26,6 +30,8 @@
 #include "../file_schema.hpp"
 #include "../file_parser.hpp"
 #include "../security.hpp"
+#include "../security_cache.hpp"
+#include "../groups.hpp"
 #include "../role.hpp"
 #include "../permission.hpp"
 #undef private
@@ -198,6 +204,162 @@ TEST(TestManifest, TestPublicOverlapped)
      }
 }
 
+TEST(TestManifest, TestCache)
+{
+    std::string id = manifests + "/usr/bin/test";
+    std::string v1 = manifests + "/v1.manifest.json";
+    std::string any = manifests + "/any.manifest.json";
+
+    char dir_template[] = "/tmp/test_manifest_cache.XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir_template));
+    std::string path = std::string(dir_template) + "/security.cache";
+
+    {
+        SecurityCache cache(path);
+        EXPECT_TRUE(cache._index.empty());
+
+        SecurityData security;
+        EXPECT_TRUE(security.AddManifest(v1, manifests, &cache, nullptr));
+        EXPECT_TRUE(security.AddManifest(any, manifests, &cache, nullptr));
+        EXPECT_TRUE(cache._dirty);
+        EXPECT_TRUE(cache.Save(nullptr));
+    }
+
+    {
+        SecurityCache cache(path);
+        EXPECT_EQ(2u, cache._index.size());
+
+        SecurityData security;
+        EXPECT_TRUE(security.AddManifest(v1, manifests, &cache, nullptr));
+        EXPECT_TRUE(security.AddManifest(any, manifests, &cache, nullptr));
+        EXPECT_FALSE(cache._dirty);
+
+        auto role = security.roles.Lookup(id);
+        ASSERT_TRUE(role);
+        EXPECT_EQ(LSHubRoleAllowedNamesDump(role), R"("com.webos.service.test.a")");
+        validate(security, id.c_str(), "com.webos.service.test.a",
+                 pbnjson::JArray{"a"}, pbnjson::JObject{{"/a", pbnjson::JArray{"a"}}},
+                     pbnjson::JObject{},pbnjson::JObject{});
+
+        role = security.roles.Lookup("com.webos.app.any");
+        ASSERT_TRUE(role);
+        EXPECT_EQ(LSHubRoleAllowedNamesDump(role), R"("com.webos.app.any")");
+        validate(security, "com.webos.app.any", "com.webos.app.any", pbnjson::JArray{"a", "b"},
+                 pbnjson::JObject{},pbnjson::JObject{},pbnjson::JObject{});
+
+        const auto &all = security._manifests;
+        auto manifest = all.find(Manifest(v1));
+        ASSERT_TRUE(manifest != all.end());
+        EXPECT_EQ("test", manifest->id);
+    }
+
+    // The cache is private
+    struct stat st;
+    ASSERT_EQ(0, stat(path.c_str(), &st));
+    EXPECT_EQ(0600u, st.st_mode & 0777);
+
+    // Groups are kept along with the rest of the data
+    {
+        SecurityCache cache(path);
+
+        Manifest manifest(v1, manifests);
+        ASSERT_TRUE(manifest.parse(nullptr));
+        auto json = pbnjson::JDomParser::fromFile(v1.c_str(), manifest_schema);
+        ManifestData data;
+        ASSERT_TRUE(ManifestData::ProcessManifest(json, manifests, data, nullptr));
+
+        GroupsPtr groups(LSHubGroupsNewRef(true), LSHubGroupsUnref);
+        groups->groups_name = g_strsplit("a,b", ",", -1);
+        groups->num_groups = 2;
+        groups->trustLevel["a"].push_back(g_intern_string("dev"));
+        data.groups.push_back(std::move(groups));
+
+        cache.Store(manifest, json, data);
+        EXPECT_TRUE(cache.Save(nullptr));
+    }
+    {
+        SecurityCache cache(path);
+
+        Manifest manifest(v1, manifests);
+        ManifestData data;
+        ASSERT_TRUE(cache.Restore(manifest, data));
+        ASSERT_EQ(1u, data.groups.size());
+        const LSHubGroups *groups = data.groups[0].get();
+        ASSERT_EQ(2, groups->num_groups);
+        EXPECT_STREQ("a", groups->groups_name[0]);
+        EXPECT_STREQ("b", groups->groups_name[1]);
+        EXPECT_EQ(nullptr, groups->groups_name[2]);
+        EXPECT_TRUE(groups->access);
+        ASSERT_EQ(1u, groups->trustLevel.size());
+        ASSERT_EQ(1u, groups->trustLevel.at("a").size());
+        EXPECT_STREQ("dev", groups->trustLevel.at("a")[0]);
+    }
+
+    // Cache that somebody else could write is ignored
+    ASSERT_EQ(0, chmod(path.c_str(), 0644));
+    {
+        SecurityCache cache(path);
+        EXPECT_TRUE(cache._index.empty());
+    }
+    ASSERT_EQ(0, chmod(path.c_str(), 0600));
+    ASSERT_EQ(0, chmod(dir_template, 0777));
+    {
+        SecurityCache cache(path);
+        EXPECT_TRUE(cache._index.empty());
+
+        SecurityData security;
+        EXPECT_TRUE(security.AddManifest(any, manifests, &cache, nullptr));
+        EXPECT_FALSE(cache.Save(nullptr));
+    }
+    ASSERT_EQ(0, chmod(dir_template, 0700));
+
+    // Damaged cache is ignored as a whole
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(-1, std::ios::end);
+        file.put('\xff');
+    }
+    {
+        SecurityCache cache(path);
+        EXPECT_TRUE(cache._index.empty());
+    }
+
+    unlink(path.c_str());
+    rmdir(dir_template);
+}
+
+TEST(TestManifest, TestParallel)
+{
+    std::vector<std::string> paths = {
+        manifests + "/v1.manifest.json",
+        manifests + "/v2.manifest.json",
+        manifests + "/invalid.manifest.json",
+        manifests + "/any.manifest.json",
+        manifests + "/v1.manifest.json",
+    };
+
+    SecurityData serial;
+    for (const auto &path : paths)
+    {
+        LS::Error error;
+        (void) serial.AddManifest(path, manifests, error);
+    }
+
+    for (unsigned workers : {1u, 2u, 8u})
+    {
+        SecurityData parallel;
+        parallel.AddManifests(paths, manifests, nullptr, workers);
+
+        EXPECT_EQ(serial._manifests.size(), parallel._manifests.size());
+        EXPECT_EQ(serial.roles.DumpCsv(), parallel.roles.DumpCsv());
+        EXPECT_EQ(serial.services.DumpCsv(), parallel.services.DumpCsv());
+        EXPECT_EQ(serial.permissions.DumpCsv(), parallel.permissions.DumpCsv());
+        EXPECT_EQ(serial.groups.DumpRequiredCsv(), parallel.groups.DumpRequiredCsv());
+        EXPECT_EQ(serial.groups.DumpProvidedCsv(), parallel.groups.DumpProvidedCsv());
+        EXPECT_EQ(serial._manifests_priority["test"].top()->path, parallel._manifests_priority["test"].top()->path);
+    }
+}
+
 TEST(TestManifest, TestManifestQueue)
 {
     Manifest v1("v1", SemanticVersion("1.0.0"));
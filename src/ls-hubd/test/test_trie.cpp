@@ -15,7 +15,7 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #define private public
-#include "../trie.hpp"
+#include "../radix_trie.hpp"
 #undef private
 
 #include <gtest/gtest.h>
@@ -24,12 +24,19 @@
 
 const int DATA_EMPTY = -1;
 
-template <typename T>
-std::map<std::string, T> TrieToMap(const Trie<T> &t)
+struct Data
 {
-    typename std::map<std::string, T> ret;
+    int value;
+    Data(int v = DATA_EMPTY) : value{v} { }
+    bool operator==(const Data &o) const { return value == o.value; }
+    bool IsEmpty() const { return value == DATA_EMPTY; }
+};
+
+std::map<std::string, Data> TrieToMap(const RadixTrie<Data> &t)
+{
+    std::map<std::string, Data> ret;
 
-    auto action = [&](const std::string &key, const T &data)
+    auto action = [&](const std::string &key, const Data &data)
     {
         if (data.value != DATA_EMPTY)
             ret[key] = data;
@@ -39,20 +46,16 @@ std::map<std::string, T> TrieToMap(const Trie<T> &t)
     return ret;
 }
 
-struct Data
-{
-    int value;
-    Data(int v = DATA_EMPTY) : value{v} { }
-    bool operator==(const Data &o) const { return value == o.value; }
-    bool IsEmpty() const { return value == DATA_EMPTY; }
-};
-
 typedef std::map<std::string, Data> MapT;
 
+bool IsBare(const RadixTrie<Data> &t)
+{
+    return !t._nodes[0].first_child;
+}
 
-TEST(TestTrie, Add)
+TEST(TestRadixTrie, Add)
 {
-    Trie<Data> t;
+    RadixTrie<Data> t;
     t.Add("abc")->value = 1;
     EXPECT_EQ(TrieToMap(t), MapT({{"abc", 1}}));
     t.Add("abc*")->value = 2;
@@ -67,9 +70,9 @@ TEST(TestTrie, Add)
     EXPECT_EQ(TrieToMap(t), MapT({{"abc", 2}, {"axy", 3}, {"a", 4}, {"ac", 5}, {"bcd", 6}}));
 }
 
-TEST(TestTrie, Find)
+TEST(TestRadixTrie, Find)
 {
-    Trie<Data> t;
+    RadixTrie<Data> t;
     t.Add("abc")->value = 1;
     t.Add("axy")->value = 3;
     t.Add("a")->value = 4;
@@ -92,9 +95,9 @@ TEST(TestTrie, Find)
     EXPECT_EQ(nullptr, t.Find("acd"));
 }
 
-TEST(TestTrie, Search)
+TEST(TestRadixTrie, Search)
 {
-    Trie<Data> t;
+    RadixTrie<Data> t;
     t.Add("abc")->value = 1;
     t.Add("axy")->value = 3;
     t.Add("a")->value = 4;
@@ -148,9 +151,9 @@ TEST(TestTrie, Search)
     EXPECT_EQ(7, node->value);
 }
 
-TEST(TestTrie, Remove)
+TEST(TestRadixTrie, Remove)
 {
-    Trie<Data> t;
+    RadixTrie<Data> t;
     t.Add("abc")->value = 1;
     t.Add("axy")->value = 3;
     t.Add("a")->value = 4;
@@ -174,5 +177,85 @@ TEST(TestTrie, Remove)
     t.Remove("abc", std::bind(action, _1, _2, "", 1));
     t.Remove("axy", std::bind(action, _1, _2, "", 3));
 
-    EXPECT_TRUE(t.children.empty());
+    EXPECT_TRUE(IsBare(t));
+}
+
+TEST(TestRadixTrie, Compression)
+{
+    RadixTrie<Data> t;
+    t.Add("com.webos.service.foo")->value = 1;
+    t.Add("com.webos.service.bar")->value = 2;
+    t.Add("com.webos.*")->value = 3;
+
+    // root, "com.webos.", "service.", "foo", "bar"
+    EXPECT_EQ(5u, t._nodes.size);
+    EXPECT_EQ(MapT({{"com.webos.", 3}, {"com.webos.service.foo", 1}, {"com.webos.service.bar", 2}}), TrieToMap(t));
+
+    // A key ending in the middle of an edge is materialized only on demand
+    EXPECT_EQ(DATA_EMPTY, t.Find("com.webos.serv")->value);
+    EXPECT_EQ(5u, t._nodes.size);
+    t.Get("com.webos.serv")->value = 4;
+    EXPECT_EQ(6u, t._nodes.size);
+    EXPECT_EQ(4, t.Find("com.webos.serv")->value);
+    EXPECT_EQ(1, t.Find("com.webos.service.foo")->value);
+    EXPECT_EQ(nullptr, t.Get("com.webos.servant"));
+
+    // Nodes of removed keys are reused: "ice." is left with a single child and
+    // is merged into it, "ice.bar" splits into "ice.ba", "r" and "z"
+    t.Remove("com.webos.service.foo", [](const char *, Data &d) { d.value = DATA_EMPTY; });
+    EXPECT_EQ(2u, t._free.size());
+    t.Add("com.webos.service.baz")->value = 5;
+    EXPECT_EQ(6u, t._nodes.size);
+    EXPECT_TRUE(t._free.empty());
+    EXPECT_EQ(MapT({{"com.webos.", 3}, {"com.webos.serv", 4}, {"com.webos.service.bar", 2}, {"com.webos.service.baz", 5}}),
+              TrieToMap(t));
+}
+
+TEST(TestRadixTrie, Reclaim)
+{
+    RadixTrie<Data> t;
+    auto clear = [](const char *, Data &d) { d.value = DATA_EMPTY; };
+
+    t.Add("com.webos.service.foo")->value = 1;
+    t.Add("com.webos.service.bar")->value = 2;
+
+    // Removing a key that ends in the middle of an edge doesn't split it
+    t.Remove("com.webos.serv", [](const char *key, Data &d) { EXPECT_STREQ("", key); EXPECT_TRUE(d.IsEmpty()); });
+    EXPECT_EQ(4u, t._nodes.size);
+    EXPECT_TRUE(t._free.empty());
+
+    // Nodes that are left empty with a single child are merged into it
+    t.Get("com.webos.serv");
+    EXPECT_EQ(5u, t._nodes.size);
+    t.Remove("com.webos.serv", clear);
+    EXPECT_EQ(1u, t._free.size());
+    t.Remove("com.webos.service.bar", clear);
+    EXPECT_EQ(3u, t._free.size());
+    EXPECT_EQ(&t._nodes[t._nodes[0].first_child], t.Find("com.webos.service.foo"));
+    EXPECT_EQ(MapT({{"com.webos.service.foo", 1}}), TrieToMap(t));
+
+    // Labels of removed nodes are reclaimed
+    for (int i = 0; i < 100; ++i)
+    {
+        std::string key = "com.webos.app" + std::to_string(i);
+        t.Add(key.c_str())->value = i;
+        t.Remove(key.c_str(), clear);
+    }
+    EXPECT_LE(t._labels.size(), 2 * (t._labels.size() - t._label_garbage));
+    EXPECT_LT(t._labels.size(), 100u);
+    EXPECT_EQ(MapT({{"com.webos.service.foo", 1}}), TrieToMap(t));
+    EXPECT_EQ(1, t.Find("com.webos.service.foo")->value);
+
+    t.Remove("com.webos.service.foo", clear);
+    EXPECT_TRUE(IsBare(t));
+    EXPECT_TRUE(t._labels.empty());
+
+    t.Add("com.webos.service.foo")->value = 1;
+    t.Clear();
+    EXPECT_TRUE(IsBare(t));
+    EXPECT_EQ(1u, t._nodes.size);
+    EXPECT_TRUE(t._labels.empty());
+    EXPECT_EQ(nullptr, t.Find("com.webos.service.foo"));
+    t.Add("com.webos")->value = 2;
+    EXPECT_EQ(MapT({{"com.webos", 2}}), TrieToMap(t));
 }
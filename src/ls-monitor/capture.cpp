@@ -0,0 +1,396 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "capture.hpp"
+
+#define CAPTURE_BUFFER_SIZE     (1024 * 1024)
+#define CAPTURE_ALIGNMENT       8
+
+static const char zeros[CAPTURE_ALIGNMENT] = {};
+
+static bool
+_TimeBefore(int64_t sec1, int64_t nsec1, const struct timespec &time2)
+{
+    return sec1 < time2.tv_sec || (sec1 == time2.tv_sec && nsec1 < time2.tv_nsec);
+}
+
+CaptureWriter::CaptureWriter():
+    fd(-1),
+    used(0),
+    offset(0),
+    records(0)
+{
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    Close();
+}
+
+bool
+CaptureWriter::WriteAll(const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+
+    while (size > 0)
+    {
+        ssize_t ret = write(fd, bytes, size);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        bytes += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+bool
+CaptureWriter::Append(const void *data, size_t size)
+{
+    offset += size;
+
+    if (used + size > buffer.size())
+    {
+        if (!Flush())
+            return false;
+
+        /* doesn't fit into the buffer at all */
+        if (size > buffer.size())
+            return WriteAll(data, size);
+    }
+
+    memcpy(buffer.data() + used, data, size);
+    used += size;
+    return true;
+}
+
+/**
+ * Create the capture file (replacing what was there) and write its header.
+ *
+ * @retval false with errno set on failure
+ */
+bool
+CaptureWriter::Open(const char *path)
+{
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return false;
+
+    buffer.resize(CAPTURE_BUFFER_SIZE);
+
+    CaptureFileHeader header = {};
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+
+    return Append(&header, sizeof(header));
+}
+
+/**
+ * Append a monitor message to the capture.
+ *
+ * @retval false with errno set on failure
+ */
+bool
+CaptureWriter::Write(_LSTransportMessage *message)
+{
+    LS_ASSERT(fd != -1);
+
+    const _LSMonitorMessageData *message_data = _LSTransportMessageGetMonitorMessageData(message);
+    const char *sender_service_name = _LSTransportMessageGetSenderServiceName(message);
+    const char *sender_unique_name = _LSTransportMessageGetSenderUniqueName(message);
+
+    if (!sender_service_name) sender_service_name = "";
+    if (!sender_unique_name) sender_unique_name = "";
+
+    size_t sender_service_len = strnlen(sender_service_name, UINT16_MAX - 1);
+    size_t sender_unique_len = strnlen(sender_unique_name, UINT16_MAX - 1);
+    size_t body_size = _LSTransportMessageGetBodySize(message);
+
+    CaptureRecord record = {};
+    record.type = _LSTransportMessageGetType(message);
+    record.token = _LSTransportMessageGetToken(message);
+    record.serial = message_data->serial;
+    record.tv_sec = message_data->timestamp.tv_sec;
+    record.tv_nsec = message_data->timestamp.tv_nsec;
+    record.direction = message_data->type;
+#ifdef SECURITY_COMPATIBILITY
+    record.is_public_bus = _LSTransportMessageGetHeader(message)->is_public_bus;
+#endif
+    record.sender_service_size = sender_service_len + 1;
+    record.sender_unique_size = sender_unique_len + 1;
+    record.body_size = body_size;
+
+    size_t size = sizeof(record) + record.sender_service_size + record.sender_unique_size + body_size;
+    size_t padding = (CAPTURE_ALIGNMENT - size % CAPTURE_ALIGNMENT) % CAPTURE_ALIGNMENT;
+    record.size = size + padding;
+
+    if (records % CAPTURE_INDEX_INTERVAL == 0)
+    {
+        index.push_back({offset, record.serial, record.tv_sec, record.tv_nsec});
+    }
+    records++;
+
+    return Append(&record, sizeof(record)) &&
+           Append(sender_service_name, sender_service_len) && Append(zeros, 1) &&
+           Append(sender_unique_name, sender_unique_len) && Append(zeros, 1) &&
+           Append(_LSTransportMessageGetBody(message), body_size) &&
+           Append(zeros, padding);
+}
+
+/**
+ * Write out what is buffered, so that a capture that gets killed keeps it.
+ *
+ * @retval false with errno set on failure
+ */
+bool
+CaptureWriter::Flush()
+{
+    if (fd == -1 || used == 0)
+        return true;
+
+    bool ret = WriteAll(buffer.data(), used);
+    used = 0;
+    return ret;
+}
+
+/**
+ * Write the index and the trailer, and close the file.
+ *
+ * @retval false with errno set on failure
+ */
+bool
+CaptureWriter::Close()
+{
+    if (fd == -1)
+        return true;
+
+    CaptureTrailer trailer = {};
+    trailer.index_offset = offset;
+    trailer.index_count = index.size();
+    trailer.record_count = records;
+    memcpy(trailer.magic, CAPTURE_TRAILER_MAGIC, sizeof(trailer.magic));
+
+    bool ret = Append(index.data(), index.size() * sizeof(CaptureIndexEntry)) &&
+               Append(&trailer, sizeof(trailer)) &&
+               Flush();
+
+    int saved_errno = errno;
+    if (close(fd) != 0 && ret)
+    {
+        saved_errno = errno;
+        ret = false;
+    }
+    fd = -1;
+
+    errno = saved_errno;
+    return ret;
+}
+
+CaptureReader::CaptureReader():
+    map(nullptr),
+    size(0),
+    position(0),
+    trailer(nullptr),
+    index(nullptr),
+    records_end(0)
+{
+}
+
+CaptureReader::~CaptureReader()
+{
+    if (map)
+    {
+        munmap(const_cast<char *>(map), size);
+    }
+}
+
+/**
+ * Map the capture file and check its header, and its index if it has one.
+ */
+bool
+CaptureReader::Open(const char *path, std::string &error)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        error = strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        error = strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    size = st.st_size;
+    if (size < sizeof(CaptureFileHeader))
+    {
+        error = "Not a capture file";
+        close(fd);
+        return false;
+    }
+
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        error = strerror(errno);
+        return false;
+    }
+    map = static_cast<const char *>(addr);
+    madvise(addr, size, MADV_SEQUENTIAL);
+
+    const CaptureFileHeader *header = reinterpret_cast<const CaptureFileHeader *>(map);
+    if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0)
+    {
+        error = "Not a capture file";
+        return false;
+    }
+    if (header->version != CAPTURE_VERSION)
+    {
+        error = "Unsupported capture version " + std::to_string(header->version);
+        return false;
+    }
+
+    position = sizeof(CaptureFileHeader);
+    records_end = size;
+
+    if (size >= sizeof(CaptureFileHeader) + sizeof(CaptureTrailer))
+    {
+        const CaptureTrailer *candidate =
+            reinterpret_cast<const CaptureTrailer *>(map + size - sizeof(CaptureTrailer));
+
+        if (memcmp(candidate->magic, CAPTURE_TRAILER_MAGIC, sizeof(candidate->magic)) == 0 &&
+            candidate->index_offset >= sizeof(CaptureFileHeader) &&
+            candidate->index_offset <= size - sizeof(CaptureTrailer) &&
+            candidate->index_count == (size - sizeof(CaptureTrailer) - candidate->index_offset) /
+                                      sizeof(CaptureIndexEntry))
+        {
+            trailer = candidate;
+            index = reinterpret_cast<const CaptureIndexEntry *>(map + trailer->index_offset);
+            records_end = trailer->index_offset;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Skip the records before the time, using the index.
+ *
+ * The records of different processes are captured in the order they reach
+ * the monitor, so the reader is positioned an index interval early. Some
+ * records before the time are still to be skipped by the caller.
+ */
+bool
+CaptureReader::Seek(const struct timespec &time)
+{
+    if (!index || trailer->index_count == 0)
+        return false;
+
+    const CaptureIndexEntry *end = index + trailer->index_count;
+    const CaptureIndexEntry *entry = std::partition_point(index, end,
+        [&time](const CaptureIndexEntry &e) { return _TimeBefore(e.tv_sec, e.tv_nsec, time); });
+
+    if (entry - index >= 2)
+        position = (entry - 2)->offset;
+    return true;
+}
+
+/**
+ * Get the next record.
+ *
+ * @retval nullptr at the end of the capture, or at a record cut short
+ */
+const CaptureRecord *
+CaptureReader::Next()
+{
+    if (position + sizeof(CaptureRecord) > records_end)
+        return nullptr;
+
+    const CaptureRecord *record = reinterpret_cast<const CaptureRecord *>(map + position);
+    size_t used = sizeof(CaptureRecord) + (size_t) record->sender_service_size +
+                  record->sender_unique_size + record->body_size;
+
+    if (record->size < used || record->size > records_end - position ||
+        record->sender_service_size == 0 || record->sender_unique_size == 0)
+    {
+        return nullptr;
+    }
+
+    const char *names = reinterpret_cast<const char *>(record + 1);
+    if (names[record->sender_service_size - 1] != '\0' ||
+        names[record->sender_service_size + record->sender_unique_size - 1] != '\0')
+    {
+        return nullptr;
+    }
+
+    position += record->size;
+    return record;
+}
+
+const char *
+CaptureReader::GetSenderServiceName(const CaptureRecord *record)
+{
+    return reinterpret_cast<const char *>(record + 1);
+}
+
+const char *
+CaptureReader::GetSenderUniqueName(const CaptureRecord *record)
+{
+    return reinterpret_cast<const char *>(record + 1) + record->sender_service_size;
+}
+
+/**
+ * Rebuild the monitor message of a record.
+ *
+ * The message has no client, so the sender names are to be taken from the
+ * record.
+ *
+ * @retval message with ref count of 1
+ */
+_LSTransportMessage *
+CaptureReader::NewMessage(const CaptureRecord *record)
+{
+    const char *body = GetSenderUniqueName(record) + record->sender_unique_size;
+
+    _LSTransportMessage *message = _LSTransportMessageNewRef(record->body_size);
+    _LSTransportMessageSetType(message, static_cast<_LSTransportMessageType>(record->type));
+    _LSTransportMessageSetToken(message, record->token);
+    if (record->body_size > 0)
+    {
+        _LSTransportMessageSetBody(message, body, record->body_size);
+    }
+#ifdef SECURITY_COMPATIBILITY
+    _LSTransportMessageGetHeader(message)->is_public_bus = record->is_public_bus;
+#endif
+
+    return message;
+}
@@ -0,0 +1,147 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include "transport.h"
+
+/*
+ * Capture file layout (host byte order, to be read on the same architecture):
+ *
+ *   CaptureFileHeader
+ *   CaptureRecord + sender names + raw message body     (for every message)
+ *   ...
+ *   CaptureIndexEntry[]                                 (every CAPTURE_INDEX_INTERVAL-th record)
+ *   CaptureTrailer
+ *
+ * The index and the trailer are written when the capture ends. A capture
+ * that was cut short (killed monitor, full disk) has neither, and is read up
+ * to its last complete record.
+ */
+
+#define CAPTURE_MAGIC           "LS2CAPT"
+#define CAPTURE_TRAILER_MAGIC   "LS2CIDX"
+#define CAPTURE_VERSION         1
+#define CAPTURE_INDEX_INTERVAL  1024
+
+struct CaptureFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct CaptureRecord
+{
+    uint32_t size;                  // of the whole record, padded to 8 bytes
+    uint32_t type;                  // _LSTransportMessageType
+    uint64_t token;
+    uint64_t serial;                // monitor serial
+    int64_t tv_sec;                 // monitor timestamp (monotonic)
+    int64_t tv_nsec;
+    uint8_t direction;              // _LSMonitorMessageType
+    uint8_t is_public_bus;
+    uint16_t sender_service_size;   // with the terminating NUL, following the record
+    uint16_t sender_unique_size;    // with the terminating NUL, following the service name
+    uint16_t reserved;
+    uint32_t body_size;             // of the message body, following the names
+    uint32_t reserved2;
+};
+
+struct CaptureIndexEntry
+{
+    uint64_t offset;
+    uint64_t serial;
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
+
+struct CaptureTrailer
+{
+    uint64_t index_offset;
+    uint64_t index_count;
+    uint64_t record_count;
+    char magic[8];
+};
+
+/**
+ * Streams the messages the monitor gets into a capture file, through a big
+ * buffer so that capturing a busy bus costs a write() every now and then.
+ */
+class CaptureWriter
+{
+    int fd;
+    std::vector<char> buffer;
+    size_t used;
+    uint64_t offset;                // in the file of the end of the buffered data
+    uint64_t records;
+    std::vector<CaptureIndexEntry> index;
+
+    bool Append(const void *data, size_t size);
+    bool WriteAll(const void *data, size_t size);
+
+public:
+    CaptureWriter();
+    ~CaptureWriter();
+    CaptureWriter(const CaptureWriter &) = delete;
+    CaptureWriter &operator=(const CaptureWriter &) = delete;
+
+    bool Open(const char *path);
+    bool Write(_LSTransportMessage *message);
+    bool Flush();
+    bool Close();
+
+    uint64_t GetRecordCount() const { return records; }
+};
+
+/**
+ * Maps a capture file and walks its records.
+ */
+class CaptureReader
+{
+    const char *map;
+    size_t size;
+    size_t position;
+    const CaptureTrailer *trailer;
+    const CaptureIndexEntry *index;
+    size_t records_end;
+
+public:
+    CaptureReader();
+    ~CaptureReader();
+    CaptureReader(const CaptureReader &) = delete;
+    CaptureReader &operator=(const CaptureReader &) = delete;
+
+    bool Open(const char *path, std::string &error);
+    bool Seek(const struct timespec &time);
+    const CaptureRecord *Next();
+
+    bool IsIndexed() const { return trailer != nullptr; }
+    uint64_t GetRecordCount() const { return trailer ? trailer->record_count : 0; }
+
+    static const char *GetSenderServiceName(const CaptureRecord *record);
+    static const char *GetSenderUniqueName(const CaptureRecord *record);
+    static _LSTransportMessage *NewMessage(const CaptureRecord *record);
+};
+
+#endif  /* _CAPTURE_H */
@@ -13,6 +13,8 @@
 // limitations under the License.
 //
 // SPDX-License-Identifier: Apache-2.0
+#include <errno.h>
+#include <math.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <stdlib.h>
@@ -28,8 +30,12 @@
 #include "clock.h"
 #include "monitor_queue.h"
 #include "json_output.hpp"
+#include "capture.hpp"
+#include "traffic_stats.hpp"
 #include "debug_methods.h"
+#include "transport_monitor_filter.h"
 #include "transport_priv.h"
+#include "transport_trace.h"
 
 #define DYNAMIC_SERVICE_STR         "dynamic"
 #define STATIC_SERVICE_STR          "static"
@@ -40,8 +46,12 @@
 
 #define TERMINAL_WIDTH_DEFAULT  80
 #define TERMINAL_WIDTH_WIDE     100
+#define TERMINAL_HEIGHT_DEFAULT 24
 #define HEADER_WIDTH_DEFAULT    45
 
+#define STATS_HEADER_LINES      5
+#define STATS_CALL_TIMEOUT      60  /* seconds a call waits for a reply in the statistics */
+
 typedef struct LSMonitorListInfo
 {
     char *unique_name;
@@ -62,7 +72,22 @@ static GHashTable *dup_hash_table;
 static const char *list_servicename_methods = NULL;
 static const char *get_servicename_api_version = NULL;
 static const char *message_filter_str = NULL;
+static const char *method_filter_str = NULL;
+static const char *types_filter_str = NULL;
+static gint sample_rate = 1;
+static std::string filter_expression;
+static _LSTransportMonitorFilter *filter = NULL;
 static std::unique_ptr<JsonOutputFormatter> json_formatter;
+static const char *capture_file = NULL;
+static const char *analyze_file = NULL;
+static const char *window_str = NULL;
+static double window_from = 0;
+static double window_to = HUGE_VAL;
+static std::unique_ptr<CaptureWriter> capture_writer;
+static gboolean stats_output = false;
+static gint stats_interval = 1;
+static std::unique_ptr<TrafficStats> traffic_stats;
+static struct timespec stats_time;
 static gboolean list_clients = false;
 static gboolean list_subscriptions = false;
 static gboolean list_malloc = false;
@@ -72,16 +97,20 @@ static gboolean json_output = false;
 static gboolean two_line_output = false;
 static gboolean sort_by_timestamps = false;
 static gboolean dump_hub_data = false;
+static gboolean trace_messages = false;
 static GMainLoop *mainloop = NULL;
 static int exit_code = EXIT_SUCCESS;
 
 static std::string ls_monitor_service_name = MONITOR_NAME;
 
 static uint32_t terminal_width = TERMINAL_WIDTH_DEFAULT;
+static uint32_t terminal_height = TERMINAL_HEIGHT_DEFAULT;
 
 static _LSTransport *transport = NULL;
 static GSList *sub_replies = NULL;
 static _LSMonitorQueue *queue = NULL;
+static _LSTransportTraceReader *trace_reader = NULL;
+static unsigned long trace_dropped = 0;
 
 /* time1 - time2 */
 double
@@ -189,9 +218,173 @@ _LSMonitorMessagePrint(_LSTransportMessage *message)
     }
 }
 
+static void
+_LSMonitorCaptureFailed()
+{
+    /* report the first error only */
+    if (exit_code == EXIT_SUCCESS)
+    {
+        fprintf(stderr, "Failed to write capture %s: %s\n", capture_file, strerror(errno));
+        exit_code = EXIT_FAILURE;
+        g_main_loop_quit(mainloop);
+    }
+}
+
+/**
+ * Write out the captured messages every now and then, so that little is lost
+ * if the monitor gets killed
+ */
+static gboolean
+_LSMonitorCaptureFlushHandler(gpointer data)
+{
+    if (!capture_writer->Flush())
+    {
+        _LSMonitorCaptureFailed();
+    }
+    return TRUE;
+}
+
+/**
+ * Print the statistics of the last interval, top-like on a terminal
+ */
+static gboolean
+_LSMonitorStatsHandler(gpointer data)
+{
+    struct timespec now;
+    ClockGetTime(&now);
+    double interval = _LSMonitorTimeDiff(&now, &stats_time);
+    stats_time = now;
+
+    traffic_stats->ExpireCalls(STATS_CALL_TIMEOUT);
+
+    if (json_output)
+    {
+        traffic_stats->PrintJson(stdout, interval);
+    }
+    else if (isatty(STDOUT_FILENO))
+    {
+        /* clear the screen and fit the busiest methods on it */
+        fprintf(stdout, "\033[H\033[2J");
+        traffic_stats->PrintTop(stdout, interval,
+                                terminal_height > STATS_HEADER_LINES ? terminal_height - STATS_HEADER_LINES : 1);
+    }
+    else
+    {
+        traffic_stats->PrintTop(stdout, interval, SIZE_MAX);
+        fprintf(stdout, "\n");
+    }
+    fflush(stdout);
+
+    traffic_stats->StartInterval();
+    return TRUE;
+}
+
+/**
+ * Analyze a capture file (within the window) and print the results
+ */
+static int
+_LSMonitorAnalyzeCapture()
+{
+    CaptureReader reader;
+    std::string error;
+
+    if (!reader.Open(analyze_file, error))
+    {
+        fprintf(stderr, "Failed to read capture %s: %s\n", analyze_file, error.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (!reader.IsIndexed())
+    {
+        fprintf(stderr, "Capture %s has no index (it was cut short), reading up to its last complete message\n",
+                analyze_file);
+    }
+
+    TrafficStats analyzer;
+    const CaptureRecord *record = reader.Next();
+
+    if (record)
+    {
+        struct timespec start = { (time_t) record->tv_sec, (long) record->tv_nsec };
+
+        if (window_from > 0)
+        {
+            struct timespec from = start;
+            from.tv_sec += (time_t) window_from;
+            from.tv_nsec += (long) ((window_from - floor(window_from)) * 1000000000.0);
+            if (from.tv_nsec >= 1000000000)
+            {
+                from.tv_sec++;
+                from.tv_nsec -= 1000000000;
+            }
+
+            if (reader.Seek(from))
+            {
+                record = reader.Next();
+            }
+        }
+
+        for (; record; record = reader.Next())
+        {
+            struct timespec timestamp = { (time_t) record->tv_sec, (long) record->tv_nsec };
+            double offset = _LSMonitorTimeDiff(&timestamp, &start);
+
+            if (offset >= window_from && offset <= window_to)
+            {
+                analyzer.AddRecord(record);
+            }
+        }
+    }
+
+    analyzer.Print(stdout);
+    return EXIT_SUCCESS;
+}
+
 static LSMessageHandlerResult
 _LSMonitorMessageHandler(_LSTransportMessage *message, void *context)
 {
+    /* the hub refused the monitor request (bad filter) */
+    if (_LSTransportMessageGetType(message) == _LSTransportMessageTypeError)
+    {
+        fprintf(stderr, "Monitor request failed: %s\n", _LSTransportMessageGetPayload(message));
+        exit_code = EXIT_FAILURE;
+        g_main_loop_quit(mainloop);
+        return LSMessageHandlerResultHandled;
+    }
+
+    /* clients filter what they send us, but older ones don't (sampling
+     * picks the same messages again) */
+    if (filter && _LSTransportMessageIsMonitorType(message) &&
+        !(_LSTransportMonitorFilterMatch(filter, message,
+                                         _LSTransportMessageGetSenderServiceName(message),
+                                         _LSTransportMessageGetSenderUniqueName(message),
+                                         _LSTransportMessageGetDestServiceName(message),
+                                         _LSTransportMessageGetDestUniqueName(message)) &&
+          _LSTransportMonitorFilterSample(filter, message,
+                                          _LSTransportMessageGetSenderUniqueName(message),
+                                          _LSTransportMessageGetDestUniqueName(message))))
+    {
+        return LSMessageHandlerResultHandled;
+    }
+
+    if (capture_writer)
+    {
+        if (_LSTransportMessageIsMonitorType(message) && !capture_writer->Write(message))
+        {
+            _LSMonitorCaptureFailed();
+        }
+        return LSMessageHandlerResultHandled;
+    }
+
+    if (traffic_stats)
+    {
+        if (_LSTransportMessageIsMonitorType(message))
+        {
+            traffic_stats->Add(message, _LSTransportMessageGetSenderUniqueName(message));
+        }
+        return LSMessageHandlerResultHandled;
+    }
+
     if (sort_by_timestamps)
     {
         _LSMonitorMessagePrint(message);
@@ -205,6 +398,32 @@ _LSMonitorMessageHandler(_LSTransportMessage *message, void *context)
     return LSMessageHandlerResultHandled;
 }
 
+static void
+_LSMonitorTraceHandler(_LSTransportMessage *message, void *context)
+{
+    _LSMonitorMessageHandler(message, context);
+}
+
+/**
+ * Read the messages traced by the services since the last time
+ */
+static gboolean
+_LSMonitorTraceReadHandler(gpointer data)
+{
+    _LSTransportTraceReader *reader = static_cast<_LSTransportTraceReader *>(data);
+
+    _LSTransportTraceReaderRead(reader, _LSMonitorTraceHandler, NULL);
+
+    unsigned long dropped = _LSTransportTraceReaderGetDropped(reader);
+    if (dropped != trace_dropped)
+    {
+        fprintf(stderr, "%lu messages dropped (services traced faster than the monitor could read)\n",
+                dropped - trace_dropped);
+        trace_dropped = dropped;
+    }
+    return TRUE;
+}
+
 static void
 _PrintMonitorListInfo(const GSList *info_list)
 {
@@ -610,6 +829,15 @@ _HandleCommandline(int argc, char *argv[])
         {"json", 'j', 0, G_OPTION_ARG_NONE, &json_output, "Print JSON formatted output for easier parsing. Take precedence over debug", NULL},
         {"sort-by-timestamps", 't', 0, G_OPTION_ARG_NONE, &sort_by_timestamps, "Sort output by timestamps instead of serials", NULL},
         {"dump-hub-data-csv", 0, 0, G_OPTION_ARG_NONE, &dump_hub_data, "Dump hub data in CSV format", NULL},
+        {"method", 0, 0, G_OPTION_ARG_STRING, &method_filter_str, "Filter by category/method (glob), filtered by the services themselves", "/com/webos/*"},
+        {"types", 0, 0, G_OPTION_ARG_STRING, &types_filter_str, "Filter by message types (call, cancel, signal, reply), filtered by the services themselves", "call,reply"},
+        {"sample", 0, 0, G_OPTION_ARG_INT, &sample_rate, "Only get about one of every N calls (with their replies) and signals", "N"},
+        {"capture", 'w', 0, G_OPTION_ARG_FILENAME, &capture_file, "Write the messages to a binary capture file instead of printing them", "FILE"},
+        {"analyze", 'r', 0, G_OPTION_ARG_FILENAME, &analyze_file, "Analyze a capture file: message rates, payload sizes and method call latencies", "FILE"},
+        {"window", 0, 0, G_OPTION_ARG_STRING, &window_str, "Only analyze the messages captured from FROM to TO seconds after the start of the capture", "FROM-TO"},
+        {"stats", 'S', 0, G_OPTION_ARG_NONE, &stats_output, "Print call rates and latencies by method, refreshed periodically. JSON lines with -j", NULL},
+        {"stats-interval", 0, 0, G_OPTION_ARG_INT, &stats_interval, "Seconds between refreshes of the statistics (1 by default)", "SECONDS"},
+        {"trace", 'T', 0, G_OPTION_ARG_NONE, &trace_messages, "Read messages from the services' trace buffers instead of having them copied to the monitor (by the services that can trace). Messages may be dropped and payloads cut", NULL},
         { NULL }
     };
 
@@ -639,6 +867,49 @@ _HandleCommandline(int argc, char *argv[])
     }
 #endif
 
+    if (window_str && (sscanf(window_str, "%lf-%lf", &window_from, &window_to) < 1 ||
+                       window_from < 0 || window_from > window_to))
+    {
+        g_critical("Invalid window: %s", window_str);
+        exit(EXIT_FAILURE);
+    }
+
+    if (stats_interval < 1)
+    {
+        g_critical("Invalid statistics interval: %d", stats_interval);
+        exit(EXIT_FAILURE);
+    }
+
+    if (stats_output && capture_file)
+    {
+        g_critical("Statistics can't be printed while capturing, analyze the capture instead");
+        exit(EXIT_FAILURE);
+    }
+
+    /* what the services are to send us */
+    if (message_filter_str)
+        filter_expression += std::string(" service=") + message_filter_str;
+    if (method_filter_str)
+        filter_expression += std::string(" method=") + method_filter_str;
+    if (types_filter_str)
+        filter_expression += std::string(" types=") + types_filter_str;
+    if (sample_rate != 1)
+        filter_expression += " sample=" + std::to_string(sample_rate);
+
+    if (!filter_expression.empty())
+    {
+        LSError lserror;
+        LSErrorInit(&lserror);
+
+        filter = _LSTransportMonitorFilterNew(filter_expression.c_str(), &lserror);
+        if (!filter)
+        {
+            g_critical("Invalid filter: %s", lserror.message);
+            LSErrorFree(&lserror);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (compact_output)
     {
         debug_output = false;
@@ -654,9 +925,14 @@ static void
 _HandleTerminal()
 {
 #ifdef TIOCGWINSZ
-    struct winsize w;
+    struct winsize w = {};
     ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
 
+    if (w.ws_row > 0)
+    {
+        terminal_height = w.ws_row;
+    }
+
     if (w.ws_col > TERMINAL_WIDTH_DEFAULT)
     {
         terminal_width = w.ws_col;
@@ -710,6 +986,12 @@ main(int argc, char *argv[])
     _HandleCommandline(argc, argv);
     _HandleTerminal();
 
+    if (analyze_file)
+    {
+        /* offline, no need for the hub */
+        return _LSMonitorAnalyzeCapture();
+    }
+
     if (list_clients || list_servicename_methods || get_servicename_api_version || dump_hub_data)
     {
         ls_monitor_service_name += std::to_string(getpid());
@@ -791,14 +1073,59 @@ main(int argc, char *argv[])
     }
     else
     {
-        /* send the message to the hub to tell clients to connect to us */
+        if (capture_file)
+        {
+            capture_writer = std::unique_ptr<CaptureWriter>(new CaptureWriter());
+            if (!capture_writer->Open(capture_file))
+            {
+                fprintf(stderr, "Failed to create capture %s: %s\n", capture_file, strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            g_timeout_add(1000, _LSMonitorCaptureFlushHandler, NULL);
+        }
+
+        if (stats_output)
+        {
+            traffic_stats = std::unique_ptr<TrafficStats>(new TrafficStats());
+            ClockGetTime(&stats_time);
+            g_timeout_add_seconds(stats_interval, _LSMonitorStatsHandler, NULL);
+        }
 
-        if (!LSTransportSendMessageMonitorRequest(transport, &lserror))
+        if (trace_messages)
+        {
+            /* services append their messages to their trace buffers, we read them */
+            trace_reader = _LSTransportTraceReaderNew(transport, &lserror);
+            if (!trace_reader)
+            {
+                _error(lserror);
+            }
+            g_timeout_add(100, _LSMonitorTraceReadHandler, trace_reader);
+
+            /* send the message to the hub to tell clients to trace (or connect, if they can't) */
+            if (!LSTransportSendMessageMonitorRequestTraced(transport,
+                                                            filter ? filter_expression.c_str() : NULL,
+                                                            &lserror))
+            {
+                _error(lserror);
+            }
+        }
+        /* send the message to the hub to tell clients to connect to us */
+        else if (!LSTransportSendMessageMonitorRequestFiltered(transport,
+                                                               filter ? filter_expression.c_str() : NULL,
+                                                               &lserror))
         {
             _error(lserror);
         }
 
-        if (json_output)
+        if (capture_writer)
+        {
+            fprintf(stderr, "Capturing to %s\n", capture_file);
+        }
+        else if (traffic_stats)
+        {
+            /* the statistics come with their own header */
+        }
+        else if (json_output)
         {
             json_formatter = std::unique_ptr<JsonOutputFormatter>(new JsonOutputFormatter(stdout));
         }
@@ -822,6 +1149,26 @@ main(int argc, char *argv[])
     g_main_loop_run(mainloop);
     g_main_loop_unref(mainloop);
 
+    if (trace_reader)
+    {
+        _LSTransportTraceReaderFree(trace_reader);
+    }
+
+    if (filter)
+    {
+        _LSTransportMonitorFilterUnref(filter);
+    }
+
+    if (capture_writer)
+    {
+        if (!capture_writer->Close() && exit_code == EXIT_SUCCESS)
+        {
+            fprintf(stderr, "Failed to write capture %s: %s\n", capture_file, strerror(errno));
+            exit_code = EXIT_FAILURE;
+        }
+        fprintf(stderr, "%" PRIu64 " messages captured\n", capture_writer->GetRecordCount());
+    }
+
     _DisconnectCustomTransport();
 
     g_hash_table_destroy(dup_hash_table);
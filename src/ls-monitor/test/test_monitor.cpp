@@ -20,6 +20,7 @@
 #include <gtest/gtest.h>
 #include <sstream>
 #include <cstdio>
+#include <cstring>
 
 #include <signal.h>
 #include <sys/types.h>
@@ -287,3 +288,140 @@ TEST_F(TestMonitor, ApiVersion)
     auto output = oss.str();
     ASSERT_EQ(output, "com.webos.versioned 3.14\n");
 }
+
+TEST_F(TestMonitor, CaptureAndAnalyze)
+{
+    // First try to launch given ls-monitor from the build system.  Resort to
+    // the system one otherwise (for testing on the target, for instance).
+    const char *ls_monitor = LS_MONITOR;
+    if (access(ls_monitor, X_OK))
+        ls_monitor = "ls-monitor";
+    std::cout << "Using monitor: " << ls_monitor << std::endl;
+
+    char capture[] = "/tmp/ls-monitor-capture-XXXXXX";
+    int fd = mkstemp(capture);
+    ASSERT_NE(-1, fd);
+    close(fd);
+
+    std::string command = std::string{"cd /; "} + ls_monitor + " -w " + capture;
+
+    unique_ptr<FILE, int (*)(FILE*)> f{
+        popen(command.c_str(), "r"),
+        pclose
+    };
+    ASSERT_TRUE(f.get() != NULL);
+    // Let the monitor get ready registering itself.
+    usleep(100000);
+
+    {
+        auto main_ctx = mk_ptr(g_main_context_new(), g_main_context_unref);
+        auto s = LS::registerService("com.webos.B");
+        s.attachToLoop(main_ctx.get());
+        auto c = s.callOneReply("luna://com.webos.A/test/method", "{}");
+        c.get();
+    }
+
+    // Let the monitor settle down, it writes the index on exit.
+    sleep(2);
+    ASSERT_NE(system("killall ls-monitor"), -1);
+    f.reset();
+
+    command = std::string{"cd /; "} + ls_monitor + " -r " + capture;
+    f = unique_ptr<FILE, int (*)(FILE*)>{
+        popen(command.c_str(), "r"),
+        pclose
+    };
+    ASSERT_TRUE(f.get() != NULL);
+
+    ostringstream oss;
+    char buff[512];
+    while (fgets(buff, sizeof(buff), f.get()))
+        oss << buff;
+    unlink(capture);
+
+    auto output = oss.str();
+    cout << "============= ls-monitor analysis =============\n" << output;
+    cout << "\n===============================================" << endl;
+
+    // One call, replied
+    istringstream iss{output};
+    std::string line;
+    bool found = false;
+    while (getline(iss, line))
+    {
+        if (line.compare(0, strlen("com.webos.A/test/method"), "com.webos.A/test/method") != 0)
+            continue;
+
+        istringstream columns{line};
+        std::string method;
+        int calls = 0, replied = 0;
+        columns >> method >> calls >> replied;
+        EXPECT_EQ(1, calls);
+        EXPECT_EQ(1, replied);
+        found = true;
+    }
+    EXPECT_TRUE(found) << "Expecting the method in the analysis";
+}
+
+TEST_F(TestMonitor, Stats)
+{
+    // First try to launch given ls-monitor from the build system.  Resort to
+    // the system one otherwise (for testing on the target, for instance).
+    const char *ls_monitor = LS_MONITOR;
+    if (access(ls_monitor, X_OK))
+        ls_monitor = "ls-monitor";
+    std::cout << "Using monitor: " << ls_monitor << std::endl;
+
+    std::string command = std::string{"cd /; "} + ls_monitor + " -S -j";
+
+    unique_ptr<FILE, int (*)(FILE*)> f{
+        popen(command.c_str(), "r"),
+        pclose
+    };
+    ASSERT_TRUE(f.get() != NULL);
+    // Let the monitor get ready registering itself.
+    usleep(100000);
+
+    thread t{
+        [this]() {
+            auto main_ctx = mk_ptr(g_main_context_new(), g_main_context_unref);
+            auto s = LS::registerService("com.webos.B");
+            s.attachToLoop(main_ctx.get());
+            auto c = s.callOneReply("luna://com.webos.A/test/method", "{}");
+            c.get();
+            s = {}; // unregister our service
+
+            // Let the monitor refresh the statistics.
+            sleep(2);
+            ASSERT_NE(system("killall ls-monitor"), -1);
+        }
+    };
+
+    ostringstream oss;
+    char buff[4096];
+    while (fgets(buff, sizeof(buff), f.get()))
+        oss << buff;
+    t.join();
+
+    auto output = oss.str();
+    cout << "============= ls-monitor statistics =============\n" << output;
+    cout << "\n=================================================" << endl;
+
+    // The last refresh has the call, replied
+    auto start = output.rfind('\n', output.size() - 2);
+    auto stats = pbnjson::JDomParser::fromString(output.substr(start == string::npos ? 0 : start + 1));
+    ASSERT_TRUE(stats.isValid());
+
+    bool found = false;
+    for (const auto &method : stats["methods"].items())
+    {
+        if (method["method"].asString() != "com.webos.A/test/method")
+            continue;
+
+        EXPECT_EQ(1, method["calls"].asNumber<int64_t>());
+        EXPECT_EQ(1, method["replied"].asNumber<int64_t>());
+        EXPECT_LE(0, method["latencyMs"]["max"].asNumber<double>());
+        found = true;
+    }
+    EXPECT_TRUE(found) << "Expecting the method in the statistics";
+}
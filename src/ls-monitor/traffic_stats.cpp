@@ -0,0 +1,415 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <pbnjson.hpp>
+
+#include "traffic_stats.hpp"
+
+using namespace pbnjson;
+
+#define HISTOGRAM_SUB_BUCKETS_LOG2  4
+#define HISTOGRAM_SUB_BUCKETS       (1 << HISTOGRAM_SUB_BUCKETS_LOG2)
+
+static double
+_TimeDiff(const struct timespec &time1, const struct timespec &time2)
+{
+    return (time1.tv_sec - time2.tv_sec) + (time1.tv_nsec - time2.tv_nsec) / 1000000000.0;
+}
+
+static bool
+_TimeBefore(const struct timespec &time1, const struct timespec &time2)
+{
+    return time1.tv_sec < time2.tv_sec || (time1.tv_sec == time2.tv_sec && time1.tv_nsec < time2.tv_nsec);
+}
+
+static const char *
+_TypeName(_LSTransportMessageType type)
+{
+    switch (type)
+    {
+    case _LSTransportMessageTypeMethodCall:
+        return "call";
+    case _LSTransportMessageTypeCancelMethodCall:
+        return "cancel";
+    case _LSTransportMessageTypeSignal:
+        return "signal";
+    case _LSTransportMessageTypeReply:
+    case _LSTransportMessageTypeReplyWithFd:
+        return "reply";
+    default:
+        return "other";
+    }
+}
+
+TrafficHistogram::TrafficHistogram():
+    count(0),
+    max(0)
+{
+}
+
+size_t
+TrafficHistogram::Bucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return value;
+
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BUCKETS_LOG2;
+    size_t sub_bucket = (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+
+    return HISTOGRAM_SUB_BUCKETS + shift * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t
+TrafficHistogram::BucketTop(size_t bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+
+    int shift = (bucket - HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_SUB_BUCKETS;
+    uint64_t sub_bucket = (bucket - HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_SUB_BUCKETS;
+    uint64_t bottom = (HISTOGRAM_SUB_BUCKETS + sub_bucket) << shift;
+
+    return bottom + (UINT64_C(1) << shift) - 1;
+}
+
+void
+TrafficHistogram::Add(uint64_t value)
+{
+    size_t bucket = Bucket(value);
+    if (bucket >= buckets.size())
+    {
+        buckets.resize(bucket + 1);
+    }
+
+    buckets[bucket]++;
+    count++;
+    max = std::max(max, value);
+}
+
+/**
+ * Get the value under which the percentile of the values are (to the
+ * precision of the buckets).
+ */
+uint64_t
+TrafficHistogram::Percentile(double percentile) const
+{
+    if (count == 0)
+        return 0;
+
+    uint64_t target = std::max<uint64_t>(1, ceil(percentile / 100.0 * count));
+    uint64_t seen = 0;
+
+    for (size_t bucket = 0; bucket < buckets.size(); bucket++)
+    {
+        seen += buckets[bucket];
+        if (seen >= target)
+            return std::min(BucketTop(bucket), max);
+    }
+    return max;
+}
+
+TrafficStats::TrafficStats():
+    messages(0),
+    unmatched_replies(0),
+    expired_calls(0),
+    first{0, 0},
+    last{0, 0}
+{
+}
+
+void
+TrafficStats::AddCall(_LSTransportMessage *message, const char *sender_unique_name,
+                      const struct timespec &timestamp, size_t payload_size)
+{
+    const char *callee = _LSTransportMessageGetDestUniqueName(message);
+    const char *service = _LSTransportMessageGetDestServiceName(message);
+    const char *category = _LSTransportMessageGetCategory(message);
+    const char *method = _LSTransportMessageGetMethod(message);
+
+    /* "/" + "foo" is "/foo", "/cat" + "foo" is "/cat/foo" */
+    std::string name = (service && *service) ? service : callee;
+    name += category;
+    if (name.back() != '/')
+        name += '/';
+    name += method;
+
+    MethodStats &stats = methods[name];
+    stats.calls++;
+    stats.interval_calls++;
+    stats.payload.Add(payload_size);
+
+    pending[CallKey{sender_unique_name, callee, _LSTransportMessageGetToken(message)}] = {&stats, timestamp};
+}
+
+void
+TrafficStats::AddReply(_LSTransportMessage *message, const char *sender_unique_name,
+                       const struct timespec &timestamp)
+{
+    auto it = pending.find(CallKey{_LSTransportMessageGetDestUniqueName(message),
+                                   sender_unique_name,
+                                   _LSTransportMessageGetReplyToken(message)});
+    if (it == pending.end())
+    {
+        unmatched_replies++;
+        return;
+    }
+
+    double latency = _TimeDiff(timestamp, it->second.sent);
+
+    it->second.method->replied++;
+    it->second.method->latency.Add(latency > 0 ? llround(latency * 1000000.0) : 0);
+    pending.erase(it);
+}
+
+/**
+ * Account a monitor message.
+ *
+ * @param  message              IN  monitor message
+ * @param  sender_unique_name   IN  unique name of the service the message came from
+ */
+void
+TrafficStats::Add(_LSTransportMessage *message, const char *sender_unique_name)
+{
+    const _LSMonitorMessageData *message_data = _LSTransportMessageGetMonitorMessageData(message);
+    const struct timespec &timestamp = message_data->timestamp;
+
+    if (messages == 0 || _TimeBefore(timestamp, first))
+        first = timestamp;
+    if (messages == 0 || _TimeBefore(last, timestamp))
+        last = timestamp;
+    messages++;
+
+    if (!sender_unique_name)
+        sender_unique_name = "";
+
+    _LSTransportMessageType type = _LSTransportMessageGetType(message);
+    bool is_reply = type == _LSTransportMessageTypeReply || type == _LSTransportMessageTypeReplyWithFd;
+
+    if (message_data->type == _LSMonitorMessageTypeTx)
+    {
+        const char *payload = _LSTransportMessageGetPayload(message);
+        size_t payload_size = payload ? strlen(payload) : 0;
+
+        TypeStats &stats = types[_TypeName(type)];
+        stats.messages++;
+        stats.interval_messages++;
+        stats.per_second[timestamp.tv_sec]++;
+        stats.payload.Add(payload_size);
+
+        if (type == _LSTransportMessageTypeMethodCall)
+        {
+            AddCall(message, sender_unique_name, timestamp, payload_size);
+        }
+    }
+    else if (is_reply)
+    {
+        AddReply(message, sender_unique_name, timestamp);
+    }
+}
+
+/**
+ * Account a record of a capture.
+ */
+void
+TrafficStats::AddRecord(const CaptureRecord *record)
+{
+    _LSTransportMessage *message = CaptureReader::NewMessage(record);
+    Add(message, CaptureReader::GetSenderUniqueName(record));
+    _LSTransportMessageUnref(message);
+}
+
+/**
+ * Give up on the calls that have waited for a reply longer than the age (in
+ * seconds), so that calls that never get one don't pile up.
+ */
+void
+TrafficStats::ExpireCalls(double age)
+{
+    for (auto it = pending.begin(); it != pending.end();)
+    {
+        if (_TimeDiff(last, it->second.sent) > age)
+        {
+            it = pending.erase(it);
+            expired_calls++;
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+/**
+ * Start counting the rates of the next interval.
+ */
+void
+TrafficStats::StartInterval()
+{
+    for (auto &type : types)
+    {
+        type.second.interval_messages = 0;
+    }
+    for (auto &method : methods)
+    {
+        method.second.interval_calls = 0;
+    }
+}
+
+std::vector<TrafficStats::MethodEntry>
+TrafficStats::SortMethods(bool by_interval) const
+{
+    std::vector<MethodEntry> sorted;
+    for (const auto &method : methods)
+    {
+        sorted.emplace_back(&method.first, &method.second);
+    }
+
+    std::sort(sorted.begin(), sorted.end(),
+              [by_interval](const MethodEntry &a, const MethodEntry &b)
+              {
+                  if (by_interval && a.second->interval_calls != b.second->interval_calls)
+                      return a.second->interval_calls > b.second->interval_calls;
+                  if (a.second->calls != b.second->calls)
+                      return a.second->calls > b.second->calls;
+                  return *a.first < *b.first;
+              });
+    return sorted;
+}
+
+/**
+ * Print the analysis of a capture.
+ */
+void
+TrafficStats::Print(FILE *file) const
+{
+    double duration = messages ? _TimeDiff(last, first) : 0;
+
+    fprintf(file, "%" PRIu64 " messages (TX and RX copies) over %.3f s\n\n", messages, duration);
+
+    fprintf(file, "%-8s %10s %10s %10s %10s %10s %10s %10s\n",
+            "TYPE", "MESSAGES", "AVG/S", "PEAK/S", "P50 B", "P90 B", "P99 B", "MAX B");
+    for (const auto &type : types)
+    {
+        const TypeStats &stats = type.second;
+        uint64_t peak = 0;
+        for (const auto &second : stats.per_second)
+        {
+            peak = std::max(peak, second.second);
+        }
+
+        fprintf(file, "%-8s %10" PRIu64 " %10.1f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+                type.first.c_str(), stats.messages, duration > 0 ? stats.messages / duration : 0.0, peak,
+                stats.payload.Percentile(50), stats.payload.Percentile(90),
+                stats.payload.Percentile(99), stats.payload.GetMax());
+    }
+
+    fprintf(file, "\n%-50s %8s %8s %10s %10s %10s %10s %10s\n",
+            "METHOD", "CALLS", "REPLIED", "P50 MS", "P90 MS", "P99 MS", "MAX MS", "P50 B");
+    for (const auto &method : SortMethods(false))
+    {
+        const MethodStats &stats = *method.second;
+
+        fprintf(file, "%-50s %8" PRIu64 " %8" PRIu64 " %10.3f %10.3f %10.3f %10.3f %10" PRIu64 "\n",
+                method.first->c_str(), stats.calls, stats.replied,
+                stats.latency.Percentile(50) / 1000.0, stats.latency.Percentile(90) / 1000.0,
+                stats.latency.Percentile(99) / 1000.0, stats.latency.GetMax() / 1000.0,
+                stats.payload.Percentile(50));
+    }
+
+    fprintf(file, "\nCalls without a captured reply: %" PRIu64 "\n", pending.size() + expired_calls);
+    fprintf(file, "Replies without a captured call (subscription updates, calls from before the capture): %" PRIu64 "\n",
+            unmatched_replies);
+}
+
+/**
+ * Print the rates of the last interval (in seconds) and the latencies so far
+ * as a table of the busiest methods.
+ */
+void
+TrafficStats::PrintTop(FILE *file, double interval, size_t rows) const
+{
+    auto rate = [interval](uint64_t count) { return interval > 0 ? count / interval : 0.0; };
+    auto type_rate = [this, &rate](const char *name)
+    {
+        auto it = types.find(name);
+        return it == types.end() ? 0.0 : rate(it->second.interval_messages);
+    };
+
+    fprintf(file, "%.1f calls/s, %.1f replies/s, %.1f signals/s, %zu methods, %zu calls waiting for a reply\n\n",
+            type_rate("call"), type_rate("reply"), type_rate("signal"), methods.size(), pending.size());
+
+    fprintf(file, "%-50s %10s %10s %10s %10s %10s %10s %10s\n",
+            "METHOD", "CALLS/S", "CALLS", "REPLIED", "P50 MS", "P90 MS", "P99 MS", "MAX MS");
+
+    std::vector<MethodEntry> sorted = SortMethods(true);
+    if (sorted.size() > rows)
+    {
+        sorted.resize(rows);
+    }
+
+    for (const auto &method : sorted)
+    {
+        const MethodStats &stats = *method.second;
+
+        fprintf(file, "%-50s %10.1f %10" PRIu64 " %10" PRIu64 " %10.3f %10.3f %10.3f %10.3f\n",
+                method.first->c_str(), rate(stats.interval_calls), stats.calls, stats.replied,
+                stats.latency.Percentile(50) / 1000.0, stats.latency.Percentile(90) / 1000.0,
+                stats.latency.Percentile(99) / 1000.0, stats.latency.GetMax() / 1000.0);
+    }
+}
+
+/**
+ * Print the same as @ref PrintTop, for all the methods, as a single line of
+ * JSON.
+ */
+void
+TrafficStats::PrintJson(FILE *file, double interval) const
+{
+    auto rate = [interval](uint64_t count) { return interval > 0 ? count / interval : 0.0; };
+
+    JValue rates = JObject();
+    for (const auto &type : types)
+    {
+        rates.put(type.first, rate(type.second.interval_messages));
+    }
+
+    JValue list = JArray();
+    for (const auto &method : SortMethods(true))
+    {
+        const MethodStats &stats = *method.second;
+
+        list.append(JObject({{"method", *method.first},
+                             {"callsPerSecond", rate(stats.interval_calls)},
+                             {"calls", (int64_t) stats.calls},
+                             {"replied", (int64_t) stats.replied},
+                             {"latencyMs", JObject({{"p50", stats.latency.Percentile(50) / 1000.0},
+                                                    {"p90", stats.latency.Percentile(90) / 1000.0},
+                                                    {"p99", stats.latency.Percentile(99) / 1000.0},
+                                                    {"max", stats.latency.GetMax() / 1000.0}})}}));
+    }
+
+    JValue output = JObject({{"time", last.tv_sec + last.tv_nsec / 1000000000.0},
+                             {"interval", interval},
+                             {"rates", rates},
+                             {"pending", (int64_t) pending.size()},
+                             {"methods", list}});
+
+    fprintf(file, "%s\n", output.stringify().c_str());
+}
@@ -0,0 +1,138 @@
+// Copyright (c) 2021 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+
+#ifndef _TRAFFIC_STATS_H
+#define _TRAFFIC_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "capture.hpp"
+
+/**
+ * Value distribution in log-linear buckets (16 per power of two), good to
+ * about 6% whatever the range, in constant memory however long it runs.
+ */
+class TrafficHistogram
+{
+    std::vector<uint64_t> buckets;
+    uint64_t count;
+    uint64_t max;
+
+    static size_t Bucket(uint64_t value);
+    static uint64_t BucketTop(size_t bucket);
+
+public:
+    TrafficHistogram();
+
+    void Add(uint64_t value);
+    uint64_t Percentile(double percentile) const;
+    uint64_t GetCount() const { return count; }
+    uint64_t GetMax() const { return max; }
+};
+
+/**
+ * Bus traffic statistics, from a capture or live: message rates and payload
+ * sizes by message type, and call rates and latencies by method.
+ *
+ * Each message is seen twice, when it's sent (TX) and when it's received
+ * (RX). Messages are counted by their TX copies. Calls are matched to their
+ * replies by (caller, callee, token), and the latency is that seen by the
+ * caller: from the TX of the call to the RX of its first reply.
+ */
+class TrafficStats
+{
+    struct TypeStats
+    {
+        uint64_t messages = 0;
+        uint64_t interval_messages = 0;
+        std::map<int64_t, uint64_t> per_second;
+        TrafficHistogram payload;
+    };
+
+    struct MethodStats
+    {
+        uint64_t calls = 0;
+        uint64_t interval_calls = 0;
+        uint64_t replied = 0;
+        TrafficHistogram latency;       // microseconds
+        TrafficHistogram payload;
+    };
+
+    struct CallKey
+    {
+        std::string caller;
+        std::string callee;
+        uint64_t token;
+
+        bool operator==(const CallKey &other) const
+        {
+            return token == other.token && caller == other.caller && callee == other.callee;
+        }
+    };
+
+    struct CallKeyHash
+    {
+        size_t operator()(const CallKey &key) const
+        {
+            std::hash<std::string> hash;
+            return hash(key.caller) ^ (hash(key.callee) * 31) ^ std::hash<uint64_t>()(key.token);
+        }
+    };
+
+    struct PendingCall
+    {
+        MethodStats *method;
+        struct timespec sent;
+    };
+
+    typedef std::pair<const std::string *, const MethodStats *> MethodEntry;
+
+    std::map<std::string, TypeStats> types;
+    std::unordered_map<std::string, MethodStats> methods;
+    std::unordered_map<CallKey, PendingCall, CallKeyHash> pending;
+    uint64_t messages;
+    uint64_t unmatched_replies;
+    uint64_t expired_calls;
+    struct timespec first;
+    struct timespec last;
+
+    void AddCall(_LSTransportMessage *message, const char *sender_unique_name,
+                 const struct timespec &timestamp, size_t payload_size);
+    void AddReply(_LSTransportMessage *message, const char *sender_unique_name,
+                  const struct timespec &timestamp);
+    std::vector<MethodEntry> SortMethods(bool by_interval) const;
+
+public:
+    TrafficStats();
+
+    void Add(_LSTransportMessage *message, const char *sender_unique_name);
+    void AddRecord(const CaptureRecord *record);
+    void ExpireCalls(double age);
+    void StartInterval();
+
+    void Print(FILE *file) const;
+    void PrintTop(FILE *file, double interval, size_t rows) const;
+    void PrintJson(FILE *file, double interval) const;
+};
+
+#endif  /* _TRAFFIC_STATS_H */